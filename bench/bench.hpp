@@ -0,0 +1,151 @@
+/**
+ * @file bench.hpp
+ * @brief 基准测试工具: 计时, 分位数统计与JSON结果输出
+ * @note 随机数使用固定种子, 同一参数下生成的场景在不同构建之间完全一致, 结果可以直接对比
+ *
+ */
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bench {
+
+constexpr uint32_t default_seed = 20231027;
+
+inline double now_ms(){
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief 阻止编译器把被测结果优化掉
+ */
+template<class T>
+inline void do_not_optimize(const T& value){
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct stats_t{
+    size_t cnt = 0;
+    double min = 0, mean = 0, max = 0;
+    double p50 = 0, p90 = 0, p99 = 0;
+};
+
+inline double percentile(const std::vector<double>& sorted, double p){
+    if(sorted.empty()) return 0;
+    // 线性插值
+    const double pos = p * (sorted.size() - 1);
+    const size_t i = size_t(pos);
+    const double frac = pos - i;
+    if(i + 1 >= sorted.size()) return sorted.back();
+    return sorted[i] * (1 - frac) + sorted[i + 1] * frac;
+}
+
+inline stats_t calc_stats(std::vector<double> samples){
+    stats_t s;
+    if(samples.empty()) return s;
+    std::sort(samples.begin(), samples.end());
+    s.cnt = samples.size();
+    s.min = samples.front();
+    s.max = samples.back();
+    double sum = 0;
+    for(auto x: samples) sum += x;
+    s.mean = sum / samples.size();
+    s.p50 = percentile(samples, 0.50);
+    s.p90 = percentile(samples, 0.90);
+    s.p99 = percentile(samples, 0.99);
+    return s;
+}
+
+struct result_t{
+    std::string name;
+    // 每个样本的耗时(毫秒)
+    std::vector<double> samples_ms;
+    // 每个样本包含多少次操作, 用于换算单次耗时
+    uint64_t ops_per_sample = 1;
+    // 附加指标, 如 draw call 数, 上传字节数
+    std::vector<std::pair<std::string, double>> metrics;
+
+    void add_metric(const std::string& key, double value){
+        metrics.emplace_back(key, value);
+    }
+};
+
+/**
+ * @brief 先预热, 再执行 sample_num 次, 每次调用 func 共 ops_per_sample 次
+ */
+template<class Func>
+inline result_t run(const std::string& name, int sample_num, uint64_t ops_per_sample, Func&& func, int warmup_num=3){
+    result_t res;
+    res.name = name;
+    res.ops_per_sample = ops_per_sample;
+    for(int i=0; i<warmup_num; i++)
+        for(uint64_t op=0; op<ops_per_sample; op++)
+            func();
+    res.samples_ms.reserve(sample_num);
+    for(int i=0; i<sample_num; i++){
+        const double beg = now_ms();
+        for(uint64_t op=0; op<ops_per_sample; op++)
+            func();
+        res.samples_ms.push_back(now_ms() - beg);
+    }
+    return res;
+}
+
+class reporter_t{
+public:
+    explicit reporter_t(std::string suite):suite(std::move(suite)){}
+
+    void add(result_t res){
+        const auto s = calc_stats(res.samples_ms);
+        const double ns_per_op = s.p50 * 1e6 / res.ops_per_sample;
+        printf("%-40s p50 %10.4f ms  p99 %10.4f ms  %12.1f ns/op\n", res.name.c_str(), s.p50, s.p99, ns_per_op);
+        results.push_back(std::move(res));
+    }
+
+    void add_param(const std::string& key, double value){
+        params.emplace_back(key, value);
+    }
+
+    bool write_json(const char* path) const{
+        FILE* fp = path == nullptr ? stdout : fopen(path, "w");
+        if(fp == nullptr){
+            printf("Failed to open %s\n", path);
+            return false;
+        }
+        fprintf(fp, "{\n  \"suite\": \"%s\",\n", suite.c_str());
+#ifdef EZ3DGL_BUILD_ID
+        fprintf(fp, "  \"build\": \"%s\",\n", EZ3DGL_BUILD_ID);
+#endif
+        fprintf(fp, "  \"compiler\": \"%s\",\n", __VERSION__);
+        fprintf(fp, "  \"params\": {");
+        for(size_t i=0; i<params.size(); i++)
+            fprintf(fp, "%s\"%s\": %g", i ? ", " : "", params[i].first.c_str(), params[i].second);
+        fprintf(fp, "},\n  \"results\": [\n");
+        for(size_t i=0; i<results.size(); i++){
+            const auto& r = results[i];
+            const auto s = calc_stats(r.samples_ms);
+            fprintf(fp, "    {\"name\": \"%s\", \"samples\": %zu, \"ops_per_sample\": %llu, "
+                        "\"ms\": {\"min\": %.6f, \"mean\": %.6f, \"p50\": %.6f, \"p90\": %.6f, \"p99\": %.6f, \"max\": %.6f}",
+                r.name.c_str(), s.cnt, (unsigned long long)r.ops_per_sample, s.min, s.mean, s.p50, s.p90, s.p99, s.max);
+            for(const auto& m: r.metrics)
+                fprintf(fp, ", \"%s\": %.6g", m.first.c_str(), m.second);
+            fprintf(fp, "}%s\n", i + 1 < results.size() ? "," : "");
+        }
+        fprintf(fp, "  ]\n}\n");
+        if(fp != stdout) fclose(fp);
+        return true;
+    }
+private:
+    std::string suite;
+    std::vector<std::pair<std::string, double>> params;
+    std::vector<result_t> results;
+};
+
+}
@@ -0,0 +1,476 @@
+/**
+ * @file bench_cpu.cpp
+ * @brief 不需要OpenGL上下文的CPU微基准, 涉及GL调用的部分使用空后端
+ * 用法: bench_cpu [result.json]
+ *
+ */
+#include <memory>
+#include <random>
+#include "bench/bench.hpp"
+#include "core/vertices_layer.hpp"
+#include "core/mesh_layer.hpp"
+#include "core/animation.hpp"
+#include "core/command_list.hpp"
+#include "core/ecs.hpp"
+#include "core/occlusion_culler.hpp"
+#include "utils/frame_arena.hpp"
+#include "utils/gl_backend.hpp"
+#include "utils/logger.hpp"
+#include "utils/preset.hpp"
+#include "utils/texture_codec.hpp"
+
+using namespace Ez3DGL;
+
+static glm::vec3 rand_vec3(std::mt19937& rng, float range){
+    std::uniform_real_distribution<float> dist(-range, range);
+    // 按固定顺序取随机数, 参数求值顺序未指定
+    const float x = dist(rng);
+    const float y = dist(rng);
+    const float z = dist(rng);
+    return glm::vec3(x, y, z);
+}
+
+static void bench_get_model(bench::reporter_t& reporter, int depth){
+    std::mt19937 rng(bench::default_seed);
+    std::vector<std::unique_ptr<model_t>> chain;
+    for(int i=0; i<depth; i++){
+        chain.emplace_back(new model_t(rand_vec3(rng, 2.f), glm::vec3(1.f), glm::vec3(0, 0, 1), i ? chain.back().get() : nullptr));
+        chain.back()->rotate_to(rand_vec3(rng, 180.f));
+    }
+    const model_t* leaf = chain.back().get();
+    reporter.add(bench::run("model_t::get_model depth " + std::to_string(depth), 50, 10000, [&](){
+        bench::do_not_optimize(leaf->get_model());
+    }));
+}
+
+static void bench_collision(bench::reporter_t& reporter, int box_num){
+    std::mt19937 rng(bench::default_seed);
+    std::vector<std::unique_ptr<model_t>> models;
+    std::vector<collision_box_t> boxes;
+    models.reserve(box_num);
+    boxes.reserve(box_num);
+    for(int i=0; i<box_num; i++){
+        models.emplace_back(new model_t(rand_vec3(rng, 50.f), glm::vec3(0.5f + (rng() % 100) / 100.f)));
+        boxes.emplace_back(models.back().get());
+    }
+    uint64_t hit = 0;
+    auto res = bench::run("collision_box_t all pairs " + std::to_string(box_num), 30, 1, [&](){
+        for(int i=0; i<box_num; i++)
+            for(int j=i+1; j<box_num; j++)
+                hit += boxes[i].check_collision(&boxes[j]);
+    });
+    res.ops_per_sample = uint64_t(box_num) * (box_num - 1) / 2;
+    bench::do_not_optimize(hit);
+    reporter.add(std::move(res));
+}
+
+static void bench_revolu_surf(bench::reporter_t& reporter, int plane_num){
+    std::vector<glm::vec2> outlines;
+    const int outline_num = 64;
+    for(int i=0; i<=outline_num; i++){
+        const float theta = glm::radians(180.f * i / outline_num);
+        outlines.emplace_back(0.5f * glm::cos(theta), 0.5f * glm::sin(theta));
+    }
+    size_t float_num = 0;
+    auto res = bench::run("vgen_revolu_surf::generate " + std::to_string(plane_num), 30, 1, [&](){
+        auto vertices = preset::vgen_revolu_surf::generate(plane_num, outlines, glm::vec3(1, 0, 0));
+        float_num = vertices.size();
+        bench::do_not_optimize(vertices.data());
+    });
+    res.add_metric("floats", float_num);
+    reporter.add(std::move(res));
+}
+
+static void bench_set_lights(bench::reporter_t& reporter, int light_num){
+    std::mt19937 rng(bench::default_seed);
+    std::vector<LightDir> dir_lights{LightDir(glm::vec3(-0.2f, -1.0f, -0.3f))};
+    std::vector<LightPoint> point_lights;
+    std::vector<LightSpot> spot_lights;
+    for(int i=0; i<light_num; i++){
+        point_lights.emplace_back(rand_vec3(rng, 20.f), glm::vec3(1.f));
+        spot_lights.emplace_back(rand_vec3(rng, 20.f), glm::vec3(0, -1, 0), glm::vec3(1.f), 12.5f, 17.5f);
+    }
+    Shader shader;
+    shader.setup_shader();
+    reporter.add(bench::run("Shader::set_lights " + std::to_string(light_num), 50, 100, [&](){
+        shader.set_lights(dir_lights, point_lights, spot_lights);
+    }));
+}
+
+/**
+ * @brief 通过空后端测量引擎自身每次绘制的CPU开销(Shader::bind, get_model, 绑定), 并回放录制的调用流
+ */
+static void bench_null_draw(bench::reporter_t& reporter, int object_num, int depth){
+    std::mt19937 rng(bench::default_seed);
+    const auto vertices = preset::vgen_ball::generate(16);
+    Mesh mesh;
+    for(size_t i=0; i+8<=vertices.size(); i+=8){
+        const float* v = &vertices[i];
+        mesh.vertex_data.emplace_back(Vertex{glm::vec3(v[0], v[1], v[2]), glm::vec3(v[3], v[4], v[5]), glm::vec2(v[6], v[7])});
+        mesh.indices.push_back(i / 8);
+    }
+    mesh.setup_vertices();
+
+    std::vector<LightPoint> point_lights;
+    for(int i=0; i<16; i++)
+        point_lights.emplace_back(rand_vec3(rng, 20.f), glm::vec3(1.f));
+    Shader shader;
+    shader.setup_shader();
+    shader.set_lights({LightDir(glm::vec3(-0.2f, -1.0f, -0.3f))}, point_lights, {});
+
+    camera_t camera(16.f / 9.f, glm::vec3(0.f, 10.f, 40.f));
+    camera.calc_view();
+    camera.calc_projection();
+    std::vector<std::unique_ptr<model_t>> objects;
+    for(int i=0; i<object_num; i++){
+        const bool root = i % depth == 0;
+        objects.emplace_back(new model_t(rand_vec3(rng, root ? 20.f : 1.5f), glm::vec3(1.f), glm::vec3(0, 0, 1),
+            root ? nullptr : objects.back().get()));
+    }
+    // 只统计绘制本身的堆分配, 不含计时代码
+    uint64_t draw_allocs = 0;
+    auto draw_frame = [&](){
+        const uint64_t allocs_beg = frame_arena::thread_heap_allocs();
+        for(const auto& object: objects)
+            mesh.draw(&shader, &camera, object.get());
+        gl_backend::frame_boundary();
+        frame_arena::end_frame();
+        draw_allocs += frame_arena::thread_heap_allocs() - allocs_beg;
+    };
+
+    draw_frame();
+    gl_backend::reset_stats();
+    draw_allocs = 0;
+    auto res = bench::run("null backend draw " + std::to_string(object_num), 30, 1, draw_frame);
+    res.ops_per_sample = object_num;
+    const auto stats = gl_backend::stats();
+    res.add_metric("gl_calls_per_draw", double(stats.calls) / stats.draw_calls);
+    res.add_metric("redundant_gl_ratio", stats.redundant_ratio());
+    // 以 EZ3DGL_COUNT_ALLOCS 编译时有效, 稳定后应为0
+    if(frame_arena::counting_allocs())
+        res.add_metric("heap_allocs_per_frame", double(draw_allocs) / stats.frames);
+    reporter.add(std::move(res));
+
+    const char* record_path = "ez3dgl_bench_null.glrec";
+    if(gl_backend::begin_record(record_path)){
+        draw_frame();
+        gl_backend::end_record();
+        auto replay = bench::run("null backend replay " + std::to_string(object_num), 30, 1, [&](){
+            gl_backend::replay(record_path);
+        });
+        replay.ops_per_sample = object_num;
+        reporter.add(std::move(replay));
+        remove(record_path);
+    }
+}
+
+/**
+ * @brief 与 bench_null_draw 相同的场景, 在工作线程上录制命令表(get_model, 法线矩阵), 再在主线程回放,
+ * 分别测量录制与回放的耗时
+ */
+static void bench_command_lists(bench::reporter_t& reporter, int object_num, int depth){
+    std::mt19937 rng(bench::default_seed);
+    const auto vertices = preset::vgen_ball::generate(16);
+    Mesh mesh;
+    for(size_t i=0; i+8<=vertices.size(); i+=8){
+        const float* v = &vertices[i];
+        mesh.vertex_data.emplace_back(Vertex{glm::vec3(v[0], v[1], v[2]), glm::vec3(v[3], v[4], v[5]), glm::vec2(v[6], v[7])});
+        mesh.indices.push_back(i / 8);
+    }
+    mesh.setup_vertices();
+
+    Shader shader;
+    shader.setup_shader();
+    shader.set_lights({LightDir(glm::vec3(-0.2f, -1.0f, -0.3f))}, {}, {});
+    camera_t camera(16.f / 9.f, glm::vec3(0.f, 10.f, 40.f));
+    camera.calc_view();
+    camera.calc_projection();
+    std::vector<std::unique_ptr<model_t>> objects;
+    for(int i=0; i<object_num; i++){
+        const bool root = i % depth == 0;
+        objects.emplace_back(new model_t(rand_vec3(rng, root ? 20.f : 1.5f), glm::vec3(1.f), glm::vec3(0, 0, 1),
+            root ? nullptr : objects.back().get()));
+    }
+    CommandRecorder recorder;
+    auto record = [&](){
+        recorder.record(objects.size(), [&](CommandList& list, size_t beg, size_t end){
+            for(size_t i=beg; i<end; i++){
+                const glm::mat4 model = objects[i]->get_model(model_t::render_alpha());
+                list.draw(mesh, model, model_t::normal_matrix(model, objects[i]->uniform_scale()));
+            }
+        });
+    };
+    const std::string suffix = " " + std::to_string(object_num) + " x" + std::to_string(job_system::worker_num() + 1);
+    auto res = bench::run("command list record" + suffix, 30, 1, record);
+    res.ops_per_sample = object_num;
+    res.add_metric("lists", recorder.stats().lists);
+    reporter.add(std::move(res));
+
+    record();
+    auto replay = bench::run("command list execute" + suffix, 30, 1, [&](){
+        recorder.execute(&shader, &camera);
+        gl_backend::frame_boundary();
+    });
+    replay.ops_per_sample = object_num;
+    reporter.add(std::move(replay));
+}
+
+/**
+ * @brief 同样的物理步进, 分别遍历堆上分散的对象与 ECS 块内连续存放的组件
+ */
+static void bench_ecs_physics(bench::reporter_t& reporter, int entity_num){
+    std::mt19937 rng(bench::default_seed);
+    const glm::vec3 gravity(0.f, -9.8f, 0.f);
+    const float step = 1.f / 60.f;
+
+    struct HeapObj{
+        std::unique_ptr<model_t> model;
+        std::unique_ptr<DynamicObj> body;
+    };
+    std::vector<HeapObj> heap_objs;
+    ecs::World world;
+    for(int i=0; i<entity_num; i++){
+        const auto pos = rand_vec3(rng, 100.f);
+        heap_objs.push_back(HeapObj{std::unique_ptr<model_t>(new model_t(pos)), std::unique_ptr<DynamicObj>(new DynamicObj(pos))});
+        world.create(ecs::Transform(pos), ecs::PhysicsBody(pos));
+    }
+    // 打乱顺序, 模拟长期运行后对象在堆上分散的情况
+    std::shuffle(heap_objs.begin(), heap_objs.end(), rng);
+
+    auto heap = bench::run("physics heap objects " + std::to_string(entity_num), 30, 1, [&](){
+        for(auto& obj: heap_objs){
+            obj.body->update_dynamic(gravity, step);
+            obj.model->save_prev_state();
+            obj.model->pos = obj.body->pos();
+        }
+    });
+    heap.ops_per_sample = entity_num;
+    reporter.add(std::move(heap));
+
+    auto query = world.query<ecs::Transform, ecs::PhysicsBody>();
+    auto ecs_serial = bench::run("physics ecs each " + std::to_string(entity_num), 30, 1, [&](){
+        query.each([&](ecs::Entity, ecs::Transform& transform, ecs::PhysicsBody& body){
+            body.update_dynamic(gravity, step);
+            transform.save_prev_state();
+            transform.pos = body.pos();
+        });
+    });
+    ecs_serial.ops_per_sample = entity_num;
+    reporter.add(std::move(ecs_serial));
+
+    auto ecs_parallel = bench::run("physics ecs par_each " + std::to_string(entity_num), 30, 1, [&](){
+        ecs::update_physics(world, gravity, step);
+    });
+    ecs_parallel.ops_per_sample = entity_num;
+    ecs_parallel.add_metric("threads", job_system::worker_num() + 1);
+    reporter.add(std::move(ecs_parallel));
+}
+
+/**
+ * @brief 纹理压缩的编码速度与质量, 图片由渐变, 高频花纹与噪声组成
+ */
+static void bench_texture_codec(bench::reporter_t& reporter, int size){
+    std::mt19937 rng(bench::default_seed);
+    std::vector<uint8_t> image(size_t(size) * size * 4);
+    for(int y=0; y<size; y++)
+        for(int x=0; x<size; x++){
+            uint8_t* p = image.data() + (size_t(y) * size + x) * 4;
+            p[0] = uint8_t(128 + 100 * std::sin(x * 0.05f));
+            p[1] = uint8_t(y * 255 / size);
+            p[2] = uint8_t((x ^ y) & 0xFF);
+            p[3] = uint8_t(x * 255 / size);
+            if((x / 16 + y / 16) % 5 == 0)
+                p[0] = uint8_t(p[0] + rng() % 24);
+        }
+    std::vector<uint8_t> decoded(image.size());
+    for(auto format: {texture_codec::format_t::bc1, texture_codec::format_t::bc3, texture_codec::format_t::bc5, texture_codec::format_t::bc7}){
+        std::vector<uint8_t> encoded;
+        auto res = bench::run(std::string("texture encode ") + texture_codec::format_name(format) + " " + std::to_string(size), 5, 1, [&](){
+            encoded = texture_codec::encode(format, image.data(), size, size);
+        }, 1);
+        texture_codec::decode(format, encoded.data(), size, size, decoded.data());
+        res.ops_per_sample = uint64_t(size) * size;
+        res.add_metric("psnr_db", texture_codec::psnr(image.data(), decoded.data(), size_t(size) * size, texture_codec::format_channels(format)));
+        res.add_metric("compression_ratio", double(image.size()) / encoded.size());
+        res.add_metric("threads", job_system::worker_num() + 1);
+        reporter.add(std::move(res));
+    }
+}
+
+/**
+ * @brief 参考城市场景: 街道两侧为大的建筑墙面遮挡体, 街区中是大量小物体,
+ * 相机沿街道平视, 测量遮挡体光栅化与包围盒测试的耗时以及剔除比例
+ */
+static void bench_occlusion(bench::reporter_t& reporter, int grid){
+    std::mt19937 rng(bench::default_seed);
+    // 单位立方体, 作为建筑与小物体共用的网格
+    const float cube_positions[] = {
+        -0.5f, -0.5f, -0.5f,  0.5f, -0.5f, -0.5f,  0.5f, 0.5f, -0.5f,  -0.5f, 0.5f, -0.5f,
+        -0.5f, -0.5f,  0.5f,  0.5f, -0.5f,  0.5f,  0.5f, 0.5f,  0.5f,  -0.5f, 0.5f,  0.5f,
+    };
+    const unsigned int cube_indices[] = {
+        0, 2, 1, 0, 3, 2,  4, 5, 6, 4, 6, 7,  0, 1, 5, 0, 5, 4,
+        3, 6, 2, 3, 7, 6,  0, 4, 7, 0, 7, 3,  1, 2, 6, 1, 6, 5,
+    };
+    const float block = 20.f, street = 8.f;
+    std::vector<glm::mat4> buildings;
+    std::vector<glm::mat4> objects;
+    std::uniform_real_distribution<float> height(10.f, 40.f), offset(-0.4f, 0.4f), scale(0.5f, 2.f);
+    for(int i=0; i<grid; i++)
+        for(int j=0; j<grid; j++){
+            const glm::vec3 center((i - grid / 2) * (block + street), 0.f, -j * (block + street) - block);
+            const float h = height(rng);
+            buildings.push_back(glm::scale(glm::translate(glm::mat4(1.f), center + glm::vec3(0.f, h / 2, 0.f)), glm::vec3(block, h, block)));
+            // 街区内的小物体, 大部分被建筑挡住
+            for(int k=0; k<16; k++){
+                const float s = scale(rng);
+                const glm::vec3 pos = center + glm::vec3(offset(rng) * block, s / 2, offset(rng) * block);
+                objects.push_back(glm::scale(glm::translate(glm::mat4(1.f), pos), glm::vec3(s)));
+            }
+        }
+    const glm::mat4 projection = glm::perspective(glm::radians(60.f), 16.f / 9.f, 0.1f, 1000.f);
+    const glm::mat4 view = glm::lookAt(glm::vec3(street / 2 - (block + street) / 2, 1.7f, 5.f),
+        glm::vec3(street / 2 - (block + street) / 2, 1.7f, -100.f), glm::vec3(0.f, 1.f, 0.f));
+    OcclusionCuller culler(256, 128);
+    const std::string suffix = std::to_string(buildings.size()) + "/" + std::to_string(objects.size());
+
+    auto raster = bench::run(std::string("occlusion rasterize ") + OcclusionCuller::simd_name() + " " + suffix, 30, 1, [&](){
+        culler.begin_frame(projection * view);
+        for(const auto& model: buildings)
+            culler.add_occluder(cube_positions, 3, cube_indices, 36, model);
+        culler.rasterize();
+    });
+    raster.ops_per_sample = buildings.size() * 12;
+    raster.add_metric("rasterized_triangles", culler.stats().rasterized_triangles);
+    raster.add_metric("threads", job_system::worker_num() + 1);
+    reporter.add(std::move(raster));
+
+    size_t visible = 0;
+    auto test = bench::run("occlusion test aabb " + suffix, 30, 1, [&](){
+        visible = 0;
+        for(const auto& model: objects)
+            visible += culler.test_aabb(glm::vec3(-0.5f), glm::vec3(0.5f), model);
+    });
+    test.ops_per_sample = objects.size();
+    test.add_metric("visible", double(visible));
+    test.add_metric("frustum_culled", double(culler.stats().frustum_culled) / culler.stats().tested);
+    test.add_metric("occluded", double(culler.stats().occluded) / culler.stats().tested);
+    reporter.add(std::move(test));
+}
+
+/**
+ * @brief 多角色动画: 63个节点的骨架(二叉树), 每个实例混合两段动画, 测量所有实例姿态求值的耗时
+ */
+static void bench_animation(bench::reporter_t& reporter, int instance_num){
+    std::mt19937 rng(bench::default_seed);
+    Skeleton skeleton;
+    const int node_num = 63;
+    for(int i=0; i<node_num; i++){
+        skeleton.add_node("node" + std::to_string(i), i ? (i - 1) / 2 : -1, glm::vec3(0.f, i ? 0.3f : 0.f, 0.f), glm::quat(1.f, 0.f, 0.f, 0.f), glm::vec3(1.f));
+        skeleton.add_joint(uint32_t(i), glm::mat4(1.f));
+    }
+    std::vector<std::unique_ptr<AnimationClip>> clips;
+    for(float frequency: {1.f, 2.5f}){
+        clips.emplace_back(new AnimationClip("clip", 2.f, 30.f, node_num));
+        auto& clip = *clips.back();
+        std::vector<glm::vec3> translations(clip.key_num()), scales(clip.key_num(), glm::vec3(1.f));
+        std::vector<glm::quat> rotations(clip.key_num());
+        for(int n=0; n<node_num; n++){
+            for(uint32_t k=0; k<clip.key_num(); k++){
+                const float t = float(k) / clip.sample_rate();
+                const float angle = 0.5f * std::sin(6.2831853f * frequency * t / clip.duration() + float(n));
+                translations[k] = glm::vec3(0.f, n ? 0.3f : 0.1f * std::sin(t), 0.f);
+                rotations[k] = glm::quat(std::cos(angle / 2), std::sin(angle / 2), 0.f, 0.f);
+            }
+            clip.add_track(uint32_t(n), translations.data(), rotations.data(), scales.data());
+        }
+    }
+    Animator animator;
+    std::uniform_real_distribution<float> weight(0.f, 1.f);
+    for(int i=0; i<instance_num; i++){
+        const auto instance = animator.add_instance(&skeleton);
+        const float w = weight(rng);
+        animator.blend(instance, clips[0].get(), w, 1.f + w);
+        animator.blend(instance, clips[1].get(), 1.f - w);
+    }
+    auto res = bench::run(std::string("animation evaluate ") + Animator::simd_name() + " " + std::to_string(instance_num), 30, 1, [&](){
+        animator.evaluate(1.f / 60);
+    });
+    res.ops_per_sample = animator.stats().joints;
+    res.add_metric("layers", animator.stats().layers);
+    res.add_metric("compression_ratio", double(clips[0]->raw_bytes()) / clips[0]->memory_bytes());
+    res.add_metric("threads", job_system::worker_num() + 1);
+    reporter.add(std::move(res));
+}
+
+/**
+ * @brief 记录日志时调用线程的开销: 异步日志器(参数二进制捕获, 后台格式化)与同步 fprintf, 输出到临时文件
+ */
+static void bench_logger(bench::reporter_t& reporter, int message_num){
+    FILE* out = std::tmpfile();
+    if(out == nullptr) return;
+    logger::set_output(out);
+    logger::set_rate_limit(0);
+    const char* name = "textures/brick_diffuse.png";
+
+    auto sync = bench::run("log fprintf " + std::to_string(message_num), 30, 1, [&](){
+        for(int i=0; i<message_num; i++)
+            fprintf(out, "Texture %s %d*%d %dchs readed. (%d)\n", name, 1024, 1024, 4, i);
+    });
+    sync.ops_per_sample = message_num;
+    reporter.add(std::move(sync));
+
+    // 格式化与写入在后台线程, 每个样本的记录不超过单个线程缓冲的一半, 写满时丢弃并计数
+    const auto before = logger::stats();
+    auto async = bench::run("log async " + std::to_string(message_num), 30, 1, [&](){
+        for(int i=0; i<message_num; i++)
+            log_info("Texture %s %d*%d %dchs readed. (%d)", name, 1024, 1024, 4, i);
+    });
+    async.ops_per_sample = message_num;
+    async.add_metric("dropped", double(logger::stats().dropped - before.dropped));
+    reporter.add(std::move(async));
+
+    auto parallel = bench::run("log async parallel " + std::to_string(message_num), 30, 1, [&](){
+        job_system::parallel_for(0, size_t(message_num), [&](size_t beg, size_t end){
+            for(size_t i=beg; i<end; i++)
+                log_info("Texture %s %d*%d %dchs readed. (%zu)", name, 1024, 1024, 4, i);
+        }, 16);
+    });
+    parallel.ops_per_sample = message_num;
+    parallel.add_metric("threads", job_system::worker_num() + 1);
+    reporter.add(std::move(parallel));
+
+    logger::flush();
+    logger::set_output(stdout, true);
+    logger::set_rate_limit(100);
+    fclose(out);
+}
+
+int main(int argc, char** argv){
+    bench::reporter_t reporter("cpu");
+    for(int depth: {1, 8, 32})
+        bench_get_model(reporter, depth);
+    for(int box_num: {256, 1024})
+        bench_collision(reporter, box_num);
+    for(int plane_num: {32, 256})
+        bench_revolu_surf(reporter, plane_num);
+    for(int light_num: {8, 128, 1024})
+        bench_set_lights(reporter, light_num);
+    job_system::init();
+    bench_ecs_physics(reporter, 100000);
+    bench_texture_codec(reporter, 512);
+    bench_occlusion(reporter, 16);
+    bench_animation(reporter, 512);
+    bench_logger(reporter, 256);
+    job_system::shutdown();
+
+    gl_backend::install(gl_backend::backend_t::null);
+    for(int object_num: {256, 4096})
+        bench_null_draw(reporter, object_num, 4);
+    job_system::init();
+    for(int object_num: {256, 4096})
+        bench_command_lists(reporter, object_num, 4);
+    job_system::shutdown();
+    gl_backend::uninstall();
+    return reporter.write_json(argc > 1 ? argv[1] : nullptr) ? 0 : 1;
+}
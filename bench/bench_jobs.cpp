@@ -0,0 +1,140 @@
+/**
+ * @file bench_jobs.cpp
+ * @brief 任务系统扩展性基准, 同一负载依次在 1..N 个线程(含主线程)上运行
+ * 用法: bench_jobs [max_threads] [result.json]
+ * max_threads 默认为硬件线程数, 每个线程数下重新 init, 线程数为1时等价于单线程
+ *
+ */
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <thread>
+#include "bench/bench.hpp"
+#include "core/vertices_layer.hpp"
+#include "core/entity_layer.hpp"
+#include "utils/job_system.hpp"
+
+using namespace Ez3DGL;
+
+static glm::vec3 rand_vec3(std::mt19937& rng, float range){
+    std::uniform_real_distribution<float> dist(-range, range);
+    // 按固定顺序取随机数, 参数求值顺序未指定
+    const float x = dist(rng);
+    const float y = dist(rng);
+    const float z = dist(rng);
+    return glm::vec3(x, y, z);
+}
+
+/**
+ * @brief 变换更新: 计算父子链中所有物体的 model 矩阵
+ */
+static bench::result_t bench_transforms(int thread_num, int object_num, int depth){
+    std::mt19937 rng(bench::default_seed);
+    std::vector<std::unique_ptr<model_t>> objects;
+    for(int i=0; i<object_num; i++){
+        const bool root = i % depth == 0;
+        objects.emplace_back(new model_t(rand_vec3(rng, root ? 20.f : 1.5f), glm::vec3(1.f), glm::vec3(0, 0, 1),
+            root ? nullptr : objects.back().get()));
+        objects.back()->rotate_to(rand_vec3(rng, 180.f));
+    }
+    std::vector<glm::mat4> matrices(object_num);
+    auto res = bench::run("transforms " + std::to_string(object_num) + " threads " + std::to_string(thread_num), 30, 1, [&](){
+        job_system::parallel_for(0, objects.size(), [&](size_t beg, size_t end){
+            for(size_t i=beg; i<end; i++)
+                matrices[i] = objects[i]->get_model();
+        }, 64);
+    });
+    bench::do_not_optimize(matrices.data());
+    res.ops_per_sample = object_num;
+    return res;
+}
+
+/**
+ * @brief 物理步进: 更新 DynamicObj 的位置与速度
+ */
+static bench::result_t bench_physics(int thread_num, int object_num){
+    std::mt19937 rng(bench::default_seed);
+    std::vector<DynamicObj> objects;
+    objects.reserve(object_num);
+    for(int i=0; i<object_num; i++)
+        objects.emplace_back(rand_vec3(rng, 50.f), 1.f + (rng() % 100) / 10.f);
+    const glm::vec3 gravity(0.f, -9.8f, 0.f);
+    auto res = bench::run("physics " + std::to_string(object_num) + " threads " + std::to_string(thread_num), 30, 1, [&](){
+        job_system::parallel_for(0, objects.size(), [&](size_t beg, size_t end){
+            for(size_t i=beg; i<end; i++)
+                objects[i].update_dynamic(gravity, 1.f / 60.f);
+        }, 256);
+    });
+    bench::do_not_optimize(objects.data());
+    res.ops_per_sample = object_num;
+    return res;
+}
+
+/**
+ * @brief 视锥剔除: 包围球与6个平面求交, 与 LightCluster 分配灯光的计算类似
+ */
+static bench::result_t bench_culling(int thread_num, int sphere_num){
+    std::mt19937 rng(bench::default_seed);
+    std::vector<glm::vec4> spheres(sphere_num);
+    for(auto& sphere: spheres)
+        sphere = glm::vec4(rand_vec3(rng, 100.f), 0.5f + (rng() % 100) / 20.f);
+    camera_t camera(16.f / 9.f, glm::vec3(0.f, 10.f, 40.f));
+    camera.calc_view();
+    camera.calc_projection();
+    // 从 VP 矩阵提取平面
+    const glm::mat4 vp = glm::transpose(camera.projection * camera.view);
+    glm::vec4 planes[6] = {vp[3] + vp[0], vp[3] - vp[0], vp[3] + vp[1], vp[3] - vp[1], vp[3] + vp[2], vp[3] - vp[2]};
+    for(auto& plane: planes)
+        plane /= glm::length(glm::vec3(plane));
+    std::vector<uint8_t> visible(sphere_num);
+    auto res = bench::run("culling " + std::to_string(sphere_num) + " threads " + std::to_string(thread_num), 30, 1, [&](){
+        job_system::parallel_for(0, spheres.size(), [&](size_t beg, size_t end){
+            for(size_t i=beg; i<end; i++){
+                bool inside = true;
+                for(const auto& plane: planes)
+                    inside = inside && glm::dot(glm::vec3(plane), glm::vec3(spheres[i])) + plane.w >= -spheres[i].w;
+                visible[i] = inside;
+            }
+        }, 1024);
+    });
+    bench::do_not_optimize(visible.data());
+    res.ops_per_sample = sphere_num;
+    return res;
+}
+
+/**
+ * @brief 大量细小任务的调度开销, 每个任务几乎不做事
+ */
+static bench::result_t bench_overhead(int thread_num, int job_num){
+    std::vector<uint64_t> sink(job_num);
+    auto res = bench::run("empty jobs " + std::to_string(job_num) + " threads " + std::to_string(thread_num), 30, 1, [&](){
+        job_system::counter_t counter;
+        for(int i=0; i<job_num; i++)
+            job_system::run([&sink, i](){sink[i] += i;}, &counter);
+        job_system::wait(&counter);
+    });
+    bench::do_not_optimize(sink.data());
+    res.ops_per_sample = job_num;
+    return res;
+}
+
+int main(int argc, char** argv){
+    int max_threads = argc > 1 ? atoi(argv[1]) : 0;
+    if(max_threads <= 0)
+        max_threads = std::max(1u, std::thread::hardware_concurrency());
+    bench::reporter_t reporter("jobs");
+    reporter.add_param("max_threads", max_threads);
+    for(int thread_num=1; thread_num<=max_threads; thread_num++){
+        job_system::init(thread_num - 1);
+        auto transforms = bench_transforms(thread_num, 65536, 8);
+        auto physics = bench_physics(thread_num, 262144);
+        auto culling = bench_culling(thread_num, 262144);
+        auto overhead = bench_overhead(thread_num, 16384);
+        for(auto* res: {&transforms, &physics, &culling, &overhead}){
+            res->add_metric("threads", thread_num);
+            reporter.add(std::move(*res));
+        }
+        job_system::shutdown();
+    }
+    return reporter.write_json(argc > 2 ? argv[2] : nullptr) ? 0 : 1;
+}
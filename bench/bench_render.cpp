@@ -0,0 +1,320 @@
+/**
+ * @file bench_render.cpp
+ * @brief 端到端渲染基准, 在离屏上下文(如 Mesa llvmpipe)中绘制程序生成的场景
+ * 用法: bench_render [models=N] [lights=M] [depth=D] [frames=F] [clustered=0/1] [import=0/1] [gpu_cull=0/1] [prepass=0/1] [png=path] [json=path]
+ * 场景由固定种子生成: N个物体组成深度为D的父子链, M个点光源
+ * gpu_cull=1 时改由 GpuCuller 在GPU上剔除并一次间接绘制所有物体, 只计算平行光; 驱动不支持时退回逐物体绘制
+ * prepass=1 时逐物体绘制先经过深度预通道, 场景绘制两遍
+ *
+ */
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include "bench/bench.hpp"
+#include "core/vertices_layer.hpp"
+#include "core/mesh_layer.hpp"
+#include "core/light_cluster.hpp"
+#include "core/gpu_culler.hpp"
+#include "core/depth_prepass.hpp"
+#include "utils/gl_backend.hpp"
+#include "utils/render_stats.hpp"
+#include "utils/preset.hpp"
+#include "window/window.hpp"
+
+using namespace Ez3DGL;
+
+namespace {
+
+const int win_width = 640;
+const int win_height = 360;
+
+struct bench_param_t{
+    int models = 256;
+    int lights = 16;
+    int depth = 4;
+    int frames = 300;
+    bool clustered = false;
+    bool import = true;
+    bool gpu_cull = false;
+    bool prepass = false;
+    const char* png_path = nullptr;
+    const char* json_path = nullptr;
+} param;
+
+bench::reporter_t reporter("render");
+
+camera_t* camera;
+Shader* shader;
+LightCluster* cluster;
+GpuCuller* culler;
+DepthPrepass prepass;
+shader_t* gpu_shader;
+std::vector<std::unique_ptr<Mesh>> meshes;
+std::vector<std::unique_ptr<model_t>> objects;
+// 每个物体使用的网格
+std::vector<int> object_mesh;
+std::vector<LightPoint> point_lights;
+
+std::vector<double> frame_draw_calls;
+std::vector<double> frame_upload_bytes;
+std::vector<double> frame_redundant_ratio;
+std::vector<double> frame_material_switches;
+std::vector<double> frame_visible_instances;
+uint64_t setup_upload_bytes = 0;
+size_t shader_variants = 0;
+
+// 按固定顺序取随机数, 避免函数参数求值顺序不同导致场景在不同编译器下不一致
+glm::vec3 rand_vec3(std::mt19937& rng){
+    std::uniform_real_distribution<float> dist(-1.f, 1.f);
+    const float x = dist(rng);
+    const float y = dist(rng);
+    const float z = dist(rng);
+    return glm::vec3(x, y, z);
+}
+
+Mesh* create_mesh(const std::vector<float>& vertices){
+    auto mesh = new Mesh;
+    const size_t vertex_num = vertices.size() / 8;
+    mesh->vertex_data.reserve(vertex_num);
+    mesh->indices.reserve(vertex_num);
+    for(size_t i=0; i<vertex_num; i++){
+        const float* v = &vertices[i * 8];
+        mesh->vertex_data.emplace_back(Vertex{glm::vec3(v[0], v[1], v[2]), glm::vec3(v[3], v[4], v[5]), glm::vec2(v[6], v[7])});
+        mesh->indices.push_back(i);
+    }
+    mesh->setup_vertices();
+    return mesh;
+}
+
+/**
+ * @brief 由旋转体生成器写出一个包含多个网格的OBJ文件, 用于测试模型导入
+ */
+std::string write_obj(int mesh_num, int plane_num){
+    const std::string path = "ez3dgl_bench_import.obj";
+    FILE* fp = fopen(path.c_str(), "w");
+    if(fp == nullptr) return "";
+    size_t index_base = 1;
+    for(int m=0; m<mesh_num; m++){
+        const auto vertices = preset::vgen_ball::generate(plane_num + m);
+        const size_t vertex_num = vertices.size() / 8;
+        fprintf(fp, "o ball%d\n", m);
+        for(size_t i=0; i<vertex_num; i++){
+            const float* v = &vertices[i * 8];
+            fprintf(fp, "v %f %f %f\nvn %f %f %f\nvt %f %f\n", v[0] + m, v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+        }
+        for(size_t i=0; i<vertex_num; i+=3){
+            const size_t a = index_base + i, b = a + 1, c = a + 2;
+            fprintf(fp, "f %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu\n", a, a, a, b, b, b, c, c, c);
+        }
+        index_base += vertex_num;
+    }
+    fclose(fp);
+    return path;
+}
+
+void bench_import(){
+    const auto path = write_obj(8, 32);
+    if(path.empty()) return;
+    auto res = bench::run("Model import", 10, 1, [&](){
+        Model model(path);
+    }, 1);
+    reporter.add(std::move(res));
+    remove(path.c_str());
+}
+
+/**
+ * @brief 与逐物体绘制相同的网格, 另加较粗糙的LOD
+ */
+void setup_gpu_cull(){
+    culler = new GpuCuller;
+    const auto ball = culler->add_mesh(preset::vgen_ball::generate(24), {});
+    culler->add_lod(ball, preset::vgen_ball::generate(12), {}, 15.f);
+    culler->add_lod(ball, preset::vgen_ball::generate(6), {}, 30.f);
+    const auto cone = culler->add_mesh(preset::vgen_cone::generate(16, 60.f), {});
+    culler->add_lod(cone, preset::vgen_cone::generate(8, 60.f), {}, 25.f);
+    const GpuCuller::mesh_handle_t handles[] = {ball, cone};
+    for(int i=0; i<param.models; i++)
+        culler->add_instance(handles[object_mesh[i]], objects[i]->get_model());
+
+    preset::shader::lights_features features{1, 0, 0, false, false, false, false};
+    gpu_shader = new shader_t(preset::shader::vs_gpu_driven(), preset::shader::fs_multiple_lights_shader(features),
+                              "view", "projection", "model");
+    gpu_shader->use();
+    gpu_shader->set_uniform("lights_dir[0].direction", glm::vec3(-0.2f, -1.0f, -0.3f));
+    gpu_shader->set_uniform("lights_dir[0].ambient", glm::vec3(0.2f));
+    gpu_shader->set_uniform("lights_dir[0].diffuse", glm::vec3(0.8f));
+    gpu_shader->set_uniform("dir_light_num", 1);
+}
+
+void parse_args(int argc, char** argv){
+    for(int i=1; i<argc; i++){
+        const char* arg = argv[i];
+        const char* eq = strchr(arg, '=');
+        if(eq == nullptr){
+            printf("Ignore argument %s\n", arg);
+            continue;
+        }
+        const std::string key(arg, eq - arg);
+        const char* value = eq + 1;
+        if(key == "models") param.models = atoi(value);
+        else if(key == "lights") param.lights = atoi(value);
+        else if(key == "depth") param.depth = atoi(value) > 0 ? atoi(value) : 1;
+        else if(key == "frames") param.frames = atoi(value);
+        else if(key == "clustered") param.clustered = atoi(value) != 0;
+        else if(key == "import") param.import = atoi(value) != 0;
+        else if(key == "gpu_cull") param.gpu_cull = atoi(value) != 0;
+        else if(key == "prepass") param.prepass = atoi(value) != 0;
+        else if(key == "png") param.png_path = value;
+        else if(key == "json") param.json_path = value;
+        else printf("Ignore argument %s\n", arg);
+    }
+}
+
+}
+
+void user_setup(){
+    gl_backend::install(gl_backend::backend_t::native);
+
+    std::mt19937 rng(bench::default_seed);
+
+    camera = new camera_t(float(win_width) / win_height, glm::vec3(0.f, 10.f, 40.f));
+    camera->calc_view();
+    camera->calc_projection();
+
+    shader = new Shader;
+    shader->setup_shader();
+
+    meshes.emplace_back(create_mesh(preset::vgen_ball::generate(24)));
+    meshes.emplace_back(create_mesh(preset::vgen_cone::generate(16, 60.f)));
+
+    // 每 depth 个物体组成一条父子链, 子物体相对父物体偏移
+    const float extent = 20.f;
+    for(int i=0; i<param.models; i++){
+        const bool root = i % param.depth == 0;
+        auto parent = root ? nullptr : objects.back().get();
+        const glm::vec3 pos = root ? rand_vec3(rng) * glm::vec3(1.f, 0.5f, 1.f) * extent : rand_vec3(rng) * 1.5f;
+        objects.emplace_back(new model_t(pos, glm::vec3(root ? 1.f : 0.8f), glm::vec3(0, 0, 1), parent));
+        object_mesh.push_back(rng() % meshes.size());
+    }
+
+    for(int i=0; i<param.lights; i++){
+        const glm::vec3 color = rand_vec3(rng) * 0.5f + 0.5f;
+        const glm::vec3 pos = rand_vec3(rng) * glm::vec3(1.f, 0.25f, 1.f) * extent;
+        point_lights.emplace_back(pos, color);
+    }
+    shader->set_lights({LightDir(glm::vec3(-0.2f, -1.0f, -0.3f))}, point_lights, {});
+    if(param.clustered){
+        cluster = new LightCluster();
+        cluster->setup();
+        shader->set_light_cluster(cluster);
+    }
+
+    if(param.gpu_cull){
+        if(GpuCuller::supported())
+            setup_gpu_cull();
+        else
+            log_warn("GPU culling is not supported by the driver, fall back to per-object draws");
+    }
+
+    if(param.import)
+        bench_import();
+    setup_upload_bytes = gl_backend::stats().upload_bytes;
+}
+
+void user_imgui(){
+    ImGui_ImplOpenGL3_NewFrame();
+    ImGui_ImplGlfw_NewFrame();
+    ImGui::NewFrame();
+}
+
+void user_loop(long int){
+    gl_backend::reset_stats();
+    const uint64_t material_switches = Shader::material_switches();
+
+    // 只转动每条链的根节点, 子节点的model矩阵随之变化
+    for(int i=0; i<param.models; i+=param.depth)
+        objects[i]->rotate(glm::vec3(0.f, 1.f, 0.5f));
+    if(cluster != nullptr)
+        cluster->update(camera, point_lights, {});
+    if(culler != nullptr){
+        for(int i=0; i<param.models; i++)
+            culler->set_transform(GpuCuller::instance_handle_t(i), *objects[i]);
+        culler->cull(camera);
+        culler->draw(gpu_shader, camera);
+    }else if(param.prepass){
+        prepass.begin_depth(shader);
+        for(int i=0; i<param.models; i++)
+            meshes[object_mesh[i]]->draw(shader, camera, objects[i].get());
+        prepass.begin_shading(shader);
+        for(int i=0; i<param.models; i++)
+            meshes[object_mesh[i]]->draw(shader, camera, objects[i].get());
+        prepass.end(shader);
+    }else{
+        for(int i=0; i<param.models; i++)
+            meshes[object_mesh[i]]->draw(shader, camera, objects[i].get());
+    }
+    // 等待GPU完成, 使帧时间包含光栅化耗时
+    glFinish();
+    if(culler != nullptr)
+        frame_visible_instances.push_back(culler->read_stats().visible);
+
+    const auto stats = gl_backend::stats();
+    frame_draw_calls.push_back(stats.draw_calls);
+    frame_upload_bytes.push_back(stats.upload_bytes);
+    frame_redundant_ratio.push_back(stats.redundant_ratio());
+    frame_material_switches.push_back(Shader::material_switches() - material_switches);
+}
+
+void user_exit(){
+    shader_variants = shader->variant_num();
+    objects.clear();
+    meshes.clear();
+    delete culler;
+    delete gpu_shader;
+    delete cluster;
+    delete shader;
+    delete camera;
+}
+
+int main(int argc, char** argv){
+    parse_args(argc, argv);
+    reporter.add_param("models", param.models);
+    reporter.add_param("lights", param.lights);
+    reporter.add_param("depth", param.depth);
+    reporter.add_param("frames", param.frames);
+    reporter.add_param("clustered", param.clustered);
+    reporter.add_param("gpu_cull", param.gpu_cull);
+    reporter.add_param("prepass", param.prepass);
+
+    headless_opt_t opt;
+    opt.frame_num = param.frames;
+    opt.png_path = param.png_path;
+    const int ret = window_launch_headless("bench_render", win_width, win_height, opt);
+    if(ret != 0) return ret;
+
+    bench::result_t frame;
+    frame.name = "frame";
+    frame.samples_ms = window_instance()->frame_cpu_ms;
+    const auto draw_calls = bench::calc_stats(frame_draw_calls);
+    const auto upload_bytes = bench::calc_stats(frame_upload_bytes);
+    frame.add_metric("draw_calls", draw_calls.mean);
+    frame.add_metric("upload_bytes", upload_bytes.mean);
+    frame.add_metric("setup_upload_bytes", setup_upload_bytes);
+    frame.add_metric("redundant_gl_ratio", bench::calc_stats(frame_redundant_ratio).mean);
+    frame.add_metric("shader_variants", shader_variants);
+    frame.add_metric("material_switches", bench::calc_stats(frame_material_switches).mean);
+    if(!frame_visible_instances.empty())
+        frame.add_metric("visible_instances", bench::calc_stats(frame_visible_instances).mean);
+    // 最近 render_stats::history_size 帧的平均值
+    for(auto counter: {render_stats::counter_t::triangles, render_stats::counter_t::program_binds,
+                       render_stats::counter_t::texture_binds, render_stats::counter_t::uniform_calls}){
+        std::string key = render_stats::counter_name(counter);
+        std::replace(key.begin(), key.end(), ' ', '_');
+        frame.add_metric(key, render_stats::summary(counter).avg);
+    }
+    reporter.add(std::move(frame));
+    return reporter.write_json(param.json_path) ? 0 : 1;
+}
@@ -0,0 +1,627 @@
+#include "core/animation.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <assimp/scene.h>
+#include "utils/debug.hpp"
+#include "utils/job_system.hpp"
+#include "utils/profiler.hpp"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace Ez3DGL;
+
+namespace {
+
+/*
+ * 4个 float 的向量(平移, 四元数, 矩阵的一列), 按编译选项选择实现
+ */
+#if defined(__SSE2__)
+struct simd_t{
+    using vec = __m128;
+    static vec load(const float* p){ return _mm_loadu_ps(p); }
+    static void store(float* p, vec v){ _mm_storeu_ps(p, v); }
+    static vec set1(float v){ return _mm_set1_ps(v); }
+    static vec zero(){ return _mm_setzero_ps(); }
+    static vec add(vec a, vec b){ return _mm_add_ps(a, b); }
+    static vec mul(vec a, vec b){ return _mm_mul_ps(a, b); }
+    // a * b + c
+    static vec madd(vec a, vec b, vec c){ return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static vec lerp(vec a, vec b, vec t){ return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t)); }
+    static float dot(vec a, vec b){
+        const vec m = _mm_mul_ps(a, b);
+        const vec s = _mm_add_ps(m, _mm_movehl_ps(m, m));
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+    }
+    template<int i>
+    static vec broadcast(vec v){ return _mm_shuffle_ps(v, v, _MM_SHUFFLE(i, i, i, i)); }
+    // 4个16位无符号数反量化为 min + q * extent
+    static vec dequantize(const uint16_t* p, vec min, vec extent){
+        const __m128i q = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), _mm_setzero_si128());
+        return madd(_mm_cvtepi32_ps(q), extent, min);
+    }
+    // 4个16位定点数反量化到 [-1, 1]
+    static vec dequantize(const int16_t* p){
+        const __m128i q = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+        return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(q, q), 16)), _mm_set1_ps(1.f / 32767.f));
+    }
+};
+#else
+struct simd_t{
+    struct vec{ float v[4]; };
+    static vec load(const float* p){ vec r; memcpy(r.v, p, sizeof(r.v)); return r; }
+    static void store(float* p, vec v){ memcpy(p, v.v, sizeof(v.v)); }
+    static vec set1(float s){ return vec{{s, s, s, s}}; }
+    static vec zero(){ return set1(0.f); }
+    static vec add(vec a, vec b){ for(int i=0; i<4; i++) a.v[i] += b.v[i]; return a; }
+    static vec mul(vec a, vec b){ for(int i=0; i<4; i++) a.v[i] *= b.v[i]; return a; }
+    static vec madd(vec a, vec b, vec c){ for(int i=0; i<4; i++) c.v[i] += a.v[i] * b.v[i]; return c; }
+    static vec lerp(vec a, vec b, vec t){ for(int i=0; i<4; i++) a.v[i] += (b.v[i] - a.v[i]) * t.v[i]; return a; }
+    static float dot(vec a, vec b){ return a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2] + a.v[3] * b.v[3]; }
+    template<int i>
+    static vec broadcast(vec v){ return set1(v.v[i]); }
+    // 只读取3个分量, 第4个分量为 min.w
+    static vec dequantize(const uint16_t* p, vec min, vec extent){
+        for(int i=0; i<3; i++) min.v[i] += float(p[i]) * extent.v[i];
+        return min;
+    }
+    static vec dequantize(const int16_t* p){
+        vec r;
+        for(int i=0; i<4; i++) r.v[i] = float(p[i]) * (1.f / 32767.f);
+        return r;
+    }
+};
+#endif
+
+using vec = simd_t::vec;
+
+// 列主序 4x4 矩阵相乘, out = a * b
+inline void mat_mul(const float* a, const float* b, float* out){
+    const vec c0 = simd_t::load(a), c1 = simd_t::load(a + 4), c2 = simd_t::load(a + 8), c3 = simd_t::load(a + 12);
+    for(int j=0; j<4; j++){
+        const vec col = simd_t::load(b + 4 * j);
+        vec r = simd_t::mul(c0, simd_t::broadcast<0>(col));
+        r = simd_t::madd(c1, simd_t::broadcast<1>(col), r);
+        r = simd_t::madd(c2, simd_t::broadcast<2>(col), r);
+        r = simd_t::madd(c3, simd_t::broadcast<3>(col), r);
+        simd_t::store(out + 4 * j, r);
+    }
+}
+
+inline vec normalize(vec q){
+    const float len2 = simd_t::dot(q, q);
+    return len2 > 0.f ? simd_t::mul(q, simd_t::set1(1.f / std::sqrt(len2))) : q;
+}
+
+// 姿态中一个节点的平移, 旋转, 缩放转换为列主序矩阵
+inline void pose_to_mat(const float* pose, float* out){
+    const float tx = pose[0], ty = pose[1], tz = pose[2];
+    const float x = pose[4], y = pose[5], z = pose[6], w = pose[7];
+    const float sx = pose[8], sy = pose[9], sz = pose[10];
+    const float xx = x * x, yy = y * y, zz = z * z;
+    const float xy = x * y, xz = x * z, yz = y * z;
+    const float wx = w * x, wy = w * y, wz = w * z;
+    out[0] = (1.f - 2.f * (yy + zz)) * sx; out[1] = 2.f * (xy + wz) * sx;       out[2] = 2.f * (xz - wy) * sx;        out[3] = 0.f;
+    out[4] = 2.f * (xy - wz) * sy;       out[5] = (1.f - 2.f * (xx + zz)) * sy; out[6] = 2.f * (yz + wx) * sy;        out[7] = 0.f;
+    out[8] = 2.f * (xz + wy) * sz;       out[9] = 2.f * (yz - wx) * sz;        out[10] = (1.f - 2.f * (xx + yy)) * sz; out[11] = 0.f;
+    out[12] = tx; out[13] = ty; out[14] = tz; out[15] = 1.f;
+}
+
+glm::mat4 to_mat4(const aiMatrix4x4& m){
+    // assimp 为行主序
+    return glm::mat4(glm::vec4(m.a1, m.b1, m.c1, m.d1), glm::vec4(m.a2, m.b2, m.c2, m.d2),
+        glm::vec4(m.a3, m.b3, m.c3, m.d3), glm::vec4(m.a4, m.b4, m.c4, m.d4));
+}
+
+glm::quat quat_slerp(glm::quat a, glm::quat b, float t){
+    float cos_theta = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+    if(cos_theta < 0.f){
+        b = glm::quat(-b.w, -b.x, -b.y, -b.z);
+        cos_theta = -cos_theta;
+    }
+    float ka = 1.f - t, kb = t;
+    // 夹角很小时退化为线性插值
+    if(cos_theta < 0.9995f){
+        const float theta = std::acos(cos_theta), sin_theta = std::sin(theta);
+        ka = std::sin(ka * theta) / sin_theta;
+        kb = std::sin(kb * theta) / sin_theta;
+    }
+    glm::quat r(ka * a.w + kb * b.w, ka * a.x + kb * b.x, ka * a.y + kb * b.y, ka * a.z + kb * b.z);
+    const float len = std::sqrt(r.x * r.x + r.y * r.y + r.z * r.z + r.w * r.w);
+    return glm::quat(r.w / len, r.x / len, r.y / len, r.z / len);
+}
+
+glm::vec3 to_vec3(const aiVector3D& v){
+    return glm::vec3(v.x, v.y, v.z);
+}
+glm::quat to_quat(const aiQuaternion& q){
+    return glm::quat(q.w, q.x, q.y, q.z);
+}
+glm::vec3 interpolate(const aiVectorKey* keys, unsigned int num, double ticks, const glm::vec3& fallback){
+    if(num == 0) return fallback;
+    const auto next = std::upper_bound(keys, keys + num, ticks, [](double t, const aiVectorKey& key){ return t < key.mTime; });
+    if(next == keys) return to_vec3(keys[0].mValue);
+    if(next == keys + num) return to_vec3(keys[num - 1].mValue);
+    const auto& prev = next[-1];
+    const float t = float((ticks - prev.mTime) / (next->mTime - prev.mTime));
+    return to_vec3(prev.mValue) + (to_vec3(next->mValue) - to_vec3(prev.mValue)) * t;
+}
+glm::quat interpolate(const aiQuatKey* keys, unsigned int num, double ticks, const glm::quat& fallback){
+    if(num == 0) return fallback;
+    const auto next = std::upper_bound(keys, keys + num, ticks, [](double t, const aiQuatKey& key){ return t < key.mTime; });
+    if(next == keys) return to_quat(keys[0].mValue);
+    if(next == keys + num) return to_quat(keys[num - 1].mValue);
+    const auto& prev = next[-1];
+    return quat_slerp(to_quat(prev.mValue), to_quat(next->mValue), float((ticks - prev.mTime) / (next->mTime - prev.mTime)));
+}
+
+}
+
+uint32_t Skeleton::add_node(const std::string& name, int32_t parent, const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale){
+    assert_with_info(parent < int32_t(node_list.size()), "parent of node %s is not added", name.c_str());
+    const uint32_t index = uint32_t(node_list.size());
+    node_list.push_back(node_t{name, parent, translation, rotation, scale});
+    node_index.emplace(name, index);
+    bind.insert(bind.end(), {translation.x, translation.y, translation.z, 0.f, rotation.x, rotation.y, rotation.z, rotation.w,
+        scale.x, scale.y, scale.z, 0.f});
+    return index;
+}
+
+uint32_t Skeleton::add_joint(uint32_t node, const glm::mat4& inverse_bind){
+    assert_with_info(node < node_list.size(), "node %u out of range", node);
+    for(size_t i=0; i<joint_list.size(); i++)
+        if(joint_list[i].node == node && memcmp(&joint_list[i].inverse_bind[0][0], &inverse_bind[0][0], sizeof(float) * 16) == 0)
+            return uint32_t(i);
+    joint_list.push_back(joint_t{node, inverse_bind});
+    return uint32_t(joint_list.size() - 1);
+}
+
+int32_t Skeleton::find_node(const std::string& name) const{
+    const auto it = node_index.find(name);
+    return it == node_index.end() ? -1 : int32_t(it->second);
+}
+
+std::unique_ptr<Skeleton> Skeleton::load(const aiScene* scene){
+    bool has_bones = false;
+    for(unsigned int i=0; i<scene->mNumMeshes; i++)
+        has_bones = has_bones || scene->mMeshes[i]->mNumBones > 0;
+    if(!has_bones && scene->mNumAnimations == 0) return nullptr;
+    std::unique_ptr<Skeleton> skeleton(new Skeleton());
+    aiMatrix4x4 root = scene->mRootNode->mTransformation;
+    skeleton->global_inverse = to_mat4(root.Inverse());
+    // 深度优先, 父节点总在子节点之前
+    std::vector<std::pair<const aiNode*, int32_t>> stack{{scene->mRootNode, -1}};
+    while(!stack.empty()){
+        const auto item = stack.back();
+        stack.pop_back();
+        aiVector3D scale, position;
+        aiQuaternion rotation;
+        item.first->mTransformation.Decompose(scale, rotation, position);
+        const int32_t index = int32_t(skeleton->add_node(item.first->mName.C_Str(), item.second, to_vec3(position), to_quat(rotation), to_vec3(scale)));
+        for(unsigned int i=item.first->mNumChildren; i>0; i--)
+            stack.emplace_back(item.first->mChildren[i - 1], index);
+    }
+    return skeleton;
+}
+
+std::vector<SkinWeights> Skeleton::bind_mesh(const aiMesh* mesh, const char* node_name){
+    const int32_t node = find_node(node_name);
+    assert_with_info(node >= 0, "node %s is not in skeleton", node_name);
+    std::vector<SkinWeights> res(mesh->mNumVertices);
+    for(unsigned int i=0; i<mesh->mNumBones; i++){
+        const aiBone* bone = mesh->mBones[i];
+        const int32_t bone_node = find_node(bone->mName.C_Str());
+        if(bone_node < 0){
+            log_warn("bone %s is not in skeleton", bone->mName.C_Str());
+            continue;
+        }
+        const float joint = float(add_joint(uint32_t(bone_node), to_mat4(bone->mOffsetMatrix)));
+        for(unsigned int j=0; j<bone->mNumWeights; j++){
+            const auto& weight = bone->mWeights[j];
+            auto& skin = res[weight.mVertexId];
+            // 替换权重最小的一项
+            int slot = 0;
+            for(int k=1; k<4; k++)
+                if(skin.weights[k] < skin.weights[slot])
+                    slot = k;
+            if(weight.mWeight > skin.weights[slot]){
+                skin.joints[slot] = joint;
+                skin.weights[slot] = weight.mWeight;
+            }
+        }
+    }
+    int32_t rigid_joint = -1;
+    for(auto& skin: res){
+        const float sum = skin.weights.x + skin.weights.y + skin.weights.z + skin.weights.w;
+        if(sum > 0.f){
+            skin.weights = skin.weights * (1.f / sum);
+            continue;
+        }
+        if(rigid_joint < 0)
+            rigid_joint = int32_t(add_joint(uint32_t(node), glm::mat4(1.f)));
+        skin.joints = glm::vec4(float(rigid_joint), 0.f, 0.f, 0.f);
+        skin.weights = glm::vec4(1.f, 0.f, 0.f, 0.f);
+    }
+    return res;
+}
+
+AnimationClip::AnimationClip(std::string name, float duration, float sample_rate, size_t node_num):
+    clip_name(std::move(name)), length(std::max(duration, 0.f)), rate(sample_rate), nodes(node_num){
+    assert_with_info(sample_rate > 0, "invalid sample rate %f", sample_rate);
+    // 最后一个关键帧落在 duration 处
+    keys = uint32_t(std::ceil(length * rate - 1e-3f)) + 1;
+}
+
+uint32_t AnimationClip::quantize(const glm::vec3* values, std::vector<uint16_t>& out, glm::vec4& min, glm::vec4& extent, uint32_t& key_num) const{
+    glm::vec3 lo = values[0], hi = values[0];
+    for(uint32_t k=1; k<keys; k++){
+        lo = glm::min(lo, values[k]);
+        hi = glm::max(hi, values[k]);
+    }
+    const glm::vec3 range = hi - lo;
+    // 去掉末尾的填充分量, 追加后再补上
+    out.pop_back();
+    const uint32_t offset = uint32_t(out.size());
+    if(std::max({range.x, range.y, range.z}) <= 1e-6f){
+        // 常量轨道, 反量化结果精确等于第一个关键帧
+        key_num = 1;
+        min = glm::vec4(values[0], 0.f);
+        extent = glm::vec4(0.f);
+        out.insert(out.end(), {0, 0, 0});
+    }else{
+        key_num = keys;
+        min = glm::vec4(lo, 0.f);
+        extent = glm::vec4(range / 65535.f, 0.f);
+        for(uint32_t k=0; k<keys; k++)
+            for(int c=0; c<3; c++)
+                out.push_back(range[c] > 0.f ? uint16_t(std::lround((values[k][c] - lo[c]) / range[c] * 65535.f)) : 0);
+    }
+    out.push_back(0);
+    return offset;
+}
+
+void AnimationClip::add_track(uint32_t node, const glm::vec3* translations, const glm::quat* rotations, const glm::vec3* scales){
+    assert_with_info(node < nodes, "node %u out of range", node);
+    track_t track;
+    track.node = node;
+    track.translation = quantize(translations, this->translations, track.translation_min, track.translation_extent, track.translation_keys);
+    track.scale = quantize(scales, this->scales, track.scale_min, track.scale_extent, track.scale_keys);
+
+    // 相邻关键帧对齐到同一半球, 采样时直接线性插值
+    std::vector<glm::vec4> aligned(keys);
+    bool constant = true;
+    for(uint32_t k=0; k<keys; k++){
+        const glm::quat& q = rotations[k];
+        glm::vec4 v(q.x, q.y, q.z, q.w);
+        v = v * (1.f / std::sqrt(glm::dot(v, v)));
+        if(k > 0 && glm::dot(v, aligned[k - 1]) < 0.f)
+            v = v * -1.f;
+        aligned[k] = v;
+        const glm::vec4 diff = v - aligned[0];
+        constant = constant && glm::dot(diff, diff) <= 1e-10f;
+    }
+    this->rotations.pop_back();
+    track.rotation = uint32_t(this->rotations.size());
+    track.rotation_keys = constant ? 1 : keys;
+    for(uint32_t k=0; k<track.rotation_keys; k++)
+        for(int c=0; c<4; c++)
+            this->rotations.push_back(int16_t(std::lround(std::clamp(aligned[k][c], -1.f, 1.f) * 32767.f)));
+    this->rotations.push_back(0);
+    tracks.push_back(track);
+}
+
+void AnimationClip::sample(float time, bool loop, float* pose) const{
+    float t = 0.f;
+    if(length > 0.f){
+        if(loop){
+            t = std::fmod(time, length);
+            if(t < 0.f) t += length;
+        }else{
+            t = std::clamp(time, 0.f, length);
+        }
+    }
+    const float key = t * rate;
+    const uint32_t k0 = std::min(uint32_t(key), keys - 1), k1 = std::min(k0 + 1, keys - 1);
+    const vec f = simd_t::set1(std::clamp(key - float(k0), 0.f, 1.f));
+    for(const auto& track: tracks){
+        float* out = pose + track.node * pose_floats;
+        {
+            const vec min = simd_t::load(&track.translation_min.x), extent = simd_t::load(&track.translation_extent.x);
+            const uint16_t* p = translations.data() + track.translation;
+            simd_t::store(out, track.translation_keys == 1 ? simd_t::dequantize(p, min, extent) :
+                simd_t::lerp(simd_t::dequantize(p + 3 * k0, min, extent), simd_t::dequantize(p + 3 * k1, min, extent), f));
+        }
+        {
+            const int16_t* p = rotations.data() + track.rotation;
+            simd_t::store(out + 4, normalize(track.rotation_keys == 1 ? simd_t::dequantize(p) :
+                simd_t::lerp(simd_t::dequantize(p + 4 * k0), simd_t::dequantize(p + 4 * k1), f)));
+        }
+        {
+            const vec min = simd_t::load(&track.scale_min.x), extent = simd_t::load(&track.scale_extent.x);
+            const uint16_t* p = scales.data() + track.scale;
+            simd_t::store(out + 8, track.scale_keys == 1 ? simd_t::dequantize(p, min, extent) :
+                simd_t::lerp(simd_t::dequantize(p + 3 * k0, min, extent), simd_t::dequantize(p + 3 * k1, min, extent), f));
+        }
+    }
+}
+
+size_t AnimationClip::memory_bytes() const{
+    return (translations.size() + scales.size()) * sizeof(uint16_t) + rotations.size() * sizeof(int16_t) + tracks.size() * sizeof(track_t);
+}
+
+size_t AnimationClip::raw_bytes() const{
+    return tracks.size() * size_t(keys) * 10 * sizeof(float);
+}
+
+std::unique_ptr<AnimationClip> AnimationClip::load(const aiAnimation* animation, const Skeleton& skeleton, float sample_rate){
+    const double ticks_per_second = animation->mTicksPerSecond > 0 ? animation->mTicksPerSecond : 25.0;
+    std::unique_ptr<AnimationClip> clip(new AnimationClip(animation->mName.C_Str(), float(animation->mDuration / ticks_per_second),
+        sample_rate, skeleton.nodes().size()));
+    const uint32_t keys = clip->key_num();
+    std::vector<glm::vec3> translations(keys), scales(keys);
+    std::vector<glm::quat> rotations(keys);
+    for(unsigned int i=0; i<animation->mNumChannels; i++){
+        const aiNodeAnim* channel = animation->mChannels[i];
+        const int32_t node = skeleton.find_node(channel->mNodeName.C_Str());
+        if(node < 0) continue;
+        const auto& bind = skeleton.nodes()[node];
+        for(uint32_t k=0; k<keys; k++){
+            const double ticks = std::min(double(k) / sample_rate, double(clip->duration())) * ticks_per_second;
+            translations[k] = interpolate(channel->mPositionKeys, channel->mNumPositionKeys, ticks, bind.translation);
+            rotations[k] = interpolate(channel->mRotationKeys, channel->mNumRotationKeys, ticks, bind.rotation);
+            scales[k] = interpolate(channel->mScalingKeys, channel->mNumScalingKeys, ticks, bind.scale);
+        }
+        clip->add_track(uint32_t(node), translations.data(), rotations.data(), scales.data());
+    }
+    log_debug("Animation %s %.2fs %zu tracks, %zu -> %zu bytes.", clip->name().c_str(), clip->duration(), clip->track_num(),
+        clip->raw_bytes(), clip->memory_bytes());
+    return clip;
+}
+
+Animator::~Animator(){
+    delete buffer;
+}
+
+const char* Animator::simd_name(){
+#if defined(__SSE2__)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+Animator::instance_t& Animator::get(handle_t instance){
+    assert_with_info(instance < instances.size() && instances[instance].skeleton != nullptr, "invalid animation instance %u", instance);
+    return instances[instance];
+}
+
+const Animator::instance_t& Animator::get(handle_t instance) const{
+    assert_with_info(instance < instances.size() && instances[instance].skeleton != nullptr, "invalid animation instance %u", instance);
+    return instances[instance];
+}
+
+Animator::handle_t Animator::add_instance(const Skeleton* skeleton){
+    assert_with_info(skeleton != nullptr, "model has no skeleton");
+    handle_t handle;
+    if(!free_handles.empty()){
+        handle = free_handles.back();
+        free_handles.pop_back();
+    }else{
+        handle = handle_t(instances.size());
+        instances.emplace_back();
+    }
+    instances[handle] = instance_t();
+    instances[handle].skeleton = skeleton;
+    layout_dirty = true;
+    return handle;
+}
+
+void Animator::remove_instance(handle_t instance){
+    get(instance).skeleton = nullptr;
+    free_handles.push_back(instance);
+    layout_dirty = true;
+}
+
+Animator::layer_t& Animator::add_layer(instance_t& instance, const AnimationClip* clip, float speed, bool loop){
+    assert_with_info(clip != nullptr, "animation clip is null");
+    assert_with_info(clip->node_num() == instance.skeleton->nodes().size(), "animation %s does not belong to the skeleton", clip->name().c_str());
+    int index = instance.layer_num;
+    if(index == max_layers){
+        index = 0;
+        for(int i=1; i<max_layers; i++)
+            if(instance.layers[i].weight < instance.layers[index].weight)
+                index = i;
+    }else{
+        instance.layer_num += 1;
+    }
+    auto& layer = instance.layers[index];
+    layer = layer_t();
+    layer.clip = clip;
+    layer.speed = speed;
+    layer.loop = loop;
+    return layer;
+}
+
+void Animator::play(handle_t instance, const AnimationClip* clip, float fade, float speed, bool loop){
+    auto& inst = get(instance);
+    // 没有正在播放的动画时直接切换, 不从绑定姿态淡入
+    if(fade <= 0.f || inst.layer_num == 0){
+        inst.layer_num = 0;
+        auto& layer = add_layer(inst, clip, speed, loop);
+        layer.weight = layer.target = 1.f;
+        return;
+    }
+    layer_t* current = nullptr;
+    for(int i=0; i<inst.layer_num; i++){
+        auto& layer = inst.layers[i];
+        layer.target = 0.f;
+        layer.fade_rate = 1.f / fade;
+        if(layer.clip == clip)
+            current = &layer;
+    }
+    // 正在淡出的同一片段重新淡入, 不从头播放
+    if(current == nullptr)
+        current = &add_layer(inst, clip, speed, loop);
+    current->speed = speed;
+    current->loop = loop;
+    current->target = 1.f;
+    current->fade_rate = 1.f / fade;
+}
+
+void Animator::blend(handle_t instance, const AnimationClip* clip, float weight, float speed, bool loop){
+    auto& inst = get(instance);
+    for(int i=0; i<inst.layer_num; i++){
+        auto& layer = inst.layers[i];
+        if(layer.clip != clip) continue;
+        if(weight <= 0.f){
+            inst.layers[i] = inst.layers[--inst.layer_num];
+            return;
+        }
+        layer.weight = layer.target = weight;
+        layer.fade_rate = 0.f;
+        layer.speed = speed;
+        layer.loop = loop;
+        return;
+    }
+    if(weight <= 0.f) return;
+    auto& layer = add_layer(inst, clip, speed, loop);
+    layer.weight = layer.target = weight;
+}
+
+void Animator::stop(handle_t instance){
+    get(instance).layer_num = 0;
+}
+
+int Animator::bone_offset(handle_t instance) const{
+    assert_with_info(!layout_dirty, "call Animator::evaluate first");
+    return int(get(instance).offset * 4);
+}
+
+const glm::mat4* Animator::joint_matrices(handle_t instance) const{
+    assert_with_info(!layout_dirty, "call Animator::evaluate first");
+    return palette.data() + get(instance).offset;
+}
+
+void Animator::layout(){
+    size_t offset = 0;
+    for(auto& instance: instances){
+        if(instance.skeleton == nullptr) continue;
+        instance.offset = offset;
+        offset += instance.skeleton->joints().size();
+    }
+    palette.resize(offset);
+    layout_dirty = false;
+}
+
+uint32_t Animator::evaluate_instance(instance_t& instance, float delta_time){
+    // 推进时间与淡入淡出, 移除已淡出的层
+    int layer_num = 0;
+    float total = 0.f;
+    for(int i=0; i<instance.layer_num; i++){
+        layer_t layer = instance.layers[i];
+        layer.time += delta_time * layer.speed;
+        const float duration = layer.clip->duration();
+        if(layer.loop && duration > 0.f){
+            layer.time = std::fmod(layer.time, duration);
+            if(layer.time < 0.f) layer.time += duration;
+        }
+        if(layer.fade_rate > 0.f){
+            const float step = layer.fade_rate * delta_time;
+            layer.weight = layer.weight < layer.target ? std::min(layer.weight + step, layer.target) : std::max(layer.weight - step, layer.target);
+            if(layer.weight == layer.target)
+                layer.fade_rate = 0.f;
+        }
+        if(layer.weight <= 0.f && layer.target <= 0.f) continue;
+        total += layer.weight;
+        instance.layers[layer_num++] = layer;
+    }
+    instance.layer_num = layer_num;
+
+    const Skeleton& skeleton = *instance.skeleton;
+    const size_t node_num = skeleton.nodes().size();
+    const size_t pose_floats = AnimationClip::pose_floats;
+    thread_local std::vector<float> pose, layer_pose, globals;
+    pose.resize(node_num * pose_floats);
+    globals.resize(node_num * 16);
+    memcpy(pose.data(), skeleton.bind_pose(), node_num * pose_floats * sizeof(float));
+    uint32_t sampled = 0;
+    if(layer_num == 1 && instance.layers[0].weight >= 1.f){
+        const auto& layer = instance.layers[0];
+        layer.clip->sample(layer.time, layer.loop, pose.data());
+        sampled = 1;
+    }else if(layer_num > 0){
+        // 总权重不足1时剩余部分为绑定姿态, 超过1时按比例归一化
+        layer_pose.resize(node_num * pose_floats);
+        const float scale = 1.f / std::max(total, 1.f);
+        const float bind_weight = std::max(1.f - total, 0.f);
+        for(size_t i=0; i<node_num * pose_floats; i+=4)
+            simd_t::store(pose.data() + i, simd_t::mul(simd_t::load(skeleton.bind_pose() + i), simd_t::set1(bind_weight)));
+        for(int l=0; l<layer_num; l++){
+            const auto& layer = instance.layers[l];
+            if(layer.weight <= 0.f) continue;
+            memcpy(layer_pose.data(), skeleton.bind_pose(), node_num * pose_floats * sizeof(float));
+            layer.clip->sample(layer.time, layer.loop, layer_pose.data());
+            const float w = layer.weight * scale;
+            const vec weight = simd_t::set1(w);
+            for(size_t n=0; n<node_num; n++){
+                float* dst = pose.data() + n * pose_floats;
+                const float* src = layer_pose.data() + n * pose_floats;
+                simd_t::store(dst, simd_t::madd(simd_t::load(src), weight, simd_t::load(dst)));
+                // 四元数 q 与 -q 表示同一旋转, 与已累加的结果对齐到同一半球
+                const vec r = simd_t::load(src + 4), acc = simd_t::load(dst + 4);
+                simd_t::store(dst + 4, simd_t::madd(r, simd_t::set1(simd_t::dot(r, acc) < 0.f ? -w : w), acc));
+                simd_t::store(dst + 8, simd_t::madd(simd_t::load(src + 8), weight, simd_t::load(dst + 8)));
+            }
+            sampled += 1;
+        }
+        for(size_t n=0; n<node_num; n++){
+            float* r = pose.data() + n * pose_floats + 4;
+            simd_t::store(r, normalize(simd_t::load(r)));
+        }
+    }
+
+    // 局部变换沿层级累乘, 根节点之上乘 global_inverse
+    float local[16];
+    const auto& nodes = skeleton.nodes();
+    for(size_t n=0; n<node_num; n++){
+        pose_to_mat(pose.data() + n * pose_floats, local);
+        const float* parent = nodes[n].parent < 0 ? &skeleton.global_inverse[0][0] : globals.data() + size_t(nodes[n].parent) * 16;
+        mat_mul(parent, local, globals.data() + n * 16);
+    }
+    const auto& joints = skeleton.joints();
+    glm::mat4* out = palette.data() + instance.offset;
+    for(size_t j=0; j<joints.size(); j++)
+        mat_mul(globals.data() + size_t(joints[j].node) * 16, &joints[j].inverse_bind[0][0], &out[j][0][0]);
+    return sampled;
+}
+
+void Animator::evaluate(float delta_time){
+    profile_scope("Animator::evaluate");
+    const auto beg = std::chrono::steady_clock::now();
+    if(layout_dirty)
+        layout();
+    std::atomic<uint32_t> layers{0};
+    job_system::parallel_for(0, instances.size(), [&](size_t first, size_t last){
+        uint32_t sampled = 0;
+        for(size_t i=first; i<last; i++)
+            if(instances[i].skeleton != nullptr)
+                sampled += evaluate_instance(instances[i], delta_time);
+        layers.fetch_add(sampled, std::memory_order_relaxed);
+    }, 8);
+    frame_stats.instances = uint32_t(instances.size() - free_handles.size());
+    frame_stats.joints = uint32_t(palette.size());
+    frame_stats.layers = layers.load();
+    frame_stats.evaluate_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - beg).count();
+}
+
+void Animator::upload(){
+    profile_scope("Animator::upload");
+    if(buffer == nullptr)
+        buffer = new texture_buffer_t(GL_RGBA32F);
+    const size_t bytes = palette.size() * sizeof(glm::mat4);
+    buffer->update((unsigned int)bytes, palette.data());
+    frame_stats.upload_bytes = bytes;
+}
@@ -0,0 +1,282 @@
+/**
+ * @file animation.hpp
+ * @brief 骨骼动画: 骨架与蒙皮关节, 量化存储的动画片段, 多实例姿态求值与GPU蒙皮用的关节矩阵
+ *
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "vertices_layer.hpp"
+
+struct aiScene;
+struct aiMesh;
+struct aiAnimation;
+
+namespace Ez3DGL{
+
+/**
+ * @brief 顶点受影响的关节(最多4个)与权重, 关节序号以 float 存放, 与其他顶点属性一同交错上传
+ */
+struct SkinWeights{
+    glm::vec4 joints = glm::vec4(0.f);
+    glm::vec4 weights = glm::vec4(0.f);
+};
+
+/**
+ * @brief 骨架, 由场景的节点层级构成(父节点在子节点之前), 蒙皮关节引用其中的节点
+ * @note 同一节点可以对应多个关节(逆绑定矩阵不同), 没有骨骼的网格整体绑定到其所在节点
+ */
+class Skeleton{
+public:
+    struct node_t{
+        std::string name;
+        // 父节点序号, 根节点为-1
+        int32_t parent;
+        // 绑定姿态下相对父节点的变换
+        glm::vec3 translation;
+        glm::quat rotation;
+        glm::vec3 scale;
+    };
+    struct joint_t{
+        uint32_t node;
+        // 从网格空间到关节空间
+        glm::mat4 inverse_bind;
+    };
+    // 作用在根节点之上, 抵消场景根节点的变换
+    glm::mat4 global_inverse = glm::mat4(1.f);
+
+    /**
+     * @brief 加入节点, 父节点必须已经加入
+     */
+    uint32_t add_node(const std::string& name, int32_t parent, const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale);
+    /**
+     * @brief 加入关节并返回序号, 节点与逆绑定矩阵都相同的关节只加入一次
+     */
+    uint32_t add_joint(uint32_t node, const glm::mat4& inverse_bind);
+    // 不存在时返回-1
+    int32_t find_node(const std::string& name) const;
+
+    const std::vector<node_t>& nodes() const{
+        return node_list;
+    }
+    const std::vector<joint_t>& joints() const{
+        return joint_list;
+    }
+    /**
+     * @brief 绑定姿态, 每个节点12个float: 平移(xyz, 0), 旋转四元数(xyzw), 缩放(xyz, 0)
+     */
+    const float* bind_pose() const{
+        return bind.data();
+    }
+
+    /**
+     * @brief 从场景的节点层级构建骨架, 场景中没有骨骼也没有动画时返回空
+     */
+    static std::unique_ptr<Skeleton> load(const aiScene* scene);
+    /**
+     * @brief 把网格的骨骼加入为关节, 返回每个顶点的关节与权重(按权重保留最大的4个并归一化)
+     * @param node_name 网格所在的节点, 没有骨骼的网格(或未受骨骼影响的顶点)整体绑定到该节点
+     */
+    std::vector<SkinWeights> bind_mesh(const aiMesh* mesh, const char* node_name);
+private:
+    std::vector<node_t> node_list;
+    std::vector<joint_t> joint_list;
+    std::vector<float> bind;
+    std::unordered_map<std::string, uint32_t> node_index;
+};
+
+/**
+ * @brief 动画片段, 所有轨道按固定采样率重新采样, 同一时刻各节点使用同一对关键帧
+ *
+ * 关键帧量化存储:
+ * - 平移与缩放每个分量16位, 在该轨道的取值范围内均匀量化;
+ * - 旋转四元数每个分量16位定点数, 相邻关键帧已对齐到同一半球, 插值后归一化;
+ * - 整段不变的轨道只保存一个关键帧.
+ */
+class AnimationClip{
+public:
+    // 姿态中每个节点的 float 数, 布局同 Skeleton::bind_pose
+    static constexpr size_t pose_floats = 12;
+
+    /**
+     * @param duration 时长(秒)
+     * @param sample_rate 每秒关键帧数
+     * @param node_num 所属骨架的节点数
+     */
+    AnimationClip(std::string name, float duration, float sample_rate, size_t node_num);
+
+    /**
+     * @brief 加入一个节点的轨道, 三个数组各有 key_num() 个关键帧, 在此量化
+     */
+    void add_track(uint32_t node, const glm::vec3* translations, const glm::quat* rotations, const glm::vec3* scales);
+    /**
+     * @brief 采样 time(秒) 时刻的局部变换, 只写入有轨道的节点, 其余节点保持 pose 中原有的值
+     * @param loop 为真时 time 按时长取模, 否则截断到 [0, duration]
+     */
+    void sample(float time, bool loop, float* pose) const;
+
+    const std::string& name() const{
+        return clip_name;
+    }
+    float duration() const{
+        return length;
+    }
+    float sample_rate() const{
+        return rate;
+    }
+    uint32_t key_num() const{
+        return keys;
+    }
+    size_t node_num() const{
+        return nodes;
+    }
+    size_t track_num() const{
+        return tracks.size();
+    }
+    // 量化后关键帧占用的字节数, 以及不量化(每帧10个float)时的字节数
+    size_t memory_bytes() const;
+    size_t raw_bytes() const;
+
+    /**
+     * @brief 从 assimp 动画导入, 按 sample_rate 重新采样, 骨架中不存在的节点的通道被忽略
+     */
+    static std::unique_ptr<AnimationClip> load(const aiAnimation* animation, const Skeleton& skeleton, float sample_rate=30.f);
+private:
+    struct track_t{
+        uint32_t node;
+        // 各通道第一个关键帧在数组中的位置(以分量计)与关键帧数(1或 key_num)
+        uint32_t translation, rotation, scale;
+        uint32_t translation_keys, rotation_keys, scale_keys;
+        // 反量化: min + q * extent
+        glm::vec4 translation_min, translation_extent;
+        glm::vec4 scale_min, scale_extent;
+    };
+    std::string clip_name;
+    float length, rate;
+    uint32_t keys;
+    size_t nodes;
+    std::vector<track_t> tracks;
+    // 各数组末尾多留一个分量, 一次读取4个分量时不越界
+    std::vector<uint16_t> translations{0};
+    std::vector<int16_t> rotations{0};
+    std::vector<uint16_t> scales{0};
+
+    // 量化一个通道并追加到 out, 返回第一个分量的位置
+    uint32_t quantize(const glm::vec3* values, std::vector<uint16_t>& out, glm::vec4& min, glm::vec4& extent, uint32_t& key_num) const;
+};
+
+/**
+ * @brief 动画实例的姿态求值, 每帧在 job_system 上并行推进所有实例的时间, 采样并混合动画层,
+ * 计算关节矩阵后统一上传到一个纹理缓冲, 由蒙皮着色器变体按实例偏移读取
+ * @note 单个实例内的插值, 混合与矩阵乘法以 SSE 4路并行(非x86平台为标量实现)
+ *
+ * 用法:
+ *     Animator animator;
+ *     auto hero = animator.add_instance(model.skeleton());
+ *     animator.play(hero, model.find_animation("run"));
+ *     animator.update(delta_time);
+ *     shader.set_bones(animator, hero);
+ *     model.draw(&shader, camera, &transform);
+ *     shader.set_bones(nullptr);
+ */
+class Animator{
+public:
+    using handle_t = uint32_t;
+    // 每个实例同时混合的动画层数上限
+    static constexpr int max_layers = 4;
+    struct stats_t{
+        uint32_t instances = 0;
+        // 本帧计算的关节矩阵数与采样的动画层数
+        uint32_t joints = 0;
+        uint32_t layers = 0;
+        float evaluate_ms = 0.f;
+        uint64_t upload_bytes = 0;
+    };
+
+    Animator() = default;
+    Animator(const Animator&) = delete;
+    Animator& operator=(const Animator&) = delete;
+    ~Animator();
+
+    handle_t add_instance(const Skeleton* skeleton);
+    void remove_instance(handle_t instance);
+    /**
+     * @brief 播放动画, 在 fade 秒内淡入, 其他层同时淡出(交叉淡化), fade 为0时立即切换
+     */
+    void play(handle_t instance, const AnimationClip* clip, float fade=0.2f, float speed=1.f, bool loop=true);
+    /**
+     * @brief 以固定权重混合一层动画(如按移动速度混合走与跑), 该片段已在播放时只修改权重与速度,
+     * 权重为0的层被移除
+     */
+    void blend(handle_t instance, const AnimationClip* clip, float weight, float speed=1.f, bool loop=true);
+    void stop(handle_t instance);
+
+    /**
+     * @brief 推进时间并计算所有实例的关节矩阵, 不需要GL上下文
+     */
+    void evaluate(float delta_time);
+    /**
+     * @brief 上传关节矩阵到纹理缓冲
+     */
+    void upload();
+    void update(float delta_time){
+        evaluate(delta_time);
+        upload();
+    }
+
+    // 关节矩阵纹理缓冲, 每个矩阵占4个texel(按列)
+    texture_buffer_t* bone_buffer() const{
+        return buffer;
+    }
+    // 实例第一个关节矩阵所在的texel
+    int bone_offset(handle_t instance) const;
+    /**
+     * @brief 实例的关节矩阵, evaluate 后有效
+     */
+    const glm::mat4* joint_matrices(handle_t instance) const;
+    const stats_t& stats() const{
+        return frame_stats;
+    }
+    static const char* simd_name();
+private:
+    struct layer_t{
+        const AnimationClip* clip = nullptr;
+        float time = 0.f;
+        float speed = 1.f;
+        float weight = 0.f;
+        // 淡入淡出的目标权重与每秒的变化量, fade_rate 为0时权重保持不变
+        float target = 0.f;
+        float fade_rate = 0.f;
+        bool loop = true;
+    };
+    struct instance_t{
+        const Skeleton* skeleton = nullptr;
+        layer_t layers[max_layers];
+        int layer_num = 0;
+        // 第一个关节矩阵在 palette 中的位置
+        size_t offset = 0;
+    };
+    std::vector<instance_t> instances;
+    std::vector<handle_t> free_handles;
+    std::vector<glm::mat4> palette;
+    bool layout_dirty = false;
+    texture_buffer_t* buffer = nullptr;
+    stats_t frame_stats;
+
+    instance_t& get(handle_t instance);
+    const instance_t& get(handle_t instance) const;
+    void layout();
+    // 加入一层, 层数已满时替换权重最小的层
+    layer_t& add_layer(instance_t& instance, const AnimationClip* clip, float speed, bool loop);
+    // 推进一个实例并写入其关节矩阵, 返回采样的层数
+    uint32_t evaluate_instance(instance_t& instance, float delta_time);
+};
+
+}
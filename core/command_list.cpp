@@ -0,0 +1,101 @@
+#include "core/command_list.hpp"
+#include <algorithm>
+#include <chrono>
+#include "utils/debug.hpp"
+#include "utils/job_system.hpp"
+#include "utils/profiler.hpp"
+#include "utils/render_stats.hpp"
+
+using namespace Ez3DGL;
+
+void CommandList::clear(){
+    draws.clear();
+    states.clear();
+}
+
+void CommandList::set_bones(texture_buffer_t* buffer, int offset){
+    states.push_back(state_t{buffer, offset});
+}
+
+void CommandList::set_bones(const Animator& animator, Animator::handle_t instance){
+    set_bones(animator.bone_buffer(), animator.bone_offset(instance));
+}
+
+void CommandList::draw(const Mesh& mesh, const glm::mat4& model, const glm::mat3& normal){
+    const vertices_t* vertices = mesh.vertices();
+    assert_with_info(vertices!=nullptr, "forget to setup vertices");
+    assert_with_info(vertices->e_cnt!=0, "Fail to draw elements due to e_cnt=0");
+    const uint32_t state = states.empty() ? no_state : uint32_t(states.size() - 1);
+    const unsigned int position_vao = vertices->split() ? vertices->position_VAO_id : vertices->VAO_id;
+    draws.push_back(draw_t{model, normal, mesh.material.get(), vertices->VAO_id, position_vao, vertices->e_cnt, GL_TRIANGLES, state});
+}
+
+void CommandList::draw(const Model& model, const model_t* transform, const OcclusionCuller* culler){
+    const auto& meshes = model.get_meshes();
+    if(meshes.empty()) return;
+    const glm::mat4 model_mat = transform->get_model(model_t::render_alpha());
+    const glm::mat3 normal = model_t::normal_matrix(model_mat, transform->uniform_scale());
+    for(const auto& mesh: meshes){
+        if(culler != nullptr && !culler->test_aabb(mesh.bounds_min, mesh.bounds_max, model_mat))
+            continue;
+        draw(mesh, model_mat, normal);
+    }
+}
+
+void CommandList::execute(Shader* shader, const camera_t* camera) const{
+    profile_gpu_scope("CommandList::execute");
+    // 命令表开始时没有关节矩阵
+    uint32_t state = no_state;
+    shader->set_bones(nullptr);
+    unsigned int vao = 0;
+    for(const auto& draw: draws){
+        if(draw.state != state){
+            state = draw.state;
+            if(state == no_state)
+                shader->set_bones(nullptr);
+            else
+                shader->set_bones(states[state].bones, states[state].bone_offset);
+        }
+        shader->bind(*draw.material, camera, draw.model, draw.normal);
+        const unsigned int draw_vao = shader->position_only() ? draw.position_vao : draw.vao;
+        if(draw_vao != vao){
+            glBindVertexArray(draw_vao);
+            render_stats::add(render_stats::counter_t::vao_binds);
+            vao = draw_vao;
+        }
+        glDrawElements(draw.mode, GLsizei(draw.count), GL_UNSIGNED_INT, 0);
+        render_stats::add_draw(draw.mode, draw.count);
+    }
+    if(state != no_state)
+        shader->set_bones(nullptr);
+}
+
+void CommandRecorder::record(size_t count, const record_fn_t& fn, size_t min_chunk){
+    profile_scope("CommandRecorder::record");
+    const auto beg = std::chrono::steady_clock::now();
+    min_chunk = std::max<size_t>(min_chunk, 1);
+    // 块数只取决于元素数与线程数, 每个线程约4块
+    const size_t max_lists = (job_system::worker_num() + 1) * 4;
+    list_num = std::min(max_lists, (count + min_chunk - 1) / min_chunk);
+    if(lists.size() < list_num)
+        lists.resize(list_num);
+    for(size_t i=0; i<list_num; i++)
+        lists[i].clear();
+    job_system::parallel_for(0, list_num, [&](size_t first, size_t last){
+        for(size_t i=first; i<last; i++)
+            fn(lists[i], count * i / list_num, count * (i + 1) / list_num);
+    });
+    frame_stats.lists = uint32_t(list_num);
+    frame_stats.draws = 0;
+    for(size_t i=0; i<list_num; i++)
+        frame_stats.draws += uint32_t(lists[i].draw_num());
+    frame_stats.record_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - beg).count();
+}
+
+void CommandRecorder::execute(Shader* shader, const camera_t* camera){
+    profile_gpu_scope("CommandRecorder::execute");
+    const auto beg = std::chrono::steady_clock::now();
+    for(size_t i=0; i<list_num; i++)
+        lists[i].execute(shader, camera);
+    frame_stats.execute_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - beg).count();
+}
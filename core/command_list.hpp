@@ -0,0 +1,108 @@
+/**
+ * @file command_list.hpp
+ * @brief 绘制命令表: 在工作线程上遍历场景并准备绘制(剔除, model矩阵与法线矩阵), 在GL线程按顺序回放
+ *
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <glm/glm.hpp>
+#include "mesh_layer.hpp"
+
+namespace Ez3DGL{
+
+/**
+ * @brief 一组绘制命令, 可以在任意线程录制, 只能在GL线程回放
+ *
+ * 每条绘制命令记录材质, VAO, 绘制参数与算好的model矩阵, 法线矩阵; 状态命令(关节矩阵)对之后录制的绘制生效.
+ * 回放时每条命令只剩变体选择(材质中缓存)与实际变化的绑定和上传, 连续相同的VAO不重复绑定.
+ * @note 录制期间场景(model_t, 网格, 材质)不能被修改, 网格在回放前不能释放顶点缓冲.
+ * 命令表开始时没有关节矩阵, 蒙皮网格前需录制 set_bones
+ */
+class CommandList{
+public:
+    void clear();
+    /**
+     * @brief 之后录制的绘制使用的关节矩阵, 见 Shader::set_bones
+     */
+    void set_bones(texture_buffer_t* buffer, int offset=0);
+    void set_bones(const Animator& animator, Animator::handle_t instance);
+    void draw(const Mesh& mesh, const glm::mat4& model, const glm::mat3& normal);
+    /**
+     * @brief 录制模型的所有网格, model矩阵按当前的插值系数计算
+     * @param culler 不为空时在录制时跳过在视锥外或被遮挡的网格, 需已调用 rasterize
+     */
+    void draw(const Model& model, const model_t* transform, const OcclusionCuller* culler=nullptr);
+    /**
+     * @brief 在GL线程按录制顺序回放
+     */
+    void execute(Shader* shader, const camera_t* camera) const;
+
+    size_t draw_num() const{
+        return draws.size();
+    }
+    bool empty() const{
+        return draws.empty();
+    }
+private:
+    static constexpr uint32_t no_state = UINT32_MAX;
+    struct draw_t{
+        glm::mat4 model;
+        glm::mat3 normal;
+        const Material* material;
+        unsigned int vao;
+        // 只含位置的VAO, 没有分离位置流时同 vao
+        unsigned int position_vao;
+        uint32_t count;
+        GLenum mode;
+        // 录制时的状态命令, no_state 表示没有关节矩阵
+        uint32_t state;
+    };
+    struct state_t{
+        texture_buffer_t* bones;
+        int bone_offset;
+    };
+    std::vector<draw_t> draws;
+    std::vector<state_t> states;
+};
+
+/**
+ * @brief 并行录制: 把 [0, count) 分成固定的若干块, 在 job_system 上各自录制到一个命令表,
+ * 回放时按块的顺序, 结果与单线程按顺序录制相同
+ *
+ * 用法:
+ *     recorder.record(objects.size(), [&](CommandList& list, size_t beg, size_t end){
+ *         for(size_t i=beg; i<end; i++)
+ *             list.draw(model, &objects[i], &culler);
+ *     });
+ *     recorder.execute(&shader, camera);
+ */
+class CommandRecorder{
+public:
+    using record_fn_t = std::function<void(CommandList&, size_t, size_t)>;
+    struct stats_t{
+        uint32_t lists = 0;
+        uint32_t draws = 0;
+        float record_ms = 0.f;
+        float execute_ms = 0.f;
+    };
+
+    /**
+     * @param min_chunk 每块至少包含的元素数
+     */
+    void record(size_t count, const record_fn_t& fn, size_t min_chunk=16);
+    void execute(Shader* shader, const camera_t* camera);
+
+    const stats_t& stats() const{
+        return frame_stats;
+    }
+private:
+    std::vector<CommandList> lists;
+    size_t list_num = 0;
+    stats_t frame_stats;
+};
+
+}
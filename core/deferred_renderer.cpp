@@ -0,0 +1,135 @@
+#include "core/deferred_renderer.hpp"
+#include <string>
+#include "utils/debug.hpp"
+#include "utils/frame_arena.hpp"
+#include "utils/profiler.hpp"
+#include "utils/preset.hpp"
+
+using namespace Ez3DGL;
+
+static unsigned int create_target(GLenum internal_format, GLenum format, GLenum type, int width, int height){
+    unsigned int tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, type, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return tex;
+}
+
+void DeferredRenderer::setup(int width, int height){
+    assert_with_info(fbo==0, "deferred renderer is already setup");
+    static const float fullscreen_triangle[] = {
+        -1.f, -1.f,
+         3.f, -1.f,
+        -1.f,  3.f,
+    };
+    fullscreen = new vertices_t(6, {2}, fullscreen_triangle, 0, nullptr);
+    this->width = width;
+    this->height = height;
+    create_targets();
+}
+
+void DeferredRenderer::resize(int width, int height){
+    if(width == this->width && height == this->height) return;
+    this->width = width;
+    this->height = height;
+    destroy_targets();
+    create_targets();
+}
+
+void DeferredRenderer::create_targets(){
+    normal_tex = create_target(GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, width, height);
+    albedo_spec_tex = create_target(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+    depth_tex = create_target(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, width, height);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    shader_t::invalidate_bind_cache();
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, normal_tex, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, albedo_spec_tex, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depth_tex, 0);
+    const GLenum attachments[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, attachments);
+    assert_with_info(glCheckFramebufferStatus(GL_FRAMEBUFFER)==GL_FRAMEBUFFER_COMPLETE, "G-buffer is incomplete");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void DeferredRenderer::destroy_targets(){
+    glDeleteFramebuffers(1, &fbo);
+    const unsigned int textures[] = {normal_tex, albedo_spec_tex, depth_tex};
+    glDeleteTextures(3, textures);
+    fbo = normal_tex = albedo_spec_tex = depth_tex = 0;
+}
+
+void DeferredRenderer::begin_geometry(Shader* shader){
+    assert_with_info(fbo!=0, "forget to setup deferred renderer");
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glClearColor(0.f, 0.f, 0.f, 0.f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    shader->set_gbuffer_pass(true);
+}
+
+void DeferredRenderer::end_geometry(Shader* shader){
+    shader->set_gbuffer_pass(false);
+    glBindFramebuffer(GL_FRAMEBUFFER, target_fbo);
+}
+
+shader_t* DeferredRenderer::get_light_shader(uint32_t dir_light_max, bool clustered){
+    auto& shader = light_shaders[dir_light_max << 1 | uint32_t(clustered)];
+    if(shader == nullptr)
+        shader = new shader_t(preset::shader::vs_fullscreen(), preset::shader::fs_deferred_lighting(dir_light_max, clustered), "view", "projection", "model");
+    return shader;
+}
+
+void DeferredRenderer::light(const camera_t* camera, const std::vector<LightDir>& dir_lights, LightCluster* cluster){
+    profile_gpu_scope("DeferredRenderer::light");
+    assert_with_info(fbo!=0, "forget to setup deferred renderer");
+    const auto bucket = ShaderVariantKey::bucket_of(dir_lights.size());
+    const auto dir_light_max = ShaderVariantKey::bucket_capacity(bucket, UINT32_MAX);
+    auto shader = get_light_shader(dir_light_max, cluster != nullptr);
+
+    shader->use();
+    shader->clear_texture();
+    shader->bind_texture("g_normal", GL_TEXTURE_2D, normal_tex);
+    shader->bind_texture("g_albedo_spec", GL_TEXTURE_2D, albedo_spec_tex);
+    shader->bind_texture("g_depth", GL_TEXTURE_2D, depth_tex);
+    if(cluster != nullptr)
+        cluster->apply2shader(shader);
+    shader->set_uniform("inv_projection", glm::inverse(camera->projection));
+    shader->set_uniform("inv_view", glm::inverse(camera->view));
+    shader->set_uniform("screen_size", glm::vec2(width, height));
+    shader->set_uniform("viewPos", camera->position);
+    if(dir_light_max > 0){
+        shader->set_uniform("dir_light_num", dir_lights.size());
+        for(size_t i=0; i<dir_lights.size(); i++){
+            frame_arena::uniform_key_t key("lights_dir", i);
+            shader->set_uniform(key.field("ambient"),    dir_lights[i].ambient);
+            shader->set_uniform(key.field("diffuse"),    dir_lights[i].diffuse);
+            shader->set_uniform(key.field("specular"),   dir_lights[i].specular);
+            shader->set_uniform(key.field("direction"),  dir_lights[i].direction);
+        }
+    }
+
+    glDisable(GL_DEPTH_TEST);
+    fullscreen->draw_array(GL_TRIANGLES);
+    glEnable(GL_DEPTH_TEST);
+
+    // 复制深度, 之后仍可前向绘制天空盒,透明物体等
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target_fbo);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, target_fbo);
+}
+
+DeferredRenderer::~DeferredRenderer(){
+    if(fbo != 0)
+        destroy_targets();
+    for(auto& shader: light_shaders)
+        delete shader.second;
+    delete fullscreen;
+}
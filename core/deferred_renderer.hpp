@@ -0,0 +1,56 @@
+/**
+ * @file deferred_renderer.hpp
+ * @brief 延迟渲染路径
+ *
+ */
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "mesh_layer.hpp"
+
+namespace Ez3DGL{
+
+/**
+ * @brief 延迟渲染, 先把可见表面写入G-buffer, 再对每个像素只计算一次光照,
+ * 可以与前向渲染逐帧切换
+ * @note G-buffer: 八面体编码的法线+材质高光指数(RGB10_A2), 漫反射颜色+高光强度(RGBA8), 深度(DEPTH24_STENCIL8),
+ * 世界坐标由深度重建. 高光颜色压缩为亮度, 高光指数限制在 [1, 1024], 第二张漫反射贴图的聚光混合不生效.
+ * 点光源与聚光通过 LightCluster 的屏幕网格逐块遍历.
+ *
+ * 用法:
+ *     deferred.begin_geometry(&shader);
+ *     model.draw(&shader, camera, model_mat);
+ *     deferred.end_geometry(&shader);
+ *     deferred.light(camera, dir_lights, &cluster);
+ */
+class DeferredRenderer{
+public:
+    void setup(int width, int height);
+    void resize(int width, int height);
+    /**
+     * @brief 开始几何阶段, 此后通过 shader 绘制的物体写入G-buffer
+     */
+    void begin_geometry(Shader* shader);
+    void end_geometry(Shader* shader);
+    /**
+     * @brief 光照阶段, 结果写入调用 begin_geometry 之前绑定的帧缓冲, 并复制深度以便继续前向绘制
+     * @param cluster 点光源与聚光的分簇, 为空时只计算平行光
+     */
+    void light(const camera_t* camera, const std::vector<LightDir>& dir_lights, LightCluster* cluster);
+    ~DeferredRenderer();
+private:
+    int width=0, height=0;
+    unsigned int fbo=0;
+    unsigned int normal_tex=0, albedo_spec_tex=0, depth_tex=0;
+    int target_fbo=0;
+    vertices_t* fullscreen=nullptr;
+    std::unordered_map<uint32_t, shader_t*> light_shaders;
+
+    void create_targets();
+    void destroy_targets();
+    shader_t* get_light_shader(uint32_t dir_light_max, bool clustered);
+};
+
+}
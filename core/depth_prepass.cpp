@@ -0,0 +1,32 @@
+#include "core/depth_prepass.hpp"
+#include "utils/debug.hpp"
+
+using namespace Ez3DGL;
+
+void DepthPrepass::begin_depth(Shader* shader){
+    assert_with_info(stage==stage_t::none, "depth prepass is already begun");
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+    shader->set_depth_pass(true);
+    stage = stage_t::depth;
+}
+
+void DepthPrepass::begin_shading(Shader* shader){
+    assert_with_info(stage==stage_t::depth, "begin_depth must be called before begin_shading");
+    shader->set_depth_pass(false);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    // 深度已完整, 着色阶段不再写入
+    glDepthMask(GL_FALSE);
+    glDepthFunc(GL_EQUAL);
+    stage = stage_t::shading;
+}
+
+void DepthPrepass::end(Shader* shader){
+    assert_with_info(stage!=stage_t::none, "depth prepass is not begun");
+    shader->set_depth_pass(false);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+    stage = stage_t::none;
+}
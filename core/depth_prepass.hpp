@@ -0,0 +1,44 @@
+/**
+ * @file depth_prepass.hpp
+ * @brief 深度预通道
+ *
+ */
+#pragma once
+
+#include "mesh_layer.hpp"
+
+namespace Ez3DGL{
+
+/**
+ * @brief 深度预通道, 先只写深度绘制一遍场景(片元着色器为空, 非蒙皮网格只读取位置流),
+ * 再以 GL_EQUAL 深度测试绘制着色, 每个像素只执行一次多光源片元着色器
+ * @note 两遍须绘制相同的几何与变换, 着色阶段不写深度. 与 DeferredRenderer 一样通过 Shader 的状态切换变体,
+ * 不能与延迟渲染的几何阶段同时使用
+ *
+ * 用法:
+ *     prepass.begin_depth(&shader);
+ *     model.draw(&shader, camera, model_mat);
+ *     prepass.begin_shading(&shader);
+ *     model.draw(&shader, camera, model_mat);
+ *     prepass.end(&shader);
+ */
+class DepthPrepass{
+public:
+    /**
+     * @brief 开始深度阶段, 关闭颜色写入, 此后通过 shader 绘制的物体只写深度
+     */
+    void begin_depth(Shader* shader);
+    /**
+     * @brief 开始着色阶段, 只着色深度与预通道相等的片元
+     */
+    void begin_shading(Shader* shader);
+    /**
+     * @brief 恢复默认的深度测试(GL_LESS)与深度写入
+     */
+    void end(Shader* shader);
+private:
+    enum class stage_t{none, depth, shading};
+    stage_t stage = stage_t::none;
+};
+
+}
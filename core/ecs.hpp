@@ -0,0 +1,554 @@
+/**
+ * @file ecs.hpp
+ * @brief 基于原型(archetype)的实体组件系统
+ * @note 组件组合相同的实体属于同一原型, 原型把实体存放在固定大小的块中, 块内每种组件连续存放(SoA),
+ * 查询按块线性遍历. 遍历期间不能增删实体或组件, 需要时通过 CommandBuffer 记录, 遍历结束后 flush
+ *
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "core/vertices_layer.hpp"
+#include "core/mesh_layer.hpp"
+#include "core/entity_layer.hpp"
+#include "utils/debug.hpp"
+#include "utils/job_system.hpp"
+#include "utils/profiler.hpp"
+
+namespace Ez3DGL{
+namespace ecs{
+
+struct Entity{
+    uint32_t index = UINT32_MAX;
+    // 实体销毁后序号会被复用, 代数不同的句柄失效
+    uint32_t generation = 0;
+
+    bool operator==(const Entity& other) const{
+        return index == other.index && generation == other.generation;
+    }
+    bool operator!=(const Entity& other) const{
+        return !(*this == other);
+    }
+};
+
+// 组件类型最多64种, 原型与查询用位掩码表示
+using ComponentMask = uint64_t;
+constexpr size_t max_component_num = 64;
+// 每个块的字节数
+constexpr size_t chunk_bytes = 16 * 1024;
+
+struct ComponentInfo{
+    size_t size;
+    size_t align;
+    void (*move_construct)(void* dst, void* src);
+    void (*destroy)(void* ptr);
+};
+
+inline std::vector<ComponentInfo>& component_infos(){
+    static std::vector<ComponentInfo> infos;
+    return infos;
+}
+
+/**
+ * @brief 组件类型编号, 第一次使用时分配
+ */
+template<class T>
+inline uint32_t component_id(){
+    static const uint32_t id = [](){
+        auto& infos = component_infos();
+        assert_with_info(infos.size() < max_component_num, "too many component types (max %zu)", max_component_num);
+        infos.push_back(ComponentInfo{sizeof(T), alignof(T),
+            [](void* dst, void* src){new(dst) T(std::move(*static_cast<T*>(src)));},
+            [](void* ptr){static_cast<T*>(ptr)->~T();}});
+        return uint32_t(infos.size() - 1);
+    }();
+    return id;
+}
+
+template<class... Ts>
+inline ComponentMask component_mask(){
+    return (ComponentMask(0) | ... | (ComponentMask(1) << component_id<Ts>()));
+}
+
+/**
+ * @brief 固定大小的内存块, 存放同一原型的若干实体
+ */
+struct Chunk{
+    std::byte* data = nullptr;
+    uint32_t count = 0;
+
+    Chunk(){
+        data = static_cast<std::byte*>(::operator new(chunk_bytes, std::align_val_t(64)));
+    }
+    Chunk(const Chunk&) = delete;
+    Chunk& operator=(const Chunk&) = delete;
+    ~Chunk(){
+        ::operator delete(data, std::align_val_t(64));
+    }
+    Entity* entities(){
+        return reinterpret_cast<Entity*>(data);
+    }
+};
+
+class Archetype{
+public:
+    ComponentMask mask;
+    // 每块可容纳的实体数
+    uint32_t capacity;
+    std::vector<std::unique_ptr<Chunk>> chunks;
+
+    explicit Archetype(ComponentMask mask): mask(mask){
+        const auto& infos = component_infos();
+        size_t row_bytes = sizeof(Entity);
+        size_t pad_bytes = 0;
+        for(uint32_t id=0; id<max_component_num; id++){
+            if(!(mask >> id & 1)) continue;
+            row_bytes += infos[id].size;
+            pad_bytes += infos[id].align;
+        }
+        assert_with_info(row_bytes + pad_bytes <= chunk_bytes, "entity is too large for a chunk (%zu bytes)", row_bytes);
+        capacity = uint32_t((chunk_bytes - pad_bytes) / row_bytes);
+        // 按编号顺序排列各列, 每列按组件对齐
+        size_t offset = sizeof(Entity) * capacity;
+        column_offset.fill(SIZE_MAX);
+        for(uint32_t id=0; id<max_component_num; id++){
+            if(!(mask >> id & 1)) continue;
+            offset = (offset + infos[id].align - 1) / infos[id].align * infos[id].align;
+            column_offset[id] = offset;
+            offset += infos[id].size * capacity;
+        }
+    }
+    ~Archetype(){
+        for(auto& chunk: chunks)
+            for(uint32_t row=0; row<chunk->count; row++)
+                destroy_row(chunk.get(), row);
+    }
+
+    bool has(uint32_t id) const{
+        return mask >> id & 1;
+    }
+    void* component(Chunk* chunk, uint32_t id, uint32_t row) const{
+        return chunk->data + column_offset[id] + component_infos()[id].size * row;
+    }
+    template<class T>
+    T* column(Chunk* chunk) const{
+        return reinterpret_cast<T*>(chunk->data + column_offset[component_id<T>()]);
+    }
+
+    /**
+     * @brief 分配一行, 组件内存未构造, 由调用者构造
+     */
+    std::pair<uint32_t, uint32_t> alloc_row(Entity entity){
+        if(chunks.empty() || chunks.back()->count == capacity)
+            chunks.emplace_back(new Chunk);
+        auto chunk = chunks.back().get();
+        const uint32_t row = chunk->count++;
+        chunk->entities()[row] = entity;
+        return {uint32_t(chunks.size() - 1), row};
+    }
+    void destroy_row(Chunk* chunk, uint32_t row){
+        const auto& infos = component_infos();
+        for(uint32_t id=0; id<max_component_num; id++)
+            if(has(id))
+                infos[id].destroy(component(chunk, id, row));
+    }
+    /**
+     * @brief 用最后一行填补被删除的行(组件已析构或已移走), 保持块内紧凑
+     * @return 被移动的实体, 没有移动时 index 为 UINT32_MAX
+     */
+    Entity remove_row(uint32_t chunk_idx, uint32_t row){
+        const auto& infos = component_infos();
+        auto chunk = chunks[chunk_idx].get();
+        auto last_chunk = chunks.back().get();
+        const uint32_t last_row = last_chunk->count - 1;
+        Entity moved;
+        if(chunk != last_chunk || row != last_row){
+            moved = last_chunk->entities()[last_row];
+            chunk->entities()[row] = moved;
+            for(uint32_t id=0; id<max_component_num; id++){
+                if(!has(id)) continue;
+                void* src = component(last_chunk, id, last_row);
+                infos[id].move_construct(component(chunk, id, row), src);
+                infos[id].destroy(src);
+            }
+        }
+        last_chunk->count -= 1;
+        if(last_chunk->count == 0)
+            chunks.pop_back();
+        return moved;
+    }
+    size_t size() const{
+        return chunks.empty() ? 0 : (chunks.size() - 1) * size_t(capacity) + chunks.back()->count;
+    }
+private:
+    std::array<size_t, max_component_num> column_offset;
+};
+
+class World;
+
+/**
+ * @brief 查询包含 Ts 所有组件的实体, 匹配的原型列表缓存在 World 中, 只在新原型出现时增量更新
+ */
+template<class... Ts>
+class Query{
+public:
+    /**
+     * @brief 在调用线程上遍历, fn(Entity, Ts&...)
+     */
+    template<class Fn>
+    void each(Fn&& fn){
+        begin_iterate();
+        for(auto arch: *archetypes)
+            for(auto& chunk: arch->chunks)
+                each_in_chunk(arch, chunk.get(), fn);
+        end_iterate();
+    }
+    /**
+     * @brief 按块并行遍历, fn 可能在多个线程上同时调用, 只能修改本实体的组件
+     */
+    template<class Fn>
+    void par_each(Fn&& fn){
+        begin_iterate();
+        std::vector<std::pair<Archetype*, Chunk*>> chunks;
+        for(auto arch: *archetypes)
+            for(auto& chunk: arch->chunks)
+                chunks.emplace_back(arch, chunk.get());
+        job_system::parallel_for(0, chunks.size(), [&](size_t beg, size_t end){
+            for(size_t i=beg; i<end; i++)
+                each_in_chunk(chunks[i].first, chunks[i].second, fn);
+        });
+        end_iterate();
+    }
+    size_t count() const{
+        size_t n = 0;
+        for(auto arch: *archetypes)
+            n += arch->size();
+        return n;
+    }
+private:
+    World* world;
+    const std::vector<Archetype*>* archetypes;
+
+    Query(World* world, const std::vector<Archetype*>* archetypes): world(world), archetypes(archetypes){}
+    void begin_iterate();
+    void end_iterate();
+
+    template<class Fn>
+    static void each_in_chunk(Archetype* arch, Chunk* chunk, Fn& fn){
+        const Entity* entities = chunk->entities();
+        auto columns = std::make_tuple(arch->template column<Ts>(chunk)...);
+        for(uint32_t row=0; row<chunk->count; row++)
+            std::apply([&](auto*... cols){fn(entities[row], cols[row]...);}, columns);
+    }
+
+    friend class World;
+};
+
+class World{
+public:
+    World() = default;
+    World(const World&) = delete;
+    World& operator=(const World&) = delete;
+
+    template<class... Ts>
+    Entity create(Ts... components){
+        assert_with_info(iterating == 0, "structural change while iterating, use CommandBuffer");
+        Entity entity = alloc_entity();
+        auto arch = get_archetype(component_mask<Ts...>());
+        auto [chunk_idx, row] = arch->alloc_row(entity);
+        auto chunk = arch->chunks[chunk_idx].get();
+        (new(arch->component(chunk, component_id<Ts>(), row)) Ts(std::move(components)), ...);
+        records[entity.index] = Record{arch, chunk_idx, row, entity.generation};
+        return entity;
+    }
+
+    void destroy(Entity entity){
+        assert_with_info(iterating == 0, "structural change while iterating, use CommandBuffer");
+        assert_with_info(alive(entity), "destroy a dead entity %u", entity.index);
+        auto& rec = records[entity.index];
+        rec.arch->destroy_row(rec.arch->chunks[rec.chunk].get(), rec.row);
+        fix_moved(rec.arch->remove_row(rec.chunk, rec.row), rec.chunk, rec.row);
+        rec.arch = nullptr;
+        rec.generation += 1;
+        free_list.push_back(entity.index);
+    }
+
+    bool alive(Entity entity) const{
+        return entity.index < records.size() && records[entity.index].arch != nullptr
+            && records[entity.index].generation == entity.generation;
+    }
+
+    template<class T>
+    bool has(Entity entity) const{
+        return alive(entity) && records[entity.index].arch->has(component_id<T>());
+    }
+
+    /**
+     * @brief 返回组件指针, 没有该组件时为空; 结构变化后指针失效
+     */
+    template<class T>
+    T* get(Entity entity){
+        if(!has<T>(entity)) return nullptr;
+        const auto& rec = records[entity.index];
+        return static_cast<T*>(rec.arch->component(rec.arch->chunks[rec.chunk].get(), component_id<T>(), rec.row));
+    }
+
+    /**
+     * @brief 添加组件, 已存在时覆盖
+     */
+    template<class T>
+    void add(Entity entity, T component){
+        if(auto exist = get<T>(entity)){
+            *exist = std::move(component);
+            return;
+        }
+        assert_with_info(alive(entity), "add component to a dead entity %u", entity.index);
+        const uint32_t id = component_id<T>();
+        auto [arch, chunk, row] = move_entity(entity, records[entity.index].arch->mask | (ComponentMask(1) << id));
+        new(arch->component(chunk, id, row)) T(std::move(component));
+    }
+
+    template<class T>
+    void remove(Entity entity){
+        if(!has<T>(entity)) return;
+        const uint32_t id = component_id<T>();
+        auto& rec = records[entity.index];
+        component_infos()[id].destroy(rec.arch->component(rec.arch->chunks[rec.chunk].get(), id, rec.row));
+        move_entity(entity, rec.arch->mask & ~(ComponentMask(1) << id), id);
+    }
+
+    template<class... Ts>
+    Query<Ts...> query(){
+        const ComponentMask mask = component_mask<Ts...>();
+        auto& cache = query_cache[mask];
+        // 只检查上次查询之后新建的原型
+        for(; cache.seen < archetypes.size(); cache.seen++)
+            if((archetypes[cache.seen]->mask & mask) == mask)
+                cache.matched.push_back(archetypes[cache.seen].get());
+        return Query<Ts...>(this, &cache.matched);
+    }
+
+    size_t size() const{
+        return records.size() - free_list.size();
+    }
+    size_t archetype_num() const{
+        return archetypes.size();
+    }
+private:
+    struct Record{
+        Archetype* arch = nullptr;
+        uint32_t chunk = 0;
+        uint32_t row = 0;
+        uint32_t generation = 0;
+    };
+    struct QueryCache{
+        size_t seen = 0;
+        std::vector<Archetype*> matched;
+    };
+
+    std::vector<Record> records;
+    std::vector<uint32_t> free_list;
+    std::vector<std::unique_ptr<Archetype>> archetypes;
+    std::unordered_map<ComponentMask, Archetype*> archetype_map;
+    std::unordered_map<ComponentMask, QueryCache> query_cache;
+    std::atomic<int> iterating{0};
+
+    Entity alloc_entity(){
+        if(!free_list.empty()){
+            const uint32_t index = free_list.back();
+            free_list.pop_back();
+            return Entity{index, records[index].generation};
+        }
+        records.emplace_back();
+        return Entity{uint32_t(records.size() - 1), 0};
+    }
+
+    Archetype* get_archetype(ComponentMask mask){
+        auto it = archetype_map.find(mask);
+        if(it != archetype_map.end())
+            return it->second;
+        archetypes.emplace_back(new Archetype(mask));
+        archetype_map[mask] = archetypes.back().get();
+        return archetypes.back().get();
+    }
+
+    void fix_moved(Entity moved, uint32_t chunk, uint32_t row){
+        if(moved.index == UINT32_MAX) return;
+        records[moved.index].chunk = chunk;
+        records[moved.index].row = row;
+    }
+
+    /**
+     * @brief 把实体移到另一个原型, 两者共有的组件被移动过去
+     * @param skip 已析构的组件, 不再移动
+     */
+    std::tuple<Archetype*, Chunk*, uint32_t> move_entity(Entity entity, ComponentMask mask, uint32_t skip=UINT32_MAX){
+        assert_with_info(iterating == 0, "structural change while iterating, use CommandBuffer");
+        const auto& infos = component_infos();
+        auto& rec = records[entity.index];
+        auto src = rec.arch;
+        auto src_chunk = src->chunks[rec.chunk].get();
+        auto dst = get_archetype(mask);
+        auto [chunk_idx, row] = dst->alloc_row(entity);
+        auto dst_chunk = dst->chunks[chunk_idx].get();
+        for(uint32_t id=0; id<max_component_num; id++){
+            if(!src->has(id) || id == skip) continue;
+            void* ptr = src->component(src_chunk, id, rec.row);
+            if(dst->has(id))
+                infos[id].move_construct(dst->component(dst_chunk, id, row), ptr);
+            infos[id].destroy(ptr);
+        }
+        fix_moved(src->remove_row(rec.chunk, rec.row), rec.chunk, rec.row);
+        rec.arch = dst;
+        rec.chunk = chunk_idx;
+        rec.row = row;
+        return {dst, dst_chunk, row};
+    }
+
+    template<class... Ts>
+    friend class Query;
+};
+
+template<class... Ts>
+void Query<Ts...>::begin_iterate(){
+    world->iterating += 1;
+}
+
+template<class... Ts>
+void Query<Ts...>::end_iterate(){
+    world->iterating -= 1;
+}
+
+/**
+ * @brief 结构变化命令缓冲, 遍历(包括并行遍历)期间记录, 遍历结束后由 flush 按记录顺序执行
+ * @note 可在多个线程同时记录
+ */
+class CommandBuffer{
+public:
+    template<class... Ts>
+    void create(Ts... components){
+        record([comps = std::make_tuple(std::move(components)...)](World& world) mutable{
+            std::apply([&](auto&... c){world.create(std::move(c)...);}, comps);
+        });
+    }
+    void destroy(Entity entity){
+        record([entity](World& world){world.destroy(entity);});
+    }
+    template<class T>
+    void add(Entity entity, T component){
+        record([entity, c = std::move(component)](World& world) mutable{world.add(entity, std::move(c));});
+    }
+    template<class T>
+    void remove(Entity entity){
+        record([entity](World& world){world.remove<T>(entity);});
+    }
+    void flush(World& world){
+        std::vector<std::function<void(World&)>> cmds;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            cmds.swap(commands);
+        }
+        for(auto& cmd: cmds)
+            cmd(world);
+    }
+    bool empty(){
+        std::lock_guard<std::mutex> lock(mutex);
+        return commands.empty();
+    }
+private:
+    std::mutex mutex;
+    std::vector<std::function<void(World&)>> commands;
+
+    void record(std::function<void(World&)> cmd){
+        std::lock_guard<std::mutex> lock(mutex);
+        commands.push_back(std::move(cmd));
+    }
+};
+
+/**
+ * 与现有各层对接的组件
+ * Transform 直接使用 model_t, 可以原样传给 Mesh::draw 与 shader_t::update_model;
+ * 块内的组件在结构变化时会移动, model_t 的父节点只能指向世界之外地址固定的对象
+ */
+using Transform = model_t;
+using PhysicsBody = DynamicObj;
+
+/**
+ * @brief 碰撞体, 按 Transform 的位置与缩放做立方体检测, 与 collision_box_t 一致
+ */
+struct Collider{
+    glm::vec3 vel_dir = glm::vec3(0, -1, 0);
+};
+
+/**
+ * @brief 可渲染组件, mesh 与 model 二选一
+ */
+struct Renderable{
+    Mesh* mesh = nullptr;
+    Model* model = nullptr;
+    Shader* shader = nullptr;
+};
+
+/**
+ * @brief 对所有物理实体施加相同的力并步进, 结果写回 Transform, 并行执行
+ */
+inline void update_physics(World& world, glm::vec3 force, float delta_time_seconds){
+    profile_scope("ecs::update_physics");
+    world.query<Transform, PhysicsBody>().par_each([&](Entity, Transform& transform, PhysicsBody& body){
+        body.update_dynamic(force, delta_time_seconds);
+        transform.save_prev_state();
+        transform.pos = body.pos();
+    });
+}
+
+/**
+ * @brief 检测所有碰撞体两两之间的碰撞
+ */
+inline void collect_collisions(World& world, std::vector<std::pair<Entity, Entity>>& pairs){
+    profile_scope("ecs::collect_collisions");
+    struct Box{
+        Entity entity;
+        Transform* transform;
+    };
+    std::vector<Box> boxes;
+    world.query<Transform, Collider>().each([&](Entity entity, Transform& transform, Collider&){
+        boxes.push_back(Box{entity, &transform});
+    });
+    pairs.clear();
+    for(size_t i=0; i<boxes.size(); i++){
+        collision_box_t box(boxes[i].transform);
+        for(size_t j=i+1; j<boxes.size(); j++){
+            collision_box_t other(boxes[j].transform);
+            if(box.check_collision(&other))
+                pairs.emplace_back(boxes[i].entity, boxes[j].entity);
+        }
+    }
+}
+
+/**
+ * @brief 绘制所有可渲染实体, 只能在主线程调用
+ */
+inline void draw_renderables(World& world, const camera_t* camera){
+    profile_gpu_scope("ecs::draw_renderables");
+    world.query<Transform, Renderable>().each([&](Entity, Transform& transform, Renderable& renderable){
+        if(renderable.mesh != nullptr)
+            renderable.mesh->draw(renderable.shader, camera, &transform);
+        else if(renderable.model != nullptr)
+            renderable.model->draw(renderable.shader, camera, &transform);
+    });
+}
+
+}
+}
@@ -1,3 +1,5 @@
+#pragma once
+
 #include "core/mesh_layer.hpp"
 #include "core/vertices_layer.hpp"
 #include "utils/debug.hpp"
@@ -8,6 +10,11 @@ class DynamicObj{
 public:
     DynamicObj(glm::vec3 pos, float mass=1): position(pos), velocity(0), acceleration(0), mass(mass){}
     glm::vec3 update_dynamic(const glm::vec3 force, float delta_time_seconds){
+        // 每个模拟步只保存一次, 渲染时在最近两步之间插值
+        if(prev_tick != model_t::current_tick()){
+            prev_position = position;
+            prev_tick = model_t::current_tick();
+        }
         acceleration = force / mass;
         position += velocity * delta_time_seconds + acceleration * delta_time_seconds * delta_time_seconds * 0.5f;
         velocity += acceleration * delta_time_seconds;
@@ -16,6 +23,14 @@ public:
     glm::vec3 pos() const{
         return position;
     }
+    /**
+     * @brief 上一步与当前步之间插值的位置, alpha 由 user_render 传入
+     */
+    glm::vec3 interpolated_pos(float alpha) const{
+        if(prev_tick != model_t::current_tick())
+            return position;
+        return glm::mix(prev_position, position, alpha);
+    }
     glm::vec3 vel() const{
         return velocity;
     }
@@ -27,6 +42,8 @@ private:
     glm::vec3 position;
     glm::vec3 velocity;
     glm::vec3 acceleration;
+    glm::vec3 prev_position;
+    uint64_t prev_tick = UINT64_MAX;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,357 @@
+#include "core/gpu_culler.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "utils/debug.hpp"
+#include "utils/preset.hpp"
+#include "utils/profiler.hpp"
+#include "utils/render_stats.hpp"
+
+using namespace Ez3DGL;
+
+namespace {
+
+// 顶点: 位置3, 法线3, 纹理坐标2
+constexpr size_t vertex_floats = 8;
+// 可见实例号所在的顶点属性, 0~2 为位置, 法线与纹理坐标
+constexpr unsigned int instance_attrib = 3;
+constexpr unsigned int group_size = 64;
+
+float uint_bits(uint32_t v){
+    float f;
+    memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+/**
+ * 由 view*projection 提取视锥的6个平面, 法线指向视锥内并归一化
+ */
+void frustum_planes(const glm::mat4& m, glm::vec4 planes[6]){
+    const glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    const glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    const glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    const glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+    planes[0] = row3 + row0;
+    planes[1] = row3 - row0;
+    planes[2] = row3 + row1;
+    planes[3] = row3 - row1;
+    planes[4] = row3 + row2;
+    planes[5] = row3 - row2;
+    for(int i=0; i<6; i++)
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+void upload_buffer(unsigned int buffer, size_t size, const void* data){
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_DYNAMIC_DRAW);
+    if(data != nullptr)
+        render_stats::add(render_stats::counter_t::buffer_upload_bytes, size);
+}
+
+}
+
+GpuCuller::GpuCuller(){
+    assert_with_info(supported(), "GPU culling requires GL 4.3");
+    cull_shader = new compute_shader_t(preset::shader::cs_gpu_cull());
+    compact_shader = new compute_shader_t(preset::shader::cs_draw_compact());
+    hiz_shader = new compute_shader_t(preset::shader::cs_hiz_downsample());
+    instance_num_loc = cull_shader->uniform_location("instance_num");
+    frustum_loc = cull_shader->uniform_location("frustum");
+    camera_pos_loc = cull_shader->uniform_location("camera_pos");
+    hiz_levels_loc = cull_shader->uniform_location("hiz_levels");
+    hiz_size_loc = cull_shader->uniform_location("hiz_size");
+    hiz_view_projection_loc = cull_shader->uniform_location("hiz_view_projection");
+    command_num_loc = compact_shader->uniform_location("command_num");
+    src_level_loc = hiz_shader->uniform_location("src_level");
+    // 层次深度与其来源都绑定在第0个纹理单元
+    cull_shader->set_uniform_at(cull_shader->uniform_location("hiz"), 0);
+    hiz_shader->set_uniform_at(hiz_shader->uniform_location("src"), 0);
+
+    instance_buffer = new texture_buffer_t(GL_RGBA32F, GL_DYNAMIC_DRAW);
+    glGenBuffers(1, &mesh_buffer);
+    glGenBuffers(1, &command_buffer);
+    glGenBuffers(1, &compact_buffer);
+    glGenBuffers(1, &visible_buffer);
+    glGenBuffers(1, &param_buffer);
+    upload_buffer(param_buffer, sizeof(uint32_t) * 4, nullptr);
+}
+
+GpuCuller::~GpuCuller(){
+    delete cull_shader;
+    delete compact_shader;
+    delete hiz_shader;
+    delete instance_buffer;
+    const unsigned int buffers[] = {mesh_buffer, command_buffer, compact_buffer, visible_buffer, param_buffer};
+    glDeleteBuffers(5, buffers);
+    if(vertices != nullptr){
+        vertices->destroy();
+        delete vertices;
+    }
+    if(hiz_texture != 0){
+        glDeleteTextures(1, &hiz_texture);
+        shader_t::invalidate_bind_cache();
+    }
+}
+
+bool GpuCuller::supported(){
+    return compute_shader_t::supported() && glMultiDrawElementsIndirect != nullptr;
+}
+
+bool GpuCuller::draw_count_supported(){
+    return glMultiDrawElementsIndirectCount != nullptr;
+}
+
+GpuCuller::mesh_handle_t GpuCuller::add_mesh(const std::vector<float>& vertices, const std::vector<unsigned int>& indices){
+    assert_with_info(vertices.size() >= vertex_floats && vertices.size() % vertex_floats == 0,
+        "invalid vertex data size %zu", vertices.size());
+    mesh_t mesh;
+    glm::vec3 bounds_min(INFINITY), bounds_max(-INFINITY);
+    for(size_t i=0; i<vertices.size(); i+=vertex_floats){
+        const glm::vec3 p(vertices[i], vertices[i + 1], vertices[i + 2]);
+        bounds_min = glm::min(bounds_min, p);
+        bounds_max = glm::max(bounds_max, p);
+    }
+    const glm::vec3 center = (bounds_min + bounds_max) * 0.5f;
+    float radius = 0.f;
+    for(size_t i=0; i<vertices.size(); i+=vertex_floats)
+        radius = std::max(radius, glm::length(glm::vec3(vertices[i], vertices[i + 1], vertices[i + 2]) - center));
+    mesh.sphere = glm::vec4(center, radius);
+    append_lod(mesh, vertices, indices, 0.f);
+    meshes.push_back(std::move(mesh));
+    return mesh_handle_t(meshes.size() - 1);
+}
+
+void GpuCuller::add_lod(mesh_handle_t mesh, const std::vector<float>& vertices, const std::vector<unsigned int>& indices, float distance){
+    assert_with_info(mesh < meshes.size(), "invalid mesh %u", mesh);
+    auto& m = meshes[mesh];
+    assert_with_info(m.lods.size() < max_lods, "mesh %u already has %u LODs", mesh, max_lods);
+    assert_with_info(distance >= m.lods.back().distance, "LODs of mesh %u must be added by distance", mesh);
+    append_lod(m, vertices, indices, distance);
+}
+
+void GpuCuller::append_lod(mesh_t& mesh, const std::vector<float>& vertices, const std::vector<unsigned int>& indices, float distance){
+    lod_t lod;
+    lod.first_index = uint32_t(index_data.size());
+    lod.base_vertex = int32_t(vertex_data.size() / vertex_floats);
+    lod.distance = distance;
+    vertex_data.insert(vertex_data.end(), vertices.begin(), vertices.end());
+    if(indices.empty()){
+        const size_t vertex_num = vertices.size() / vertex_floats;
+        for(size_t i=0; i<vertex_num; i++)
+            index_data.push_back((unsigned int)i);
+    }else{
+        index_data.insert(index_data.end(), indices.begin(), indices.end());
+    }
+    lod.index_num = uint32_t(index_data.size()) - lod.first_index;
+    mesh.lods.push_back(lod);
+    geometry_dirty = layout_dirty = true;
+}
+
+GpuCuller::instance_handle_t GpuCuller::add_instance(mesh_handle_t mesh, const glm::mat4& model, bool uniform_scale){
+    assert_with_info(mesh < meshes.size(), "invalid mesh %u", mesh);
+    const instance_handle_t instance = instance_handle_t(instance_meshes.size());
+    instance_meshes.push_back(mesh);
+    instance_data.resize(instance_data.size() + instance_vec4s);
+    instance_data[instance * instance_vec4s + 7] = glm::vec4(uint_bits(mesh), uint_bits(1), 0.f, 0.f);
+    write_instance(instance, model, model_t::normal_matrix(model, uniform_scale));
+    meshes[mesh].instance_num += 1;
+    layout_dirty = true;
+    return instance;
+}
+
+void GpuCuller::set_transform(instance_handle_t instance, const glm::mat4& model, bool uniform_scale){
+    assert_with_info(instance < instance_meshes.size(), "invalid instance %u", instance);
+    write_instance(instance, model, model_t::normal_matrix(model, uniform_scale));
+}
+
+void GpuCuller::set_transform(instance_handle_t instance, const model_t& model){
+    set_transform(instance, model.get_model(model_t::render_alpha()), model.uniform_scale());
+}
+
+void GpuCuller::set_enabled(instance_handle_t instance, bool enabled){
+    assert_with_info(instance < instance_meshes.size(), "invalid instance %u", instance);
+    instance_data[instance * instance_vec4s + 7].y = uint_bits(enabled ? 1 : 0);
+    instances_dirty = true;
+}
+
+void GpuCuller::write_instance(instance_handle_t instance, const glm::mat4& model, const glm::mat3& normal){
+    glm::vec4* data = &instance_data[instance * instance_vec4s];
+    for(int i=0; i<4; i++)
+        data[i] = model[i];
+    for(int i=0; i<3; i++)
+        data[4 + i] = glm::vec4(normal[i], 0.f);
+    instances_dirty = true;
+}
+
+void GpuCuller::upload_geometry(){
+    if(vertices != nullptr){
+        vertices->destroy();
+        delete vertices;
+    }
+    vertices = new vertices_t((unsigned int)vertex_data.size(), {3, 3, 2}, vertex_data.data(),
+                              (unsigned int)index_data.size(), index_data.data());
+    // 可见列表同时作为每实例的顶点属性, 绘制命令的 base_instance 指向各自的区间
+    glBindVertexArray(vertices->VAO_id);
+    glBindBuffer(GL_ARRAY_BUFFER, visible_buffer);
+    glVertexAttribIPointer(instance_attrib, 1, GL_UNSIGNED_INT, 0, nullptr);
+    glEnableVertexAttribArray(instance_attrib);
+    glVertexAttribDivisor(instance_attrib, 1);
+    glBindVertexArray(0);
+    geometry_dirty = false;
+}
+
+void GpuCuller::upload_layout(){
+    commands.clear();
+    std::vector<gpu_mesh_t> gpu_meshes(meshes.size());
+    // 每级LOD都为网格的所有实例预留区间, 实例全部选中同一级时也放得下
+    uint32_t visible_num = 0;
+    for(size_t i=0; i<meshes.size(); i++){
+        const auto& mesh = meshes[i];
+        auto& gpu_mesh = gpu_meshes[i];
+        gpu_mesh = gpu_mesh_t{};
+        gpu_mesh.sphere = mesh.sphere;
+        gpu_mesh.first_command = uint32_t(commands.size());
+        gpu_mesh.lod_num = uint32_t(mesh.lods.size());
+        for(size_t l=0; l<mesh.lods.size(); l++){
+            const auto& lod = mesh.lods[l];
+            gpu_mesh.lod_distance[l] = lod.distance;
+            commands.push_back(draw_command_t{lod.index_num, 0, lod.first_index, lod.base_vertex, visible_num});
+            visible_num += mesh.instance_num;
+        }
+    }
+    upload_buffer(mesh_buffer, sizeof(gpu_mesh_t) * gpu_meshes.size(), gpu_meshes.data());
+    upload_buffer(command_buffer, sizeof(draw_command_t) * commands.size(), nullptr);
+    upload_buffer(compact_buffer, sizeof(draw_command_t) * commands.size(), nullptr);
+    upload_buffer(visible_buffer, sizeof(uint32_t) * std::max(visible_num, 1u), nullptr);
+    layout_dirty = false;
+}
+
+void GpuCuller::build_hiz(unsigned int depth_texture, int width, int height, const glm::mat4& view_projection){
+    profile_gpu_scope("GpuCuller::build_hiz");
+    // 第0级为深度缓冲的一半
+    const int w = std::max(width / 2, 1);
+    const int h = std::max(height / 2, 1);
+    if(w != hiz_width || h != hiz_height){
+        if(hiz_texture != 0)
+            glDeleteTextures(1, &hiz_texture);
+        glGenTextures(1, &hiz_texture);
+        shader_t::invalidate_bind_cache();
+        hiz_width = w;
+        hiz_height = h;
+        hiz_levels = 1 + int(std::floor(std::log2(float(std::max(w, h)))));
+        shader_t::bind_texture_unit(0, GL_TEXTURE_2D, hiz_texture);
+        for(int l=0; l<hiz_levels; l++)
+            glTexImage2D(GL_TEXTURE_2D, l, GL_R32F, std::max(w >> l, 1), std::max(h >> l, 1), 0, GL_RED, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, hiz_levels - 1);
+    }
+    for(int l=0; l<hiz_levels; l++){
+        // 读上一级, 写本级, 同一纹理的不同级
+        shader_t::bind_texture_unit(0, GL_TEXTURE_2D, l == 0 ? depth_texture : hiz_texture);
+        glBindImageTexture(0, hiz_texture, l, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        hiz_shader->set_uniform_at(src_level_loc, l == 0 ? 0 : l - 1);
+        hiz_shader->dispatch((std::max(w >> l, 1) + 7) / 8, (std::max(h >> l, 1) + 7) / 8);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+    hiz_view_projection = view_projection;
+    hiz_valid = true;
+}
+
+void GpuCuller::clear_hiz(){
+    hiz_valid = false;
+}
+
+void GpuCuller::cull(const camera_t* camera){
+    profile_gpu_scope("GpuCuller::cull");
+    culled = false;
+    if(instance_meshes.empty()) return;
+    if(geometry_dirty) upload_geometry();
+    if(layout_dirty) upload_layout();
+    if(instances_dirty){
+        instance_buffer->update((unsigned int)(instance_data.size() * sizeof(glm::vec4)), instance_data.data());
+        instances_dirty = false;
+    }
+
+    // 每帧从实例数为0的命令开始
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, command_buffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(draw_command_t) * commands.size(), commands.data());
+    const uint32_t zeros[4] = {0, 0, 0, 0};
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, param_buffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zeros), zeros);
+    render_stats::add(render_stats::counter_t::buffer_upload_bytes, sizeof(draw_command_t) * commands.size() + sizeof(zeros));
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instance_buffer->buffer_id);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mesh_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, command_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, visible_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, compact_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, param_buffer);
+
+    glm::vec4 planes[6];
+    frustum_planes(camera->projection * camera->view, planes);
+    const uint32_t instance_num = uint32_t(instance_meshes.size());
+    cull_shader->set_uniform_at(instance_num_loc, int(instance_num));
+    cull_shader->set_uniform_at(frustum_loc, planes, 6);
+    cull_shader->set_uniform_at(camera_pos_loc, camera->position);
+    cull_shader->set_uniform_at(hiz_levels_loc, hiz_valid ? hiz_levels : 0);
+    if(hiz_valid){
+        cull_shader->set_uniform_at(hiz_size_loc, glm::vec2(hiz_width, hiz_height));
+        cull_shader->set_uniform_at(hiz_view_projection_loc, hiz_view_projection);
+        shader_t::bind_texture_unit(0, GL_TEXTURE_2D, hiz_texture);
+    }
+    cull_shader->dispatch((instance_num + group_size - 1) / group_size);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    if(draw_count_supported()){
+        compact_shader->set_uniform_at(command_num_loc, int(commands.size()));
+        compact_shader->dispatch((uint32_t(commands.size()) + group_size - 1) / group_size);
+    }
+    // 之后作为间接绘制命令, 绘制参数与顶点属性读取
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    culled = true;
+}
+
+void GpuCuller::draw(shader_t* shader, const camera_t* camera){
+    if(!culled) return;
+    profile_gpu_scope("GpuCuller::draw");
+    shader->use();
+    shader->update_camera(camera);
+    shader->bind_texture("instance_data", instance_buffer);
+    glBindVertexArray(vertices->VAO_id);
+    render_stats::add(render_stats::counter_t::vao_binds);
+    const GLsizei max_draws = GLsizei(commands.size());
+    if(draw_count_supported()){
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, compact_buffer);
+        glBindBuffer(GL_PARAMETER_BUFFER, param_buffer);
+        glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, 0, max_draws, sizeof(draw_command_t));
+    }else{
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, max_draws, sizeof(draw_command_t));
+    }
+    // 实例与三角形数在GPU上决定, 只计一次提交
+    render_stats::add(render_stats::counter_t::draw_calls);
+}
+
+GpuCuller::stats_t GpuCuller::read_stats(){
+    stats_t stats;
+    stats.instances = uint32_t(instance_meshes.size());
+    if(!culled) return stats;
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    uint32_t params[4];
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, param_buffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(params), params);
+    std::vector<draw_command_t> result(commands.size());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, command_buffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(draw_command_t) * result.size(), result.data());
+    stats.frustum_culled = params[1];
+    stats.occluded = params[2];
+    for(const auto& cmd: result){
+        if(cmd.instance_count == 0) continue;
+        stats.visible += cmd.instance_count;
+        stats.draws += 1;
+        stats.triangles += uint64_t(cmd.count / 3) * cmd.instance_count;
+    }
+    return stats;
+}
@@ -0,0 +1,169 @@
+/**
+ * @file gpu_culler.hpp
+ * @brief GPU驱动的剔除与绘制: 计算着色器做视锥/层次深度剔除与LOD选择, 输出压缩后的间接绘制命令
+ *
+ */
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "vertices_layer.hpp"
+
+namespace Ez3DGL{
+
+/**
+ * @brief GPU驱动绘制, 所有网格(含各级LOD)合并到一个 vertices_t, 所有实例的变换存放在一个缓冲中;
+ * 每帧由计算着色器剔除实例并按距离选择LOD, 把可见实例写入各 (网格, LOD) 绘制命令的实例区间,
+ * 再压缩掉空命令, 最后一次 glMultiDrawElementsIndirectCount 画完整个场景, CPU上没有逐物体的工作
+ * @note 需要 GL 4.3(计算着色器与 glMultiDrawElementsIndirect), 不支持 GL 4.6 的 glMultiDrawElementsIndirectCount 时
+ * 不压缩, 直接提交全部命令(空命令的实例数为0). 使用前先用 supported() 判断, 不支持时应改用逐物体绘制.
+ * 层次深度遮挡测试使用上一帧的深度, 在一帧内移动较快的物体可能晚一帧出现
+ *
+ * 用法:
+ *     auto ball = culler.add_mesh(vertices, {});
+ *     culler.add_lod(ball, low_vertices, {}, 20.f);
+ *     auto handle = culler.add_instance(ball, model_mat);
+ *     // 每帧
+ *     culler.set_transform(handle, model_mat);
+ *     culler.cull(camera);
+ *     culler.draw(&shader, camera);    // shader 的顶点着色器为 preset::shader::vs_gpu_driven
+ */
+class GpuCuller{
+public:
+    using mesh_handle_t = uint32_t;
+    using instance_handle_t = uint32_t;
+    static constexpr uint32_t max_lods = 4;
+
+    struct stats_t{
+        uint32_t instances = 0;
+        // 以下由 read_stats 从GPU读回
+        uint32_t visible = 0;
+        uint32_t frustum_culled = 0;
+        uint32_t occluded = 0;
+        // 实例数不为0的绘制命令数
+        uint32_t draws = 0;
+        uint64_t triangles = 0;
+    };
+
+    GpuCuller();
+    ~GpuCuller();
+    GpuCuller(const GpuCuller&) = delete;
+    GpuCuller& operator=(const GpuCuller&) = delete;
+
+    /**
+     * @brief 当前上下文是否支持GPU剔除
+     */
+    static bool supported();
+    // 是否使用 glMultiDrawElementsIndirectCount 提交压缩后的命令
+    static bool draw_count_supported();
+
+    /**
+     * @brief 加入网格作为第0级LOD, 包围球由其顶点计算
+     * @param vertices 顶点按 位置3, 法线3, 纹理坐标2 交错存放
+     * @param indices 三角形索引, 为空时按顶点顺序每3个组成一个三角形
+     */
+    mesh_handle_t add_mesh(const std::vector<float>& vertices, const std::vector<unsigned int>& indices);
+    /**
+     * @brief 加入较粗糙的一级LOD, 距离不小于 distance 时使用; 需按距离从小到大加入, 每个网格最多 max_lods 级
+     */
+    void add_lod(mesh_handle_t mesh, const std::vector<float>& vertices, const std::vector<unsigned int>& indices, float distance);
+
+    instance_handle_t add_instance(mesh_handle_t mesh, const glm::mat4& model, bool uniform_scale=true);
+    void set_transform(instance_handle_t instance, const glm::mat4& model, bool uniform_scale=true);
+    void set_transform(instance_handle_t instance, const model_t& model);
+    /**
+     * @brief 禁用的实例不参与剔除与绘制
+     */
+    void set_enabled(instance_handle_t instance, bool enabled);
+
+    /**
+     * @brief 由深度纹理构建层次深度, 供此后的 cull 做遮挡测试; 通常在一帧结束时传入本帧的深度与 view*projection
+     * @param depth_texture 深度纹理(如 DeferredRenderer 的深度目标), 不能有多重采样
+     */
+    void build_hiz(unsigned int depth_texture, int width, int height, const glm::mat4& view_projection);
+    /**
+     * @brief 不再做遮挡测试, 直到下次 build_hiz
+     */
+    void clear_hiz();
+
+    /**
+     * @brief 上传改变的实例与命令, 在GPU上剔除并生成本帧的绘制命令
+     */
+    void cull(const camera_t* camera);
+    /**
+     * @brief 用 cull 生成的命令绘制所有可见实例
+     * @param shader 顶点着色器需按 vs_gpu_driven 读取 instance_data 与第3个顶点属性
+     */
+    void draw(shader_t* shader, const camera_t* camera);
+
+    /**
+     * @brief 读回本帧的剔除结果, 会等待GPU完成剔除, 只用于调试与基准测试
+     */
+    stats_t read_stats();
+    size_t mesh_num() const{
+        return meshes.size();
+    }
+    size_t instance_num() const{
+        return instance_meshes.size();
+    }
+private:
+    // 与 cs_gpu_cull 中的 DrawCommand 及 DrawElementsIndirectCommand 一致
+    struct draw_command_t{
+        uint32_t count;
+        uint32_t instance_count;
+        uint32_t first_index;
+        int32_t base_vertex;
+        uint32_t base_instance;
+    };
+    struct lod_t{
+        uint32_t first_index, index_num;
+        int32_t base_vertex;
+        float distance;
+    };
+    struct mesh_t{
+        glm::vec4 sphere;
+        std::vector<lod_t> lods;
+        uint32_t instance_num = 0;
+    };
+    // 与 cs_gpu_cull 中的 Mesh 一致(std430)
+    struct gpu_mesh_t{
+        glm::vec4 sphere;
+        float lod_distance[max_lods];
+        uint32_t first_command, lod_num, padding[2];
+    };
+    // 每个实例8个 vec4: model, 法线矩阵的3列, (网格, 是否启用)
+    static constexpr size_t instance_vec4s = 8;
+
+    std::vector<mesh_t> meshes;
+    std::vector<float> vertex_data;
+    std::vector<unsigned int> index_data;
+    std::vector<glm::vec4> instance_data;
+    std::vector<mesh_handle_t> instance_meshes;
+    // 每帧开始时的命令, 实例数为0
+    std::vector<draw_command_t> commands;
+
+    vertices_t* vertices = nullptr;
+    texture_buffer_t* instance_buffer = nullptr;
+    unsigned int mesh_buffer = 0, command_buffer = 0, compact_buffer = 0, visible_buffer = 0, param_buffer = 0;
+    compute_shader_t* cull_shader = nullptr;
+    compute_shader_t* compact_shader = nullptr;
+    compute_shader_t* hiz_shader = nullptr;
+    int instance_num_loc, frustum_loc, camera_pos_loc, hiz_levels_loc, hiz_size_loc, hiz_view_projection_loc;
+    int command_num_loc, src_level_loc;
+
+    unsigned int hiz_texture = 0;
+    int hiz_width = 0, hiz_height = 0, hiz_levels = 0;
+    bool hiz_valid = false;
+    glm::mat4 hiz_view_projection = glm::mat4(1.f);
+
+    bool geometry_dirty = false, layout_dirty = false, instances_dirty = false;
+    bool culled = false;
+
+    void append_lod(mesh_t& mesh, const std::vector<float>& vertices, const std::vector<unsigned int>& indices, float distance);
+    void write_instance(instance_handle_t instance, const glm::mat4& model, const glm::mat3& normal);
+    void upload_geometry();
+    void upload_layout();
+};
+
+}
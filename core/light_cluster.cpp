@@ -0,0 +1,247 @@
+#include "core/light_cluster.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include "core/mesh_layer.hpp"
+#include "utils/debug.hpp"
+#include "utils/job_system.hpp"
+#include "utils/frame_arena.hpp"
+#include "utils/profiler.hpp"
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace Ez3DGL;
+
+// 每个灯光在纹理缓冲中占用的 vec4 数量
+static constexpr uint32_t light_texels = 5;
+
+LightCluster::LightCluster(uint32_t grid_x, uint32_t grid_y, uint32_t grid_z):
+    grid_x(grid_x), grid_y(grid_y), grid_z(grid_z){
+    assert_with_info(grid_x>0 && grid_y>0 && grid_z>0, "invalid cluster grid %ux%ux%u", grid_x, grid_y, grid_z);
+}
+
+LightCluster::~LightCluster(){
+    delete grid_buffer;
+    delete item_buffer;
+    delete light_buffer;
+}
+
+void LightCluster::setup(){
+    assert_with_info(grid_buffer==nullptr, "light cluster is already setup");
+    grid_buffer = new texture_buffer_t(GL_RG32UI);
+    item_buffer = new texture_buffer_t(GL_R16UI);
+    light_buffer = new texture_buffer_t(GL_RGBA32F);
+}
+
+float LightCluster::light_radius(const LightPoint& light, float threshold){
+    const float intensity = std::max({
+        light.ambient.x, light.ambient.y, light.ambient.z,
+        light.diffuse.x, light.diffuse.y, light.diffuse.z,
+        light.specular.x, light.specular.y, light.specular.z});
+    // 解 constant + linear*d + quadratic*d^2 = intensity/threshold
+    const float c = light.constant - intensity / threshold;
+    if(c >= 0) return 0;
+    if(light.quadratic > 1e-8f)
+        return (-light.linear + std::sqrt(light.linear*light.linear - 4*light.quadratic*c)) / (2*light.quadratic);
+    if(light.linear > 1e-8f)
+        return -c / light.linear;
+    return FLT_MAX;
+}
+
+static glm::vec3 ndc_ray(const glm::mat4& inv_proj, float x, float y){
+    auto p = inv_proj * glm::vec4(x, y, -1.f, 1.f);
+    p /= p.w;
+    // 缩放到 z=-1, 乘以深度即得到该深度上的点
+    return glm::vec3(p) / -p.z;
+}
+
+void LightCluster::build_clusters(const camera_t* camera){
+    if(!clusters.empty() && camera->projection == cached_projection)
+        return;
+    cached_projection = camera->projection;
+    const auto inv_proj = glm::inverse(camera->projection);
+    const float z_near = camera->z_near, z_far = camera->z_far;
+    const float log_ratio = std::log(z_far / z_near);
+
+    slice_depth.resize(grid_z + 1);
+    for(uint32_t z=0; z<=grid_z; z++)
+        slice_depth[z] = z_near * std::pow(z_far / z_near, float(z) / grid_z);
+    depth_scale = grid_z / log_ratio;
+    depth_bias = -grid_z * std::log(z_near) / log_ratio;
+
+    clusters.resize(cluster_num());
+    for(uint32_t y=0; y<grid_y; y++)
+        for(uint32_t x=0; x<grid_x; x++){
+            const float x0 = -1.f + 2.f*x/grid_x, x1 = -1.f + 2.f*(x+1)/grid_x;
+            const float y0 = -1.f + 2.f*y/grid_y, y1 = -1.f + 2.f*(y+1)/grid_y;
+            const glm::vec3 rays[4] = {
+                ndc_ray(inv_proj, x0, y0), ndc_ray(inv_proj, x1, y0),
+                ndc_ray(inv_proj, x0, y1), ndc_ray(inv_proj, x1, y1)};
+            for(uint32_t z=0; z<grid_z; z++){
+                aabb_t box{glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX)};
+                for(const auto& ray: rays)
+                    for(const float depth: {slice_depth[z], slice_depth[z+1]}){
+                        box.min = glm::min(box.min, ray*depth);
+                        box.max = glm::max(box.max, ray*depth);
+                    }
+                clusters[x + grid_x*(y + grid_y*z)] = box;
+            }
+        }
+}
+
+void LightCluster::update(const camera_t* camera, const std::vector<LightPoint>& point_lights, const std::vector<LightSpot>& spot_lights){
+    profile_scope("LightCluster::update");
+    assert_with_info(grid_buffer!=nullptr, "forget to setup light cluster");
+    build_clusters(camera);
+
+    GLint vp[4];
+    glGetIntegerv(GL_VIEWPORT, vp);
+    viewport = glm::vec2(std::max(vp[2], 1), std::max(vp[3], 1));
+
+    // 灯光索引以16位存储
+    light_cnt = static_cast<uint32_t>(std::min<size_t>(point_lights.size() + spot_lights.size(), UINT16_MAX));
+    spheres.resize(light_cnt);
+    light_data.resize(light_cnt * light_texels * 4);
+    auto push_light = [&](uint32_t i, const LightPoint& light, glm::vec3 direction, float cutoff, float cutoff_outer){
+        const auto center = glm::vec3(camera->view * glm::vec4(light.position, 1.f));
+        spheres.x[i] = center.x;
+        spheres.y[i] = center.y;
+        spheres.z[i] = center.z;
+        spheres.r[i] = light_radius(light, attenuation_threshold);
+        float* d = &light_data[i * light_texels * 4];
+        const float texels[light_texels*4] = {
+            light.position.x, light.position.y, light.position.z, cutoff_outer,
+            light.ambient.x,  light.ambient.y,  light.ambient.z,  light.constant,
+            light.diffuse.x,  light.diffuse.y,  light.diffuse.z,  light.linear,
+            light.specular.x, light.specular.y, light.specular.z, light.quadratic,
+            direction.x,      direction.y,      direction.z,      cutoff};
+        std::copy(texels, texels + light_texels*4, d);
+    };
+    uint32_t idx = 0;
+    // 点光源视为张角180度的聚光, 着色器中的聚光强度恒为1
+    for(size_t i=0; i<point_lights.size() && idx<light_cnt; i++)
+        push_light(idx++, point_lights[i], glm::vec3(0, 0, -1), -1.f, -2.f);
+    for(size_t i=0; i<spot_lights.size() && idx<light_cnt; i++)
+        push_light(idx++, spot_lights[i], spot_lights[i].direction,
+            glm::cos(glm::radians(spot_lights[i].inner_degree)), glm::cos(glm::radians(spot_lights[i].outer_degree)));
+
+    // 各深度切片互不依赖, 分给多个线程处理
+    slice_items.resize(grid_z);
+    slice_grid.resize(grid_z);
+    if(light_cnt < 64){
+        assign_slices(0, grid_z);
+    }else{
+        job_system::parallel_for(0, grid_z, [this](size_t beg, size_t end){
+            assign_slices(uint32_t(beg), uint32_t(end));
+        });
+    }
+
+    grid.resize(cluster_num() * 2);
+    items.clear();
+    const uint32_t slice_size = grid_x * grid_y;
+    for(uint32_t z=0; z<grid_z; z++){
+        const uint32_t base = static_cast<uint32_t>(items.size());
+        for(uint32_t i=0; i<slice_size; i++){
+            grid[(z*slice_size + i)*2] = base + slice_grid[z][i*2];
+            grid[(z*slice_size + i)*2 + 1] = slice_grid[z][i*2 + 1];
+        }
+        items.insert(items.end(), slice_items[z].begin(), slice_items[z].end());
+    }
+
+    grid_buffer->update(grid.size() * sizeof(uint32_t), grid.data());
+    item_buffer->update(items.size() * sizeof(uint16_t), items.data());
+    light_buffer->update(light_data.size() * sizeof(float), light_data.data());
+    update_cnt += 1;
+}
+
+void LightCluster::assign_slices(uint32_t slice_beg, uint32_t slice_end){
+    profile_scope("LightCluster::assign_slices");
+    // 候选灯光只在本次调用内使用, 从帧内存分配
+    auto arena = frame_arena::resource();
+    frame_arena::vector<float> cx(arena), cy(arena), cz(arena), cr2(arena);
+    frame_arena::vector<uint16_t> cidx(arena);
+    const size_t cand_cap = (light_cnt + 3) / 4 * 4;
+    cx.reserve(cand_cap); cy.reserve(cand_cap); cz.reserve(cand_cap); cr2.reserve(cand_cap);
+    cidx.reserve(cand_cap);
+    const uint32_t slice_size = grid_x * grid_y;
+    for(uint32_t z=slice_beg; z<slice_end; z++){
+        auto& out_items = slice_items[z];
+        auto& out_grid = slice_grid[z];
+        out_items.clear();
+        out_grid.assign(slice_size * 2, 0);
+
+        // 先按深度筛出与该切片相交的灯光
+        cx.clear(); cy.clear(); cz.clear(); cr2.clear(); cidx.clear();
+        const float d0 = slice_depth[z], d1 = slice_depth[z+1];
+        for(uint32_t i=0; i<light_cnt; i++){
+            const float depth = -spheres.z[i], r = spheres.r[i];
+            if(depth + r < d0 || depth - r > d1) continue;
+            cx.push_back(spheres.x[i]);
+            cy.push_back(spheres.y[i]);
+            cz.push_back(spheres.z[i]);
+            cr2.push_back(r == FLT_MAX ? FLT_MAX : r*r);
+            cidx.push_back(static_cast<uint16_t>(i));
+        }
+        // 补齐到4的倍数, 填充的球体远在无穷处不会与任何网格相交
+        while(cx.size() % 4 != 0){
+            cx.push_back(1e18f); cy.push_back(1e18f); cz.push_back(1e18f); cr2.push_back(0);
+            cidx.push_back(0);
+        }
+        const size_t cand_num = cx.size();
+
+        for(uint32_t i=0; i<slice_size; i++){
+            const auto& box = clusters[z*slice_size + i];
+            const uint32_t beg = static_cast<uint32_t>(out_items.size());
+            uint32_t cnt = 0;
+#if defined(__SSE2__)
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 min_x = _mm_set1_ps(box.min.x), max_x = _mm_set1_ps(box.max.x);
+            const __m128 min_y = _mm_set1_ps(box.min.y), max_y = _mm_set1_ps(box.max.y);
+            const __m128 min_z = _mm_set1_ps(box.min.z), max_z = _mm_set1_ps(box.max.z);
+            for(size_t j=0; j<cand_num && cnt<max_lights_per_cluster; j+=4){
+                const __m128 x = _mm_loadu_ps(&cx[j]), y = _mm_loadu_ps(&cy[j]), zz = _mm_loadu_ps(&cz[j]);
+                const __m128 dx = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(min_x, x), _mm_sub_ps(x, max_x)));
+                const __m128 dy = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(min_y, y), _mm_sub_ps(y, max_y)));
+                const __m128 dz = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(min_z, zz), _mm_sub_ps(zz, max_z)));
+                const __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                int mask = _mm_movemask_ps(_mm_cmple_ps(d2, _mm_loadu_ps(&cr2[j])));
+                while(mask && cnt<max_lights_per_cluster){
+                    const int bit = __builtin_ctz(mask);
+                    out_items.push_back(cidx[j + bit]);
+                    cnt += 1;
+                    mask &= mask - 1;
+                }
+            }
+#else
+            for(size_t j=0; j<cand_num && cnt<max_lights_per_cluster; j++){
+                const float dx = std::max(0.f, std::max(box.min.x - cx[j], cx[j] - box.max.x));
+                const float dy = std::max(0.f, std::max(box.min.y - cy[j], cy[j] - box.max.y));
+                const float dz = std::max(0.f, std::max(box.min.z - cz[j], cz[j] - box.max.z));
+                if(dx*dx + dy*dy + dz*dz <= cr2[j]){
+                    out_items.push_back(cidx[j]);
+                    cnt += 1;
+                }
+            }
+#endif
+            out_grid[i*2] = beg;
+            out_grid[i*2 + 1] = cnt;
+        }
+    }
+}
+
+void LightCluster::apply2shader(shader_t* shader) const{
+    assert_with_info(grid_buffer!=nullptr, "forget to setup light cluster");
+    shader->bind_texture("cluster_grid", grid_buffer);
+    shader->bind_texture("cluster_items", item_buffer);
+    shader->bind_texture("cluster_lights", light_buffer);
+    shader->set_uniform("cluster_dim", dim());
+    shader->set_uniform("cluster_scale", scale_params());
+}
+
+void LightCluster::bind_units(unsigned int first_unit) const{
+    assert_with_info(grid_buffer!=nullptr, "forget to setup light cluster");
+    shader_t::bind_texture_unit(first_unit, GL_TEXTURE_BUFFER, grid_buffer->texture_id);
+    shader_t::bind_texture_unit(first_unit + 1, GL_TEXTURE_BUFFER, item_buffer->texture_id);
+    shader_t::bind_texture_unit(first_unit + 2, GL_TEXTURE_BUFFER, light_buffer->texture_id);
+}
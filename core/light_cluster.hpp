@@ -0,0 +1,123 @@
+/**
+ * @file light_cluster.hpp
+ * @brief 分簇前向渲染(Clustered Forward)的灯光剔除
+ *
+ */
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "vertices_layer.hpp"
+
+namespace Ez3DGL{
+
+class LightPoint;
+class LightSpot;
+
+/**
+ * @brief 灯光分簇, 将视锥体划分为 grid_x*grid_y*grid_z 的三维网格(深度方向指数划分),
+ * 在CPU上把点光源和聚光灯按影响半径分配到网格, 片元着色器只遍历所在网格内的灯光
+ * @note 网格与灯光数据通过纹理缓冲上传, 需要在 OpenGL 上下文中调用 setup()
+ *
+ */
+class LightCluster{
+public:
+    // 每种光源的亮度低于该阈值即认为超出影响范围
+    float attenuation_threshold = 1.f/256;
+    // 单个网格内最多的灯光数量
+    uint32_t max_lights_per_cluster = 256;
+
+    /**
+     * @param grid_x 屏幕横向划分数
+     * @param grid_y 屏幕纵向划分数
+     * @param grid_z 深度方向划分数
+     * @note 灯光较多时各深度切片通过 job_system 并行分配
+     */
+    explicit LightCluster(uint32_t grid_x=16, uint32_t grid_y=9, uint32_t grid_z=24);
+    ~LightCluster();
+
+    void setup();
+    /**
+     * @brief 重新划分网格(相机投影变化时)并分配灯光, 每帧调用一次
+     */
+    void update(const camera_t* camera, const std::vector<LightPoint>& point_lights, const std::vector<LightSpot>& spot_lights);
+    /**
+     * @brief 绑定网格数据到着色器
+     */
+    void apply2shader(shader_t* shader) const;
+    /**
+     * @brief 把网格, 灯光索引, 灯光数据依次绑定到从 first_unit 开始的三个纹理单元,
+     * 着色器中的 cluster_grid/cluster_items/cluster_lights 采样器需预先指向这些单元
+     */
+    void bind_units(unsigned int first_unit) const;
+    // 着色器中的 cluster_dim
+    glm::vec3 dim() const{
+        return glm::vec3(grid_x, grid_y, grid_z);
+    }
+    // 着色器中的 cluster_scale
+    glm::vec4 scale_params() const{
+        return glm::vec4(grid_x / viewport.x, grid_y / viewport.y, depth_scale, depth_bias);
+    }
+    // 每次 update 后递增, 用于判断 cluster_dim/cluster_scale 是否需要重新上传
+    uint64_t version() const{
+        return update_cnt;
+    }
+
+    /**
+     * @brief 由衰减系数推算点光源的影响半径
+     */
+    static float light_radius(const LightPoint& light, float threshold);
+
+    uint32_t cluster_num() const{
+        return grid_x*grid_y*grid_z;
+    }
+    uint32_t light_num() const{
+        return light_cnt;
+    }
+    // 所有网格内的灯光索引总数
+    uint32_t item_num() const{
+        return static_cast<uint32_t>(items.size());
+    }
+private:
+    struct aabb_t{
+        glm::vec3 min, max;
+    };
+    // 视图空间中的灯光包围球(SoA, 便于SIMD)
+    struct spheres_t{
+        std::vector<float> x, y, z, r;
+        void resize(size_t n){
+            x.resize(n); y.resize(n); z.resize(n); r.resize(n);
+        }
+    };
+
+    uint32_t grid_x, grid_y, grid_z;
+
+    glm::mat4 cached_projection = glm::mat4(0.f);
+    std::vector<aabb_t> clusters;
+    // 每个深度切片在视图空间中的[近, 远]距离
+    std::vector<float> slice_depth;
+    float depth_scale = 0, depth_bias = 0;
+
+    uint32_t light_cnt = 0;
+    spheres_t spheres;
+    std::vector<float> light_data;
+    // 每个网格的(起始位置, 数量)
+    std::vector<uint32_t> grid;
+    std::vector<uint16_t> items;
+    // 每个深度切片各自的分配结果, 由不同线程填写
+    std::vector<std::vector<uint16_t>> slice_items;
+    std::vector<std::vector<uint32_t>> slice_grid;
+
+    glm::vec2 viewport = glm::vec2(1.f);
+    uint64_t update_cnt = 0;
+
+    texture_buffer_t* grid_buffer = nullptr;
+    texture_buffer_t* item_buffer = nullptr;
+    texture_buffer_t* light_buffer = nullptr;
+
+    void build_clusters(const camera_t* camera);
+    void assign_slices(uint32_t slice_beg, uint32_t slice_end);
+};
+
+}
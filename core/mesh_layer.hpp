@@ -1,21 +1,35 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <deque>
+#include <map>
+#include <memory>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <string>
 #include <sys/socket.h>
+#include <unordered_map>
 #include <vector>
 #include "utils/preset.hpp"
 #include "vertices_layer.hpp"
+#include "animation.hpp"
+#include "light_cluster.hpp"
+#include "occlusion_culler.hpp"
+#include "occlusion_queries.hpp"
 
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include "utils/debug.hpp"
+#include "utils/profiler.hpp"
+#include "utils/job_system.hpp"
+#include "utils/frame_arena.hpp"
+#include "utils/rect_packer.hpp"
 
 namespace Ez3DGL{
 
@@ -34,6 +48,336 @@ struct Texture {
     texture_t* tex=nullptr;
 };
 
+/**
+ * @brief 一张贴图在纹理数组中的位置: 所在的数组与层, 以及层内的uv区域
+ */
+struct TextureRegion{
+    texture_array_t* array=nullptr;
+    int layer=0;
+    // 区域在层中的uv偏移(xy)与缩放(zw), 整层为 (0, 0, 1, 1)
+    glm::vec4 uv_rect=glm::vec4(0.f, 0.f, 1.f, 1.f);
+
+    /**
+     * @brief 把 [0,1] 内的uv映射到区域内, 不需要重复寻址的网格可以直接烘焙进顶点
+     */
+    glm::vec2 remap(glm::vec2 uv) const{
+        return glm::vec2(uv_rect.x, uv_rect.y) + uv * glm::vec2(uv_rect.z, uv_rect.w);
+    }
+};
+
+/**
+ * @brief 纹理数组管理, 把尺寸相容的贴图合并进 GL_TEXTURE_2D_ARRAY 的各层, 小贴图先打包进图集页再作为一层,
+ * 使用不同贴图的材质共用一次纹理绑定, 切换材质只需更新区域与层号
+ * @note 所有贴图统一转换为 RGBA8; add 返回的区域在 build 后生效, 每次 build 只处理此前新加入的贴图
+ */
+class TextureArrayManager{
+public:
+    enum class Fit{
+        // 只有尺寸完全相同的贴图放进同一数组
+        Exact,
+        // 宽高各自向上取2的幂分组, 贴图放在层的左上角, 其余部分以边缘像素填充
+        Pad,
+        // 宽高各自向上取2的幂分组, 贴图缩放到整层
+        Resize,
+    };
+    struct Options{
+        Fit fit=Fit::Pad;
+        // 宽高都不超过该值的贴图打包进图集页, 为0时不使用图集
+        int atlas_max_size=128;
+        int atlas_size=1024;
+        // 图集中每块区域四周以边缘像素填充的宽度, 减少过滤与多级纹理的串色
+        int atlas_padding=4;
+        // 单个纹理数组的最大层数(GL 3.3 至少支持256), 超出后新建数组
+        int max_layers=256;
+        bool mipmap=true;
+    };
+
+    TextureArrayManager() = default;
+    explicit TextureArrayManager(const Options& options): options(options){}
+    TextureArrayManager(const TextureArrayManager&) = delete;
+    TextureArrayManager& operator=(const TextureArrayManager&) = delete;
+
+    /**
+     * @brief 加入一张贴图, 像素被复制, 调用后即可释放
+     * @return 贴图的区域, build 后有效, 地址在管理器销毁前不变
+     */
+    const TextureRegion* add(const unsigned char* pixels, int width, int height, int channels){
+        assert_with_info(pixels!=nullptr && width>0 && height>0 && channels>=1 && channels<=4,
+            "invalid image %d*%d %dchs", width, height, channels);
+        regions.emplace_back();
+        PendingImage image{std::vector<unsigned char>(size_t(width) * height * 4), width, height, &regions.back()};
+        for(size_t i=0; i<size_t(width) * height; i++){
+            const unsigned char* src = pixels + i * channels;
+            unsigned char* dst = image.rgba.data() + i * 4;
+            // 灰度复制到RGB, 缺少的alpha为不透明
+            dst[0] = src[0];
+            dst[1] = channels >= 3 ? src[1] : src[0];
+            dst[2] = channels >= 3 ? src[2] : src[0];
+            dst[3] = channels == 4 ? src[3] : channels == 2 ? src[1] : 255;
+        }
+        pending.push_back(std::move(image));
+        return &regions.back();
+    }
+    const TextureRegion* add(const char* file_name){
+        int width, height, channels;
+        unsigned char* data = stbi_load(file_name, &width, &height, &channels, 0);
+        if(data == nullptr)
+            panic_with_info("Fail to load texture %s", file_name);
+        auto region = add(data, width, height, channels);
+        stbi_image_free(data);
+        return region;
+    }
+    /**
+     * @brief 分组, 打包图集并上传所有新加入的贴图
+     */
+    void build(){
+        profile_scope("TextureArrayManager::build");
+        if(pending.empty()) return;
+        std::vector<PendingImage*> atlas_images;
+        // 按层尺寸分组
+        std::map<std::pair<int, int>, std::vector<PendingImage*>> groups;
+        const int cell_padding = 2 * options.atlas_padding;
+        for(auto& image: pending){
+            if(image.width <= options.atlas_max_size && image.height <= options.atlas_max_size &&
+                image.width + cell_padding <= options.atlas_size && image.height + cell_padding <= options.atlas_size)
+                atlas_images.push_back(&image);
+            else if(options.fit == Fit::Exact)
+                groups[{image.width, image.height}].push_back(&image);
+            else
+                groups[{ceil_pow2(image.width), ceil_pow2(image.height)}].push_back(&image);
+        }
+        if(!atlas_images.empty())
+            build_atlas(atlas_images);
+        for(auto& group: groups)
+            build_group(group.first.first, group.first.second, group.second);
+        pending.clear();
+    }
+
+    size_t array_num() const{
+        return arrays.size();
+    }
+    size_t region_num() const{
+        return regions.size();
+    }
+    // 所有纹理数组第0级占用的显存(字节)
+    size_t memory_bytes() const{
+        size_t bytes = 0;
+        for(const auto& array: arrays)
+            bytes += size_t(array->width) * array->height * array->layers * 4;
+        return bytes;
+    }
+private:
+    struct PendingImage{
+        std::vector<unsigned char> rgba;
+        int width, height;
+        TextureRegion* region;
+    };
+    // 一层的像素与落在该层中的区域
+    struct Layer{
+        std::vector<unsigned char> rgba;
+        std::vector<TextureRegion*> regions;
+    };
+    Options options;
+    std::vector<PendingImage> pending;
+    std::deque<TextureRegion> regions;
+    std::vector<std::unique_ptr<texture_array_t>> arrays;
+
+    static int ceil_pow2(int v){
+        int res = 1;
+        while(res < v)
+            res <<= 1;
+        return res;
+    }
+    /**
+     * @brief 把贴图复制到层中 (x, y) 处, 四周 padding 宽度以及右下角到 (fill_w, fill_h) 的部分复制边缘像素
+     */
+    static void blit_clamped(Layer& layer, int layer_width, const PendingImage& image, int x, int y, int padding, int fill_w, int fill_h){
+        for(int dy=-padding; dy<fill_h+padding; dy++){
+            const int sy = std::clamp(dy, 0, image.height - 1);
+            unsigned char* dst = layer.rgba.data() + (size_t(y + dy) * layer_width + x - padding) * 4;
+            for(int dx=-padding; dx<fill_w+padding; dx++, dst+=4){
+                const int sx = std::clamp(dx, 0, image.width - 1);
+                memcpy(dst, image.rgba.data() + (size_t(sy) * image.width + sx) * 4, 4);
+            }
+        }
+    }
+    // 双线性缩放到整层
+    static void blit_resized(Layer& layer, int layer_width, int layer_height, const PendingImage& image){
+        const float sx = float(image.width) / layer_width, sy = float(image.height) / layer_height;
+        for(int y=0; y<layer_height; y++){
+            const float fy = std::clamp((y + 0.5f) * sy - 0.5f, 0.f, float(image.height - 1));
+            const int y0 = int(fy), y1 = std::min(y0 + 1, image.height - 1);
+            const float ty = fy - y0;
+            for(int x=0; x<layer_width; x++){
+                const float fx = std::clamp((x + 0.5f) * sx - 0.5f, 0.f, float(image.width - 1));
+                const int x0 = int(fx), x1 = std::min(x0 + 1, image.width - 1);
+                const float tx = fx - x0;
+                auto p = [&](int px, int py, int c){return float(image.rgba[(size_t(py) * image.width + px) * 4 + c]);};
+                for(int c=0; c<4; c++){
+                    const float top = p(x0, y0, c) + (p(x1, y0, c) - p(x0, y0, c)) * tx;
+                    const float bottom = p(x0, y1, c) + (p(x1, y1, c) - p(x0, y1, c)) * tx;
+                    layer.rgba[(size_t(y) * layer_width + x) * 4 + c] = (unsigned char)(top + (bottom - top) * ty + 0.5f);
+                }
+            }
+        }
+    }
+    /**
+     * @brief 小贴图按高度从大到小装进图集页, 每页作为一层
+     */
+    void build_atlas(std::vector<PendingImage*>& images){
+        const int size = options.atlas_size, padding = options.atlas_padding;
+        std::stable_sort(images.begin(), images.end(), [](const PendingImage* a, const PendingImage* b){
+            return a->height != b->height ? a->height > b->height : a->width > b->width;
+        });
+        std::vector<Layer> pages;
+        std::vector<rect_packer_t> packers;
+        for(auto image: images){
+            int x = 0, y = 0;
+            size_t page = 0;
+            for(; page<packers.size(); page++)
+                if(packers[page].insert(image->width + 2 * padding, image->height + 2 * padding, x, y))
+                    break;
+            if(page == packers.size()){
+                packers.emplace_back(size, size);
+                pages.push_back(Layer{std::vector<unsigned char>(size_t(size) * size * 4, 0), {}});
+                packers.back().insert(image->width + 2 * padding, image->height + 2 * padding, x, y);
+            }
+            blit_clamped(pages[page], size, *image, x + padding, y + padding, padding, image->width, image->height);
+            image->region->uv_rect = glm::vec4(float(x + padding) / size, float(y + padding) / size,
+                float(image->width) / size, float(image->height) / size);
+            pages[page].regions.push_back(image->region);
+            image->rgba = std::vector<unsigned char>();
+        }
+        upload_layers(size, size, pages);
+    }
+    void build_group(int width, int height, std::vector<PendingImage*>& images){
+        std::vector<Layer> layers(images.size());
+        // 补边与缩放在工作线程中进行, 上传在主线程
+        job_system::parallel_for(0, images.size(), [&](size_t beg, size_t end){
+            for(size_t i=beg; i<end; i++){
+                auto& image = *images[i];
+                auto& layer = layers[i];
+                layer.regions.push_back(image.region);
+                if(image.width == width && image.height == height){
+                    layer.rgba = std::move(image.rgba);
+                    continue;
+                }
+                layer.rgba.resize(size_t(width) * height * 4);
+                if(options.fit == Fit::Resize){
+                    blit_resized(layer, width, height, image);
+                }else{
+                    blit_clamped(layer, width, image, 0, 0, 0, width, height);
+                    image.region->uv_rect = glm::vec4(0.f, 0.f, float(image.width) / width, float(image.height) / height);
+                }
+                image.rgba = std::vector<unsigned char>();
+            }
+        }, 1);
+        upload_layers(width, height, layers);
+    }
+    void upload_layers(int width, int height, std::vector<Layer>& layers){
+        const size_t max_layers = size_t(std::max(options.max_layers, 1));
+        for(size_t beg=0; beg<layers.size(); beg+=max_layers){
+            const size_t num = std::min(max_layers, layers.size() - beg);
+            auto array = new texture_array_t(width, height, int(num), options.mipmap);
+            for(size_t i=0; i<num; i++){
+                auto& layer = layers[beg + i];
+                array->upload_layer(int(i), layer.rgba.data());
+                for(auto region: layer.regions){
+                    region->array = array;
+                    region->layer = int(i);
+                }
+                layer.rgba = std::vector<unsigned char>();
+            }
+            array->generate_mipmap();
+            log_info("Texture array %d*%d*%zu built.", width, height, num);
+            arrays.emplace_back(array);
+        }
+    }
+};
+
+/**
+ * @brief 材质的标量参数, 紧凑存放, 整体比较判断是否需要重新上传
+ */
+struct MaterialParams{
+    // 小于0时使用 Shader::tmp_material_shininess
+    float shininess=-1.f;
+
+    bool operator==(const MaterialParams& other) const{
+        return shininess == other.shininess;
+    }
+    bool operator!=(const MaterialParams& other) const{
+        return !(*this == other);
+    }
+};
+
+class Shader;
+
+/**
+ * @brief 材质, 导入模型时创建, 纹理按固定的纹理单元分配, 并缓存所用的着色器变体
+ * @note 连续绘制同一材质时 Shader::bind 不再重新绑定纹理和上传参数
+ */
+class Material{
+public:
+    // 固定的纹理单元, 分簇数据占用其后的三个单元
+    static constexpr unsigned int unit_diffuse = 0;
+    static constexpr unsigned int unit_diffuse_mix = 1;
+    static constexpr unsigned int unit_specular = 2;
+    static constexpr unsigned int unit_cluster = 3;
+    static constexpr unsigned int unit_bones = 6;
+
+    texture_t* diffuse = nullptr;
+    // 第二张漫反射贴图, 只在聚光中混合
+    texture_t* diffuse_mix = nullptr;
+    texture_t* specular = nullptr;
+    // 纹理数组中的区域(由 TextureArrayManager 分配), 设置了任一区域时代替上面的纹理, 两个区域各自可以为空,
+    // 使用同一纹理数组的材质之间切换不重新绑定纹理
+    const TextureRegion* diffuse_region = nullptr;
+    const TextureRegion* specular_region = nullptr;
+    MaterialParams params;
+    // 网格顶点带有关节与权重, Shader 设置了关节矩阵时选用蒙皮变体
+    bool skinned = false;
+
+    Material() = default;
+    explicit Material(const std::vector<Texture>& textures, MaterialParams params=MaterialParams()): params(params){
+        int diffuse_cnt = 0;
+        for(const auto& texture: textures)
+            switch (texture.type) {
+                case Texture::Type::Diffuse:{
+                    if(diffuse_cnt == 0)
+                        diffuse = texture.tex;
+                    else if(diffuse_cnt == 1)
+                        diffuse_mix = texture.tex;
+                    diffuse_cnt += 1;
+                    break;
+                }
+                case Texture::Type::Specula:{
+                    if(specular == nullptr)
+                        specular = texture.tex;
+                    break;
+                }
+                default: panic_with_info("unsupport texture type");
+            }
+    }
+    bool same_as(const Material& other) const{
+        return diffuse == other.diffuse && diffuse_mix == other.diffuse_mix && specular == other.specular &&
+            diffuse_region == other.diffuse_region && specular_region == other.specular_region && params == other.params;
+    }
+private:
+    // 上次选出的变体, Shader 的状态版本或材质的纹理组合变化后重新选择
+    mutable const Shader* cached_shader = nullptr;
+    mutable uint64_t cached_version = 0;
+    mutable void* cached_variant = nullptr;
+    mutable uint8_t cached_textures = 0;
+
+    // 影响变体选择的纹理组合, 纹理是公开成员, 每次 bind 时比较
+    uint8_t texture_mask() const{
+        return uint8_t(diffuse != nullptr) | uint8_t(diffuse_mix != nullptr) << 1 | uint8_t(specular != nullptr) << 2 |
+            uint8_t(diffuse_region != nullptr) << 3 | uint8_t(specular_region != nullptr) << 4;
+    }
+
+    friend class Shader;
+};
+
 
 class LightBase{
 public:
@@ -105,89 +449,469 @@ public:
             }
 };
 
+/**
+ * @brief 着色器变体的键, 由特性位组成
+ * @note 光源数量按2的幂分桶(桶k最多容纳2^(k-1)个光源, 桶0表示没有该类光源),
+ * 避免光源数量每变化一次就编译一个新的变体
+ */
+struct ShaderVariantKey{
+    uint8_t dir_bucket=0;
+    uint8_t point_bucket=0;
+    uint8_t spot_bucket=0;
+    bool diffuse_map=false;
+    bool diffuse_mix_map=false;
+    bool specular_map=false;
+    bool specular=true;
+    bool clustered=false;
+    bool gbuffer=false;
+    bool texture_array=false;
+    bool skinned=false;
+    // 深度预通道: 片元着色器为空, 只保留变换(与蒙皮)
+    bool depth_only=false;
+
+    uint32_t bits() const{
+        return uint32_t(dir_bucket) | uint32_t(point_bucket)<<4 | uint32_t(spot_bucket)<<8 |
+            uint32_t(diffuse_map)<<12 | uint32_t(diffuse_mix_map)<<13 |
+            uint32_t(specular_map)<<14 | uint32_t(specular)<<15 | uint32_t(clustered)<<16 |
+            uint32_t(gbuffer)<<17 | uint32_t(texture_array)<<18 | uint32_t(skinned)<<19 |
+            uint32_t(depth_only)<<20;
+    }
+    static uint8_t bucket_of(size_t light_num){
+        uint8_t bucket = 0;
+        while(light_num > 0 && (size_t(1) << bucket) < light_num)
+            bucket += 1;
+        return light_num > 0 ? bucket + 1 : 0;
+    }
+    static uint32_t bucket_capacity(uint8_t bucket, uint32_t max_light_num){
+        if(bucket == 0) return 0;
+        return std::min(uint32_t(1) << (bucket - 1), max_light_num);
+    }
+};
+
 class Shader{
 public:
     float tmp_material_shininess=32;
+    // 关闭后选用不计算镜面光的着色器变体
+    bool enable_specular=true;
 
     void setup_shader(uint32_t max_light_num=128){
-        assert_with_info(shader==nullptr, "shader is already setup");
-        shader = new shader_t(preset::shader::vs_fragpos_normal_texcoord(), preset::shader::fs_multiple_lights_shader(max_light_num), "view", "projection", "model");
+        assert_with_info(this->max_light_num==0, "shader is already setup");
+        assert_with_info(max_light_num>0, "max_light_num must be positive");
+        this->max_light_num = max_light_num;
     }
     void set_lights(const std::vector<LightDir>& dir_lights, const std::vector<LightPoint>& point_lights, const std::vector<LightSpot>& spot_lights){
-        shader->use();
-        shader->set_uniform("dir_light_num", dir_lights.size());
-        shader->set_uniform("point_light_num", point_lights.size());
-        shader->set_uniform("spot_light_num", spot_lights.size());
-        for(int i=0; i<dir_lights.size(); i++){
-            std::string key = "lights_dir[" + std::to_string(i) + "]";
-            shader->set_uniform(std::string(key+".ambient").c_str(),    dir_lights[i].ambient);
-            shader->set_uniform(std::string(key+".diffuse").c_str(),    dir_lights[i].diffuse);
-            shader->set_uniform(std::string(key+".specular").c_str(),   dir_lights[i].specular);
-            shader->set_uniform(std::string(key+".direction").c_str(),  dir_lights[i].direction);
-        }
-        for(int i=0; i<point_lights.size(); i++){
-            std::string key = "lights_point[" + std::to_string(i) + "]";
-            shader->set_uniform(std::string(key+".ambient").c_str(),    point_lights[i].ambient);
-            shader->set_uniform(std::string(key+".diffuse").c_str(),    point_lights[i].diffuse);
-            shader->set_uniform(std::string(key+".specular").c_str(),   point_lights[i].specular);
-            shader->set_uniform(std::string(key+".position").c_str(),   point_lights[i].position);
-
-            shader->set_uniform(std::string(key+".constant").c_str(),   point_lights[i].constant);
-            shader->set_uniform(std::string(key+".linear").c_str(),     point_lights[i].linear);
-            shader->set_uniform(std::string(key+".quadratic").c_str(),  point_lights[i].quadratic);
-        }
-        for(int i=0; i<spot_lights.size(); i++){
-            std::string key = "lights_spot[" + std::to_string(i) + "]";
-            shader->set_uniform(std::string(key+".ambient").c_str(),    spot_lights[i].ambient);
-            shader->set_uniform(std::string(key+".diffuse").c_str(),    spot_lights[i].diffuse);
-            shader->set_uniform(std::string(key+".specular").c_str(),   spot_lights[i].specular);
-            shader->set_uniform(std::string(key+".direction").c_str(),  spot_lights[i].direction);
-            shader->set_uniform(std::string(key+".position").c_str(),   spot_lights[i].position);
-
-            shader->set_uniform(std::string(key+".constant").c_str(),   spot_lights[i].constant);
-            shader->set_uniform(std::string(key+".linear").c_str(),     spot_lights[i].linear);
-            shader->set_uniform(std::string(key+".quadratic").c_str(),  spot_lights[i].quadratic);
-
-            shader->set_uniform(std::string(key+".cutoff").c_str(),     glm::cos(glm::radians(spot_lights[i].inner_degree)));
-            shader->set_uniform(std::string(key+".cutoff_outer").c_str(),glm::cos(glm::radians(spot_lights[i].outer_degree)));
-        }
-
+        // 灯光在bind时才上传到所选的变体, 每个变体只在灯光变化后上传一次
+        // 各类灯光数量所在的桶变化时变体也会变化
+        if(ShaderVariantKey::bucket_of(dir_lights.size()) != ShaderVariantKey::bucket_of(lights_dir.size()) ||
+            ShaderVariantKey::bucket_of(point_lights.size()) != ShaderVariantKey::bucket_of(lights_point.size()) ||
+            ShaderVariantKey::bucket_of(spot_lights.size()) != ShaderVariantKey::bucket_of(lights_spot.size()))
+            state_version += 1;
+        lights_dir = dir_lights;
+        lights_point = point_lights;
+        lights_spot = spot_lights;
+        lights_version += 1;
+    }
+    /**
+     * 设置后点光源与聚光改由分簇数据提供, set_lights 中的点光源与聚光不再使用,
+     * 需要每帧调用 cluster->update 更新分簇
+     */
+    void set_light_cluster(LightCluster* cluster){
+        light_cluster = cluster;
+        state_version += 1;
+    }
+    /**
+     * 延迟渲染的几何阶段, 开启后选用只写G-buffer的变体(由 DeferredRenderer 切换)
+     */
+    void set_gbuffer_pass(bool enable){
+        if(gbuffer_pass != enable)
+            state_version += 1;
+        gbuffer_pass = enable;
+    }
+    /**
+     * 深度预通道, 开启后选用只写深度的变体, 非蒙皮网格只读取位置流(由 DepthPrepass 切换)
+     */
+    void set_depth_pass(bool enable){
+        if(depth_pass != enable)
+            state_version += 1;
+        depth_pass = enable;
+    }
+    /**
+     * @brief 最近一次 bind 所选的变体是否只需要位置属性, 为真时可用 vertices_t::draw_element_position 绘制
+     */
+    bool position_only() const{
+        return bound_position_only;
+    }
+    /**
+     * 设置之后绘制的蒙皮网格所用的关节矩阵, 为空时蒙皮网格以绑定姿态绘制
+     * @param offset 实例第一个关节矩阵所在的texel, 见 Animator::bone_offset
+     */
+    void set_bones(texture_buffer_t* buffer, int offset=0){
+        if((bones == nullptr) != (buffer == nullptr))
+            state_version += 1;
+        bones = buffer;
+        bone_offset = offset;
+    }
+    void set_bones(const Animator& animator, Animator::handle_t instance){
+        set_bones(animator.bone_buffer(), animator.bone_offset(instance));
     }
     void bind(const std::vector<Texture>& textures, const camera_t* camera, const model_t* model){
-        assert_with_info(shader!=nullptr, "forget to setup shader");
-        shader->use();
-        shader->clear_texture();
-        int diffuse_cnt = 0, specular_cnt = 0;
-        for(const auto& texture: textures)
-            switch (texture.type) {
-                case Texture::Type::Diffuse:{
-                    std::string diffuse_key = "material.diffuse[" + std::to_string(diffuse_cnt) + "]";
-                    shader->bind_texture(diffuse_key.c_str(), texture.tex);
-                    diffuse_cnt+=1;
-                    break;
-                }   
-                case Texture::Type::Specula:{
-                    std::string specular_key = "material.specular[" + std::to_string(specular_cnt) + "]";
-                    shader->bind_texture(specular_key.c_str(), texture.tex);
-                    specular_cnt+=1;
-                    break;
-                }
-                default: panic_with_info("unsupport texture type");
-            }
-        // shader->set_uniform("diffuse_num", diffuse_cnt);
-        // shader->set_uniform("specular_num", spaiTexecular_cnt);
-        shader->set_uniform("material.shininess", tmp_material_shininess);
-        shader->set_uniform("viewPos", camera->position);
-        shader->update_camera(camera);
-        shader->update_model(model);
+        bind(Material(textures), camera, model);
+    }
+    /**
+     * @brief 绑定材质, 只重新绑定纹理变化了的单元, 参数与相机只在变化时上传
+     */
+    void bind(const Material& material, const camera_t* camera, const model_t* model){
+        variant_t* variant = bind_material(material, camera);
+        // model矩阵未变时(如同一对象的各网格)跳过法线矩阵的计算与上传
+        const glm::mat4 model_matrix = model->get_model(model_t::render_alpha());
+        if(variant->model != model_matrix){
+            shader->update_model(model_matrix, model->uniform_scale());
+            variant->model = model_matrix;
+        }
+    }
+    /**
+     * @brief 以预先算好的model矩阵与法线矩阵绑定(见 CommandList)
+     */
+    void bind(const Material& material, const camera_t* camera, const glm::mat4& model, const glm::mat3& normal){
+        variant_t* variant = bind_material(material, camera);
+        if(variant->model != model){
+            shader->update_model(model, normal);
+            variant->model = model;
+        }
+    }
+    /**
+     * @brief 之后的 bind 重新上传所有uniform(如其他代码改写了变体程序的uniform)
+     */
+    void invalidate_bind_state(){
+        last_material = Material();
+        for(auto& variant: variants)
+            variant.second.reset_cache();
+        shader_t::invalidate_bind_cache();
+    }
+    // 已编译的变体数量
+    size_t variant_num() const{
+        return variants.size();
+    }
+    /**
+     * @brief 累计的材质切换次数(绑定的纹理或参数与上一次不同), 两帧之差即每帧切换次数
+     */
+    static uint64_t material_switches(){
+        return material_switch_cnt;
     }
     ~Shader(){
-        if(shader!=nullptr)
-            delete shader;
+        for(auto& variant: variants)
+            delete variant.second.shader;
     }
     friend class Lights;
 private:
+    struct variant_t{
+        shader_t* shader=nullptr;
+        ShaderVariantKey key;
+        // 该变体中灯光数据对应的版本
+        uint64_t lights_version=0;
+        // 创建时解析的uniform位置, 采样器在创建时指向固定的纹理单元
+        int loc_shininess=-1, loc_view_pos=-1;
+        int loc_cluster_dim=-1, loc_cluster_scale=-1;
+        int loc_diffuse_region=-1, loc_diffuse_layer=-1, loc_specular_region=-1, loc_specular_layer=-1;
+        int loc_bone_offset=-1;
+        // 已上传到该变体的值
+        MaterialParams params;
+        bool params_valid=false;
+        glm::vec3 view_pos=glm::vec3(NAN);
+        glm::mat4 view=glm::mat4(NAN), projection=glm::mat4(NAN), model=glm::mat4(NAN);
+        uint64_t cluster_version=UINT64_MAX;
+        glm::vec4 diffuse_rect=glm::vec4(NAN), specular_rect=glm::vec4(NAN);
+        int diffuse_layer=-1, specular_layer=-1;
+        int bone_offset=-1;
+
+        void reset_cache(){
+            lights_version = 0;
+            params_valid = false;
+            view_pos = glm::vec3(NAN);
+            view = projection = model = glm::mat4(NAN);
+            cluster_version = UINT64_MAX;
+            diffuse_rect = specular_rect = glm::vec4(NAN);
+            diffuse_layer = specular_layer = -1;
+            bone_offset = -1;
+        }
+    };
+    uint32_t max_light_num=0;
+    std::unordered_map<uint32_t, variant_t> variants;
+    // 当前绑定的变体
     shader_t* shader=nullptr;
+    Material last_material;
+    // 影响变体选择的状态(灯光数量所在的桶, 分簇, G-buffer, 深度预通道, 镜面光)的版本
+    uint64_t state_version=1;
+    bool state_specular=true;
+    inline static uint64_t material_switch_cnt=0;
+
+    std::vector<LightDir> lights_dir;
+    std::vector<LightPoint> lights_point;
+    std::vector<LightSpot> lights_spot;
+    uint64_t lights_version=0;
+    LightCluster* light_cluster=nullptr;
+    bool gbuffer_pass=false;
+    bool depth_pass=false;
+    bool bound_position_only=false;
+    texture_buffer_t* bones=nullptr;
+    int bone_offset=0;
+
+    // 选择并绑定变体, 上传材质, 灯光与相机, 返回所选的变体
+    variant_t* bind_material(const Material& material, const camera_t* camera){
+        profile_scope("Shader::bind");
+        assert_with_info(max_light_num!=0, "forget to setup shader");
+        if(enable_specular != state_specular){
+            state_specular = enable_specular;
+            state_version += 1;
+        }
+        variant_t* variant;
+        const uint8_t textures = material.texture_mask();
+        if(material.cached_shader == this && material.cached_version == state_version && material.cached_textures == textures){
+            variant = static_cast<variant_t*>(material.cached_variant);
+        }else{
+            const bool skinned = material.skinned && bones != nullptr;
+            if(material.diffuse_region != nullptr || material.specular_region != nullptr)
+                variant = &get_variant(select_variant(material.diffuse_region!=nullptr, false, material.specular_region!=nullptr, true, skinned));
+            else
+                variant = &get_variant(select_variant(material.diffuse!=nullptr, material.diffuse_mix!=nullptr, material.specular!=nullptr, false, skinned));
+            material.cached_shader = this;
+            material.cached_version = state_version;
+            material.cached_variant = variant;
+            material.cached_textures = textures;
+        }
+        const auto& key = variant->key;
+        shader = variant->shader;
+        shader->use();
+        bound_position_only = key.depth_only && !key.skinned;
+        if(key.depth_only){
+            // 只上传变换, 材质在着色阶段再切换
+            if(key.skinned)
+                bind_bones(variant);
+            if(variant->view != camera->view || variant->projection != camera->projection){
+                shader->update_camera(camera);
+                variant->view = camera->view;
+                variant->projection = camera->projection;
+            }
+            return variant;
+        }
+        if(variant->lights_version != lights_version){
+            apply_lights(key);
+            variant->lights_version = lights_version;
+        }
+        if(key.clustered){
+            light_cluster->bind_units(Material::unit_cluster);
+            if(variant->cluster_version != light_cluster->version()){
+                shader->set_uniform_at(variant->loc_cluster_dim, light_cluster->dim());
+                shader->set_uniform_at(variant->loc_cluster_scale, light_cluster->scale_params());
+                variant->cluster_version = light_cluster->version();
+            }
+        }
+        if(key.skinned)
+            bind_bones(variant);
+        if(!material.same_as(last_material)){
+            last_material = material;
+            material_switch_cnt += 1;
+        }
+        if(key.texture_array){
+            if(key.diffuse_map)
+                bind_material_region(Material::unit_diffuse, material.diffuse_region, variant->loc_diffuse_region, variant->loc_diffuse_layer,
+                    variant->diffuse_rect, variant->diffuse_layer);
+            if(key.specular_map)
+                bind_material_region(Material::unit_specular, material.specular_region, variant->loc_specular_region, variant->loc_specular_layer,
+                    variant->specular_rect, variant->specular_layer);
+        }else{
+            if(key.diffuse_map)
+                bind_material_texture(Material::unit_diffuse, material.diffuse);
+            if(key.diffuse_mix_map)
+                bind_material_texture(Material::unit_diffuse_mix, material.diffuse_mix);
+            if(key.specular_map)
+                bind_material_texture(Material::unit_specular, material.specular);
+        }
+        // G-buffer 变体也写入高光指数, 光照阶段逐像素读取
+        if(key.specular){
+            MaterialParams params = material.params;
+            if(params.shininess < 0)
+                params.shininess = tmp_material_shininess;
+            if(!variant->params_valid || variant->params != params){
+                shader->set_uniform_at(variant->loc_shininess, params.shininess);
+                variant->params = params;
+                variant->params_valid = true;
+            }
+        }
+        if(key.specular && !key.gbuffer){
+            if(variant->view_pos != camera->position){
+                shader->set_uniform_at(variant->loc_view_pos, camera->position);
+                variant->view_pos = camera->position;
+            }
+        }
+        if(variant->view != camera->view || variant->projection != camera->projection){
+            shader->update_camera(camera);
+            variant->view = camera->view;
+            variant->projection = camera->projection;
+        }
+        return variant;
+    }
+    void bind_bones(variant_t* variant){
+        shader_t::bind_texture_unit(Material::unit_bones, GL_TEXTURE_BUFFER, bones->texture_id);
+        if(variant->bone_offset != bone_offset){
+            shader->set_uniform_at(variant->loc_bone_offset, bone_offset);
+            variant->bone_offset = bone_offset;
+        }
+    }
+    ShaderVariantKey select_variant(bool diffuse_map, bool diffuse_mix_map, bool specular_map, bool texture_array=false, bool skinned=false) const{
+        ShaderVariantKey key;
+        if(depth_pass){
+            // 只写深度的变体与材质无关
+            key.depth_only = true;
+            key.specular = false;
+            key.skinned = skinned;
+            return key;
+        }
+        key.dir_bucket = ShaderVariantKey::bucket_of(std::min<size_t>(lights_dir.size(), max_light_num));
+        key.point_bucket = ShaderVariantKey::bucket_of(std::min<size_t>(lights_point.size(), max_light_num));
+        key.spot_bucket = ShaderVariantKey::bucket_of(std::min<size_t>(lights_spot.size(), max_light_num));
+        if(light_cluster != nullptr){
+            key.clustered = true;
+            key.point_bucket = 0;
+            key.spot_bucket = 0;
+        }
+        key.diffuse_map = diffuse_map;
+        // 第二张漫反射贴图只在聚光中混合
+        key.diffuse_mix_map = diffuse_mix_map && (key.spot_bucket > 0 || key.clustered);
+        if(gbuffer_pass){
+            // 光照在延迟渲染的光照阶段统一计算
+            key.gbuffer = true;
+            key.dir_bucket = key.point_bucket = key.spot_bucket = 0;
+            key.clustered = false;
+            key.diffuse_mix_map = false;
+        }
+        key.specular_map = specular_map && enable_specular;
+        key.specular = enable_specular;
+        key.texture_array = texture_array;
+        key.skinned = skinned;
+        return key;
+    }
+    variant_t& get_variant(const ShaderVariantKey& key){
+        auto& variant = variants[key.bits()];
+        if(variant.shader == nullptr){
+            preset::shader::lights_features features{
+                ShaderVariantKey::bucket_capacity(key.dir_bucket, max_light_num),
+                ShaderVariantKey::bucket_capacity(key.point_bucket, max_light_num),
+                ShaderVariantKey::bucket_capacity(key.spot_bucket, max_light_num),
+                key.diffuse_map, key.diffuse_mix_map, key.specular_map, key.specular, key.clustered, key.gbuffer, key.texture_array};
+            const std::string vs = key.skinned ? preset::shader::vs_skinned() : preset::shader::vs_fragpos_normal_texcoord();
+            const std::string fs = key.depth_only ? preset::shader::fs_empty() : preset::shader::fs_multiple_lights_shader(features);
+            variant.shader = new shader_t(vs, fs, "view", "projection", "model");
+            variant.key = key;
+            setup_variant(variant);
+        }
+        return variant;
+    }
+    void setup_variant(variant_t& variant){
+        const auto& key = variant.key;
+        auto program = variant.shader;
+        program->use();
+        if(key.texture_array){
+            if(key.diffuse_map){
+                program->set_uniform("material.diffuse_array", int(Material::unit_diffuse));
+                variant.loc_diffuse_region = program->uniform_location("material.diffuse_region");
+                variant.loc_diffuse_layer = program->uniform_location("material.diffuse_layer");
+            }
+            if(key.specular_map){
+                program->set_uniform("material.specular_array", int(Material::unit_specular));
+                variant.loc_specular_region = program->uniform_location("material.specular_region");
+                variant.loc_specular_layer = program->uniform_location("material.specular_layer");
+            }
+        }else{
+            if(key.diffuse_map)
+                program->set_uniform("material.diffuse[0]", int(Material::unit_diffuse));
+            if(key.diffuse_mix_map)
+                program->set_uniform("material.diffuse[1]", int(Material::unit_diffuse_mix));
+            if(key.specular_map)
+                program->set_uniform("material.specular[0]", int(Material::unit_specular));
+        }
+        if(key.clustered){
+            program->set_uniform("cluster_grid", int(Material::unit_cluster));
+            program->set_uniform("cluster_items", int(Material::unit_cluster + 1));
+            program->set_uniform("cluster_lights", int(Material::unit_cluster + 2));
+            variant.loc_cluster_dim = program->uniform_location("cluster_dim");
+            variant.loc_cluster_scale = program->uniform_location("cluster_scale");
+        }
+        if(key.skinned){
+            program->set_uniform("bone_matrices", int(Material::unit_bones));
+            variant.loc_bone_offset = program->uniform_location("bone_offset");
+        }
+        if(key.specular)
+            variant.loc_shininess = program->uniform_location("material.shininess");
+        if(key.specular && !key.gbuffer)
+            variant.loc_view_pos = program->uniform_location("viewPos");
+    }
+    void bind_material_texture(unsigned int unit, texture_t* texture){
+        assert_with_info(texture->valid, "blind texture %s fail", texture->file_name ? texture->file_name : "");
+        shader_t::bind_texture_unit(unit, GL_TEXTURE_2D, texture->texture_id);
+    }
+    /**
+     * @brief 绑定区域所在的纹理数组(与上次相同时不产生GL调用), 区域与层号只在变化时上传
+     */
+    void bind_material_region(unsigned int unit, const TextureRegion* region, int loc_region, int loc_layer, glm::vec4& rect, int& layer){
+        assert_with_info(region->array!=nullptr, "texture region is not built, call TextureArrayManager::build first");
+        shader_t::bind_texture_unit(unit, GL_TEXTURE_2D_ARRAY, region->array->texture_id);
+        if(rect != region->uv_rect){
+            shader->set_uniform_at(loc_region, region->uv_rect);
+            rect = region->uv_rect;
+        }
+        if(layer != region->layer){
+            shader->set_uniform_at(loc_layer, float(region->layer));
+            layer = region->layer;
+        }
+    }
+    void apply_lights(const ShaderVariantKey& variant_key){
+        const auto dir_num = std::min<size_t>(lights_dir.size(), ShaderVariantKey::bucket_capacity(variant_key.dir_bucket, max_light_num));
+        const auto point_num = std::min<size_t>(lights_point.size(), ShaderVariantKey::bucket_capacity(variant_key.point_bucket, max_light_num));
+        const auto spot_num = std::min<size_t>(lights_spot.size(), ShaderVariantKey::bucket_capacity(variant_key.spot_bucket, max_light_num));
+        if(variant_key.dir_bucket > 0)
+            shader->set_uniform("dir_light_num", dir_num);
+        if(variant_key.point_bucket > 0)
+            shader->set_uniform("point_light_num", point_num);
+        if(variant_key.spot_bucket > 0)
+            shader->set_uniform("spot_light_num", spot_num);
+        for(size_t i=0; i<dir_num; i++){
+            frame_arena::uniform_key_t key("lights_dir", i);
+            shader->set_uniform(key.field("ambient"),    lights_dir[i].ambient);
+            shader->set_uniform(key.field("diffuse"),    lights_dir[i].diffuse);
+            if(variant_key.specular)
+                shader->set_uniform(key.field("specular"),   lights_dir[i].specular);
+            shader->set_uniform(key.field("direction"),  lights_dir[i].direction);
+        }
+        for(size_t i=0; i<point_num; i++){
+            frame_arena::uniform_key_t key("lights_point", i);
+            shader->set_uniform(key.field("ambient"),    lights_point[i].ambient);
+            shader->set_uniform(key.field("diffuse"),    lights_point[i].diffuse);
+            if(variant_key.specular)
+                shader->set_uniform(key.field("specular"),   lights_point[i].specular);
+            shader->set_uniform(key.field("position"),   lights_point[i].position);
+
+            shader->set_uniform(key.field("constant"),   lights_point[i].constant);
+            shader->set_uniform(key.field("linear"),     lights_point[i].linear);
+            shader->set_uniform(key.field("quadratic"),  lights_point[i].quadratic);
+        }
+        for(size_t i=0; i<spot_num; i++){
+            frame_arena::uniform_key_t key("lights_spot", i);
+            shader->set_uniform(key.field("ambient"),    lights_spot[i].ambient);
+            shader->set_uniform(key.field("diffuse"),    lights_spot[i].diffuse);
+            if(variant_key.specular)
+                shader->set_uniform(key.field("specular"),   lights_spot[i].specular);
+            shader->set_uniform(key.field("direction"),  lights_spot[i].direction);
+            shader->set_uniform(key.field("position"),   lights_spot[i].position);
+
+            shader->set_uniform(key.field("constant"),   lights_spot[i].constant);
+            shader->set_uniform(key.field("linear"),     lights_spot[i].linear);
+            shader->set_uniform(key.field("quadratic"),  lights_spot[i].quadratic);
+
+            shader->set_uniform(key.field("cutoff"),     glm::cos(glm::radians(lights_spot[i].inner_degree)));
+            shader->set_uniform(key.field("cutoff_outer"), glm::cos(glm::radians(lights_spot[i].outer_degree)));
+        }
+    }
 };
 
 class Mesh{
@@ -195,20 +919,77 @@ public:
     std::vector<Vertex> vertex_data;
     std::vector<unsigned int> indices;
     std::vector<Texture> textures;
+    // 每个顶点的关节与权重, 为空时不是蒙皮网格
+    std::vector<SkinWeights> skin;
+    // 为空时 setup_vertices 按 textures 创建, 之后修改 textures 需同时更新材质
+    std::shared_ptr<Material> material;
+    // 局部空间包围盒, 由 setup_vertices 计算
+    glm::vec3 bounds_min = glm::vec3(0.f), bounds_max = glm::vec3(0.f);
 
     void setup_vertices(){
         assert_with_info(vert==nullptr, "vertices is already setup");
-        vert = new vertices_t(vertex_data.size()*(3+3+2), {3, 3, 2}, (float*)&vertex_data[0], indices.size(), indices.data());
+        if(skin.empty()){
+            vert = new vertices_t(vertex_data.size()*(3+3+2), {3, 3, 2}, (float*)&vertex_data[0], indices.size(), indices.data(),
+                GL_STATIC_DRAW, true);
+        }else{
+            assert_with_info(skin.size()==vertex_data.size(), "skin weights do not match vertices");
+            // 关节与权重交错在顶点之后, 对应属性3与4
+            std::vector<float> data;
+            data.reserve(vertex_data.size()*(3+3+2+4+4));
+            for(size_t i=0; i<vertex_data.size(); i++){
+                const float* vertex = &vertex_data[i].position.x;
+                data.insert(data.end(), vertex, vertex + (3+3+2));
+                data.insert(data.end(), {skin[i].joints.x, skin[i].joints.y, skin[i].joints.z, skin[i].joints.w,
+                    skin[i].weights.x, skin[i].weights.y, skin[i].weights.z, skin[i].weights.w});
+            }
+            vert = new vertices_t(data.size(), {3, 3, 2, 4, 4}, data.data(), indices.size(), indices.data(),
+                GL_STATIC_DRAW, true);
+        }
+        if(material == nullptr){
+            material = std::make_shared<Material>(textures);
+            material->skinned = !skin.empty();
+        }
+        if(!vertex_data.empty()){
+            bounds_min = bounds_max = vertex_data[0].position;
+            for(const auto& vertex: vertex_data){
+                bounds_min = glm::min(bounds_min, vertex.position);
+                bounds_max = glm::max(bounds_max, vertex.position);
+            }
+        }
+    }
+    /**
+     * @brief 把网格作为遮挡体加入, 顶点数据需在 culler.rasterize 前保持不变
+     */
+    void add_occluder(OcclusionCuller& culler, const glm::mat4& model) const{
+        if(vertex_data.empty() || indices.empty()) return;
+        culler.add_occluder(&vertex_data[0].position.x, sizeof(Vertex) / sizeof(float), indices.data(), indices.size(), model);
+    }
+    /**
+     * @brief 立即释放顶点缓冲, 之后需重新 setup_vertices 才能绘制
+     */
+    void release_vertices(){
+        if(vert == nullptr) return;
+        vert->destroy();
+        delete vert;
+        vert = nullptr;
     }
     ~Mesh(){
         if(vert!=nullptr)
             delete vert;
     }
 
+    // 为空表示顶点缓冲未创建或已释放
+    const vertices_t* vertices() const{
+        return vert;
+    }
     void draw(Shader* shader, const camera_t* camera, const model_t* model) const{
+        profile_scope("Mesh::draw");
         assert_with_info(vert!=nullptr, "forget to setup vertices");
-        shader->bind(textures, camera, model);
-        vert->draw_element(GL_TRIANGLES);
+        shader->bind(*material, camera, model);
+        if(shader->position_only())
+            vert->draw_element_position(GL_TRIANGLES);
+        else
+            vert->draw_element(GL_TRIANGLES);
     }
 private:
     vertices_t* vert=nullptr;
@@ -217,23 +998,95 @@ private:
 class Model{
 public:
     Model()=default;
-    Model(std::string path){
-        setup_model(path);
+    Model(std::string path, TextureArrayManager* texture_arrays=nullptr){
+        setup_model(path, texture_arrays);
     }
-    void setup_model(std::string path){
+    /**
+     * @param texture_arrays 不为空时贴图放入该纹理数组管理器(加载完成后 build), 材质使用其中的区域,
+     * 多个模型可以共用一个管理器, 从而共用纹理绑定
+     */
+    void setup_model(std::string path, TextureArrayManager* texture_arrays=nullptr){
+        profile_scope("Model::setup_model");
         assert_with_info(model_path.empty(), "model is already setup");
         model_path = path;
+        this->texture_arrays = texture_arrays;
         load_model(path);
         for(auto& mesh: meshes){
             mesh.setup_vertices();
         }
     }
-    void draw(Shader* shader, const camera_t* camera, const model_t* model){
+    /**
+     * @param culler 不为空时跳过在视锥外或被遮挡的网格, 需已调用 rasterize
+     */
+    void draw(Shader* shader, const camera_t* camera, const model_t* model, const OcclusionCuller* culler=nullptr){
+        profile_gpu_scope("Model::draw");
+        assert_with_info(!model_path.empty(), "forget to setup model");
+        // 与 Mesh::draw 使用相同的插值矩阵
+        const glm::mat4 model_mat = culler != nullptr ? model->get_model(model_t::render_alpha()) : glm::mat4(1.f);
+        for(const auto& mesh: meshes){
+            if(culler != nullptr && !culler->test_aabb(mesh.bounds_min, mesh.bounds_max, model_mat))
+                continue;
+            mesh.draw(shader, camera, model);
+        }
+    }
+    /**
+     * @brief 以硬件遮挡查询剔除网格: 先绘制上一帧可见的网格, 再批量查询其余网格的包围盒并以条件渲染绘制
+     */
+    void draw(Shader* shader, const camera_t* camera, const model_t* model, OcclusionQueries* queries){
+        profile_gpu_scope("Model::draw");
         assert_with_info(!model_path.empty(), "forget to setup model");
+        frame_arena::vector<std::pair<const Mesh*, OcclusionQueries::object_t*>> hidden(frame_arena::resource());
         for(const auto& mesh: meshes){
+            auto& object = queries->object(&mesh, model);
+            if(!object.visible){
+                hidden.emplace_back(&mesh, &object);
+                continue;
+            }
+            const bool queried = queries->begin_query(object);
             mesh.draw(shader, camera, model);
+            if(queried)
+                queries->end_query();
+        }
+        if(hidden.empty()) return;
+        const glm::mat4 model_mat = model->get_model(model_t::render_alpha());
+        queries->begin_box_queries(camera);
+        for(const auto& item: hidden)
+            queries->query_box(*item.second, item.first->bounds_min, item.first->bounds_max, model_mat);
+        queries->end_box_queries();
+        for(const auto& item: hidden){
+            if(!queries->begin_conditional(*item.second)) continue;
+            item.first->draw(shader, camera, model);
+            queries->end_conditional();
         }
     }
+    const std::vector<Mesh>& get_meshes() const{
+        return meshes;
+    }
+    /**
+     * @brief 把所有网格作为遮挡体加入, 适合墙面, 建筑等简单的大模型
+     */
+    void add_occluder(OcclusionCuller& culler, const model_t* model) const{
+        const glm::mat4 model_mat = model->get_model();
+        for(const auto& mesh: meshes)
+            mesh.add_occluder(culler, model_mat);
+    }
+    /**
+     * @brief 模型的骨架, 模型中没有骨骼也没有动画时为空
+     * @note 有骨架的模型所有网格都是蒙皮网格, 没有骨骼的网格整体跟随其所在节点
+     */
+    const Skeleton* skeleton() const{
+        return model_skeleton.get();
+    }
+    const std::vector<std::unique_ptr<AnimationClip>>& animations() const{
+        return clips;
+    }
+    // 按名称查找动画, 不存在时返回空
+    const AnimationClip* find_animation(const std::string& name) const{
+        for(const auto& clip: clips)
+            if(clip->name() == name)
+                return clip.get();
+        return nullptr;
+    }
     ~Model(){
         for(const auto& texture: loaded_textures)
             delete texture.tex;
@@ -243,15 +1096,70 @@ private:
     std::vector<Texture> loaded_textures;
     std::string model_path;
     std::string directory;
+    // 在工作线程中预先解码的外部纹理图片, 按文件路径索引, 加载完成后释放
+    struct DecodedImage{
+        unsigned char* pixels=nullptr;
+        int width=0, height=0, channels=0;
+    };
+    std::unordered_map<std::string, DecodedImage> decoded_images;
+    // 每个 aiMaterial 对应一个材质, 使用同一材质的网格共享
+    std::unordered_map<unsigned int, std::shared_ptr<Material>> materials;
+    TextureArrayManager* texture_arrays=nullptr;
+    // 已放入纹理数组的贴图, 按文件路径索引
+    std::unordered_map<std::string, const TextureRegion*> loaded_regions;
+    std::unique_ptr<Skeleton> model_skeleton;
+    std::vector<std::unique_ptr<AnimationClip>> clips;
     void load_model(std::string path){
+        profile_scope("Model::load_model");
         Assimp::Importer import;
-        const aiScene *scene = import.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);    
+        // 每个顶点最多保留4个骨骼权重
+        const aiScene *scene = import.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_LimitBoneWeights);
 
         assert_with_info(!(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode), "ERROR::ASSIMP::%s", import.GetErrorString());
 
         directory = path.substr(0, path.find_last_of('/'));
 
+        decode_images(scene);
+        model_skeleton = Skeleton::load(scene);
         process_node(scene->mRootNode, scene);
+        if(model_skeleton != nullptr){
+            for(unsigned int i = 0; i < scene->mNumAnimations; i++)
+                clips.push_back(AnimationClip::load(scene->mAnimations[i], *model_skeleton));
+            log_info("Skeleton %zu nodes %zu joints, %zu animations.", model_skeleton->nodes().size(),
+                model_skeleton->joints().size(), clips.size());
+        }
+        if(texture_arrays != nullptr)
+            texture_arrays->build();
+        for(auto& image: decoded_images)
+            stbi_image_free(image.second.pixels);
+        decoded_images.clear();
+    }
+    /**
+     * @brief 并行解码所有材质引用的外部图片, 纹理对象仍在主线程创建
+     */
+    void decode_images(const aiScene *scene){
+        profile_scope("Model::decode_images");
+        std::vector<std::string> paths;
+        for(unsigned int i = 0; i < scene->mNumMaterials; i++){
+            for(auto type: {aiTextureType_DIFFUSE, aiTextureType_SPECULAR}){
+                for(unsigned int j = 0; j < scene->mMaterials[i]->GetTextureCount(type); j++){
+                    aiString filename;
+                    scene->mMaterials[i]->GetTexture(type, j, &filename);
+                    if(scene->GetEmbeddedTexture(filename.C_Str()) != nullptr)
+                        continue;
+                    std::string filepath = directory + '/' + std::string(filename.C_Str());
+                    if(decoded_images.emplace(filepath, DecodedImage{}).second)
+                        paths.push_back(filepath);
+                }
+            }
+        }
+        job_system::parallel_for(0, paths.size(), [&](size_t beg, size_t end){
+            for(size_t i = beg; i < end; i++){
+                // 各线程只写入自己负责的元素, 表结构在并行阶段不变
+                auto& image = decoded_images.at(paths[i]);
+                image.pixels = stbi_load(paths[i].c_str(), &image.width, &image.height, &image.channels, 0);
+            }
+        });
     }
     std::vector<Texture> process_texture(aiMaterial * mat, aiTextureType type, const aiScene *scene){
         Texture::Type tex_type;
@@ -263,7 +1171,7 @@ private:
         std::vector<Texture> textures;
         for(unsigned int i = 0; i < mat->GetTextureCount(type); i++)
         {
-            printf("texture %d %d\n", int(tex_type), i);
+            log_trace("texture %d %d", int(tex_type), i);
             aiString filename;
             mat->GetTexture(type, i, &filename);
             std::string filepath = directory + '/' + std::string(filename.C_Str());
@@ -282,15 +1190,54 @@ private:
                 auto size = aitexture->mHeight == 0 ? aitexture->mWidth : aitexture->mHeight * aitexture->mWidth;
                 tex = new texture_t(reinterpret_cast<unsigned char*>(aitexture->pcData), size);
             }else{
-                tex = new texture_t(filepath.c_str());
+                auto decoded = decoded_images.find(filepath);
+                if(decoded != decoded_images.end() && decoded->second.pixels != nullptr){
+                    const auto& image = decoded->second;
+                    tex = new texture_t(image.pixels, image.width, image.height, image.channels, filepath.c_str());
+                    log_debug("Texture %s %d*%d %dchs readed.", filepath.c_str(), image.height, image.width, image.channels);
+                }else{
+                    tex = new texture_t(filepath.c_str());
+                }
             }
             textures.emplace_back(Texture{tex_type, tex});
             loaded_textures.emplace_back(Texture{tex_type, tex});
         }
         return textures;
     }
-    Mesh process_mesh(aiMesh *mesh, const aiScene *scene){
+    /**
+     * @brief 把材质的第一张该类贴图放入纹理数组, 没有该类贴图时返回空
+     */
+    const TextureRegion* process_region(aiMaterial * mat, aiTextureType type, const aiScene *scene){
+        if(mat->GetTextureCount(type) == 0) return nullptr;
+        aiString filename;
+        mat->GetTexture(type, 0, &filename);
+        std::string filepath = directory + '/' + std::string(filename.C_Str());
+        auto& region = loaded_regions[filepath];
+        if(region != nullptr) return region;
+        auto aitexture = scene->GetEmbeddedTexture(filename.C_Str());
+        if(aitexture!=nullptr){
+            auto size = aitexture->mHeight == 0 ? aitexture->mWidth : aitexture->mHeight * aitexture->mWidth;
+            int width, height, channels;
+            auto pixels = stbi_load_from_memory(reinterpret_cast<unsigned char*>(aitexture->pcData), size, &width, &height, &channels, 0);
+            if(pixels == nullptr)
+                panic_with_info("Fail to load embedded texture %s", filename.C_Str());
+            region = texture_arrays->add(pixels, width, height, channels);
+            stbi_image_free(pixels);
+        }else{
+            auto decoded = decoded_images.find(filepath);
+            if(decoded != decoded_images.end() && decoded->second.pixels != nullptr){
+                const auto& image = decoded->second;
+                region = texture_arrays->add(image.pixels, image.width, image.height, image.channels);
+            }else{
+                region = texture_arrays->add(filepath.c_str());
+            }
+        }
+        return region;
+    }
+    Mesh process_mesh(aiMesh *mesh, const aiScene *scene, const aiNode *node){
         Mesh res;
+        res.vertex_data.reserve(mesh->mNumVertices);
+        res.indices.reserve(size_t(mesh->mNumFaces) * 3);
         // 处理顶点数据
         for(unsigned int i = 0; i < mesh->mNumVertices; i++){
             res.vertex_data.emplace_back(Vertex{
@@ -307,12 +1254,34 @@ private:
             for(unsigned int j = 0; j < face.mNumIndices; j++)
                 res.indices.push_back(face.mIndices[j]);
         }
+        if(model_skeleton != nullptr)
+            res.skin = model_skeleton->bind_mesh(mesh, node->mName.C_Str());
         // 处理材质数据
         if(mesh->mMaterialIndex>=0){
-            auto tex_diff = process_texture(scene->mMaterials[mesh->mMaterialIndex], aiTextureType_DIFFUSE, scene);
-            res.textures.insert(res.textures.end(), tex_diff.begin(), tex_diff.end());
-            auto tex_spe = process_texture(scene->mMaterials[mesh->mMaterialIndex], aiTextureType_SPECULAR, scene);
-            res.textures.insert(res.textures.end(), tex_spe.begin(), tex_spe.end());
+            auto ai_material = scene->mMaterials[mesh->mMaterialIndex];
+            if(texture_arrays == nullptr){
+                auto tex_diff = process_texture(ai_material, aiTextureType_DIFFUSE, scene);
+                res.textures.insert(res.textures.end(), tex_diff.begin(), tex_diff.end());
+                auto tex_spe = process_texture(ai_material, aiTextureType_SPECULAR, scene);
+                res.textures.insert(res.textures.end(), tex_spe.begin(), tex_spe.end());
+            }
+            auto& material = materials[mesh->mMaterialIndex];
+            if(material == nullptr){
+                MaterialParams params;
+                float shininess = 0;
+                if(ai_material->Get(AI_MATKEY_SHININESS, shininess) == AI_SUCCESS && shininess > 0)
+                    params.shininess = shininess;
+                if(texture_arrays != nullptr){
+                    material = std::make_shared<Material>();
+                    material->params = params;
+                    material->diffuse_region = process_region(ai_material, aiTextureType_DIFFUSE, scene);
+                    material->specular_region = process_region(ai_material, aiTextureType_SPECULAR, scene);
+                }else{
+                    material = std::make_shared<Material>(res.textures, params);
+                }
+                material->skinned = model_skeleton != nullptr;
+            }
+            res.material = material;
         }
         return std::move(res);
     }
@@ -321,7 +1290,7 @@ private:
         for(unsigned int i = 0; i < node->mNumMeshes; i++)
         {
             aiMesh *mesh = scene->mMeshes[node->mMeshes[i]]; 
-            meshes.push_back(process_mesh(mesh, scene));         
+            meshes.push_back(process_mesh(mesh, scene, node));         
         }
         // 接下来对它的子节点重复这一过程
         for(unsigned int i = 0; i < node->mNumChildren; i++)
@@ -0,0 +1,389 @@
+#include "core/occlusion_culler.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include "utils/debug.hpp"
+#include "utils/job_system.hpp"
+#include "utils/profiler.hpp"
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace Ez3DGL;
+
+namespace {
+
+constexpr int tile_w = 32;
+constexpr int tile_h = 32;
+// 裁剪后多边形最多的顶点数(三角形被近平面与4个保护带平面裁剪)
+constexpr int max_clip_vertices = 8;
+// 每个三角形裁剪后最多的三角形数
+constexpr int max_clip_triangles = max_clip_vertices - 2;
+// 保护带: 屏幕外超出该倍数的部分裁掉, 避免过大的坐标损失边函数的精度
+constexpr float guard_band = 4.f;
+
+/*
+ * 一行中同时处理的像素, 接口相同, 按编译选项选择实现
+ */
+#if defined(__AVX2__)
+struct lanes_t{
+    static constexpr int width = 8;
+    using vec = __m256;
+    static vec set1(float v){ return _mm256_set1_ps(v); }
+    static vec ramp(){ return _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f); }
+    static vec add(vec a, vec b){ return _mm256_add_ps(a, b); }
+    static vec mul(vec a, vec b){ return _mm256_mul_ps(a, b); }
+    static vec min(vec a, vec b){ return _mm256_min_ps(a, b); }
+    static vec load(const float* p){ return _mm256_loadu_ps(p); }
+    static void store(float* p, vec v){ _mm256_storeu_ps(p, v); }
+    static vec inside(vec e0, vec e1, vec e2){
+        const vec zero = _mm256_setzero_ps();
+        return _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(e0, zero, _CMP_GE_OQ), _mm256_cmp_ps(e1, zero, _CMP_GE_OQ)),
+            _mm256_cmp_ps(e2, zero, _CMP_GE_OQ));
+    }
+    static bool any(vec mask){ return _mm256_movemask_ps(mask) != 0; }
+    // mask 为真的通道取 a, 否则取 b
+    static vec select(vec mask, vec a, vec b){ return _mm256_blendv_ps(b, a, mask); }
+};
+#elif defined(__SSE2__)
+struct lanes_t{
+    static constexpr int width = 4;
+    using vec = __m128;
+    static vec set1(float v){ return _mm_set1_ps(v); }
+    static vec ramp(){ return _mm_setr_ps(0.f, 1.f, 2.f, 3.f); }
+    static vec add(vec a, vec b){ return _mm_add_ps(a, b); }
+    static vec mul(vec a, vec b){ return _mm_mul_ps(a, b); }
+    static vec min(vec a, vec b){ return _mm_min_ps(a, b); }
+    static vec load(const float* p){ return _mm_loadu_ps(p); }
+    static void store(float* p, vec v){ _mm_storeu_ps(p, v); }
+    static vec inside(vec e0, vec e1, vec e2){
+        const vec zero = _mm_setzero_ps();
+        return _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+    }
+    static bool any(vec mask){ return _mm_movemask_ps(mask) != 0; }
+    static vec select(vec mask, vec a, vec b){ return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+};
+#else
+struct lanes_t{
+    static constexpr int width = 1;
+    using vec = float;
+    static vec set1(float v){ return v; }
+    static vec ramp(){ return 0.f; }
+    static vec add(vec a, vec b){ return a + b; }
+    static vec mul(vec a, vec b){ return a * b; }
+    static vec min(vec a, vec b){ return std::min(a, b); }
+    static vec load(const float* p){ return *p; }
+    static void store(float* p, vec v){ *p = v; }
+    static vec inside(vec e0, vec e1, vec e2){ return e0 >= 0.f && e1 >= 0.f && e2 >= 0.f ? 1.f : 0.f; }
+    static bool any(vec mask){ return mask != 0.f; }
+    static vec select(vec mask, vec a, vec b){ return mask != 0.f ? a : b; }
+};
+#endif
+
+// 用平面 dot(plane, v) >= 0 裁剪多边形, 返回裁剪后的顶点数
+int clip_polygon(const glm::vec4* in, int n, glm::vec4* out, const glm::vec4& plane){
+    int m = 0;
+    for(int i=0; i<n; i++){
+        const glm::vec4& a = in[i];
+        const glm::vec4& b = in[(i + 1) % n];
+        const float da = glm::dot(plane, a), db = glm::dot(plane, b);
+        if(da >= 0)
+            out[m++] = a;
+        if((da >= 0) != (db >= 0))
+            out[m++] = a + (b - a) * (da / (da - db));
+    }
+    return m;
+}
+
+}
+
+const char* OcclusionCuller::simd_name(){
+#if defined(__AVX2__)
+    return "avx2";
+#elif defined(__SSE2__)
+    return "sse";
+#else
+    return "scalar";
+#endif
+}
+
+OcclusionCuller::OcclusionCuller(int width, int height){
+    assert_with_info(width>0 && height>0, "invalid occlusion buffer %d*%d", width, height);
+    // 行宽为8的倍数, SIMD 读写不会越过行尾
+    buffer_w = (width + 7) / 8 * 8;
+    buffer_h = height;
+    tile_cols = (buffer_w + tile_w - 1) / tile_w;
+    tile_rows = (buffer_h + tile_h - 1) / tile_h;
+    tile_bins.resize(size_t(tile_cols) * tile_rows);
+    int w = buffer_w, h = buffer_h;
+    levels.push_back(level_t{w, h, std::vector<float>(size_t(w) * h, 1.f)});
+    while(w > 1 || h > 1){
+        w = std::max(1, (w + 1) / 2);
+        h = std::max(1, (h + 1) / 2);
+        levels.push_back(level_t{w, h, std::vector<float>(size_t(w) * h, 1.f)});
+    }
+}
+
+void OcclusionCuller::begin_frame(const camera_t* camera){
+    begin_frame(camera->projection * camera->view);
+}
+
+void OcclusionCuller::begin_frame(const glm::mat4& view_projection){
+    this->view_projection = view_projection;
+    occluders.clear();
+    occluder_offsets.clear();
+    occluder_triangles = rasterized_triangles = 0;
+    tested = frustum_culled = occluded = 0;
+    rasterized = false;
+}
+
+void OcclusionCuller::add_occluder(const float* positions, size_t stride, const unsigned int* indices, size_t index_num, const glm::mat4& model){
+    assert_with_info(!rasterized, "add occluders before rasterize");
+    occluder_offsets.push_back(occluder_triangles);
+    occluders.push_back(occluder_t{positions, stride, indices, index_num / 3, view_projection * model});
+    occluder_triangles += uint32_t(index_num / 3);
+}
+
+void OcclusionCuller::setup_triangles(size_t beg, size_t end){
+    static const glm::vec4 clip_planes[5] = {
+        // 近平面 z >= -w
+        glm::vec4(0.f, 0.f, 1.f, 1.f),
+        glm::vec4(1.f, 0.f, 0.f, guard_band), glm::vec4(-1.f, 0.f, 0.f, guard_band),
+        glm::vec4(0.f, 1.f, 0.f, guard_band), glm::vec4(0.f, -1.f, 0.f, guard_band),
+    };
+    size_t occluder = std::upper_bound(occluder_offsets.begin(), occluder_offsets.end(), beg) - occluder_offsets.begin() - 1;
+    for(size_t i=beg; i<end; i++){
+        while(i >= occluder_offsets[occluder] + occluders[occluder].triangle_num)
+            occluder += 1;
+        const auto& src = occluders[occluder];
+        const unsigned int* tri = src.indices + (i - occluder_offsets[occluder]) * 3;
+        uint8_t* valid = triangle_valid.data() + i * max_clip_triangles;
+        memset(valid, 0, max_clip_triangles);
+
+        glm::vec4 poly[2][max_clip_vertices];
+        int outside_mask = 0x3F;
+        for(int k=0; k<3; k++){
+            const float* p = src.positions + size_t(tri[k]) * src.stride;
+            const glm::vec4 v = src.mvp * glm::vec4(p[0], p[1], p[2], 1.f);
+            poly[0][k] = v;
+            int outside = 0;
+            if(v.x < -v.w) outside |= 1;
+            if(v.x > v.w) outside |= 2;
+            if(v.y < -v.w) outside |= 4;
+            if(v.y > v.w) outside |= 8;
+            if(v.z < -v.w) outside |= 16;
+            if(v.z > v.w) outside |= 32;
+            outside_mask &= outside;
+        }
+        // 三个顶点都在同一裁剪面外
+        if(outside_mask != 0) continue;
+        int n = 3, cur = 0;
+        for(const auto& plane: clip_planes){
+            n = clip_polygon(poly[cur], n, poly[cur ^ 1], plane);
+            cur ^= 1;
+            if(n < 3) break;
+        }
+        if(n < 3) continue;
+        glm::vec3 screen[max_clip_vertices];
+        for(int k=0; k<n; k++){
+            const glm::vec4& v = poly[cur][k];
+            const float inv_w = 1.f / v.w;
+            screen[k] = glm::vec3((v.x * inv_w * 0.5f + 0.5f) * buffer_w, (v.y * inv_w * 0.5f + 0.5f) * buffer_h,
+                std::clamp(v.z * inv_w * 0.5f + 0.5f, 0.f, 1.f));
+        }
+        // 扇形三角化
+        for(int k=1; k+1<n; k++){
+            auto& out = triangles[i * max_clip_triangles + k - 1];
+            const glm::vec3* v[3] = {&screen[0], &screen[k], &screen[k + 1]};
+            for(int j=0; j<3; j++){
+                out.x[j] = v[j]->x;
+                out.y[j] = v[j]->y;
+                out.z[j] = v[j]->z;
+            }
+            const float area = (out.x[1] - out.x[0]) * (out.y[2] - out.y[0]) - (out.y[1] - out.y[0]) * (out.x[2] - out.x[0]);
+            if(std::fabs(area) < 1e-6f) continue;
+            // 统一为逆时针
+            if(area < 0){
+                std::swap(out.x[1], out.x[2]);
+                std::swap(out.y[1], out.y[2]);
+                std::swap(out.z[1], out.z[2]);
+            }
+            valid[k - 1] = 1;
+        }
+    }
+}
+
+void OcclusionCuller::bin_triangles(){
+    for(auto& bin: tile_bins)
+        bin.clear();
+    for(size_t i=0; i<triangles.size(); i++){
+        if(!triangle_valid[i]) continue;
+        const auto& tri = triangles[i];
+        const float min_x = std::min({tri.x[0], tri.x[1], tri.x[2]}), max_x = std::max({tri.x[0], tri.x[1], tri.x[2]});
+        const float min_y = std::min({tri.y[0], tri.y[1], tri.y[2]}), max_y = std::max({tri.y[0], tri.y[1], tri.y[2]});
+        if(max_x < 0 || max_y < 0 || min_x >= buffer_w || min_y >= buffer_h) continue;
+        const int tx0 = std::max(0, int(min_x) / tile_w), tx1 = std::min(tile_cols - 1, int(max_x) / tile_w);
+        const int ty0 = std::max(0, int(min_y) / tile_h), ty1 = std::min(tile_rows - 1, int(max_y) / tile_h);
+        for(int ty=ty0; ty<=ty1; ty++)
+            for(int tx=tx0; tx<=tx1; tx++)
+                tile_bins[size_t(ty) * tile_cols + tx].push_back(uint32_t(i));
+        rasterized_triangles += 1;
+    }
+}
+
+void OcclusionCuller::rasterize_tile(int tile){
+    using L = lanes_t;
+    const int tile_x0 = tile % tile_cols * tile_w, tile_y0 = tile / tile_cols * tile_h;
+    const int tile_x1 = std::min(tile_x0 + tile_w, buffer_w) - 1, tile_y1 = std::min(tile_y0 + tile_h, buffer_h) - 1;
+    float* depth = levels.front().depth.data();
+    for(auto index: tile_bins[tile]){
+        const auto& t = triangles[index];
+        // 边函数 E(p) = A*x + B*y + C, 在边的左侧为正; 第k条边与第k个顶点相对
+        float A[3], B[3], C[3];
+        for(int k=0; k<3; k++){
+            const int a = (k + 1) % 3, b = (k + 2) % 3;
+            A[k] = t.y[a] - t.y[b];
+            B[k] = t.x[b] - t.x[a];
+            C[k] = -(A[k] * t.x[a] + B[k] * t.y[a]);
+        }
+        const float area = A[0] * t.x[0] + B[0] * t.y[0] + C[0];
+        // 深度在屏幕空间中是线性的: z = zA*x + zB*y + zC
+        const float zA = (A[0] * t.z[0] + A[1] * t.z[1] + A[2] * t.z[2]) / area;
+        const float zB = (B[0] * t.z[0] + B[1] * t.z[1] + B[2] * t.z[2]) / area;
+        const float zC = (C[0] * t.z[0] + C[1] * t.z[1] + C[2] * t.z[2]) / area;
+
+        const int x0 = std::max(tile_x0, int(std::floor(std::min({t.x[0], t.x[1], t.x[2]}))));
+        const int x1 = std::min(tile_x1, int(std::ceil(std::max({t.x[0], t.x[1], t.x[2]}))));
+        const int y0 = std::max(tile_y0, int(std::floor(std::min({t.y[0], t.y[1], t.y[2]}))));
+        const int y1 = std::min(tile_y1, int(std::ceil(std::max({t.y[0], t.y[1], t.y[2]}))));
+        if(x0 > x1 || y0 > y1) continue;
+        // 从对齐的位置开始, 整组读写; 分块宽度是 SIMD 宽度的倍数, 不会写到相邻分块
+        const int span_beg = x0 - (x0 - tile_x0) % L::width;
+        const L::vec ramp = L::ramp();
+        const L::vec a0 = L::set1(A[0]), a1 = L::set1(A[1]), a2 = L::set1(A[2]), za = L::set1(zA);
+        const L::vec step0 = L::set1(A[0] * L::width), step1 = L::set1(A[1] * L::width), step2 = L::set1(A[2] * L::width);
+        const L::vec zstep = L::set1(zA * L::width);
+        for(int y=y0; y<=y1; y++){
+            const float py = y + 0.5f;
+            const L::vec px = L::add(L::set1(span_beg + 0.5f), ramp);
+            L::vec e0 = L::add(L::mul(a0, px), L::set1(B[0] * py + C[0]));
+            L::vec e1 = L::add(L::mul(a1, px), L::set1(B[1] * py + C[1]));
+            L::vec e2 = L::add(L::mul(a2, px), L::set1(B[2] * py + C[2]));
+            L::vec z = L::add(L::mul(za, px), L::set1(zB * py + zC));
+            float* row = depth + size_t(y) * buffer_w;
+            for(int x=span_beg; x<=x1; x+=L::width){
+                const L::vec mask = L::inside(e0, e1, e2);
+                if(L::any(mask)){
+                    const L::vec old_depth = L::load(row + x);
+                    L::store(row + x, L::select(mask, L::min(old_depth, z), old_depth));
+                }
+                e0 = L::add(e0, step0);
+                e1 = L::add(e1, step1);
+                e2 = L::add(e2, step2);
+                z = L::add(z, zstep);
+            }
+        }
+    }
+}
+
+void OcclusionCuller::build_hiz(){
+    for(size_t l=1; l<levels.size(); l++){
+        const auto& src = levels[l - 1];
+        auto& dst = levels[l];
+        for(int y=0; y<dst.height; y++){
+            const int sy0 = std::min(y * 2, src.height - 1), sy1 = std::min(y * 2 + 1, src.height - 1);
+            for(int x=0; x<dst.width; x++){
+                const int sx0 = std::min(x * 2, src.width - 1), sx1 = std::min(x * 2 + 1, src.width - 1);
+                dst.depth[size_t(y) * dst.width + x] = std::max(
+                    std::max(src.depth[size_t(sy0) * src.width + sx0], src.depth[size_t(sy0) * src.width + sx1]),
+                    std::max(src.depth[size_t(sy1) * src.width + sx0], src.depth[size_t(sy1) * src.width + sx1]));
+            }
+        }
+    }
+}
+
+void OcclusionCuller::rasterize(){
+    profile_scope("OcclusionCuller::rasterize");
+    assert_with_info(!rasterized, "call begin_frame before rasterize");
+    std::fill(levels.front().depth.begin(), levels.front().depth.end(), 1.f);
+    triangles.resize(size_t(occluder_triangles) * max_clip_triangles);
+    triangle_valid.resize(triangles.size());
+    job_system::parallel_for(0, occluder_triangles, [this](size_t beg, size_t end){
+        setup_triangles(beg, end);
+    }, 256);
+    bin_triangles();
+    job_system::parallel_for(0, tile_bins.size(), [this](size_t beg, size_t end){
+        for(size_t tile=beg; tile<end; tile++)
+            rasterize_tile(int(tile));
+    });
+    build_hiz();
+    rasterized = true;
+}
+
+bool OcclusionCuller::test_aabb(const glm::vec3& local_min, const glm::vec3& local_max, const glm::mat4& model) const{
+    assert_with_info(rasterized, "call rasterize before test_aabb");
+    tested.fetch_add(1, std::memory_order_relaxed);
+    const glm::mat4 mvp = view_projection * model;
+    int outside_all = 0x3F;
+    bool crosses_near = false;
+    float min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX, min_z = FLT_MAX;
+    for(int k=0; k<8; k++){
+        const glm::vec3 corner(k & 1 ? local_max.x : local_min.x, k & 2 ? local_max.y : local_min.y, k & 4 ? local_max.z : local_min.z);
+        const glm::vec4 v = mvp * glm::vec4(corner, 1.f);
+        int outside = 0;
+        if(v.x < -v.w) outside |= 1;
+        if(v.x > v.w) outside |= 2;
+        if(v.y < -v.w) outside |= 4;
+        if(v.y > v.w) outside |= 8;
+        if(v.z < -v.w) outside |= 16;
+        if(v.z > v.w) outside |= 32;
+        outside_all &= outside;
+        if(v.z < -v.w || v.w <= 1e-6f){
+            crosses_near = true;
+            continue;
+        }
+        const float inv_w = 1.f / v.w;
+        min_x = std::min(min_x, v.x * inv_w);
+        max_x = std::max(max_x, v.x * inv_w);
+        min_y = std::min(min_y, v.y * inv_w);
+        max_y = std::max(max_y, v.y * inv_w);
+        min_z = std::min(min_z, v.z * inv_w);
+    }
+    if(outside_all != 0){
+        frustum_culled.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    // 与近平面相交的物体离相机很近, 视为可见
+    if(crosses_near) return true;
+
+    const int x0 = std::clamp(int(std::floor((min_x * 0.5f + 0.5f) * buffer_w)), 0, buffer_w - 1);
+    const int x1 = std::clamp(int(std::floor((max_x * 0.5f + 0.5f) * buffer_w)), 0, buffer_w - 1);
+    const int y0 = std::clamp(int(std::floor((min_y * 0.5f + 0.5f) * buffer_h)), 0, buffer_h - 1);
+    const int y1 = std::clamp(int(std::floor((max_y * 0.5f + 0.5f) * buffer_h)), 0, buffer_h - 1);
+    const float box_depth = min_z * 0.5f + 0.5f;
+    // 选择覆盖范围不超过4x4个像素的层级
+    size_t level = 0;
+    int size = std::max(x1 - x0, y1 - y0) + 1;
+    while(size > 4 && level + 1 < levels.size()){
+        size = (size + 1) / 2;
+        level += 1;
+    }
+    const auto& hiz = levels[level];
+    for(int y=y0>>level; y<=(y1>>level); y++)
+        for(int x=x0>>level; x<=(x1>>level); x++)
+            if(box_depth <= hiz.depth[size_t(y) * hiz.width + x])
+                return true;
+    occluded.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+OcclusionCuller::stats_t OcclusionCuller::stats() const{
+    stats_t res;
+    res.occluder_triangles = occluder_triangles;
+    res.rasterized_triangles = rasterized_triangles;
+    res.tested = tested.load(std::memory_order_relaxed);
+    res.frustum_culled = frustum_culled.load(std::memory_order_relaxed);
+    res.occluded = occluded.load(std::memory_order_relaxed);
+    return res;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file occlusion_culler.hpp
+ * @brief CPU软件遮挡剔除: 低分辨率深度缓冲光栅化遮挡体, 层次深度(Hi-Z)测试包围盒
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "vertices_layer.hpp"
+
+namespace Ez3DGL{
+
+/**
+ * @brief 遮挡剔除, 每帧先把选定的遮挡体(墙, 建筑等大而简单的网格)光栅化到低分辨率深度缓冲,
+ * 再用其层次深度测试候选物体的包围盒, 被完全遮挡的物体不再绘制
+ * @note 光栅化按屏幕分块在 job_system 上并行, 每块内以 SIMD 一次处理一行中的多个像素
+ * (编译时开启 AVX2 时8个, 否则SSE 4个, 非x86平台逐像素); 全部在CPU上完成, 不需要GL上下文
+ *
+ */
+class OcclusionCuller{
+public:
+    struct stats_t{
+        // 本帧加入的遮挡体三角形数, 以及裁剪后实际光栅化的三角形数
+        uint32_t occluder_triangles = 0;
+        uint32_t rasterized_triangles = 0;
+        // 测试的包围盒数, 其中在视锥外与被遮挡的数量
+        uint32_t tested = 0;
+        uint32_t frustum_culled = 0;
+        uint32_t occluded = 0;
+    };
+
+    /**
+     * @param width 深度缓冲宽度, 向上取整到8的倍数
+     * @param height 深度缓冲高度
+     */
+    explicit OcclusionCuller(int width=256, int height=128);
+
+    /**
+     * @brief 开始新的一帧, 清空深度缓冲与遮挡体, 使用相机当前的 view/projection
+     */
+    void begin_frame(const camera_t* camera);
+    void begin_frame(const glm::mat4& view_projection);
+    /**
+     * @brief 加入遮挡体, 数据在 rasterize 前不会被复制, 需保持有效
+     * @param positions 第一个顶点的位置, 相邻顶点间隔 stride 个 float
+     * @param indices 三角形索引
+     */
+    void add_occluder(const float* positions, size_t stride, const unsigned int* indices, size_t index_num, const glm::mat4& model);
+    /**
+     * @brief 光栅化所有遮挡体并构建层次深度, 之后才能调用 test_aabb
+     */
+    void rasterize();
+    /**
+     * @brief 测试局部空间包围盒经 model 变换后是否可能可见, 线程安全
+     * @return 在视锥外或被完全遮挡时返回 false
+     */
+    bool test_aabb(const glm::vec3& local_min, const glm::vec3& local_max, const glm::mat4& model) const;
+
+    stats_t stats() const;
+    int width() const{
+        return buffer_w;
+    }
+    int height() const{
+        return buffer_h;
+    }
+    /**
+     * @brief 第0级深度缓冲, 行优先, 第0行在屏幕底部, 值为 [0,1] 的窗口深度(1为远平面)
+     */
+    const float* depth_buffer() const{
+        return levels.front().depth.data();
+    }
+    // 当前编译使用的SIMD指令集: "avx2", "sse" 或 "scalar"
+    static const char* simd_name();
+private:
+    struct occluder_t{
+        const float* positions;
+        size_t stride;
+        const unsigned int* indices;
+        size_t triangle_num;
+        glm::mat4 mvp;
+    };
+    // 屏幕空间三角形, 坐标以像素为单位
+    struct triangle_t{
+        float x[3], y[3], z[3];
+    };
+    struct level_t{
+        int width, height;
+        std::vector<float> depth;
+    };
+
+    int buffer_w, buffer_h;
+    // 分块数
+    int tile_cols, tile_rows;
+    glm::mat4 view_projection = glm::mat4(1.f);
+
+    std::vector<occluder_t> occluders;
+    // 各遮挡体第一个三角形的全局序号
+    std::vector<size_t> occluder_offsets;
+    // 每个遮挡体三角形被近平面与保护带裁剪后最多得到6个三角形
+    std::vector<triangle_t> triangles;
+    std::vector<uint8_t> triangle_valid;
+    std::vector<std::vector<uint32_t>> tile_bins;
+    // 第0级为深度缓冲, 之后每级取 2x2 中的最大(最远)深度
+    std::vector<level_t> levels;
+    bool rasterized = false;
+
+    uint32_t occluder_triangles = 0, rasterized_triangles = 0;
+    mutable std::atomic<uint32_t> tested{0}, frustum_culled{0}, occluded{0};
+
+    void setup_triangles(size_t beg, size_t end);
+    void bin_triangles();
+    void rasterize_tile(int tile);
+    void build_hiz();
+};
+
+}
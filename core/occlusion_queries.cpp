@@ -0,0 +1,182 @@
+#include "core/occlusion_queries.hpp"
+#include <algorithm>
+#include "utils/debug.hpp"
+#include "utils/preset.hpp"
+#include "utils/profiler.hpp"
+
+using namespace Ez3DGL;
+
+// 超过该帧数未使用的物体不再跟踪
+static constexpr uint64_t unused_frames = 120;
+
+OcclusionQueries::OcclusionQueries(uint32_t check_interval):check_interval(std::max(1u, check_interval)){
+}
+
+OcclusionQueries::~OcclusionQueries(){
+    for(auto object: pending)
+        query_pool.push_back(object->query);
+    if(!query_pool.empty())
+        glDeleteQueries(GLsizei(query_pool.size()), query_pool.data());
+    delete box;
+    delete box_shader;
+}
+
+void OcclusionQueries::setup(){
+    assert_with_info(box==nullptr, "occlusion queries are already setup");
+    static const float cube[] = {
+        0.f, 0.f, 0.f,  1.f, 0.f, 0.f,  1.f, 1.f, 0.f,  0.f, 1.f, 0.f,
+        0.f, 0.f, 1.f,  1.f, 0.f, 1.f,  1.f, 1.f, 1.f,  0.f, 1.f, 1.f,
+    };
+    static const unsigned int cube_indices[] = {
+        0, 2, 1, 0, 3, 2,  4, 5, 6, 4, 6, 7,  0, 1, 5, 0, 5, 4,
+        3, 6, 2, 3, 7, 6,  0, 4, 7, 0, 7, 3,  1, 2, 6, 1, 6, 5,
+    };
+    box = new vertices_t(24, {3}, cube, 36, cube_indices);
+    box_shader = new shader_t(preset::shader::vs_bounding_box(), preset::shader::fs_empty(), "view", "projection", "model");
+    loc_model = box_shader->uniform_location("model");
+    loc_box_min = box_shader->uniform_location("box_min");
+    loc_box_max = box_shader->uniform_location("box_max");
+}
+
+unsigned int OcclusionQueries::acquire_query(){
+    unsigned int query;
+    if(query_pool.empty()){
+        glGenQueries(1, &query);
+    }else{
+        query = query_pool.back();
+        query_pool.pop_back();
+    }
+    return query;
+}
+
+void OcclusionQueries::begin_frame(){
+    profile_scope("OcclusionQueries::begin_frame");
+    frame += 1;
+    frame_stats = stats_t();
+    for(size_t i=0; i<pending.size();){
+        auto& object = *pending[i];
+        GLint available = 0;
+        glGetQueryObjectiv(object.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available){
+            i++;
+            continue;
+        }
+        GLuint any_samples = 0;
+        glGetQueryObjectuiv(object.query, GL_QUERY_RESULT, &any_samples);
+        frame_stats.results_read += 1;
+        if(any_samples != 0)
+            object.next_check = frame + check_interval;
+        object.visible = any_samples != 0;
+        query_pool.push_back(object.query);
+        object.query = 0;
+        pending[i] = pending.back();
+        pending.pop_back();
+    }
+    if(frame % 64 == 0)
+        evict_unused();
+}
+
+void OcclusionQueries::evict_unused(){
+    for(auto it=objects.begin(); it!=objects.end();){
+        if(it->second.query == 0 && it->second.last_used + unused_frames < frame)
+            it = objects.erase(it);
+        else
+            ++it;
+    }
+}
+
+OcclusionQueries::object_t& OcclusionQueries::object(const void* mesh, const void* instance){
+    const key_t key{mesh, instance};
+    auto it = objects.find(key);
+    if(it == objects.end()){
+        it = objects.emplace(key, object_t()).first;
+        // 错开各物体确认可见性的帧
+        it->second.next_check = frame + key_hash_t()(key) % check_interval;
+    }
+    auto& object = it->second;
+    object.last_used = frame;
+    frame_stats.objects += 1;
+    if(object.visible)
+        frame_stats.visible += 1;
+    else
+        frame_stats.skipped += 1;
+    return object;
+}
+
+bool OcclusionQueries::begin_query(object_t& object){
+    if(object.query != 0 || frame < object.next_check) return false;
+    object.query = acquire_query();
+    pending.push_back(&object);
+    frame_stats.queries_issued += 1;
+    glBeginQuery(GL_ANY_SAMPLES_PASSED, object.query);
+    return true;
+}
+
+void OcclusionQueries::end_query(){
+    glEndQuery(GL_ANY_SAMPLES_PASSED);
+}
+
+void OcclusionQueries::begin_box_queries(const camera_t* camera){
+    assert_with_info(box!=nullptr, "forget to setup occlusion queries");
+    box_shader->use();
+    box_shader->update_camera(camera);
+    camera_pos = camera->position;
+    near_margin = camera->z_near * 2.f;
+    // 记下调用者的写入掩码(如深度预通道的着色阶段关闭了深度写入), 结束时恢复
+    glGetIntegerv(GL_COLOR_WRITEMASK, saved_color_mask);
+    glGetIntegerv(GL_DEPTH_WRITEMASK, &saved_depth_mask);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+}
+
+void OcclusionQueries::query_box(object_t& object, const glm::vec3& bounds_min, const glm::vec3& bounds_max, const glm::mat4& model){
+    // 上一帧的查询尚未完成时不重发, 本帧的 begin_conditional 以该旧查询为条件, 即可见性滞后一帧
+    if(object.query != 0) return;
+    // 相机在包围盒内(或靠近到被近平面裁掉)时包围盒查询不可靠, 直接视为可见
+    glm::vec3 world_min(INFINITY), world_max(-INFINITY);
+    for(int k=0; k<8; k++){
+        const glm::vec3 corner(k & 1 ? bounds_max.x : bounds_min.x, k & 2 ? bounds_max.y : bounds_min.y, k & 4 ? bounds_max.z : bounds_min.z);
+        const glm::vec3 world = glm::vec3(model * glm::vec4(corner, 1.f));
+        world_min = glm::min(world_min, world);
+        world_max = glm::max(world_max, world);
+    }
+    if(camera_pos.x >= world_min.x - near_margin && camera_pos.x <= world_max.x + near_margin &&
+       camera_pos.y >= world_min.y - near_margin && camera_pos.y <= world_max.y + near_margin &&
+       camera_pos.z >= world_min.z - near_margin && camera_pos.z <= world_max.z + near_margin){
+        object.visible = true;
+        object.next_check = frame + check_interval;
+        return;
+    }
+    object.query = acquire_query();
+    pending.push_back(&object);
+    frame_stats.queries_issued += 1;
+    frame_stats.box_queries += 1;
+    box_shader->set_uniform_at(loc_model, model);
+    box_shader->set_uniform_at(loc_box_min, bounds_min);
+    box_shader->set_uniform_at(loc_box_max, bounds_max);
+    glBeginQuery(GL_ANY_SAMPLES_PASSED, object.query);
+    box->draw_element(GL_TRIANGLES);
+    glEndQuery(GL_ANY_SAMPLES_PASSED);
+}
+
+void OcclusionQueries::end_box_queries(){
+    glColorMask(GLboolean(saved_color_mask[0]), GLboolean(saved_color_mask[1]), GLboolean(saved_color_mask[2]), GLboolean(saved_color_mask[3]));
+    glDepthMask(GLboolean(saved_depth_mask));
+}
+
+bool OcclusionQueries::begin_conditional(const object_t& object){
+    conditional_active = false;
+    if(object.query == 0)
+        return object.visible;
+    // GPU等待查询结果, CPU不等待
+    glBeginConditionalRender(object.query, GL_QUERY_WAIT);
+    conditional_active = true;
+    frame_stats.conditional_draws += 1;
+    return true;
+}
+
+void OcclusionQueries::end_conditional(){
+    if(conditional_active)
+        glEndConditionalRender();
+    conditional_active = false;
+}
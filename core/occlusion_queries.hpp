@@ -0,0 +1,137 @@
+/**
+ * @file occlusion_queries.hpp
+ * @brief 时间相干的硬件遮挡查询(Coherent Hierarchical Culling): 复用上一帧的可见性, 异步读取查询结果
+ *
+ */
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include "vertices_layer.hpp"
+
+namespace Ez3DGL{
+
+/**
+ * @brief 基于遮挡查询的剔除, 物体由(网格, 实例)两个指针标识
+ *
+ * 每帧按上一帧已知的可见性处理:
+ * - 可见的物体直接绘制, 每隔 check_interval 帧把绘制本身包在查询中, 确认仍然可见;
+ * - 不可见的物体不直接绘制, 以包围盒发出查询(关闭颜色与深度写入), 再以该查询做条件渲染,
+ *   包围盒可见时GPU当帧就绘制物体, 不会因结果延迟而闪烁.
+ * 查询结果只在 GL_QUERY_RESULT_AVAILABLE 为真时读取, CPU从不等待GPU; 每个物体同时最多一个未完成的查询
+ * @note 需要在 OpenGL 上下文中调用 setup(); 物体按从前到后的顺序绘制时剔除效果最好
+ *
+ * 用法:
+ *     queries.begin_frame();
+ *     model.draw(&shader, camera, model_mat, &queries);
+ */
+class OcclusionQueries{
+public:
+    struct stats_t{
+        // 本帧处理的物体数, 直接绘制的数量与被跳过(未直接绘制)的数量
+        uint32_t objects = 0;
+        uint32_t visible = 0;
+        uint32_t skipped = 0;
+        // 本帧发出的查询数, 其中以包围盒发出的数量
+        uint32_t queries_issued = 0;
+        uint32_t box_queries = 0;
+        // 条件渲染的绘制数, 以及本帧读回的查询结果数
+        uint32_t conditional_draws = 0;
+        uint32_t results_read = 0;
+    };
+    struct object_t{
+        bool visible = true;
+        // 未完成的查询, 0 表示没有
+        unsigned int query = 0;
+        // 下次确认可见性的帧
+        uint64_t next_check = 0;
+        uint64_t last_used = 0;
+    };
+
+    /**
+     * @param check_interval 可见物体重新确认可见性的间隔帧数, 各物体错开
+     */
+    explicit OcclusionQueries(uint32_t check_interval=8);
+    ~OcclusionQueries();
+
+    void setup();
+    /**
+     * @brief 读取已完成的查询并更新可见性, 不等待未完成的查询
+     */
+    void begin_frame();
+
+    /**
+     * @brief 取得物体的状态, 第一次出现的物体视为可见
+     */
+    object_t& object(const void* mesh, const void* instance);
+    /**
+     * @brief 可见物体绘制前调用, 需要确认可见性时开始查询并返回 true, 此时绘制后需调用 end_query
+     */
+    bool begin_query(object_t& object);
+    void end_query();
+
+    /**
+     * @brief 包围盒查询的批次, 期间关闭颜色与深度写入, 使用包围盒着色器; end_box_queries 恢复调用前的写入掩码
+     */
+    void begin_box_queries(const camera_t* camera);
+    /**
+     * @brief 不可见物体的包围盒查询, 已有未完成的查询时不发出新的查询
+     * @note 此时 begin_conditional 使用的是之前帧发出的查询, 结果相对当前帧滞后(通常一帧)
+     * @param bounds_min 局部空间包围盒
+     * @param model 包围盒的模型矩阵
+     */
+    void query_box(object_t& object, const glm::vec3& bounds_min, const glm::vec3& bounds_max, const glm::mat4& model);
+    void end_box_queries();
+    /**
+     * @brief 以物体未完成的查询开始条件渲染并返回 true, 没有查询时返回物体是否可见(直接绘制)
+     */
+    bool begin_conditional(const object_t& object);
+    void end_conditional();
+
+    const stats_t& stats() const{
+        return frame_stats;
+    }
+    // 当前跟踪的物体数
+    size_t object_num() const{
+        return objects.size();
+    }
+private:
+    struct key_t{
+        const void* mesh;
+        const void* instance;
+        bool operator==(const key_t& other) const{
+            return mesh == other.mesh && instance == other.instance;
+        }
+    };
+    struct key_hash_t{
+        size_t operator()(const key_t& key) const{
+            const size_t a = reinterpret_cast<size_t>(key.mesh), b = reinterpret_cast<size_t>(key.instance);
+            return a ^ (b + 0x9e3779b97f4a7c15ull + (a << 6) + (a >> 2));
+        }
+    };
+
+    uint32_t check_interval;
+    uint64_t frame = 0;
+    stats_t frame_stats;
+    std::unordered_map<key_t, object_t, key_hash_t> objects;
+    // 有未完成查询的物体
+    std::vector<object_t*> pending;
+    std::vector<unsigned int> query_pool;
+
+    vertices_t* box=nullptr;
+    shader_t* box_shader=nullptr;
+    int loc_model=-1, loc_box_min=-1, loc_box_max=-1;
+    glm::vec3 camera_pos = glm::vec3(0.f);
+    float near_margin = 0.f;
+    bool conditional_active = false;
+    // begin_box_queries 前的颜色与深度写入掩码
+    GLint saved_color_mask[4] = {GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE};
+    GLint saved_depth_mask = GL_TRUE;
+
+    unsigned int acquire_query();
+    void evict_unused();
+};
+
+}
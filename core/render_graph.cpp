@@ -0,0 +1,564 @@
+#include "core/render_graph.hpp"
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include "core/vertices_layer.hpp"
+#include "utils/debug.hpp"
+#include "utils/profiler.hpp"
+
+using namespace Ez3DGL;
+
+namespace {
+
+struct format_info_t{
+    GLenum internal_format, format, type;
+    uint32_t bytes;
+    // 深度格式的附着点, 颜色格式为0
+    GLenum attachment;
+    const char* name;
+};
+
+const format_info_t formats[] = {
+    {GL_R8,                 GL_RED,             GL_UNSIGNED_BYTE,                   1,  0, "R8"},
+    {GL_RG8,                GL_RG,              GL_UNSIGNED_BYTE,                   2,  0, "RG8"},
+    {GL_RGBA8,              GL_RGBA,            GL_UNSIGNED_BYTE,                   4,  0, "RGBA8"},
+    {GL_SRGB8_ALPHA8,       GL_RGBA,            GL_UNSIGNED_BYTE,                   4,  0, "SRGB8_A8"},
+    {GL_RGB10_A2,           GL_RGBA,            GL_UNSIGNED_INT_2_10_10_10_REV,     4,  0, "RGB10_A2"},
+    {GL_R11F_G11F_B10F,     GL_RGB,             GL_FLOAT,                           4,  0, "R11G11B10F"},
+    {GL_R16F,               GL_RED,             GL_FLOAT,                           2,  0, "R16F"},
+    {GL_RG16F,              GL_RG,              GL_FLOAT,                           4,  0, "RG16F"},
+    {GL_RGBA16F,            GL_RGBA,            GL_FLOAT,                           8,  0, "RGBA16F"},
+    {GL_R32F,               GL_RED,             GL_FLOAT,                           4,  0, "R32F"},
+    {GL_RG32F,              GL_RG,              GL_FLOAT,                           8,  0, "RG32F"},
+    {GL_RGBA32F,            GL_RGBA,            GL_FLOAT,                           16, 0, "RGBA32F"},
+    {GL_DEPTH_COMPONENT24,  GL_DEPTH_COMPONENT, GL_UNSIGNED_INT,                    4,  GL_DEPTH_ATTACHMENT, "D24"},
+    {GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT,                           4,  GL_DEPTH_ATTACHMENT, "D32F"},
+    {GL_DEPTH24_STENCIL8,   GL_DEPTH_STENCIL,   GL_UNSIGNED_INT_24_8,               4,  GL_DEPTH_STENCIL_ATTACHMENT, "D24S8"},
+};
+
+const format_info_t& format_info(GLenum internal_format){
+    for(const auto& info: formats)
+        if(info.internal_format == internal_format)
+            return info;
+    panic_with_info("unsupported render target format 0x%x", internal_format);
+    return formats[0];
+}
+
+bool same_desc(const RenderGraph::texture_desc_t& a, const RenderGraph::texture_desc_t& b){
+    return a.width == b.width && a.height == b.height && a.internal_format == b.internal_format;
+}
+
+double mib(uint64_t bytes){
+    return double(bytes) / (1024. * 1024.);
+}
+
+}
+
+/*
+ * 声明
+ */
+
+RenderGraph::handle_t RenderGraph::Builder::create_texture(const char* name, const texture_desc_t& desc){
+    assert_with_info(desc.width > 0 && desc.height > 0, "%s: invalid size %dx%d", name, desc.width, desc.height);
+    format_info(desc.internal_format);
+    return graph->add_resource(name, kind_t::texture, false, desc, 0, 0);
+}
+
+RenderGraph::handle_t RenderGraph::Builder::create_buffer(const char* name, size_t size){
+    assert_with_info(size > 0, "%s: empty buffer", name);
+    return graph->add_resource(name, kind_t::buffer, false, texture_desc_t(), size, 0);
+}
+
+RenderGraph::handle_t RenderGraph::Builder::read(handle_t resource){
+    assert_with_info(resource < graph->nodes.size(), "invalid render graph handle %u", resource);
+    auto& node = graph->nodes[resource];
+    const auto& res = graph->resources[node.resource];
+    assert_with_info(res.kind != kind_t::backbuffer, "pass %s: the backbuffer can not be read", graph->passes[pass].name);
+    assert_with_info(node.writer != no_pass || res.imported, "pass %s: %s is read before written", graph->passes[pass].name, res.name);
+    if(res.kind == kind_t::texture){
+        for(auto w: graph->passes[pass].writes){
+            assert_with_info(graph->nodes[w].resource != node.resource, "pass %s: %s is both read and written", graph->passes[pass].name, res.name);
+        }
+    }
+    auto& reads = graph->passes[pass].reads;
+    if(std::find(reads.begin(), reads.end(), resource) == reads.end()){
+        reads.push_back(resource);
+        node.refs += 1;
+    }
+    return resource;
+}
+
+RenderGraph::handle_t RenderGraph::Builder::write(handle_t resource){
+    assert_with_info(resource < graph->nodes.size(), "invalid render graph handle %u", resource);
+    const auto node = graph->nodes[resource];
+    auto& res = graph->resources[node.resource];
+    auto& p = graph->passes[pass];
+    assert_with_info(res.latest == resource, "pass %s: only the latest version of %s can be written", p.name, res.name);
+    if(node.writer == pass) return resource;
+    if(res.kind == kind_t::texture){
+        for(auto r: p.reads){
+            assert_with_info(graph->nodes[r].resource != node.resource, "pass %s: %s is both read and written", p.name, res.name);
+        }
+    }
+    // 写入视为在上一版本的内容之上继续绘制, 上一版本的写入者不会被剔除
+    graph->nodes[resource].refs += 1;
+    const handle_t handle = handle_t(graph->nodes.size());
+    graph->nodes.push_back(node_t{node.resource, node.version + 1, pass, resource, 0});
+    res.latest = handle;
+    p.writes.push_back(handle);
+    return handle;
+}
+
+void RenderGraph::Builder::side_effect(){
+    graph->passes[pass].side_effect = true;
+}
+
+RenderGraph::RenderGraph(){
+    reset();
+}
+
+RenderGraph::~RenderGraph(){
+    release_pool();
+}
+
+void RenderGraph::reset(){
+    passes.clear();
+    resources.clear();
+    nodes.clear();
+    order.clear();
+    compiled = false;
+    frame += 1;
+    frame_stats = stats_t();
+    backbuffer_resource = nodes[add_resource("backbuffer", kind_t::backbuffer, true, texture_desc_t(), 0, 0)].resource;
+}
+
+RenderGraph::handle_t RenderGraph::add_resource(const char* name, kind_t kind, bool imported, const texture_desc_t& desc, size_t size, unsigned int id){
+    assert_with_info(!compiled, "render graph is already compiled, call reset first");
+    const auto index = uint32_t(resources.size());
+    const handle_t handle = handle_t(nodes.size());
+    if(kind == kind_t::texture)
+        size = size_t(texture_bytes(desc));
+    resources.push_back(resource_t{name, kind, imported, desc, size, id, no_pass, handle, no_pass, 0});
+    nodes.push_back(node_t{index, 0, no_pass, invalid_handle, 0});
+    return handle;
+}
+
+void RenderGraph::add_pass(const char* name, const std::function<void(Builder&)>& setup, std::function<void(const Resources&)> execute){
+    assert_with_info(!compiled, "render graph is already compiled, call reset first");
+    const auto index = uint32_t(passes.size());
+    passes.emplace_back();
+    passes.back().name = name;
+    passes.back().execute = std::move(execute);
+    Builder builder(this, index);
+    setup(builder);
+}
+
+RenderGraph::handle_t RenderGraph::backbuffer() const{
+    return resources[backbuffer_resource].latest;
+}
+
+RenderGraph::handle_t RenderGraph::import_texture(const char* name, unsigned int texture_id, const texture_desc_t& desc){
+    format_info(desc.internal_format);
+    return add_resource(name, kind_t::texture, true, desc, 0, texture_id);
+}
+
+uint64_t RenderGraph::texture_bytes(const texture_desc_t& desc){
+    return uint64_t(desc.width) * uint64_t(desc.height) * format_info(desc.internal_format).bytes;
+}
+
+/*
+ * 编译
+ */
+
+void RenderGraph::compile(){
+    profile_scope("RenderGraph::compile");
+    assert_with_info(!compiled, "render graph is already compiled, call reset first");
+    cull();
+    sort();
+    allocate();
+    compiled = true;
+}
+
+void RenderGraph::cull(){
+    std::vector<uint32_t> refs(nodes.size());
+    for(size_t i=0; i<nodes.size(); i++)
+        refs[i] = nodes[i].refs;
+    std::vector<handle_t> unused;
+    const auto release_pass = [&](pass_t& pass){
+        pass.culled = true;
+        const auto release_node = [&](handle_t node){
+            if(--refs[node] == 0 && nodes[node].writer != no_pass)
+                unused.push_back(node);
+        };
+        for(auto r: pass.reads)
+            release_node(r);
+        for(auto w: pass.writes)
+            release_node(nodes[w].previous);
+    };
+    for(auto& pass: passes){
+        pass.refs = uint32_t(pass.writes.size());
+        pass.culled = false;
+        // 写入导入资源的阶段结果在图外使用
+        bool sink = pass.side_effect;
+        for(auto w: pass.writes)
+            sink = sink || resources[nodes[w].resource].imported;
+        if(sink)
+            pass.refs += 1;
+    }
+    // 先收集本来就无人读取的节点, 再释放无人使用的阶段; 顺序反过来时释放中归零的节点会被重复收集
+    for(size_t i=0; i<nodes.size(); i++)
+        if(refs[i] == 0 && nodes[i].writer != no_pass)
+            unused.push_back(handle_t(i));
+    for(auto& pass: passes)
+        if(pass.refs == 0)
+            release_pass(pass);
+    while(!unused.empty()){
+        const auto node = unused.back();
+        unused.pop_back();
+        auto& pass = passes[nodes[node].writer];
+        if(!pass.culled && --pass.refs == 0)
+            release_pass(pass);
+    }
+    frame_stats.passes = uint32_t(passes.size());
+    for(const auto& pass: passes)
+        frame_stats.culled += pass.culled;
+}
+
+void RenderGraph::sort(){
+    const size_t pass_num = passes.size();
+    std::vector<std::vector<uint32_t>> readers(nodes.size());
+    for(uint32_t i=0; i<pass_num; i++)
+        if(!passes[i].culled)
+            for(auto r: passes[i].reads)
+                readers[r].push_back(i);
+    std::vector<std::vector<uint32_t>> next(pass_num);
+    std::vector<uint32_t> in_degree(pass_num, 0);
+    const auto depend = [&](uint32_t before, uint32_t after){
+        if(before == no_pass || before == after || passes[before].culled) return;
+        next[before].push_back(after);
+        in_degree[after] += 1;
+    };
+    for(uint32_t i=0; i<pass_num; i++){
+        if(passes[i].culled) continue;
+        // 写后读
+        for(auto r: passes[i].reads)
+            depend(nodes[r].writer, i);
+        for(auto w: passes[i].writes){
+            const auto previous = nodes[w].previous;
+            // 写后写与读后写
+            depend(nodes[previous].writer, i);
+            for(auto reader: readers[previous])
+                depend(reader, i);
+        }
+    }
+    // 可以执行的阶段中先执行声明在前的
+    std::priority_queue<uint32_t, std::vector<uint32_t>, std::greater<uint32_t>> ready;
+    uint32_t alive = 0;
+    for(uint32_t i=0; i<pass_num; i++){
+        if(passes[i].culled) continue;
+        alive += 1;
+        if(in_degree[i] == 0)
+            ready.push(i);
+    }
+    order.clear();
+    while(!ready.empty()){
+        const auto pass = ready.top();
+        ready.pop();
+        order.push_back(pass);
+        for(auto after: next[pass])
+            if(--in_degree[after] == 0)
+                ready.push(after);
+    }
+    assert_with_info(order.size() == alive, "render graph has a dependency cycle");
+}
+
+void RenderGraph::allocate(){
+    for(uint32_t i=0; i<order.size(); i++){
+        const auto& pass = passes[order[i]];
+        const auto touch = [&](handle_t handle){
+            auto& res = resources[nodes[handle].resource];
+            res.first = std::min(res.first, i);
+            res.last = std::max(res.last, i);
+        };
+        for(auto r: pass.reads)
+            touch(r);
+        for(auto w: pass.writes)
+            touch(w);
+    }
+    for(auto& physical: pool){
+        physical.used = false;
+        physical.busy_until = 0;
+    }
+    // 按生存期开始的先后分配, 生存期已结束的对象可以被之后开始的资源复用
+    std::vector<uint32_t> transients;
+    for(uint32_t i=0; i<resources.size(); i++){
+        const auto& res = resources[i];
+        if(!res.imported && res.first != no_pass)
+            transients.push_back(i);
+    }
+    std::stable_sort(transients.begin(), transients.end(), [this](uint32_t a, uint32_t b){
+        return resources[a].first < resources[b].first;
+    });
+    for(auto index: transients){
+        auto& res = resources[index];
+        res.physical = acquire(res, res.first);
+        auto& physical = pool[res.physical];
+        physical.used = true;
+        physical.busy_until = res.last;
+        physical.last_frame = frame;
+        frame_stats.transients += 1;
+        frame_stats.virtual_bytes += res.size;
+    }
+    for(const auto& physical: pool){
+        if(!physical.used) continue;
+        frame_stats.physicals += 1;
+        frame_stats.physical_bytes += physical.size;
+    }
+}
+
+uint32_t RenderGraph::acquire(const resource_t& resource, uint32_t first){
+    uint32_t best = no_pass;
+    uint32_t free_slot = no_pass;
+    for(uint32_t i=0; i<pool.size(); i++){
+        const auto& physical = pool[i];
+        if(physical.id == 0){
+            free_slot = i;
+            continue;
+        }
+        if(physical.kind != resource.kind || (physical.used && physical.busy_until >= first)) continue;
+        if(resource.kind == kind_t::texture){
+            if(!same_desc(physical.desc, resource.desc)) continue;
+        }else if(physical.size < resource.size){
+            continue;
+        }
+        // 缓冲选容量最小的, 留下大的给之后的资源
+        if(best == no_pass || physical.size < pool[best].size)
+            best = i;
+    }
+    if(best != no_pass) return best;
+
+    physical_t physical{resource.kind, resource.desc, resource.size, 0, frame, 0, false};
+    if(resource.kind == kind_t::texture){
+        const auto& info = format_info(resource.desc.internal_format);
+        glGenTextures(1, &physical.id);
+        glBindTexture(GL_TEXTURE_2D, physical.id);
+        glTexImage2D(GL_TEXTURE_2D, 0, info.internal_format, resource.desc.width, resource.desc.height, 0, info.format, info.type, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        shader_t::invalidate_bind_cache();
+    }else{
+        glGenBuffers(1, &physical.id);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, physical.id);
+        glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(resource.size), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    assert_with_info(physical.id != 0, "fail to create render target %s", resource.name);
+    frame_stats.created += 1;
+    if(free_slot != no_pass){
+        pool[free_slot] = physical;
+        return free_slot;
+    }
+    pool.push_back(physical);
+    return uint32_t(pool.size() - 1);
+}
+
+/*
+ * 执行
+ */
+
+void RenderGraph::execute(){
+    profile_scope("RenderGraph::execute");
+    if(!compiled)
+        compile();
+    GLint target_fbo = 0;
+    GLint viewport[4] = {0, 0, 0, 0};
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target_fbo);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    for(auto index: order){
+        const auto& pass = passes[index];
+        profile_gpu_scope(pass.name);
+        bind_targets(pass, target_fbo, viewport);
+        if(pass.execute)
+            pass.execute(Resources(this, index));
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, target_fbo);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    collect_pool();
+}
+
+void RenderGraph::bind_targets(const pass_t& pass, int target_fbo, const int* viewport){
+    bool to_backbuffer = false;
+    std::vector<unsigned int> colors;
+    unsigned int depth = 0;
+    GLenum depth_attachment = 0;
+    int width = 0, height = 0;
+    for(auto w: pass.writes){
+        const auto& res = resources[nodes[w].resource];
+        if(res.kind == kind_t::backbuffer){
+            to_backbuffer = true;
+            continue;
+        }
+        if(res.kind != kind_t::texture) continue;
+        const unsigned int id = res.imported ? res.imported_id : pool[res.physical].id;
+        const auto& info = format_info(res.desc.internal_format);
+        if(info.attachment != 0){
+            assert_with_info(depth == 0, "pass %s writes more than one depth target", pass.name);
+            depth = id;
+            depth_attachment = info.attachment;
+        }else{
+            colors.push_back(id);
+        }
+        assert_with_info(width == 0 || (width == res.desc.width && height == res.desc.height),
+            "pass %s writes targets of different sizes", pass.name);
+        width = res.desc.width;
+        height = res.desc.height;
+    }
+    if(to_backbuffer){
+        assert_with_info(colors.empty() && depth == 0, "pass %s writes both the backbuffer and textures", pass.name);
+        glBindFramebuffer(GL_FRAMEBUFFER, target_fbo);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        return;
+    }
+    // 只写缓冲的阶段不改变帧缓冲
+    if(colors.empty() && depth == 0) return;
+
+    auto key = colors;
+    key.push_back(depth);
+    auto it = framebuffers.find(key);
+    if(it == framebuffers.end()){
+        framebuffer_t framebuffer{0, frame};
+        glGenFramebuffers(1, &framebuffer.fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.fbo);
+        std::vector<GLenum> attachments;
+        for(size_t i=0; i<colors.size(); i++){
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GLenum(GL_COLOR_ATTACHMENT0 + i), GL_TEXTURE_2D, colors[i], 0);
+            attachments.push_back(GLenum(GL_COLOR_ATTACHMENT0 + i));
+        }
+        if(depth != 0)
+            glFramebufferTexture2D(GL_FRAMEBUFFER, depth_attachment, GL_TEXTURE_2D, depth, 0);
+        if(attachments.empty()){
+            attachments.push_back(GL_NONE);
+            glReadBuffer(GL_NONE);
+        }
+        glDrawBuffers(GLsizei(attachments.size()), attachments.data());
+        assert_with_info(glCheckFramebufferStatus(GL_FRAMEBUFFER)==GL_FRAMEBUFFER_COMPLETE, "framebuffer of pass %s is incomplete", pass.name);
+        it = framebuffers.emplace(std::move(key), framebuffer).first;
+    }else{
+        glBindFramebuffer(GL_FRAMEBUFFER, it->second.fbo);
+    }
+    it->second.last_frame = frame;
+    glViewport(0, 0, width, height);
+}
+
+void RenderGraph::collect_pool(){
+    for(auto& physical: pool){
+        if(physical.id == 0 || frame - physical.last_frame < pool_keep_frames) continue;
+        if(physical.kind == kind_t::texture)
+            glDeleteTextures(1, &physical.id);
+        else
+            glDeleteBuffers(1, &physical.id);
+        physical.id = 0;
+        frame_stats.released += 1;
+    }
+    for(auto it = framebuffers.begin(); it != framebuffers.end();){
+        if(frame - it->second.last_frame < pool_keep_frames){
+            ++it;
+            continue;
+        }
+        glDeleteFramebuffers(1, &it->second.fbo);
+        it = framebuffers.erase(it);
+    }
+    frame_stats.pool_bytes = 0;
+    for(const auto& physical: pool)
+        if(physical.id != 0)
+            frame_stats.pool_bytes += physical.size;
+}
+
+void RenderGraph::release_pool(){
+    for(auto& physical: pool){
+        if(physical.id == 0) continue;
+        if(physical.kind == kind_t::texture)
+            glDeleteTextures(1, &physical.id);
+        else
+            glDeleteBuffers(1, &physical.id);
+    }
+    pool.clear();
+    for(auto& framebuffer: framebuffers)
+        glDeleteFramebuffers(1, &framebuffer.second.fbo);
+    framebuffers.clear();
+    frame_stats.pool_bytes = 0;
+}
+
+uint32_t RenderGraph::Resources::check(handle_t resource) const{
+    assert_with_info(resource < graph->nodes.size(), "invalid render graph handle %u", resource);
+    const auto index = graph->nodes[resource].resource;
+    const auto& p = graph->passes[pass];
+    bool declared = false;
+    for(auto r: p.reads)
+        declared = declared || graph->nodes[r].resource == index;
+    for(auto w: p.writes)
+        declared = declared || graph->nodes[w].resource == index;
+    assert_with_info(declared, "pass %s uses %s without declaring it", p.name, graph->resources[index].name);
+    return index;
+}
+
+unsigned int RenderGraph::Resources::texture(handle_t resource) const{
+    const auto& res = graph->resources[check(resource)];
+    assert_with_info(res.kind == kind_t::texture, "%s is not a texture", res.name);
+    return res.imported ? res.imported_id : graph->pool[res.physical].id;
+}
+
+unsigned int RenderGraph::Resources::buffer(handle_t resource) const{
+    const auto& res = graph->resources[check(resource)];
+    assert_with_info(res.kind == kind_t::buffer, "%s is not a buffer", res.name);
+    return graph->pool[res.physical].id;
+}
+
+const RenderGraph::texture_desc_t& RenderGraph::Resources::texture_desc(handle_t resource) const{
+    return graph->resources[check(resource)].desc;
+}
+
+/*
+ * 输出
+ */
+
+void RenderGraph::dump(FILE* out) const{
+    fprintf(out, "[RenderGraph] %u passes (%u culled), %u transients in %u objects, %.2f MiB virtual / %.2f MiB physical, pool %.2f MiB\n",
+        frame_stats.passes, frame_stats.culled, frame_stats.transients, frame_stats.physicals,
+        mib(frame_stats.virtual_bytes), mib(frame_stats.physical_bytes), mib(frame_stats.pool_bytes));
+    const auto print_handles = [&](const char* label, const std::vector<handle_t>& handles){
+        if(handles.empty()) return;
+        fprintf(out, " %s:", label);
+        for(auto h: handles)
+            fprintf(out, " %s#%u", resources[nodes[h].resource].name, nodes[h].version);
+        fprintf(out, ";");
+    };
+    for(uint32_t i=0; i<order.size(); i++){
+        const auto& pass = passes[order[i]];
+        fprintf(out, "  %2u %-20s", i, pass.name);
+        print_handles("reads", pass.reads);
+        print_handles("writes", pass.writes);
+        fprintf(out, "\n");
+    }
+    for(const auto& pass: passes)
+        if(pass.culled)
+            fprintf(out, "  -- %-20s culled\n", pass.name);
+    for(const auto& res: resources){
+        if(res.kind == kind_t::backbuffer) continue;
+        fprintf(out, "  %-20s ", res.name);
+        if(res.kind == kind_t::texture)
+            fprintf(out, "%5dx%-5d %-10s", res.desc.width, res.desc.height, format_info(res.desc.internal_format).name);
+        else
+            fprintf(out, "%-22s", "buffer");
+        fprintf(out, " %8.2f MiB", mib(res.size));
+        if(res.imported)
+            fprintf(out, "  imported\n");
+        else if(res.first == no_pass)
+            fprintf(out, "  unused\n");
+        else
+            fprintf(out, "  passes [%u, %u] -> object %u\n", res.first, res.last, res.physical);
+    }
+}
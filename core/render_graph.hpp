@@ -0,0 +1,223 @@
+/**
+ * @file render_graph.hpp
+ * @brief 帧渲染图: 各阶段声明读写的资源, 自动剔除无用阶段并排序执行, 临时渲染目标从池中分配并在生存期不重叠时复用
+ *
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <vector>
+#include <glad/glad.h>
+
+namespace Ez3DGL{
+
+/**
+ * @brief 每帧重新声明的渲染图
+ *
+ * add_pass 时立即调用 setup, 在其中通过 Builder 创建临时纹理/缓冲并声明读写; execute 回调在执行时按顺序调用.
+ * 每次写入产生资源的新版本(新句柄), 读取引用某个版本, 由此得到阶段之间的依赖. 编译时:
+ * - 从写入导入资源(默认帧缓冲, import_texture)或标记了副作用的阶段出发反向引用计数, 剔除结果无人使用的阶段;
+ * - 按读后写, 写后读, 写后写依赖拓扑排序, 没有依赖的阶段保持声明顺序;
+ * - 临时资源的生存期为第一个到最后一个使用它的阶段, 从池中分配GL对象, 生存期不重叠且格式尺寸相同的纹理
+ *   (或容量足够的缓冲)复用同一对象.
+ * 执行写入纹理的阶段前自动绑定以这些纹理为附件的帧缓冲(按写入顺序为颜色附件, 深度格式为深度附件)并设置视口;
+ * 写入 backbuffer() 的阶段绑定 execute 开始时的帧缓冲与视口.
+ * @note OpenGL 没有显式的内存别名, 复用以GL对象为粒度; 复用的纹理内容未定义, 第一次写入的阶段需自行清除.
+ * 池中对象连续 pool_keep_frames 帧未使用时释放. 阶段与资源的名字只保存指针, 需在本帧内有效
+ *
+ * 用法:
+ *     graph.reset();
+ *     RenderGraph::handle_t hdr;
+ *     graph.add_pass("scene", [&](RenderGraph::Builder& b){
+ *         hdr = b.write(b.create_texture("hdr", {width, height, GL_RGBA16F}));
+ *         b.write(b.create_texture("depth", {width, height, GL_DEPTH24_STENCIL8}));
+ *     }, [&](const RenderGraph::Resources&){
+ *         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+ *         model.draw(&shader, camera, &transform);
+ *     });
+ *     graph.add_pass("tonemap", [&](RenderGraph::Builder& b){
+ *         b.read(hdr);
+ *         b.write(graph.backbuffer());
+ *     }, [&](const RenderGraph::Resources& res){
+ *         tonemap.bind_texture("hdr", GL_TEXTURE_2D, res.texture(hdr));
+ *         fullscreen->draw_array(GL_TRIANGLES);
+ *     });
+ *     graph.execute();
+ */
+class RenderGraph{
+public:
+    using handle_t = uint32_t;
+    static constexpr handle_t invalid_handle = UINT32_MAX;
+    static constexpr uint32_t pool_keep_frames = 3;
+
+    struct texture_desc_t{
+        int width = 0;
+        int height = 0;
+        GLenum internal_format = GL_RGBA8;
+    };
+    struct stats_t{
+        uint32_t passes = 0;
+        uint32_t culled = 0;
+        // 本帧的临时资源数, 及其占用的GL对象数(复用后)
+        uint32_t transients = 0;
+        uint32_t physicals = 0;
+        // 本帧新建与释放的GL对象数
+        uint32_t created = 0;
+        uint32_t released = 0;
+        // 临时资源各自分配时的总字节数, 实际使用的GL对象字节数, 以及池中全部对象的字节数
+        uint64_t virtual_bytes = 0;
+        uint64_t physical_bytes = 0;
+        uint64_t pool_bytes = 0;
+    };
+
+    class Builder{
+    public:
+        handle_t create_texture(const char* name, const texture_desc_t& desc);
+        handle_t create_buffer(const char* name, size_t size);
+        /**
+         * @brief 声明读取某个版本, 该版本必须已被写入过
+         */
+        handle_t read(handle_t resource);
+        /**
+         * @brief 声明写入, 只能写入最新版本, 返回写入后的新版本
+         */
+        handle_t write(handle_t resource);
+        // 标记为有副作用(如读回到CPU), 不被剔除
+        void side_effect();
+    private:
+        friend class RenderGraph;
+        Builder(RenderGraph* graph, uint32_t pass):graph(graph), pass(pass){}
+        RenderGraph* graph;
+        uint32_t pass;
+    };
+
+    class Resources{
+    public:
+        // 本阶段读写的纹理/缓冲对应的GL对象
+        unsigned int texture(handle_t resource) const;
+        unsigned int buffer(handle_t resource) const;
+        const texture_desc_t& texture_desc(handle_t resource) const;
+    private:
+        friend class RenderGraph;
+        Resources(const RenderGraph* graph, uint32_t pass):graph(graph), pass(pass){}
+        const RenderGraph* graph;
+        uint32_t pass;
+        uint32_t check(handle_t resource) const;
+    };
+
+    RenderGraph();
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+    ~RenderGraph();
+
+    /**
+     * @brief 开始声明新的一帧, 清空上一帧的阶段与资源, 保留资源池
+     */
+    void reset();
+    void add_pass(const char* name, const std::function<void(Builder&)>& setup, std::function<void(const Resources&)> execute);
+    /**
+     * @brief 默认帧缓冲(execute 开始时绑定的帧缓冲)的最新版本, 只能写入
+     */
+    handle_t backbuffer() const;
+    /**
+     * @brief 导入外部持有的纹理(如阴影贴图, 历史帧), 写入它的阶段不被剔除
+     * @note 以它为附件的帧缓冲被缓存, 删除并重建该纹理后需调用 release_pool
+     */
+    handle_t import_texture(const char* name, unsigned int texture_id, const texture_desc_t& desc);
+
+    /**
+     * @brief 剔除, 排序并分配资源, execute 时未编译则自动编译
+     */
+    void compile();
+    void execute();
+
+    const stats_t& stats() const{
+        return frame_stats;
+    }
+    /**
+     * @brief 输出本帧的阶段, 资源及其生存期与内存占用
+     */
+    void dump(FILE* out=stdout) const;
+    /**
+     * @brief 释放池中所有GL对象
+     */
+    void release_pool();
+
+    static uint64_t texture_bytes(const texture_desc_t& desc);
+private:
+    enum class kind_t: uint8_t{
+        texture, buffer, backbuffer
+    };
+    struct resource_t{
+        const char* name;
+        kind_t kind;
+        bool imported;
+        texture_desc_t desc;
+        size_t size;
+        // 导入的GL对象, 或编译后分配的池中对象序号
+        unsigned int imported_id;
+        uint32_t physical;
+        // 最新版本的句柄
+        handle_t latest;
+        // 在执行顺序中第一个与最后一个使用它的阶段, 未使用时 first > last
+        uint32_t first, last;
+    };
+    struct node_t{
+        uint32_t resource;
+        uint32_t version;
+        // 写入该版本的阶段与上一个版本, 初始版本没有
+        uint32_t writer;
+        handle_t previous;
+        // 读取它或在其上继续写入的阶段数
+        uint32_t refs;
+    };
+    struct pass_t{
+        const char* name;
+        std::function<void(const Resources&)> execute;
+        std::vector<handle_t> reads, writes;
+        bool side_effect = false;
+        bool culled = false;
+        uint32_t refs = 0;
+    };
+    struct physical_t{
+        kind_t kind;
+        texture_desc_t desc;
+        size_t size;
+        unsigned int id;
+        uint64_t last_frame;
+        // 本帧中占用到的阶段(执行顺序), 之后的阶段可以复用
+        uint32_t busy_until;
+        bool used;
+    };
+    struct framebuffer_t{
+        unsigned int fbo;
+        uint64_t last_frame;
+    };
+    static constexpr uint32_t no_pass = UINT32_MAX;
+
+    std::vector<pass_t> passes;
+    std::vector<resource_t> resources;
+    std::vector<node_t> nodes;
+    std::vector<uint32_t> order;
+    std::vector<physical_t> pool;
+    // 附件(颜色附件..., 深度附件)对应的帧缓冲
+    std::map<std::vector<unsigned int>, framebuffer_t> framebuffers;
+    uint32_t backbuffer_resource = 0;
+    uint64_t frame = 0;
+    bool compiled = false;
+    stats_t frame_stats;
+
+    handle_t add_resource(const char* name, kind_t kind, bool imported, const texture_desc_t& desc, size_t size, unsigned int id);
+    void cull();
+    void sort();
+    void allocate();
+    uint32_t acquire(const resource_t& resource, uint32_t first);
+    void bind_targets(const pass_t& pass, int target_fbo, const int* viewport);
+    void collect_pool();
+};
+
+}
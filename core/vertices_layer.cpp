@@ -1,4 +1,5 @@
 #include "core/vertices_layer.hpp"
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <cstdio>
@@ -10,6 +11,9 @@
 #include <vector>
 #include <cmath>
 #include "utils/debug.hpp"
+#include "utils/profiler.hpp"
+#include "utils/render_stats.hpp"
+#include "utils/texture_codec.hpp"
 #include <glm/gtx/quaternion.hpp>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -18,6 +22,78 @@
 using namespace Ez3DGL;
 
 
+namespace {
+
+// 每个纹理单元上各目标绑定的纹理名字加一, 0表示未知
+constexpr unsigned int cached_unit_num = 32;
+unsigned int unit_textures[cached_unit_num][4];
+// 当前激活的纹理单元加一, 0表示未知
+unsigned int active_unit = 0;
+// 当前使用的程序加一, 0表示未知
+unsigned int current_program = 0;
+
+// 部分 glad 配置没有生成 S3TC 扩展的常量
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+// BPTC 在 GL 4.2 才进入核心, 按 3.3 核心生成的头文件中没有
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#endif
+
+GLenum compressed_internal_format(texture_codec::format_t format, bool srgb){
+    switch (format) {
+        case texture_codec::format_t::bc1: return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case texture_codec::format_t::bc3: return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case texture_codec::format_t::bc5: return GL_COMPRESSED_RG_RGTC2;
+        case texture_codec::format_t::bc7: return srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+        default: return srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+    }
+}
+
+/**
+ * 按驱动报告的压缩格式列表判断, RGTC 是 GL 3.0 的核心格式, 不一定出现在列表中
+ */
+bool compressed_format_supported(GLenum internal_format){
+    if(internal_format == GL_COMPRESSED_RG_RGTC2)
+        return true;
+    static std::vector<GLint> formats;
+    static bool queried = false;
+    if(!queried){
+        GLint num = 0;
+        glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &num);
+        formats.resize(std::max(num, 0));
+        if(num > 0)
+            glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, formats.data());
+        queried = true;
+    }
+    return std::find(formats.begin(), formats.end(), GLint(internal_format)) != formats.end();
+}
+
+int texture_target_slot(GLenum target){
+    switch (target) {
+        case GL_TEXTURE_2D: return 0;
+        case GL_TEXTURE_BUFFER: return 1;
+        case GL_TEXTURE_CUBE_MAP: return 2;
+        case GL_TEXTURE_2D_ARRAY: return 3;
+        default: return -1;
+    }
+}
+
+}
+
 static double get_distance(glm::vec3 a, glm::vec3 b){
     return sqrt(pow(a.x-b.x, 2) + pow(a.y-b.y, 2) + pow(a.z-b.z, 2));
 }
@@ -26,6 +102,7 @@ shader_t::shader_t(const char* vertex_shader_path, const char* fragment_shader_p
                        const char* view_key, const char* proj_key, const char* model_key):
                        vertex_shader_path(vertex_shader_path), fragment_shader_path(fragment_shader_path),
                        view_key(view_key), proj_key(proj_key), model_key(model_key){
+    profile_scope("shader_t::compile");
     std::string vertexCode;
     std::string fragmentCode;
     std::ifstream vShaderFile;
@@ -67,6 +144,7 @@ shader_t::shader_t(const char* vertex_shader_path, const char* fragment_shader_p
     glShaderSource(fragment_id, 1, &fShaderCode, NULL);
     glCompileShader(fragment_id);
     check_compile_errors(fragment_id, "FRAGMENT");
+    render_stats::add(render_stats::counter_t::shader_compiles, 2);
     // shader Program
     program_id = glCreateProgram();
     glAttachShader(program_id, vertex_id);
@@ -76,6 +154,7 @@ shader_t::shader_t(const char* vertex_shader_path, const char* fragment_shader_p
     // delete the shaders as they're linked into our program now and no longer necessary
     glDeleteShader(vertex_id);
     glDeleteShader(fragment_id);
+    resolve_locations();
 }
 
 shader_t::shader_t(const std::string vertex_shader, const std::string fragment_shader,
@@ -83,6 +162,7 @@ shader_t::shader_t(const std::string vertex_shader, const std::string fragment_s
                    vertex_shader_path("FROM STRING"), fragment_shader_path("FROM STRING"),
                        view_key(view_key), proj_key(proj_key), model_key(model_key)
 {
+    profile_scope("shader_t::compile");
     const char* vShaderCode = vertex_shader.c_str();
     const char* fShaderCode = fragment_shader.c_str();
     // 2. compile shaders
@@ -96,6 +176,7 @@ shader_t::shader_t(const std::string vertex_shader, const std::string fragment_s
     glShaderSource(fragment_id, 1, &fShaderCode, NULL);
     glCompileShader(fragment_id);
     check_compile_errors(fragment_id, "FRAGMENT");
+    render_stats::add(render_stats::counter_t::shader_compiles, 2);
     // shader Program
     program_id = glCreateProgram();
     glAttachShader(program_id, vertex_id);
@@ -105,10 +186,76 @@ shader_t::shader_t(const std::string vertex_shader, const std::string fragment_s
     // delete the shaders as they're linked into our program now and no longer necessary
     glDeleteShader(vertex_id);
     glDeleteShader(fragment_id);
+    resolve_locations();
 }
 
 void shader_t::use() const{
+    if(current_program == program_id + 1) return;
     glUseProgram(program_id);
+    render_stats::add(render_stats::counter_t::program_binds);
+    current_program = program_id + 1;
+}
+
+void shader_t::resolve_locations(){
+    view_loc = uniform_location(view_key);
+    proj_loc = uniform_location(proj_key);
+    model_loc = uniform_location(model_key);
+    normal_loc = uniform_location("normal_matrix");
+}
+
+int shader_t::uniform_location(const char* key) const{
+    return glGetUniformLocation(program_id, key);
+}
+
+void shader_t::set_uniform_at(int location, int val) const{
+    glUniform1i(location, val);
+    render_stats::add(render_stats::counter_t::uniform_calls);
+}
+
+void shader_t::set_uniform_at(int location, float val) const{
+    glUniform1f(location, val);
+    render_stats::add(render_stats::counter_t::uniform_calls);
+}
+
+void shader_t::set_uniform_at(int location, const glm::vec3 &val) const{
+    glUniform3fv(location, 1, &val[0]);
+    render_stats::add(render_stats::counter_t::uniform_calls);
+}
+
+void shader_t::set_uniform_at(int location, const glm::vec4 &val) const{
+    glUniform4fv(location, 1, &val[0]);
+    render_stats::add(render_stats::counter_t::uniform_calls);
+}
+
+void shader_t::set_uniform_at(int location, const glm::mat3 &mat) const{
+    glUniformMatrix3fv(location, 1, GL_FALSE, glm::value_ptr(mat));
+    render_stats::add(render_stats::counter_t::uniform_calls);
+}
+
+void shader_t::set_uniform_at(int location, const glm::mat4 &mat) const{
+    glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(mat));
+    render_stats::add(render_stats::counter_t::uniform_calls);
+}
+
+void shader_t::bind_texture_unit(unsigned int unit, GLenum target, unsigned int texture_id){
+    const int slot = texture_target_slot(target);
+    const bool cached = unit < cached_unit_num && slot >= 0;
+    if(cached && unit_textures[unit][slot] == texture_id + 1)
+        return;
+    if(active_unit != unit + 1){
+        glActiveTexture(GL_TEXTURE0 + unit);
+        active_unit = unit + 1;
+    }
+    glBindTexture(target, texture_id);
+    render_stats::add(render_stats::counter_t::texture_binds);
+    if(cached)
+        unit_textures[unit][slot] = texture_id + 1;
+}
+
+void shader_t::invalidate_bind_cache(){
+    memset(unit_textures, 0, sizeof(unit_textures));
+    active_unit = 0;
+    current_program = 0;
 }
 
 int shader_t::get_uniform_loc(const char* key) const{
@@ -122,37 +269,51 @@ void shader_t::set_uniform(const char* key, bool val) const{
 
 void shader_t::set_uniform(const char* key, int val) const{
     glUniform1i(get_uniform_loc(key), val);
+    render_stats::add(render_stats::counter_t::uniform_calls);
 }
 
 void shader_t::set_uniform(const char* key, size_t val) const{
     glUniform1i(get_uniform_loc(key), val);
+    render_stats::add(render_stats::counter_t::uniform_calls);
 }
 void shader_t::set_uniform(const char* key, unsigned int val) const{
     glUniform1i(get_uniform_loc(key), val);
+    render_stats::add(render_stats::counter_t::uniform_calls);
 }
 
 void shader_t::set_uniform(const char* key, float val) const{
-    glUniform1f(get_uniform_loc(key), val); 
+    glUniform1f(get_uniform_loc(key), val);
+    render_stats::add(render_stats::counter_t::uniform_calls);
 }
 
 void shader_t::set_uniform(const char* key, const glm::mat4 &mat) const{
     glUniformMatrix4fv(get_uniform_loc(key), 1, GL_FALSE, glm::value_ptr(mat));
+    render_stats::add(render_stats::counter_t::uniform_calls);
+}
+
+void shader_t::set_uniform(const char* key, const glm::vec2 &val) const{
+    glUniform2fv(get_uniform_loc(key), 1, &val[0]);
+    render_stats::add(render_stats::counter_t::uniform_calls);
 }
 
 void shader_t::set_uniform(const char* key, const glm::vec3 &val) const{
-    glUniform3fv(get_uniform_loc(key), 1, &val[0]); 
+    glUniform3fv(get_uniform_loc(key), 1, &val[0]);
+    render_stats::add(render_stats::counter_t::uniform_calls);
 }
 
 void shader_t::set_uniform(const char* key, const float x, const float y, const float z) const{
     glUniform3f(get_uniform_loc(key), x, y, z);
+    render_stats::add(render_stats::counter_t::uniform_calls);
 }
 
 void shader_t::set_uniform(const char* key, const glm::vec4 &val) const{
-    glUniform4fv(get_uniform_loc(key), 1, &val[0]); 
+    glUniform4fv(get_uniform_loc(key), 1, &val[0]);
+    render_stats::add(render_stats::counter_t::uniform_calls);
 }
 
 void shader_t::set_uniform(const char* key, const float x, const float y, const float z, const float w) const{
     glUniform4f(get_uniform_loc(key), x, y, z, w);
+    render_stats::add(render_stats::counter_t::uniform_calls);
 }
 
 
@@ -162,12 +323,19 @@ void shader_t::clear_texture(){
 
 void shader_t::bind_texture(const char *texture_key, struct texture_t* texture) {
     assert_with_info(texture->valid, "blind texture %s fail", texture_key);
+    bind_texture(texture_key, GL_TEXTURE_2D, texture->texture_id);
+}
+
+void shader_t::bind_texture(const char *texture_key, class texture_buffer_t* texture) {
+    bind_texture(texture_key, GL_TEXTURE_BUFFER, texture->texture_id);
+}
+
+void shader_t::bind_texture(const char *texture_key, GLenum target, unsigned int texture_id) {
     use();
     bool hav=false;
     unsigned int unit_id = 0;
     for(int i=0;i<texture_blinded.size();++i){
-        auto tt = texture_blinded[i];
-        if(tt->texture_id == texture->texture_id){
+        if(texture_blinded[i] == texture_id){
             unit_id = i;
             hav=true;
             break;
@@ -175,25 +343,39 @@ void shader_t::bind_texture(const char *texture_key, struct texture_t* texture)
     }
     if(!hav){
         unit_id = texture_blinded.size();
-        texture_blinded.push_back(texture);
+        texture_blinded.push_back(texture_id);
     }
     assert_with_info(unit_id<16, "too much texture to blind");
-    glActiveTexture(GL_TEXTURE0+unit_id);
-    glBindTexture(GL_TEXTURE_2D, texture->texture_id);
+    bind_texture_unit(unit_id, target, texture_id);
     set_uniform(texture_key, unit_id);
 }
 
 void shader_t::update_camera(const camera_t *camera) const{
-    set_uniform(proj_key, camera->projection);
-    set_uniform(view_key, camera->view);
+    assert_with_info(proj_loc!=-1 && view_loc!=-1, "Invaild key: %s or %s", proj_key, view_key);
+    set_uniform_at(proj_loc, camera->projection);
+    set_uniform_at(view_loc, camera->view);
 }
 
 void shader_t::update_model(const model_t *model) const{
-    set_uniform(model_key, model->get_model());
+    update_model(*model);
 }
 
 void shader_t::update_model(const model_t& model) const{
-    set_uniform(model_key, model.get_model());
+    update_model(model.get_model(model_t::render_alpha()), model.uniform_scale());
+}
+
+void shader_t::update_model(const glm::mat4& model, bool uniform_scale) const{
+    assert_with_info(model_loc!=-1, "Invaild key: %s", model_key);
+    set_uniform_at(model_loc, model);
+    if(normal_loc != -1)
+        set_uniform_at(normal_loc, model_t::normal_matrix(model, uniform_scale));
+}
+
+void shader_t::update_model(const glm::mat4& model, const glm::mat3& normal) const{
+    assert_with_info(model_loc!=-1, "Invaild key: %s", model_key);
+    set_uniform_at(model_loc, model);
+    if(normal_loc != -1)
+        set_uniform_at(normal_loc, normal);
 }
 
 void shader_t::check_compile_errors(unsigned int shader, const char* type)
@@ -220,7 +402,7 @@ void shader_t::check_compile_errors(unsigned int shader, const char* type)
         if (!success)
         {
             glGetProgramInfoLog(shader, 1024, NULL, infoLog);
-            printf("[%s Program ERROR] %s\n", type, infoLog);
+            log_error("[%s Program ERROR] %s", type, infoLog);
         }
     }
 }    
@@ -229,29 +411,111 @@ shader_t::~shader_t(){
     //glDeleteProgram(program_id);
 }
 
+compute_shader_t::compute_shader_t(const std::string& source){
+    profile_scope("compute_shader_t::compile");
+    assert_with_info(supported(), "compute shader requires GL 4.3");
+    const char* code = source.c_str();
+    const unsigned int shader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(shader, 1, &code, NULL);
+    glCompileShader(shader);
+    int success;
+    char info_log[1024];
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if(!success){
+        glGetShaderInfoLog(shader, 1024, NULL, info_log);
+        panic_with_info("[COMPUTE Shader ERROR] %s\n", info_log);
+    }
+    render_stats::add(render_stats::counter_t::shader_compiles);
+    program_id = glCreateProgram();
+    glAttachShader(program_id, shader);
+    glLinkProgram(program_id);
+    glGetProgramiv(program_id, GL_LINK_STATUS, &success);
+    if(!success){
+        glGetProgramInfoLog(program_id, 1024, NULL, info_log);
+        log_error("[COMPUTE Program ERROR] %s", info_log);
+    }
+    glDeleteShader(shader);
+}
+
+compute_shader_t::~compute_shader_t(){
+    if(current_program == program_id + 1)
+        current_program = 0;
+    glDeleteProgram(program_id);
+}
+
+void compute_shader_t::use() const{
+    if(current_program == program_id + 1) return;
+    glUseProgram(program_id);
+    render_stats::add(render_stats::counter_t::program_binds);
+    current_program = program_id + 1;
+}
+
+void compute_shader_t::dispatch(unsigned int x, unsigned int y, unsigned int z) const{
+    use();
+    glDispatchCompute(x, y, z);
+}
+
+int compute_shader_t::uniform_location(const char* key) const{
+    return glGetUniformLocation(program_id, key);
+}
+
+void compute_shader_t::set_uniform_at(int location, int val) const{
+    use();
+    glUniform1i(location, val);
+    render_stats::add(render_stats::counter_t::uniform_calls);
+}
+
+void compute_shader_t::set_uniform_at(int location, float val) const{
+    use();
+    glUniform1f(location, val);
+    render_stats::add(render_stats::counter_t::uniform_calls);
+}
+
+void compute_shader_t::set_uniform_at(int location, const glm::vec2 &val) const{
+    use();
+    glUniform2fv(location, 1, &val[0]);
+    render_stats::add(render_stats::counter_t::uniform_calls);
+}
+
+void compute_shader_t::set_uniform_at(int location, const glm::vec3 &val) const{
+    use();
+    glUniform3fv(location, 1, &val[0]);
+    render_stats::add(render_stats::counter_t::uniform_calls);
+}
+
+void compute_shader_t::set_uniform_at(int location, const glm::vec4* val, int count) const{
+    use();
+    glUniform4fv(location, count, &val[0][0]);
+    render_stats::add(render_stats::counter_t::uniform_calls);
+}
+
+void compute_shader_t::set_uniform_at(int location, const glm::mat4 &mat) const{
+    use();
+    glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(mat));
+    render_stats::add(render_stats::counter_t::uniform_calls);
+}
+
+bool compute_shader_t::supported(){
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if(major < 4 || (major == 4 && minor < 3))
+        return false;
+    return glDispatchCompute != nullptr && glMemoryBarrier != nullptr && glBindImageTexture != nullptr;
+}
+
 texture_t::texture_t(const char* file_name):file_name(file_name){
     if(file_name==NULL) return;
+    if(texture_codec::is_container_file(file_name)){
+        load_container(file_name);
+        return;
+    }
     int width, height, nrCh;
     unsigned char* data = stbi_load(file_name, &width, &height, &nrCh, 0);
     // stbi_set_flip_vertically_on_load(true);
-    glGenTextures(1, &texture_id);
-    glBindTexture(GL_TEXTURE_2D, texture_id);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
     if(data){
-        GLenum color_format;
-        switch (nrCh) {
-            case 1: color_format = GL_RED; break;
-            case 3: color_format = GL_RGB; break;
-            case 4: color_format = GL_RGBA; break;
-            default: panic_with_info("unsupport format(nrCh=%d)", nrCh);
-        }
-        glTexImage2D(GL_TEXTURE_2D, 0, color_format, width, height, 0, color_format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        printf("[OK] Texture %s %d*%d %dchs readed.\n", file_name, height, width, nrCh);
+        upload(data, width, height, nrCh);
+        log_debug("Texture %s %d*%d %dchs readed.", file_name, height, width, nrCh);
     }else{
         panic_with_info("Fail to load texture %s", file_name);
         return;
@@ -260,9 +524,27 @@ texture_t::texture_t(const char* file_name):file_name(file_name){
     valid = true;
 }
 
-texture_t::texture_t(unsigned char* data, int size){
+texture_t::texture_t(unsigned char* data, int size):file_name(nullptr){
     int width, height, nrCh;
     auto image_data = stbi_load_from_memory(data, size, &width, &height, &nrCh, 0);
+    if(image_data){
+        upload(image_data, width, height, nrCh);
+        log_debug("Texture from mem %d*%d %dchs readed.", height, width, nrCh);
+    }else{
+        panic_with_info("load NULL");
+        return;
+    }
+    stbi_image_free(image_data);
+    valid = true;
+}
+
+texture_t::texture_t(const unsigned char* pixels, int width, int height, int channels, const char* file_name):file_name(file_name){
+    assert_with_info(pixels!=nullptr, "texture pixels is NULL");
+    upload(pixels, width, height, channels);
+    valid = true;
+}
+
+void texture_t::upload(const unsigned char* pixels, int width, int height, int channels){
     glGenTextures(1, &texture_id);
     glBindTexture(GL_TEXTURE_2D, texture_id);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
@@ -270,34 +552,167 @@ texture_t::texture_t(unsigned char* data, int size){
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    if(image_data){
-        GLenum color_format;
-        switch (nrCh) {
-            case 1: color_format = GL_RED; break;
-            case 3: color_format = GL_RGB; break;
-            case 4: color_format = GL_RGBA; break;
-            default: panic_with_info("unsupport format(nrCh=%d)", nrCh);
+    GLenum color_format;
+    switch (channels) {
+        case 1: color_format = GL_RED; break;
+        case 3: color_format = GL_RGB; break;
+        case 4: color_format = GL_RGBA; break;
+        default: panic_with_info("unsupport format(nrCh=%d)", channels);
+    }
+    glTexImage2D(GL_TEXTURE_2D, 0, color_format, width, height, 0, color_format, GL_UNSIGNED_BYTE, pixels);
+    render_stats::add(render_stats::counter_t::texture_upload_bytes, uint64_t(width) * height * channels);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    shader_t::invalidate_bind_cache();
+}
+
+texture_t::texture_t(const texture_codec::container_t& container, const char* file_name):file_name(file_name){
+    valid = upload_container(container);
+}
+
+void texture_t::destroy(){
+    if(!valid) return;
+    glDeleteTextures(1, &texture_id);
+    shader_t::invalidate_bind_cache();
+    valid = false;
+}
+
+void texture_t::load_container(const char* file_name){
+    texture_codec::container_t container;
+    if(!texture_codec::read_container(file_name, container)){
+        panic_with_info("Fail to load texture %s", file_name);
+        return;
+    }
+    valid = upload_container(container);
+}
+
+bool texture_t::upload_container(const texture_codec::container_t& container){
+    GLenum internal_format = compressed_internal_format(container.format, container.srgb);
+    const bool compressed = texture_codec::is_block_compressed(container.format) && compressed_format_supported(internal_format);
+    if(!compressed)
+        internal_format = container.srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+    const int level_num = int(container.levels.size());
+    glGenTextures(1, &texture_id);
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, level_num > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level_num - 1);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    std::vector<unsigned char> decoded;
+    for(int i=0; i<level_num; i++){
+        const auto& level = container.levels[i];
+        if(compressed){
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, internal_format, level.width, level.height, 0, GLsizei(level.data.size()), level.data.data());
+            render_stats::add(render_stats::counter_t::texture_upload_bytes, level.data.size());
+            continue;
         }
-        glTexImage2D(GL_TEXTURE_2D, 0, color_format, width, height, 0, color_format, GL_UNSIGNED_BYTE, image_data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        printf("[OK] Texture from mem %d*%d %dchs readed.\n", height, width, nrCh);
+        const unsigned char* pixels = level.data.data();
+        if(texture_codec::is_block_compressed(container.format)){
+            decoded.resize(size_t(level.width) * level.height * 4);
+            if(!texture_codec::decode(container.format, level.data.data(), level.width, level.height, decoded.data())){
+                panic_with_info("Fail to decode texture %s", file_name != nullptr ? file_name : "from mem");
+                return false;
+            }
+            pixels = decoded.data();
+        }
+        glTexImage2D(GL_TEXTURE_2D, i, internal_format, level.width, level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        render_stats::add(render_stats::counter_t::texture_upload_bytes, uint64_t(level.width) * level.height * 4);
+    }
+    shader_t::invalidate_bind_cache();
+    if(file_name != nullptr)
+        log_debug("Texture %s %d*%d %s %d levels%s readed.", file_name, container.height, container.width,
+            texture_codec::format_name(container.format), level_num, compressed || !texture_codec::is_block_compressed(container.format) ? "" : " (decoded)");
+    return true;
+}
+
+texture_array_t::texture_array_t(int width, int height, int layers, bool mipmap):
+    width(width), height(height), layers(layers), mipmap(mipmap){
+    assert_with_info(width>0 && height>0 && layers>0, "invalid texture array %d*%d*%d", width, height, layers);
+    GLint max_layers = 0;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+    assert_with_info(max_layers==0 || layers<=max_layers, "too many texture array layers %d (max %d)", layers, max_layers);
+    glGenTextures(1, &texture_id);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture_id);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, mipmap ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    shader_t::invalidate_bind_cache();
+}
+
+texture_array_t::~texture_array_t(){
+    glDeleteTextures(1, &texture_id);
+}
+
+void texture_array_t::upload_layer(int layer, const unsigned char* rgba){
+    assert_with_info(layer>=0 && layer<layers, "texture array layer %d out of range", layer);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture_id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+    render_stats::add(render_stats::counter_t::texture_upload_bytes, uint64_t(width) * height * 4);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    shader_t::invalidate_bind_cache();
+}
+
+void texture_array_t::generate_mipmap(){
+    if(!mipmap) return;
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture_id);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    shader_t::invalidate_bind_cache();
+}
+
+texture_buffer_t::texture_buffer_t(GLenum internal_format, GLenum buffer_usage):
+    internal_format(internal_format), buffer_usage(buffer_usage){
+    glGenBuffers(1, &buffer_id);
+    glGenTextures(1, &texture_id);
+    // 空缓冲无法关联到纹理, 先分配一个最小的缓冲
+    update(0, nullptr);
+}
+
+texture_buffer_t::~texture_buffer_t(){
+    glDeleteTextures(1, &texture_id);
+    glDeleteBuffers(1, &buffer_id);
+}
+
+void texture_buffer_t::update(unsigned int data_size, const void* data){
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer_id);
+    if(data_size > size || size == 0){
+        // 扩容时重新关联纹理, 按2倍增长避免每帧重新分配
+        size = std::max(data_size, std::max(size*2, 16u));
+        glBufferData(GL_TEXTURE_BUFFER, size, nullptr, buffer_usage);
+        glBindTexture(GL_TEXTURE_BUFFER, texture_id);
+        glTexBuffer(GL_TEXTURE_BUFFER, internal_format, buffer_id);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        shader_t::invalidate_bind_cache();
     }else{
-        panic_with_info("load NULL");
-        return;
+        // orphan 旧缓冲, 避免等待GPU读取完成
+        glBufferData(GL_TEXTURE_BUFFER, size, nullptr, buffer_usage);
     }
-    stbi_image_free(image_data);
-    valid = true;
+    if(data_size > 0){
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, data_size, data);
+        render_stats::add(render_stats::counter_t::buffer_upload_bytes, data_size);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
 }
 
 vertices_t::vertices_t(unsigned int vertex_data_len, std::initializer_list<unsigned int> vertex_div, const float* vertex_data,
                             unsigned int element_num, const unsigned int* element_data, 
-                            GLenum buffer_usage){
+                            GLenum buffer_usage, bool split_position){
 
     e_cnt = element_num;
     unsigned int vertex_per_size = 0;
     for(const unsigned int &item : vertex_div)
         vertex_per_size += item;
     v_cnt = vertex_data_len / vertex_per_size;
+    vertex_floats = vertex_per_size;
+    if(split_position){
+        assert_with_info(vertex_div.size() > 1, "nothing left to interleave after splitting position");
+        position_floats = *vertex_div.begin();
+    }
     // Vertex Array
     glGenVertexArrays(1, &VAO_id);
     
@@ -310,35 +725,110 @@ vertices_t::vertices_t(unsigned int vertex_data_len, std::initializer_list<unsig
     if(element_num != 0)
         glGenBuffers(1, &EBO_id);
         
-
-    glBindBuffer(GL_ARRAY_BUFFER, VBO_id);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float)*vertex_data_len, vertex_data, buffer_usage);
+    if(vertex_data != nullptr)
+        render_stats::add(render_stats::counter_t::buffer_upload_bytes, sizeof(float)*vertex_data_len);
+    if(split_position){
+        // 拆成位置流与其余属性流
+        const unsigned int other_floats = vertex_per_size - position_floats;
+        std::vector<float> positions, others;
+        if(vertex_data != nullptr){
+            positions.resize(size_t(v_cnt) * position_floats);
+            others.resize(size_t(v_cnt) * other_floats);
+            for(unsigned int v=0; v<v_cnt; v++){
+                const float* src = vertex_data + size_t(v) * vertex_per_size;
+                std::copy(src, src + position_floats, positions.data() + size_t(v) * position_floats);
+                std::copy(src + position_floats, src + vertex_per_size, others.data() + size_t(v) * other_floats);
+            }
+        }
+        glGenBuffers(1, &position_VBO_id);
+        glBindBuffer(GL_ARRAY_BUFFER, position_VBO_id);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(float)*v_cnt*position_floats, vertex_data ? positions.data() : nullptr, buffer_usage);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO_id);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(float)*v_cnt*other_floats, vertex_data ? others.data() : nullptr, buffer_usage);
+    }else{
+        glBindBuffer(GL_ARRAY_BUFFER, VBO_id);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(float)*vertex_data_len, vertex_data, buffer_usage);
+    }
 
     if(element_num != 0){
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO_id);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int)*element_num, element_data, buffer_usage);
+        if(element_data != nullptr)
+            render_stats::add(render_stats::counter_t::buffer_upload_bytes, sizeof(unsigned int)*element_num);
     }
 
     int i=0, j=0;
     for(const unsigned int &item : vertex_div){
+        if(split_position && i == 0){
+            glBindBuffer(GL_ARRAY_BUFFER, position_VBO_id);
+            glVertexAttribPointer(0, item, GL_FLOAT, GL_FALSE, item*sizeof(float), (void*)0);
+            glEnableVertexAttribArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, VBO_id);
+            i+=1;
+            continue;
+        }
+        const unsigned int stride = vertex_per_size - position_floats;
         // glVertexAttribPointer(i, item, GL_FLOAT, GL_FALSE, 0, (void*)(j*sizeof(float)));
-        glVertexAttribPointer(i, item, GL_FLOAT, GL_FALSE, vertex_per_size*sizeof(float), (void*)(j*sizeof(float)));
+        glVertexAttribPointer(i, item, GL_FLOAT, GL_FALSE, stride*sizeof(float), (void*)(j*sizeof(float)));
         glEnableVertexAttribArray(i);
         i+=1;
         j+=item;
     }
+
+    if(split_position){
+        // 只含位置的VAO, 共用元素缓冲
+        glGenVertexArrays(1, &position_VAO_id);
+        glBindVertexArray(position_VAO_id);
+        if(element_num != 0)
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO_id);
+        glBindBuffer(GL_ARRAY_BUFFER, position_VBO_id);
+        glVertexAttribPointer(0, position_floats, GL_FLOAT, GL_FALSE, position_floats*sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+    }
     
     glBindVertexArray(0);
 
 }
 
 void vertices_t::update_vbo_buffer(unsigned int data_size, const float* vertex_data, unsigned int offset=0){
+    render_stats::add(render_stats::counter_t::buffer_upload_bytes, data_size);
+    if(!split()){
+        glBindBuffer(GL_ARRAY_BUFFER, VBO_id);
+        glBufferSubData(GL_ARRAY_BUFFER, offset, data_size, vertex_data);
+        return;
+    }
+    const unsigned int stride = vertex_floats * sizeof(float);
+    assert_with_info(data_size % stride == 0 && offset % stride == 0, "split vertices must be updated by whole vertices");
+    const unsigned int first = offset / stride, num = data_size / stride;
+    const unsigned int other_floats = vertex_floats - position_floats;
+    std::vector<float> positions(size_t(num) * position_floats), others(size_t(num) * other_floats);
+    for(unsigned int v=0; v<num; v++){
+        const float* src = vertex_data + size_t(v) * vertex_floats;
+        std::copy(src, src + position_floats, positions.data() + size_t(v) * position_floats);
+        std::copy(src + position_floats, src + vertex_floats, others.data() + size_t(v) * other_floats);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, position_VBO_id);
+    glBufferSubData(GL_ARRAY_BUFFER, first * position_floats * sizeof(float), positions.size() * sizeof(float), positions.data());
     glBindBuffer(GL_ARRAY_BUFFER, VBO_id);
-    glBufferSubData(GL_ARRAY_BUFFER, offset, data_size, vertex_data);
+    glBufferSubData(GL_ARRAY_BUFFER, first * other_floats * sizeof(float), others.size() * sizeof(float), others.data());
 }
 void vertices_t::update_ebo_buffer(unsigned int data_size, const unsigned int* element_data, unsigned int offset=0){
     glBindBuffer(GL_ARRAY_BUFFER, EBO_id);
     glBufferSubData(GL_ARRAY_BUFFER, offset, data_size, element_data);
+    render_stats::add(render_stats::counter_t::buffer_upload_bytes, data_size);
+}
+
+void vertices_t::destroy(){
+    glDeleteVertexArrays(1, &VAO_id);
+    glDeleteBuffers(1, &VBO_id);
+    if(e_cnt != 0)
+        glDeleteBuffers(1, &EBO_id);
+    if(split()){
+        glDeleteVertexArrays(1, &position_VAO_id);
+        glDeleteBuffers(1, &position_VBO_id);
+    }
+    VAO_id = VBO_id = EBO_id = 0;
+    position_VAO_id = position_VBO_id = 0;
 }
 
 vertices_t::~vertices_t(){
@@ -351,8 +841,11 @@ vertices_t::~vertices_t(){
 }
 
 void vertices_t::draw_array(GLenum draw_mode, int beg, int num) const{
+    profile_scope("vertices_t::draw_array");
     glBindVertexArray(VAO_id);
     glDrawArrays(draw_mode, beg, num);
+    render_stats::add(render_stats::counter_t::vao_binds);
+    render_stats::add_draw(draw_mode, uint64_t(num));
     glBindVertexArray(0);
 }
 
@@ -360,9 +853,24 @@ void vertices_t::draw_array(GLenum draw_mode) const {
     draw_array(draw_mode, 0, v_cnt);
 }
 void vertices_t::draw_element(GLenum draw_mode) const{
+    profile_scope("vertices_t::draw_element");
     assert_with_info(e_cnt!=0, "Fail to draw elements due to e_cnt=0");
     glBindVertexArray(VAO_id);
     glDrawElements(draw_mode, e_cnt, GL_UNSIGNED_INT, 0);
+    render_stats::add(render_stats::counter_t::vao_binds);
+    render_stats::add_draw(draw_mode, e_cnt);
+}
+void vertices_t::draw_element_position(GLenum draw_mode) const{
+    if(!split()){
+        draw_element(draw_mode);
+        return;
+    }
+    profile_scope("vertices_t::draw_element_position");
+    assert_with_info(e_cnt!=0, "Fail to draw elements due to e_cnt=0");
+    glBindVertexArray(position_VAO_id);
+    glDrawElements(draw_mode, e_cnt, GL_UNSIGNED_INT, 0);
+    render_stats::add(render_stats::counter_t::vao_binds);
+    render_stats::add_draw(draw_mode, e_cnt);
 }
 
 
@@ -382,7 +890,7 @@ void camera_t::calc_view(){
 }
 
 void camera_t::calc_projection(){
-    projection = glm::perspective(glm::radians(fov), screen_w_div_h, 0.1f, 500.0f);
+    projection = glm::perspective(glm::radians(fov), screen_w_div_h, z_near, z_far);
 }
 
 void camera_t::change_pos(enum dir move_dir, float step){
@@ -460,53 +968,127 @@ glm::mat4 model_t::get_model() const{
     return parent_trans * transl_trans * rotate_trans * scala_trans;
 }
 
+glm::mat4 model_t::get_model(float alpha) const{
+    if(alpha >= 1.f)
+        return get_model();
+    auto parent_trans = glm::mat4(1.);
+    if(parent)
+        parent_trans = parent->get_model(alpha);
+    // 本步没有移动时上一步的状态与当前相同
+    const bool moved = prev_tick == tick;
+    const auto transl_trans = glm::translate(glm::mat4(1.), moved ? glm::mix(prev_pos, pos, alpha) : pos);
+    const auto rotate_trans = glm::toMat4(moved ? glm::slerp(prev_quaternion, quaternion, alpha) : quaternion);
+    const auto scala_trans = glm::scale(glm::mat4(1.), moved ? glm::mix(prev_scale, scale, alpha) : scale);
+    return parent_trans * transl_trans * rotate_trans * scala_trans;
+}
+
+bool model_t::uniform_scale() const{
+    const auto uniform = [](const glm::vec3& s){
+        return s.x == s.y && s.y == s.z;
+    };
+    if(!uniform(scale) || (prev_tick == tick && !uniform(prev_scale)))
+        return false;
+    return parent == nullptr || parent->uniform_scale();
+}
+
+glm::mat3 model_t::normal_matrix(const glm::mat4& model, bool uniform_scale){
+    const glm::vec3 c0(model[0]), c1(model[1]), c2(model[2]);
+    if(uniform_scale){
+        // R*s 的逆转置为 R/s
+        const float s2 = glm::dot(c0, c0);
+        return glm::mat3(c0, c1, c2) * (s2 > 0.f ? 1.f / s2 : 0.f);
+    }
+    // 逆转置的各列为余子式向量除以行列式
+    const glm::vec3 r0 = glm::cross(c1, c2), r1 = glm::cross(c2, c0), r2 = glm::cross(c0, c1);
+    const float det = glm::dot(c0, r0);
+    return glm::mat3(r0, r1, r2) * (det != 0.f ? 1.f / det : 0.f);
+}
+
+void model_t::save_prev_state(){
+    if(prev_tick == tick) return;
+    prev_pos = pos;
+    prev_scale = scale;
+    prev_quaternion = quaternion;
+    prev_tick = tick;
+}
+
+uint64_t model_t::tick = 0;
+
+void model_t::advance_tick(){
+    tick += 1;
+}
+
+uint64_t model_t::current_tick(){
+    return tick;
+}
+
+float model_t::interp_alpha = 1.f;
+
+void model_t::set_render_alpha(float alpha){
+    interp_alpha = alpha;
+}
+
+float model_t::render_alpha(){
+    return interp_alpha;
+}
+
 glm::mat4 model_t::move_to(glm::vec3 x){
+    save_prev_state();
     pos = x;
     return get_model();
 }
 
 glm::mat4 model_t::move_to(float x, float y, float z){
+    save_prev_state();
     pos = glm::vec3(x, y, z);
     return get_model();
 }
 
 glm::mat4 model_t::scale_to(float x){
+    save_prev_state();
     scale = glm::vec3(x, x, x);
     return get_model();
 }
 
 glm::mat4 model_t::scale_to(float x, float y, float z){
+    save_prev_state();
     scale = glm::vec3(x, y, z);
     return get_model();
 }
 
 glm::mat4 model_t::scale_to(glm::vec3 x){
+    save_prev_state();
     scale = x;
     return get_model();
 }
 
 glm::mat4 model_t::set_quaternion(const glm::quat& q){
+    save_prev_state();
     quaternion = q;
     return get_model();
 }
 
 glm::mat4 model_t::rotate_to(float degree, glm::vec3 axis){
+    save_prev_state();
     quaternion =glm::angleAxis(glm::radians(degree), axis);
     return get_model();
 }
 
 glm::mat4 model_t::rotate_to(glm::vec3 pitch_yaw_roll_degree){
+    save_prev_state();
     quaternion = glm::quat(pitch_yaw_roll_degree);
     return get_model();
 }
 
 glm::mat4 model_t::rotate(glm::vec3 pitch_yaw_roll_degree){
+    save_prev_state();
     const auto q = glm::quat(glm::radians(pitch_yaw_roll_degree));
     quaternion = q * quaternion;
     return get_model();
 }
 
 glm::mat4 model_t::rotate(float degree, glm::vec3 axis){
+    save_prev_state();
     const auto q = glm::angleAxis(glm::radians(degree), axis);
     quaternion = q * quaternion;
 
@@ -20,10 +20,13 @@
 #include <vector>
 #include <glm/gtc/quaternion.hpp>
 #include "stb_image.h"
+#include "utils/render_stats.hpp"
 
 namespace Ez3DGL {
 
+namespace texture_codec { struct container_t; }
 class texture_t;
+class texture_buffer_t;
 class camera_t;
 class model_t;
 
@@ -42,9 +45,16 @@ class shader_t{
         void use() const;
         void clear_texture();
         void bind_texture(const char* texture_key, class texture_t* texture);
+        void bind_texture(const char* texture_key, class texture_buffer_t* texture);
+        void bind_texture(const char* texture_key, GLenum target, unsigned int texture_id);
         void update_camera(const camera_t *camera) const;
+        /**
+         * @brief 设置model矩阵, 着色器声明了 mat3 normal_matrix 时同时设置在CPU上算好的法线矩阵
+         */
         void update_model(const model_t *model) const;
         void update_model(const model_t& model) const;
+        void update_model(const glm::mat4& model, bool uniform_scale) const;
+        void update_model(const glm::mat4& model, const glm::mat3& normal) const;
 
         void set_uniform(const char* key, bool val) const;
         void set_uniform(const char* key, int val) const;
@@ -52,10 +62,31 @@ class shader_t{
         void set_uniform(const char* key, unsigned int val) const;
         void set_uniform(const char* key, float val) const;
         void set_uniform(const char* key, const glm::mat4 &mat) const;
+        void set_uniform(const char* key, const glm::vec2 &val) const;
         void set_uniform(const char* key, const glm::vec3 &val) const;
         void set_uniform(const char* key, float x, float y, float z) const;
         void set_uniform(const char* key, const glm::vec4 &val) const;
         void set_uniform(const char* key, float x, float y, float z, float w) const;
+
+        /**
+         * @brief 查询uniform位置, 不存在时返回-1; 预先解析后通过 set_uniform_at 设置, 避免每次按名字查询
+         */
+        int uniform_location(const char* key) const;
+        void set_uniform_at(int location, int val) const;
+        void set_uniform_at(int location, float val) const;
+        void set_uniform_at(int location, const glm::vec3 &val) const;
+        void set_uniform_at(int location, const glm::vec4 &val) const;
+        void set_uniform_at(int location, const glm::mat3 &mat) const;
+        void set_uniform_at(int location, const glm::mat4 &mat) const;
+
+        /**
+         * @brief 绑定纹理到指定的纹理单元, 该单元上已绑定同一纹理时不发出GL调用
+         */
+        static void bind_texture_unit(unsigned int unit, GLenum target, unsigned int texture_id);
+        /**
+         * @brief 清空当前程序与纹理单元的缓存, 绕过 use/bind_texture_unit 改变绑定后调用(window_loop 每帧开始时调用)
+         */
+        static void invalidate_bind_cache();
         
         ~shader_t();
     private:
@@ -64,13 +95,45 @@ class shader_t{
         const char* view_key;
         const char* proj_key;
         const char* model_key;
+        int view_loc=-1, proj_loc=-1, model_loc=-1, normal_loc=-1;
+        void resolve_locations();
         // utility function for checking shader compilation/linking errors.
         void check_compile_errors(unsigned int shader, const char* type);
         // unsigned int texture_cnt=0;
-        std::vector<texture_t*> texture_blinded;
+        std::vector<unsigned int> texture_blinded;
         int get_uniform_loc(const char* key) const;
 };
 
+/**
+ * @brief 计算着色器程序, 需要 GL 4.3; 与 shader_t 共用当前程序的缓存
+ *
+ */
+class compute_shader_t{
+    public:
+        unsigned int program_id;
+
+        explicit compute_shader_t(const std::string& source);
+        ~compute_shader_t();
+        void use() const;
+        /**
+         * @brief 使用本程序并按工作组数调度, 之后读取其写入的数据前需调用 glMemoryBarrier
+         */
+        void dispatch(unsigned int x, unsigned int y=1, unsigned int z=1) const;
+
+        int uniform_location(const char* key) const;
+        void set_uniform_at(int location, int val) const;
+        void set_uniform_at(int location, float val) const;
+        void set_uniform_at(int location, const glm::vec2 &val) const;
+        void set_uniform_at(int location, const glm::vec3 &val) const;
+        void set_uniform_at(int location, const glm::vec4* val, int count) const;
+        void set_uniform_at(int location, const glm::mat4 &mat) const;
+
+        /**
+         * @brief 当前上下文是否支持计算着色器(GL 4.3 且相关函数已加载)
+         */
+        static bool supported();
+};
+
 /**
  * @brief 纹理对象,读取图片生成纹理
  *
@@ -80,12 +143,78 @@ class texture_t{
         unsigned int texture_id;
         bool valid = false;
 
+        /**
+         * @brief 从图片文件创建纹理; .ktx2 文件直接上传其中预先压缩的各级纹理,
+         * 驱动不支持该压缩格式时在CPU上解码为 RGBA8 上传
+         */
         texture_t(const char* file_name);
         texture_t(unsigned char* image_data, int size);
+        /**
+         * @brief 从已解码的像素创建纹理, 解码可以在工作线程完成, 本构造函数只能在主线程调用
+         * @param channels 通道数, 支持1/3/4
+         */
+        texture_t(const unsigned char* pixels, int width, int height, int channels, const char* file_name=nullptr);
+        /**
+         * @brief 从已读入内存的压缩纹理创建, 规则与 .ktx2 文件相同, 只能在主线程调用
+         */
+        texture_t(const texture_codec::container_t& container, const char* file_name=nullptr);
+        /**
+         * @brief 立即删除GL纹理(析构时不删除), 之后不能再使用
+         */
+        void destroy();
         const char* file_name;
+    private:
+        void upload(const unsigned char* pixels, int width, int height, int channels);
+        void load_container(const char* file_name);
+        bool upload_container(const texture_codec::container_t& container);
         
 };
 
+/**
+ * @brief 二维纹理数组(GL_TEXTURE_2D_ARRAY), 每层尺寸相同, 内部格式为 RGBA8
+ * @note 着色器中以 sampler2DArray 访问, 不同层的纹理共用一次绑定
+ *
+ */
+class texture_array_t{
+    public:
+        unsigned int texture_id;
+        int width, height, layers;
+
+        texture_array_t(int width, int height, int layers, bool mipmap=true);
+        ~texture_array_t();
+        /**
+         * @brief 上传一层像素
+         * @param rgba 尺寸与数组一致的 RGBA8 像素
+         */
+        void upload_layer(int layer, const unsigned char* rgba);
+        /**
+         * @brief 所有层上传后生成多级纹理
+         */
+        void generate_mipmap();
+    private:
+        bool mipmap;
+};
+
+/**
+ * @brief 纹理缓冲对象(GL_TEXTURE_BUFFER),用于向着色器传递大块数组数据
+ * @note 着色器中以 samplerBuffer/usamplerBuffer + texelFetch 访问
+ *
+ */
+class texture_buffer_t{
+    public:
+        unsigned int buffer_id;
+        unsigned int texture_id;
+        GLenum internal_format;
+        // 当前缓冲大小(字节)
+        unsigned int size = 0;
+
+        texture_buffer_t(GLenum internal_format, GLenum buffer_usage=GL_STREAM_DRAW);
+        ~texture_buffer_t();
+        void update(unsigned int data_size, const void* data);
+    private:
+        GLenum buffer_usage;
+};
+
 class texture_skybox_t{
 public:
     unsigned int texture_id;
@@ -113,6 +242,7 @@ public:
                     GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
                     color_format, width, height, 0, color_format, GL_UNSIGNED_BYTE, image
                 );
+                render_stats::add(render_stats::counter_t::texture_upload_bytes, uint64_t(width) * height * nrCh);
             }
         }
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -121,6 +251,7 @@ public:
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
         glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        shader_t::invalidate_bind_cache();
     }
 };
 
@@ -140,16 +271,42 @@ public:
     unsigned int v_cnt;
     // Element number
     unsigned int e_cnt;
+    // 位置单独存放时的位置缓冲与只含位置属性的VAO, 否则为0
+    unsigned int position_VBO_id = 0;
+    unsigned int position_VAO_id = 0;
 
+    /**
+     * @param split_position 为真时第一个属性(位置)单独存放在紧密排列的缓冲中, 其余属性仍交错存放在 VBO_id,
+     * 并另建只含位置的VAO; 只写深度的绘制(深度预通道)用 draw_element_position, 只读取位置数据
+     */
     vertices_t(unsigned int vertex_data_len, std::initializer_list<unsigned int> vertex_div, const float* vertex_data,
                         unsigned int element_num, const unsigned int* element_data,
-                        GLenum buffer_usage=GL_STATIC_DRAW);
+                        GLenum buffer_usage=GL_STATIC_DRAW, bool split_position=false);
     ~vertices_t();
     void draw_array(GLenum draw_mode, int beg, int num) const;
     void draw_array(GLenum draw_mode=GL_TRIANGLES) const;
     void draw_element(GLenum draw_mode) const;
+    /**
+     * @brief 只用位置属性绘制元素, 没有分离位置时同 draw_element
+     */
+    void draw_element_position(GLenum draw_mode) const;
+    bool split() const{
+        return position_VAO_id != 0;
+    }
+    /**
+     * @brief 更新顶点数据, 数据仍按构造时的交错格式给出, 分离位置时会拆开分别上传
+     * @param vertex_data_size, offset 字节数, 分离位置时须为整数个顶点
+     */
     void update_vbo_buffer(unsigned int vertex_data_size, const float* vertex_data, unsigned int offset=0);
     void update_ebo_buffer(unsigned int element_data_size, const unsigned int* element_data, unsigned int offset=0);
+    /**
+     * @brief 立即删除VAO与缓冲(析构时不删除), 之后不能再绘制
+     */
+    void destroy();
+private:
+    // 每个顶点的浮点数与其中位置的浮点数
+    unsigned int vertex_floats = 0;
+    unsigned int position_floats = 0;
 };
 
 /**
@@ -167,6 +324,10 @@ class camera_t{
 
         float screen_w_div_h;
 
+        // near & far clipping plane
+        float z_near = 0.1f;
+        float z_far = 500.0f;
+
         glm::mat4 view;
         glm::mat4 projection;
 
@@ -198,6 +359,8 @@ class camera_t{
 
 /**
  * @brief model对象,封装了model矩阵,方便缩放平移旋转物体,支持父子绑定
+ * @note 固定步长模拟时保存上一步的状态, 渲染时可在最近两步之间插值.
+ * 每一步第一次通过成员函数修改状态前自动保存, 直接修改 pos/scale/quaternion 前需先调用 save_prev_state
  * 
  */
 class model_t{
@@ -210,6 +373,20 @@ public:
     model_t(glm::vec3 pos, glm::vec3 scale=glm::vec3(1.), glm::vec3 init_dir=glm::vec3(0, 0, 1), class model_t* p=nullptr);
 
     glm::mat4 get_model() const;
+    /**
+     * @brief 在上一步与当前步之间插值的model矩阵
+     * @param alpha 插值系数[0, 1], 由 user_render 传入
+     */
+    glm::mat4 get_model(float alpha) const;
+    /**
+     * @brief 自身与所有父对象的缩放三个分量都相等(插值时上一步也是)
+     */
+    bool uniform_scale() const;
+    /**
+     * @brief model矩阵对应的法线矩阵, 即左上3x3的逆转置
+     * @param uniform_scale 为真时只是旋转与等比缩放, 直接由3x3部分除以缩放的平方得到, 否则按余子式求逆
+     */
+    static glm::mat3 normal_matrix(const glm::mat4& model, bool uniform_scale);
     glm::mat4 move_to(glm::vec3 pos);
     glm::mat4 move_to(float x, float y, float z);
     glm::mat4 scale_to(float x);
@@ -223,8 +400,30 @@ public:
     glm::vec3 look_at_dir() const;
     glm::vec3 rotate_euler_angles() const;
     void set_parent_model(class model_t* p);
+    // 保存修改前的状态, 同一步内只保存一次
+    void save_prev_state();
+
+    /**
+     * @brief 模拟步计数, 由窗口运行时在每次 user_fixed_update 前递增
+     */
+    static void advance_tick();
+    static uint64_t current_tick();
+    /**
+     * @brief 渲染时的插值系数, shader_t::update_model 按此插值, 由窗口运行时在 user_render 前设置
+     */
+    static void set_render_alpha(float alpha);
+    static float render_alpha();
 private:
     class model_t* parent = nullptr;
+
+    glm::vec3 prev_pos;
+    glm::vec3 prev_scale;
+    glm::quat prev_quaternion;
+    // 保存上一步状态时的模拟步, 不等于当前步时表示本步没有移动
+    uint64_t prev_tick = UINT64_MAX;
+
+    static uint64_t tick;
+    static float interp_alpha;
 };
 
 /**
@@ -0,0 +1,260 @@
+#include "core/world_streamer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include "utils/debug.hpp"
+#include "utils/profiler.hpp"
+
+using namespace Ez3DGL;
+
+static_assert(sizeof(Vertex) == world_pack::vertex_floats * sizeof(float), "world pack vertex layout mismatch");
+
+WorldStreamer::WorldStreamer(const char* pack_file){
+    open(pack_file);
+}
+
+WorldStreamer::WorldStreamer(const char* pack_file, const Options& options):options(options){
+    open(pack_file);
+}
+
+WorldStreamer::~WorldStreamer(){
+    job_system::wait(&load_counter);
+    for(size_t i=0; i<cell_num; i++)
+        release(cells[i]);
+}
+
+void WorldStreamer::open(const char* pack_file){
+    if(!reader.open(pack_file)) return;
+    cell_num = reader.cells().size();
+    cells.reset(new cell_t[cell_num]);
+    frame_stats.cells = uint32_t(cell_num);
+    log_info("World %s %zu cells readed.", pack_file, cell_num);
+}
+
+float WorldStreamer::hitch_bucket_limit(int bucket){
+    return bucket >= hitch_bucket_num - 1 ? INFINITY : 0.25f * float(1 << bucket);
+}
+
+bool WorldStreamer::resident(size_t cell) const{
+    assert_with_info(cell < cell_num, "cell %zu out of range", cell);
+    return cells[cell].state.load(std::memory_order_acquire) == state_t::resident;
+}
+
+void WorldStreamer::update(const camera_t* camera){
+    profile_scope("WorldStreamer::update");
+    if(!valid()) return;
+    const auto beg = std::chrono::steady_clock::now();
+    step(camera, options.upload_budget_ms);
+    const float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - beg).count();
+    int bucket = 0;
+    while(ms >= hitch_bucket_limit(bucket))
+        bucket += 1;
+    hitch[bucket] += 1;
+    frame_stats.update_ms = ms;
+}
+
+void WorldStreamer::flush(const camera_t* camera){
+    profile_scope("WorldStreamer::flush");
+    if(!valid()) return;
+    while(true){
+        bool done = step(camera, INFINITY) == 0;
+        for(auto index: in_range){
+            const auto state = cells[index].state.load(std::memory_order_acquire);
+            // 超出预算而无法读取的单元不再等待
+            if(state == state_t::loading || state == state_t::loaded)
+                done = false;
+        }
+        if(done) break;
+        job_system::wait(&load_counter);
+    }
+}
+
+void WorldStreamer::schedule(const camera_t* camera){
+    frame += 1;
+    in_range.clear();
+    const auto& infos = reader.cells();
+    for(size_t i=0; i<cell_num; i++){
+        const auto& info = infos[i];
+        // 到单元包围盒的水平距离
+        const float dx = std::max({info.bounds_min.x - camera->position.x, 0.f, camera->position.x - info.bounds_max.x});
+        const float dz = std::max({info.bounds_min.z - camera->position.z, 0.f, camera->position.z - info.bounds_max.z});
+        auto& cell = cells[i];
+        cell.distance = std::sqrt(dx * dx + dz * dz);
+        if(cell.distance <= options.load_radius){
+            cell.last_needed = frame;
+            in_range.push_back(uint32_t(i));
+        }
+    }
+    std::sort(in_range.begin(), in_range.end(), [this](uint32_t a, uint32_t b){
+        return cells[a].distance < cells[b].distance;
+    });
+}
+
+void WorldStreamer::start_load(uint32_t index){
+    auto& cell = cells[index];
+    cell.state.store(state_t::loading, std::memory_order_relaxed);
+    frame_stats.loads += 1;
+    job_system::run([this, index](){
+        profile_scope("WorldStreamer::load");
+        auto& cell = cells[index];
+        std::unique_ptr<world_pack::cell_t> data(new world_pack::cell_t());
+        if(reader.read_cell(index, *data))
+            cell.data = std::move(data);
+        cell.state.store(state_t::loaded, std::memory_order_release);
+    }, &load_counter);
+}
+
+uint32_t WorldStreamer::step(const camera_t* camera, float upload_budget_ms){
+    const auto beg = std::chrono::steady_clock::now();
+    schedule(camera);
+    const auto& infos = reader.cells();
+
+    // 读取中与等待上传的单元将要占用的字节数
+    uint32_t loading = 0;
+    uint64_t pending_bytes = 0;
+    for(size_t i=0; i<cell_num; i++){
+        const auto state = cells[i].state.load(std::memory_order_acquire);
+        if(state == state_t::loading)
+            loading += 1;
+        if(state == state_t::loading || state == state_t::loaded)
+            pending_bytes += infos[i].memory_bytes - cells[i].uploaded_bytes;
+    }
+    uint32_t started = 0;
+    for(auto index: in_range){
+        auto& cell = cells[index];
+        if(cell.failed || cell.state.load(std::memory_order_acquire) != state_t::unloaded) continue;
+        if(loading >= options.max_loading) break;
+        const uint64_t bytes = infos[index].memory_bytes;
+        while(resident_bytes + pending_bytes + bytes > options.memory_budget && evict_one()){}
+        // 更远的单元同样放不下
+        if(resident_bytes + pending_bytes + bytes > options.memory_budget) break;
+        start_load(index);
+        started += 1;
+        loading += 1;
+        pending_bytes += bytes;
+    }
+
+    // 由近到远上传, 每帧至少上传一项
+    bool uploaded_any = false, out_of_time = false;
+    for(auto index: in_range){
+        auto& cell = cells[index];
+        while(cell.state.load(std::memory_order_acquire) == state_t::loaded){
+            if(cell.data == nullptr){
+                log_error("fail to read world cell (%d, %d)", infos[index].x, infos[index].z);
+                cell.failed = true;
+                cell.state.store(state_t::unloaded, std::memory_order_relaxed);
+                frame_stats.failures += 1;
+                break;
+            }
+            if(uploaded_any && std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - beg).count() >= upload_budget_ms){
+                out_of_time = true;
+                break;
+            }
+            upload_item(cell);
+            uploaded_any = true;
+        }
+        if(out_of_time) break;
+    }
+
+    // 读取完成时已离开加载范围的单元
+    for(size_t i=0; i<cell_num; i++){
+        auto& cell = cells[i];
+        if(cell.last_needed != frame && cell.state.load(std::memory_order_acquire) == state_t::loaded){
+            release(cell);
+            frame_stats.cancels += 1;
+        }
+    }
+    while(resident_bytes > options.memory_budget && evict_one()){}
+    update_stats();
+    return started;
+}
+
+bool WorldStreamer::upload_item(cell_t& cell){
+    auto& data = *cell.data;
+    const size_t texture_num = data.textures.size();
+    const size_t item_num = texture_num + data.meshes.size();
+    uint64_t bytes = 0;
+    if(cell.uploaded_items < texture_num){
+        const auto& src = data.textures[cell.uploaded_items];
+        cell.textures.emplace_back(new texture_t(src));
+        for(const auto& level: src.levels)
+            bytes += level.data.size();
+    }else if(cell.uploaded_items < item_num){
+        const auto& src = data.meshes[cell.uploaded_items - texture_num];
+        std::unique_ptr<Mesh> mesh(new Mesh());
+        mesh->vertex_data.resize(src.vertex_num());
+        memcpy(static_cast<void*>(mesh->vertex_data.data()), src.vertices.data(), src.vertices.size() * sizeof(float));
+        mesh->indices.assign(src.indices.begin(), src.indices.end());
+        if(src.texture >= 0)
+            mesh->textures.push_back(Texture{Texture::Type::Diffuse, cell.textures[src.texture].get()});
+        mesh->setup_vertices();
+        cell.meshes.push_back(std::move(mesh));
+        bytes = src.vertices.size() * sizeof(float) + src.indices.size() * sizeof(uint32_t);
+    }
+    if(cell.uploaded_items < item_num)
+        cell.uploaded_items += 1;
+    cell.uploaded_bytes += bytes;
+    resident_bytes += bytes;
+    if(cell.uploaded_items < item_num) return false;
+    cell.data.reset();
+    cell.state.store(state_t::resident, std::memory_order_relaxed);
+    frame_stats.uploads += 1;
+    return true;
+}
+
+void WorldStreamer::release(cell_t& cell){
+    for(auto& mesh: cell.meshes)
+        mesh->release_vertices();
+    for(auto& texture: cell.textures)
+        texture->destroy();
+    cell.meshes.clear();
+    cell.textures.clear();
+    cell.data.reset();
+    resident_bytes -= cell.uploaded_bytes;
+    cell.uploaded_bytes = 0;
+    cell.uploaded_items = 0;
+    cell.state.store(state_t::unloaded, std::memory_order_relaxed);
+}
+
+bool WorldStreamer::evict_one(){
+    cell_t* oldest = nullptr;
+    for(size_t i=0; i<cell_num; i++){
+        auto& cell = cells[i];
+        if(cell.last_needed == frame || cell.state.load(std::memory_order_acquire) != state_t::resident) continue;
+        if(oldest == nullptr || cell.last_needed < oldest->last_needed)
+            oldest = &cell;
+    }
+    if(oldest == nullptr) return false;
+    release(*oldest);
+    frame_stats.evictions += 1;
+    return true;
+}
+
+void WorldStreamer::update_stats(){
+    frame_stats.in_range = uint32_t(in_range.size());
+    frame_stats.resident = frame_stats.loading = frame_stats.staged = 0;
+    for(size_t i=0; i<cell_num; i++){
+        switch(cells[i].state.load(std::memory_order_acquire)){
+            case state_t::resident: frame_stats.resident += 1; break;
+            case state_t::loading:  frame_stats.loading += 1; break;
+            case state_t::loaded:   frame_stats.staged += 1; break;
+            default: break;
+        }
+    }
+    frame_stats.resident_bytes = resident_bytes;
+}
+
+void WorldStreamer::draw(Shader* shader, const camera_t* camera, const OcclusionCuller* culler){
+    profile_gpu_scope("WorldStreamer::draw");
+    const glm::mat4 identity(1.f);
+    for(auto index: in_range){
+        const auto& cell = cells[index];
+        if(cell.state.load(std::memory_order_acquire) != state_t::resident) continue;
+        for(const auto& mesh: cell.meshes){
+            if(culler != nullptr && !culler->test_aabb(mesh->bounds_min, mesh->bounds_max, identity))
+                continue;
+            mesh->draw(shader, camera, &origin);
+        }
+    }
+}
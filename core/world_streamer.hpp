@@ -0,0 +1,158 @@
+/**
+ * @file world_streamer.hpp
+ * @brief 开放世界流式加载: 按到相机的距离在后台线程读取世界分块文件中的单元, 每帧限时上传, 超出显存预算时按LRU淘汰
+ *
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "mesh_layer.hpp"
+#include "utils/job_system.hpp"
+#include "utils/world_pack.hpp"
+
+namespace Ez3DGL{
+
+/**
+ * @brief 世界流式加载, 场景由 world_pack 文件(见 tools/world_pack)按水平网格划分为单元
+ *
+ * 每帧 update:
+ * - 与相机水平距离在 load_radius 内的单元按距离由近到远排队, 在 job_system 工作线程上读取并解析;
+ * - 读取完成的单元在主线程按时间预算逐个纹理/网格上传, 超出预算的部分留到下一帧;
+ * - 已上传的字节数超出 memory_budget 时, 淘汰最久未进入加载范围的单元.
+ * 离开加载范围的单元在淘汰前仍留在显存中, 回到范围内时不需要重新读取
+ * @note update 与 draw 只能在主线程调用; 未初始化 job_system 时读取在主线程同步完成
+ *
+ * 用法:
+ *     WorldStreamer world("city.ezwp");
+ *     world.update(camera);
+ *     world.draw(&shader, camera);
+ */
+class WorldStreamer{
+public:
+    struct Options{
+        // 加载范围(水平距离)
+        float load_radius=300.f;
+        // 显存预算(字节), 只统计本模块上传的顶点, 索引与纹理
+        uint64_t memory_budget=512ull*1024*1024;
+        // 每帧上传的时间预算(毫秒), 每帧至少上传一项
+        float upload_budget_ms=2.f;
+        // 同时读取的单元数上限
+        uint32_t max_loading=4;
+    };
+    struct stats_t{
+        // 单元总数, 在加载范围内的数量
+        uint32_t cells = 0;
+        uint32_t in_range = 0;
+        // 已上传, 正在读取, 读取完成等待上传的单元数
+        uint32_t resident = 0;
+        uint32_t loading = 0;
+        uint32_t staged = 0;
+        uint64_t resident_bytes = 0;
+        // 累计: 读取, 完成上传, 淘汰, 读取完成后已不需要而丢弃, 读取失败的单元数
+        uint64_t loads = 0;
+        uint64_t uploads = 0;
+        uint64_t evictions = 0;
+        uint64_t cancels = 0;
+        uint64_t failures = 0;
+        // 上一次 update 的耗时(毫秒)
+        float update_ms = 0.f;
+    };
+    // update 耗时直方图的桶数, 第i个桶的上界为 0.25*2^i 毫秒, 最后一个桶没有上界
+    static constexpr int hitch_bucket_num = 8;
+
+    explicit WorldStreamer(const char* pack_file);
+    WorldStreamer(const char* pack_file, const Options& options);
+    WorldStreamer(const WorldStreamer&) = delete;
+    WorldStreamer& operator=(const WorldStreamer&) = delete;
+    /**
+     * @brief 等待正在读取的单元完成后释放所有资源
+     */
+    ~WorldStreamer();
+
+    bool valid() const{
+        return cell_num != 0;
+    }
+    /**
+     * @brief 按相机位置调度读取, 在时间预算内上传, 必要时淘汰
+     */
+    void update(const camera_t* camera);
+    /**
+     * @brief 绘制加载范围内已上传的单元
+     * @param culler 不为空时跳过在视锥外或被遮挡的网格
+     */
+    void draw(Shader* shader, const camera_t* camera, const OcclusionCuller* culler=nullptr);
+    /**
+     * @brief 阻塞直到加载范围内的单元全部上传(如进入场景时), 不受时间预算限制
+     */
+    void flush(const camera_t* camera);
+
+    const stats_t& stats() const{
+        return frame_stats;
+    }
+    const std::array<uint64_t, hitch_bucket_num>& hitch_histogram() const{
+        return hitch;
+    }
+    // 桶的上界(毫秒), 最后一个桶返回 INFINITY
+    static float hitch_bucket_limit(int bucket);
+    const world_pack::cell_info_t& cell_info(size_t cell) const{
+        return reader.cells()[cell];
+    }
+    bool resident(size_t cell) const;
+    const Options& get_options() const{
+        return options;
+    }
+private:
+    enum class state_t : uint8_t{
+        unloaded,
+        loading,
+        // 数据已读入内存, 等待上传
+        loaded,
+        resident,
+    };
+    struct cell_t{
+        std::atomic<state_t> state{state_t::unloaded};
+        // 工作线程写入, state 变为 loaded 后主线程读取
+        std::unique_ptr<world_pack::cell_t> data;
+        bool failed = false;
+        std::vector<std::unique_ptr<texture_t>> textures;
+        std::vector<std::unique_ptr<Mesh>> meshes;
+        // 已上传的项数(先纹理后网格)与字节数
+        size_t uploaded_items = 0;
+        uint64_t uploaded_bytes = 0;
+        // 最近一次在加载范围内的帧
+        uint64_t last_needed = 0;
+        float distance = 0.f;
+    };
+
+    Options options;
+    world_pack::reader_t reader;
+    size_t cell_num = 0;
+    std::unique_ptr<cell_t[]> cells;
+    // 本帧在加载范围内的单元, 由近到远
+    std::vector<uint32_t> in_range;
+    model_t origin{glm::vec3(0.f)};
+    job_system::counter_t load_counter;
+    uint64_t frame = 0;
+    uint64_t resident_bytes = 0;
+    stats_t frame_stats;
+    std::array<uint64_t, hitch_bucket_num> hitch{};
+
+    void open(const char* pack_file);
+    void schedule(const camera_t* camera);
+    // 一次调度与上传, 返回开始读取的单元数
+    uint32_t step(const camera_t* camera, float upload_budget_ms);
+    void start_load(uint32_t index);
+    // 上传一项, 单元全部上传后返回 true
+    bool upload_item(cell_t& cell);
+    void release(cell_t& cell);
+    // 淘汰一个本帧不需要的单元, 没有可淘汰的单元时返回 false
+    bool evict_one();
+    void update_stats();
+};
+
+}
@@ -0,0 +1,74 @@
+/**
+ * @file texture_compress.cpp
+ * @brief 离线纹理压缩工具: 读取图片, 生成多级纹理, 编码为 BC1/BC3/BC5/BC7 并写入 .ktx2
+ * 用法: texture_compress <input> <output.ktx2> [bc1|bc3|bc5|bc7|rgba8] [--srgb] [--no-mips] [--threads N]
+ * 默认格式为 bc7, 编码按块行在任务系统上并行, 线程数默认为硬件线程数
+ *
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "stb_image.h"
+#include "utils/job_system.hpp"
+#include "utils/texture_codec.hpp"
+
+using namespace Ez3DGL;
+
+static int usage(){
+    printf("usage: texture_compress <input> <output.ktx2> [bc1|bc3|bc5|bc7|rgba8] [--srgb] [--no-mips] [--threads N]\n");
+    return 1;
+}
+
+int main(int argc, char** argv){
+    if(argc < 3) return usage();
+    texture_codec::format_t format = texture_codec::format_t::bc7;
+    bool srgb = false, mipmaps = true;
+    int threads = -1;
+    for(int i=3; i<argc; i++){
+        if(strcmp(argv[i], "--srgb") == 0) srgb = true;
+        else if(strcmp(argv[i], "--no-mips") == 0) mipmaps = false;
+        else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+        else if(!texture_codec::parse_format(argv[i], format)) return usage();
+    }
+    int width, height, channels;
+    unsigned char* pixels = stbi_load(argv[1], &width, &height, &channels, 4);
+    if(pixels == nullptr){
+        printf("[ERROR] fail to load %s\n", argv[1]);
+        return 1;
+    }
+    // 工作线程数不含主线程
+    job_system::init(threads > 0 ? threads - 1 : -1);
+    const auto beg = std::chrono::steady_clock::now();
+    auto container = texture_codec::compress(pixels, width, height, format, srgb, mipmaps);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+
+    size_t compressed_bytes = 0, raw_bytes = 0;
+    std::vector<uint8_t> decoded;
+    std::vector<texture_codec::level_t> reference;
+    if(mipmaps)
+        reference = texture_codec::build_mips(pixels, width, height, container.srgb);
+    else
+        reference.push_back(texture_codec::level_t{width, height, std::vector<uint8_t>(pixels, pixels + size_t(width) * height * 4)});
+    for(size_t i=0; i<container.levels.size(); i++){
+        const auto& level = container.levels[i];
+        decoded.resize(size_t(level.width) * level.height * 4);
+        texture_codec::decode(container.format, level.data.data(), level.width, level.height, decoded.data());
+        printf("level %2zu %5d*%-5d %9zu bytes  PSNR %6.2f dB\n", i, level.width, level.height, level.data.size(),
+            texture_codec::psnr(reference[i].data.data(), decoded.data(), size_t(level.width) * level.height,
+                texture_codec::format_channels(container.format)));
+        compressed_bytes += level.data.size();
+        raw_bytes += reference[i].data.size();
+    }
+    printf("%s %s%s: %zu -> %zu bytes (%.2fx), %.1f ms, %.2f MPix/s on %u threads\n", argv[1],
+        texture_codec::format_name(container.format), container.srgb ? " srgb" : "", raw_bytes, compressed_bytes,
+        double(raw_bytes) / compressed_bytes, seconds * 1e3, raw_bytes / 4 / seconds / 1e6, job_system::worker_num() + 1);
+    stbi_image_free(pixels);
+    job_system::shutdown();
+    if(!texture_codec::write_container(argv[2], container)){
+        printf("[ERROR] fail to write %s\n", argv[2]);
+        return 1;
+    }
+    return 0;
+}
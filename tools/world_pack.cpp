@@ -0,0 +1,145 @@
+/**
+ * @file world_pack.cpp
+ * @brief 离线世界分块工具: 按清单摆放模型, 烘焙到世界空间后按水平网格划分单元, 写入 WorldStreamer 读取的分块文件
+ * 用法: world_pack <manifest.txt> <output.ezwp> [--cell-size N] [bc1|bc3|bc7|rgba8] [--srgb] [--threads N]
+ * 清单每行一个模型: <模型文件> <x> <y> <z> [缩放] [绕y轴旋转角度], 以 # 开头的行为注释;
+ * 每个网格归入其包围盒中心所在的单元, 漫反射贴图压缩后存入用到它的每个单元, 默认格式为 bc7, 单元边长为 64
+ *
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "stb_image.h"
+#include "utils/job_system.hpp"
+#include "utils/texture_codec.hpp"
+#include "utils/world_pack.hpp"
+
+using namespace Ez3DGL;
+
+static int usage(){
+    printf("usage: world_pack <manifest.txt> <output.ezwp> [--cell-size N] [bc1|bc3|bc7|rgba8] [--srgb] [--threads N]\n");
+    return 1;
+}
+
+struct packer_t{
+    world_pack::writer_t writer;
+    texture_codec::format_t format;
+    bool srgb;
+    // 已压缩的贴图, 按文件路径索引, -1 表示读取失败
+    std::unordered_map<std::string, int32_t> textures;
+    size_t mesh_num = 0;
+
+    int32_t texture(const std::string& path){
+        auto it = textures.find(path);
+        if(it != textures.end()) return it->second;
+        int width, height, channels;
+        unsigned char* pixels = stbi_load(path.c_str(), &width, &height, &channels, 4);
+        int32_t index = -1;
+        if(pixels == nullptr){
+            printf("[ERROR] fail to load %s\n", path.c_str());
+        }else{
+            index = int32_t(writer.add_texture(texture_codec::compress(pixels, width, height, format, srgb)));
+            stbi_image_free(pixels);
+        }
+        textures[path] = index;
+        return index;
+    }
+
+    bool add_model(const std::string& path, const glm::mat4& model){
+        Assimp::Importer import;
+        const aiScene* scene = import.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenNormals);
+        if(scene == nullptr || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || scene->mRootNode == nullptr){
+            printf("[ERROR] Assimp %s\n", import.GetErrorString());
+            return false;
+        }
+        const std::string directory = path.substr(0, path.find_last_of('/'));
+        const glm::mat3 normal_matrix = glm::mat3(glm::transpose(glm::inverse(model)));
+        for(unsigned int i=0; i<scene->mNumMeshes; i++){
+            const aiMesh* mesh = scene->mMeshes[i];
+            if(mesh->mNumVertices == 0) continue;
+            world_pack::mesh_t res;
+            res.vertices.reserve(size_t(mesh->mNumVertices) * world_pack::vertex_floats);
+            for(unsigned int v=0; v<mesh->mNumVertices; v++){
+                const glm::vec3 p = glm::vec3(model * glm::vec4(mesh->mVertices[v].x, mesh->mVertices[v].y, mesh->mVertices[v].z, 1.f));
+                glm::vec3 n(0.f, 1.f, 0.f);
+                if(mesh->mNormals != nullptr)
+                    n = glm::normalize(normal_matrix * glm::vec3(mesh->mNormals[v].x, mesh->mNormals[v].y, mesh->mNormals[v].z));
+                const glm::vec2 uv = mesh->mTextureCoords[0] ?
+                    glm::vec2(mesh->mTextureCoords[0][v].x, mesh->mTextureCoords[0][v].y) : glm::vec2(0.f, 0.f);
+                res.vertices.insert(res.vertices.end(), {p.x, p.y, p.z, n.x, n.y, n.z, uv.x, uv.y});
+            }
+            for(unsigned int f=0; f<mesh->mNumFaces; f++)
+                for(unsigned int k=0; k<mesh->mFaces[f].mNumIndices; k++)
+                    res.indices.push_back(mesh->mFaces[f].mIndices[k]);
+            const aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+            if(material->GetTextureCount(aiTextureType_DIFFUSE) > 0){
+                aiString filename;
+                material->GetTexture(aiTextureType_DIFFUSE, 0, &filename);
+                res.texture = texture(directory + '/' + filename.C_Str());
+            }
+            writer.add_mesh(std::move(res));
+            mesh_num += 1;
+        }
+        return true;
+    }
+};
+
+int main(int argc, char** argv){
+    if(argc < 3) return usage();
+    float cell_size = 64.f;
+    texture_codec::format_t format = texture_codec::format_t::bc7;
+    bool srgb = false;
+    int threads = -1;
+    for(int i=3; i<argc; i++){
+        if(strcmp(argv[i], "--cell-size") == 0 && i + 1 < argc) cell_size = float(atof(argv[++i]));
+        else if(strcmp(argv[i], "--srgb") == 0) srgb = true;
+        else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+        else if(!texture_codec::parse_format(argv[i], format)) return usage();
+    }
+    if(cell_size <= 0) return usage();
+    std::ifstream manifest(argv[1]);
+    if(!manifest.is_open()){
+        printf("[ERROR] fail to open %s\n", argv[1]);
+        return 1;
+    }
+    // 工作线程数不含主线程
+    job_system::init(threads > 0 ? threads - 1 : -1);
+    packer_t packer{world_pack::writer_t(cell_size), format, srgb, {}, 0};
+    std::string line;
+    int line_no = 0, model_num = 0;
+    while(std::getline(manifest, line)){
+        line_no += 1;
+        std::istringstream in(line);
+        std::string path;
+        glm::vec3 pos;
+        float scale = 1.f, yaw = 0.f;
+        if(!(in >> path) || path[0] == '#') continue;
+        if(!(in >> pos.x >> pos.y >> pos.z)){
+            printf("[ERROR] %s:%d: expect <model> <x> <y> <z> [scale] [yaw]\n", argv[1], line_no);
+            continue;
+        }
+        in >> scale >> yaw;
+        glm::mat4 model = glm::translate(glm::mat4(1.f), pos);
+        model = glm::rotate(model, glm::radians(yaw), glm::vec3(0.f, 1.f, 0.f));
+        model = glm::scale(model, glm::vec3(scale));
+        if(packer.add_model(path, model))
+            model_num += 1;
+    }
+    job_system::shutdown();
+    if(!packer.writer.write(argv[2])){
+        printf("[ERROR] fail to write %s\n", argv[2]);
+        return 1;
+    }
+    printf("%s: %d models, %zu meshes, %zu textures, %zu cells of %.1f\n", argv[2], model_num, packer.mesh_num,
+        packer.textures.size(), packer.writer.cell_num(), cell_size);
+    return 0;
+}
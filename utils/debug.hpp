@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cassert>
+#include "utils/logger.hpp"
+
 #define ANSI_FG_BLACK   "\33[1;30m"
 #define ANSI_FG_RED     "\33[1;31m"
 #define ANSI_FG_GREEN   "\33[1;32m"
@@ -22,19 +25,16 @@
 
 
 #define log_with_info(FMT, ...) \
-    do{ \
-        printf("%s:%d %s:" "\n",    \
-            __FILE__, __LINE__, __func__);  \
-        printf(ANSI_FMT("[LOG] " FMT, ANSI_FG_BLUE) "\n", ## __VA_ARGS__); \
-    }while(0)
+    log_at_(info, true, FMT, ## __VA_ARGS__)
 
+// 条件只求值一次; 失败时同步输出, 未定义 NDEBUG 时终止
 #define assert_with_info(COND, FMT, ...) \
-    if(!(COND)){ \
-        printf("%s:%d %s:" "\n",    \
-            __FILE__, __LINE__, __func__);  \
-        printf(ANSI_FMT("[ASSERT] " FMT, ANSI_FG_RED) "\n", ## __VA_ARGS__); \
-    } \
-    assert(COND)
+    do{ \
+        if(!(COND)){ \
+            log_fatal("assertion `%s' failed: " FMT, #COND, ## __VA_ARGS__); \
+            assert(false && #COND); \
+        } \
+    }while(0)
 
 #define panic_with_info(FMT, ...) \
     assert_with_info(0, FMT, ## __VA_ARGS__)
@@ -0,0 +1,197 @@
+#include "utils/frame_arena.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+using namespace Ez3DGL;
+
+namespace {
+
+std::atomic<uint64_t> total_allocs{0};
+thread_local uint64_t thread_allocs = 0;
+uint64_t frame_beg_allocs = 0;
+uint64_t frame_allocs = 0;
+
+// 所有线程的帧分配器, 帧末统一释放
+struct arena_list_t{
+    std::mutex mutex;
+    std::vector<frame_arena::arena_t*> arenas;
+};
+
+arena_list_t& arena_list(){
+    static arena_list_t list;
+    return list;
+}
+
+struct thread_arena_t{
+    frame_arena::arena_t arena;
+
+    thread_arena_t(){
+        auto& list = arena_list();
+        std::lock_guard<std::mutex> lock(list.mutex);
+        list.arenas.push_back(&arena);
+    }
+    ~thread_arena_t(){
+        auto& list = arena_list();
+        std::lock_guard<std::mutex> lock(list.mutex);
+        list.arenas.erase(std::find(list.arenas.begin(), list.arenas.end(), &arena));
+    }
+};
+
+}
+
+frame_arena::arena_t::arena_t(size_t block_size): block_size(block_size){
+}
+
+frame_arena::arena_t::~arena_t(){
+    for(auto& block: blocks)
+        ::operator delete(block.data, std::align_val_t(alignof(std::max_align_t)));
+}
+
+void* frame_arena::arena_t::do_allocate(size_t bytes, size_t alignment){
+    while(true){
+        if(cur < blocks.size()){
+            auto& block = blocks[cur];
+            // 按绝对地址对齐, 块本身只按 max_align_t 对齐, 新块的大小已留出对齐的余量
+            const uintptr_t base = reinterpret_cast<uintptr_t>(block.data);
+            const size_t beg = size_t((base + offset + alignment - 1) / alignment * alignment - base);
+            if(beg + bytes <= block.size){
+                offset = beg + bytes;
+                return block.data + beg;
+            }
+            // 当前块放不下, 换到下一个块
+            used_before += offset;
+            cur += 1;
+            offset = 0;
+            if(cur < blocks.size())
+                continue;
+        }
+        const size_t size = std::max(block_size, bytes + alignment);
+        blocks.push_back(block_t{static_cast<std::byte*>(::operator new(size, std::align_val_t(alignof(std::max_align_t)))), size});
+        cur = blocks.size() - 1;
+        offset = 0;
+    }
+}
+
+void frame_arena::arena_t::reset(){
+    if(blocks.size() > 1){
+        // 合并为一个能容纳本帧全部用量的块
+        const size_t size = capacity();
+        for(auto& block: blocks)
+            ::operator delete(block.data, std::align_val_t(alignof(std::max_align_t)));
+        blocks.clear();
+        blocks.push_back(block_t{static_cast<std::byte*>(::operator new(size, std::align_val_t(alignof(std::max_align_t)))), size});
+        block_size = std::max(block_size, size);
+    }
+    cur = 0;
+    offset = 0;
+    used_before = 0;
+}
+
+size_t frame_arena::arena_t::used() const{
+    return used_before + offset;
+}
+
+size_t frame_arena::arena_t::capacity() const{
+    size_t size = 0;
+    for(const auto& block: blocks)
+        size += block.size;
+    return size;
+}
+
+std::pmr::memory_resource* frame_arena::resource(){
+    thread_local thread_arena_t arena;
+    return &arena.arena;
+}
+
+void frame_arena::end_frame(){
+    {
+        auto& list = arena_list();
+        std::lock_guard<std::mutex> lock(list.mutex);
+        for(auto arena: list.arenas)
+            arena->reset();
+    }
+    const uint64_t now = heap_allocs();
+    frame_allocs = now - frame_beg_allocs;
+    frame_beg_allocs = now;
+}
+
+uint64_t frame_arena::thread_heap_allocs(){
+    return thread_allocs;
+}
+
+uint64_t frame_arena::heap_allocs(){
+    return total_allocs.load(std::memory_order_relaxed);
+}
+
+uint64_t frame_arena::last_frame_heap_allocs(){
+    return frame_allocs;
+}
+
+#ifdef EZ3DGL_COUNT_ALLOCS
+
+bool frame_arena::counting_allocs(){
+    return true;
+}
+
+static void* counted_alloc(size_t size, size_t alignment){
+    total_allocs.fetch_add(1, std::memory_order_relaxed);
+    thread_allocs += 1;
+    if(size == 0)
+        size = 1;
+    void* p = nullptr;
+    if(alignment <= alignof(std::max_align_t))
+        p = malloc(size);
+    else
+        p = aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    if(p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size){
+    return counted_alloc(size, alignof(std::max_align_t));
+}
+void* operator new[](size_t size){
+    return counted_alloc(size, alignof(std::max_align_t));
+}
+void* operator new(size_t size, std::align_val_t alignment){
+    return counted_alloc(size, size_t(alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment){
+    return counted_alloc(size, size_t(alignment));
+}
+void operator delete(void* p) noexcept{
+    free(p);
+}
+void operator delete[](void* p) noexcept{
+    free(p);
+}
+void operator delete(void* p, size_t) noexcept{
+    free(p);
+}
+void operator delete[](void* p, size_t) noexcept{
+    free(p);
+}
+void operator delete(void* p, std::align_val_t) noexcept{
+    free(p);
+}
+void operator delete[](void* p, std::align_val_t) noexcept{
+    free(p);
+}
+void operator delete(void* p, size_t, std::align_val_t) noexcept{
+    free(p);
+}
+void operator delete[](void* p, size_t, std::align_val_t) noexcept{
+    free(p);
+}
+
+#else
+
+bool frame_arena::counting_allocs(){
+    return false;
+}
+
+#endif
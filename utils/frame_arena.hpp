@@ -0,0 +1,140 @@
+/**
+ * @file frame_arena.hpp
+ * @brief 帧内临时内存: 线性分配器(std::pmr 内存资源, 每帧结束时整体释放), 不分配堆内存的uniform名字拼接
+ * @note 定义 EZ3DGL_COUNT_ALLOCS 后替换全局 operator new 统计堆分配次数, 用于验证绘制路径每帧没有堆分配
+ *
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <vector>
+#include "utils/debug.hpp"
+
+namespace Ez3DGL {
+namespace frame_arena {
+
+    /**
+     * @brief 线性分配器, 释放单个分配不做任何事, reset 时整体释放
+     * @note 一帧用量超过当前块时向上游申请新块, reset 时合并为一个足够大的块, 稳定后不再申请堆内存
+     */
+    class arena_t : public std::pmr::memory_resource{
+    public:
+        explicit arena_t(size_t block_size=256*1024);
+        arena_t(const arena_t&) = delete;
+        arena_t& operator=(const arena_t&) = delete;
+        ~arena_t();
+
+        void reset();
+        // 当前已分配的字节数
+        size_t used() const;
+        size_t capacity() const;
+    protected:
+        void* do_allocate(size_t bytes, size_t alignment) override;
+        void do_deallocate(void*, size_t, size_t) override{}
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override{
+            return this == &other;
+        }
+    private:
+        struct block_t{
+            std::byte* data;
+            size_t size;
+        };
+        std::vector<block_t> blocks;
+        size_t block_size;
+        // 正在使用的块与其中已用的字节数
+        size_t cur = 0;
+        size_t offset = 0;
+        // 之前的块中已用的字节数
+        size_t used_before = 0;
+    };
+
+    /**
+     * @brief 调用线程的帧内存资源, 分配的内存在本帧结束(window_loop 末尾)前有效
+     * @note 每个线程各自一个分配器, 工作线程上的并行任务也可以使用; 跨帧运行的任务不能使用
+     */
+    std::pmr::memory_resource* resource();
+
+    template<class T>
+    using vector = std::pmr::vector<T>;
+
+    /**
+     * @brief 帧边界, 由 window_loop 在帧末调用, 释放所有线程的帧内存并记录本帧的堆分配次数
+     */
+    void end_frame();
+
+    /**
+     * @brief 是否以 EZ3DGL_COUNT_ALLOCS 编译
+     */
+    bool counting_allocs();
+    /**
+     * @brief 调用线程累计的堆分配次数(operator new), 未开启统计时为0
+     */
+    uint64_t thread_heap_allocs();
+    /**
+     * @brief 所有线程累计的堆分配次数
+     */
+    uint64_t heap_allocs();
+    /**
+     * @brief 上一帧所有线程的堆分配次数
+     */
+    uint64_t last_frame_heap_allocs();
+
+    /**
+     * @brief 在栈上拼接 uniform 名字, 如 "lights_point[3]" + ".ambient", 不分配堆内存
+     */
+    class uniform_key_t{
+    public:
+        explicit uniform_key_t(const char* name){
+            base_len = 0;
+            append(name);
+            buf[base_len] = '\0';
+        }
+        uniform_key_t(const char* array_name, unsigned int index){
+            base_len = 0;
+            append(array_name);
+            append("[");
+            char digits[16];
+            int n = 0;
+            do{
+                digits[n++] = char('0' + index % 10);
+                index /= 10;
+            }while(index > 0);
+            while(n > 0){
+                assert_with_info(base_len + 1 < sizeof(buf), "uniform key is too long");
+                buf[base_len++] = digits[--n];
+            }
+            append("]");
+            buf[base_len] = '\0';
+        }
+        /**
+         * @brief 返回 "基础名.name", 返回的指针在下一次调用 field 前有效
+         */
+        const char* field(const char* name){
+            size_t len = base_len;
+            const size_t name_len = strlen(name);
+            assert_with_info(len + 1 + name_len < sizeof(buf), "uniform key is too long: %s", name);
+            buf[len++] = '.';
+            memcpy(buf + len, name, name_len + 1);
+            return buf;
+        }
+        const char* c_str(){
+            buf[base_len] = '\0';
+            return buf;
+        }
+    private:
+        char buf[64];
+        size_t base_len;
+
+        void append(const char* s){
+            const size_t len = strlen(s);
+            assert_with_info(base_len + len < sizeof(buf), "uniform key is too long: %s", s);
+            memcpy(buf + base_len, s, len);
+            base_len += len;
+        }
+    };
+
+}
+}
@@ -0,0 +1,1208 @@
+#include "utils/gl_backend.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <glad/glad.h>
+#include "utils/debug.hpp"
+
+using namespace Ez3DGL;
+
+/*
+ * 参数类型: '-' 普通值, 'o' 以指针传递的偏移量,
+ * 'u' uniform位置(按当前程序映射), 其余为对象名字:
+ * 't' 纹理, 'b' 缓冲, 'v' VAO, 'f' 帧缓冲, 'r' 渲染缓冲, 'p' 程序, 's' 着色器, 'q' 查询
+ */
+#define GL_GENERIC_FUNCS(X) \
+    X(glActiveTexture,          "-") \
+    X(glAttachShader,           "ps") \
+    X(glBeginConditionalRender, "q-") \
+    X(glBeginQuery,             "-q") \
+    X(glBindBuffer,             "-b") \
+    X(glBindBufferBase,         "--b") \
+    X(glBindFramebuffer,        "-f") \
+    X(glBindRenderbuffer,       "-r") \
+    X(glBindTexture,            "-t") \
+    X(glBindVertexArray,        "v") \
+    X(glBlitFramebuffer,        "----------") \
+    X(glClear,                  "-") \
+    X(glClearColor,             "----") \
+    X(glColorMask,              "----") \
+    X(glCompileShader,          "s") \
+    X(glDeleteProgram,          "p") \
+    X(glDeleteShader,           "s") \
+    X(glDepthFunc,              "-") \
+    X(glDepthMask,              "-") \
+    X(glDisable,                "-") \
+    X(glDrawArrays,             "---") \
+    X(glDrawElements,           "---o") \
+    X(glEnable,                 "-") \
+    X(glEnableVertexAttribArray,"-") \
+    X(glEndConditionalRender,   "") \
+    X(glEndQuery,               "-") \
+    X(glFinish,                 "") \
+    X(glFramebufferRenderbuffer,"---r") \
+    X(glFramebufferTexture2D,   "---t-") \
+    X(glGenerateMipmap,         "-") \
+    X(glLinkProgram,            "p") \
+    X(glPixelStorei,            "--") \
+    X(glReadBuffer,             "-") \
+    X(glRenderbufferStorage,    "----") \
+    X(glTexBuffer,              "--b") \
+    X(glTexParameteri,          "---") \
+    X(glUniform1f,              "u-") \
+    X(glUniform1i,              "u-") \
+    X(glUniform3f,              "u---") \
+    X(glUniform4f,              "u----") \
+    X(glUseProgram,             "p") \
+    X(glVertexAttribDivisor,    "--") \
+    X(glVertexAttribIPointer,   "----o") \
+    X(glVertexAttribPointer,    "-----o") \
+    X(glViewport,               "----")
+
+// GL 4.2 以上才有的函数, 驱动不支持时不安装, 保持为空指针以便调用方判断
+#define GL_OPTIONAL_FUNCS(X) \
+    X(glBindImageTexture,       "-t-----") \
+    X(glDispatchCompute,        "---") \
+    X(glMemoryBarrier,          "-") \
+    X(glMultiDrawElementsIndirect,      "--o--") \
+    X(glMultiDrawElementsIndirectCount, "--o---")
+
+// 生成与删除对象名字
+#define GL_NAME_FUNCS(X) \
+    X(glGenBuffers,             glDeleteBuffers,        'b') \
+    X(glGenFramebuffers,        glDeleteFramebuffers,   'f') \
+    X(glGenQueries,             glDeleteQueries,        'q') \
+    X(glGenRenderbuffers,       glDeleteRenderbuffers,  'r') \
+    X(glGenTextures,            glDeleteTextures,       't') \
+    X(glGenVertexArrays,        glDeleteVertexArrays,   'v')
+
+#define GL_UNIFORMV_FUNCS(X) \
+    X(glUniform2fv, 2) \
+    X(glUniform3fv, 3) \
+    X(glUniform4fv, 4)
+
+#define GL_UNIFORM_MATRIX_FUNCS(X) \
+    X(glUniformMatrix3fv, 9) \
+    X(glUniformMatrix4fv, 16)
+
+// 不改变状态的查询, 只统计, 不录制
+#define GL_QUERY_FUNCS(X) \
+    X(glCheckFramebufferStatus) \
+    X(glGetBufferSubData) \
+    X(glGetIntegerv) \
+    X(glGetProgramInfoLog) \
+    X(glGetProgramiv) \
+    X(glGetQueryObjectiv) \
+    X(glGetQueryObjectuiv) \
+    X(glGetQueryObjectui64v) \
+    X(glGetShaderInfoLog) \
+    X(glGetShaderiv) \
+    X(glReadPixels)
+
+#define GL_OTHER_FUNCS(X) \
+    X(glBufferData) \
+    X(glBufferSubData) \
+    X(glCompressedTexImage2D) \
+    X(glCreateProgram) \
+    X(glCreateShader) \
+    X(glDrawBuffers) \
+    X(glGetUniformLocation) \
+    X(glShaderSource) \
+    X(glTexImage2D) \
+    X(glTexImage3D) \
+    X(glTexSubImage3D)
+
+namespace {
+
+enum func_id_t : uint16_t{
+#define X_ID(NAME, ...) id_##NAME,
+#define X_NAME_ID(GEN, DEL, KIND) id_##GEN, id_##DEL,
+    GL_GENERIC_FUNCS(X_ID)
+    GL_OPTIONAL_FUNCS(X_ID)
+    GL_NAME_FUNCS(X_NAME_ID)
+    GL_UNIFORMV_FUNCS(X_ID)
+    GL_UNIFORM_MATRIX_FUNCS(X_ID)
+    GL_QUERY_FUNCS(X_ID)
+    GL_OTHER_FUNCS(X_ID)
+#undef X_ID
+#undef X_NAME_ID
+    func_num
+};
+
+// 录制文件中的帧标记
+constexpr uint16_t frame_marker = 0xFFFF;
+constexpr uint32_t record_magic = 0x4C475A45; // "EZGL"
+constexpr uint32_t record_version = 6;
+
+/**
+ * 状态缓存, 用于判断冗余调用; 值总是被记录(空后端的查询由此返回),
+ * known 为假表示该状态可能已被绕过分发层的调用改变
+ */
+struct shadow_t{
+    struct value_t{
+        uint64_t value = 0;
+        bool known = false;
+        // 返回是否冗余
+        bool set(uint64_t v){
+            const bool redundant = known && value == v;
+            value = v;
+            known = true;
+            return redundant;
+        }
+    };
+    value_t program, vao, active_texture, clear_color, viewport;
+    value_t draw_fbo, read_fbo, renderbuffer;
+    std::unordered_map<uint64_t, value_t> textures, buffers, caps, uniforms;
+    int viewport_rect[4] = {0, 0, 0, 0};
+    int unpack_alignment = 4;
+
+    void invalidate(){
+        for(auto v: {&program, &vao, &active_texture, &clear_color, &viewport, &draw_fbo, &read_fbo, &renderbuffer})
+            v->known = false;
+        for(auto map: {&textures, &buffers, &caps, &uniforms})
+            for(auto& v: *map)
+                v.second.known = false;
+    }
+};
+
+struct writer_t{
+    FILE* fp = nullptr;
+    std::vector<uint8_t> buf;
+
+    template<class T>
+    void put(T v){
+        static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable types can be recorded");
+        const auto p = reinterpret_cast<const uint8_t*>(&v);
+        buf.insert(buf.end(), p, p + sizeof(T));
+    }
+    void put(const void* p){
+        put<uint64_t>(reinterpret_cast<uintptr_t>(p));
+    }
+    void put_bytes(const void* data, uint32_t size){
+        put<uint32_t>(data == nullptr ? UINT32_MAX : size);
+        if(data == nullptr) return;
+        const auto p = static_cast<const uint8_t*>(data);
+        buf.insert(buf.end(), p, p + size);
+    }
+    void flush(){
+        if(fp != nullptr && !buf.empty())
+            fwrite(buf.data(), 1, buf.size(), fp);
+        buf.clear();
+    }
+};
+
+struct reader_t{
+    const uint8_t* p;
+    const uint8_t* end;
+    bool ok = true;
+
+    template<class T>
+    T get(){
+        T v{};
+        if(size_t(end - p) < sizeof(T)){
+            ok = false;
+            p = end;
+            return v;
+        }
+        memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        return v;
+    }
+    // 返回空指针表示录制时传入的是空指针
+    const void* get_bytes(uint32_t& size){
+        size = get<uint32_t>();
+        if(size == UINT32_MAX){
+            size = 0;
+            return nullptr;
+        }
+        if(size_t(end - p) < size){
+            ok = false;
+            p = end;
+            size = 0;
+            return nullptr;
+        }
+        const void* data = p;
+        p += size;
+        return data;
+    }
+};
+
+// 回放时录制的名字到新名字的映射
+struct replay_map_t{
+    std::unordered_map<uint64_t, uint64_t> names[128];
+    // (程序, 录制时的位置) -> 新位置
+    std::unordered_map<uint64_t, int64_t> uniforms;
+    uint64_t program = 0;
+
+    int64_t map(char kind, int64_t v){
+        if(kind == '-' || kind == 'o' || kind == '\0') return v;
+        if(kind == 'u'){
+            if(v < 0) return v;
+            auto it = uniforms.find(program << 32 | uint32_t(v));
+            return it == uniforms.end() ? -1 : it->second;
+        }
+        if(v == 0) return 0;
+        // 录制开始前创建的对象沿用原名字
+        auto it = names[int(kind)].find(uint64_t(v));
+        return it == names[int(kind)].end() ? v : int64_t(it->second);
+    }
+};
+
+using replay_fn_t = void (*)(reader_t&, replay_map_t&);
+
+struct func_entry_t{
+    const char* name;
+    void** slot;
+    void* hook;
+    void* null;
+    replay_fn_t replay;
+    // 安装前glad中的指针
+    void* saved;
+    // 驱动可以不支持
+    bool optional;
+};
+
+struct backend_state_t{
+    bool installed = false;
+    gl_backend::backend_t backend = gl_backend::backend_t::native;
+    // 实际执行调用的函数, native时为驱动函数, null时为空实现
+    void* real[func_num];
+    uint64_t calls[func_num];
+    uint64_t redundant[func_num];
+    uint64_t draw_calls = 0;
+    uint64_t upload_bytes = 0;
+    uint64_t frames = 0;
+    shadow_t shadow;
+    writer_t writer;
+    bool recording = false;
+    bool replaying = false;
+
+    // 空后端的对象名字与uniform位置
+    uint32_t null_next_name = 1;
+    // 按 (program, 名字哈希) 分桶, 查找时不分配堆内存
+    std::unordered_map<uint64_t, std::vector<std::pair<std::string, int>>> null_uniforms;
+    int null_uniform_num = 0;
+};
+
+backend_state_t& state(){
+    static backend_state_t s;
+    return s;
+}
+
+template<class T>
+uint64_t to_u64(T v){
+    if constexpr(std::is_pointer<T>::value){
+        return reinterpret_cast<uintptr_t>(v);
+    }else if constexpr(std::is_floating_point<T>::value){
+        uint32_t bits;
+        float f = v;
+        memcpy(&bits, &f, sizeof(bits));
+        return bits;
+    }else{
+        return uint64_t(v);
+    }
+}
+
+uint64_t hash_bytes(const void* data, size_t size, uint64_t h=1469598103934665603ull){
+    const auto p = static_cast<const uint8_t*>(data);
+    for(size_t i=0; i<size; i++){
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+bool set_uniform_shadow(shadow_t& s, int64_t loc, uint64_t hash){
+    if(loc < 0) return false;
+    return s.uniforms[s.program.value << 32 | uint32_t(loc)].set(hash);
+}
+
+/**
+ * @brief 更新状态缓存并返回本次调用是否冗余
+ */
+bool update_shadow(uint16_t id, const uint64_t* v, size_t n){
+    auto& s = state().shadow;
+    switch(id){
+        case id_glUseProgram:       return s.program.set(v[0]);
+        case id_glBindVertexArray:{
+            // 元素缓冲的绑定属于VAO
+            s.buffers[GL_ELEMENT_ARRAY_BUFFER].known = false;
+            return s.vao.set(v[0]);
+        }
+        case id_glActiveTexture:    return s.active_texture.set(v[0]);
+        case id_glBindTexture:      return s.textures[s.active_texture.value << 32 | v[0]].set(v[1]);
+        case id_glBindBuffer:       return s.buffers[v[0]].set(v[1]);
+        case id_glBindBufferBase:{
+            // 同时绑定到通用绑定点, 索引绑定点不缓存
+            s.buffers[v[0]].set(v[2]);
+            return false;
+        }
+        case id_glBindRenderbuffer: return s.renderbuffer.set(v[0]);
+        case id_glBindFramebuffer:{
+            if(v[0] == GL_DRAW_FRAMEBUFFER) return s.draw_fbo.set(v[1]);
+            if(v[0] == GL_READ_FRAMEBUFFER) return s.read_fbo.set(v[1]);
+            const bool draw = s.draw_fbo.set(v[1]);
+            const bool read = s.read_fbo.set(v[1]);
+            return draw && read;
+        }
+        case id_glEnable:           return s.caps[v[0]].set(1);
+        case id_glDisable:          return s.caps[v[0]].set(0);
+        case id_glClearColor:       return s.clear_color.set(hash_bytes(v, n * sizeof(uint64_t)));
+        case id_glViewport:{
+            for(int i=0; i<4; i++)
+                s.viewport_rect[i] = int(v[i]);
+            return s.viewport.set(hash_bytes(v, n * sizeof(uint64_t)));
+        }
+        case id_glPixelStorei:{
+            if(v[0] == GL_UNPACK_ALIGNMENT) s.unpack_alignment = int(v[1]);
+            return false;
+        }
+        case id_glUniform1f:
+        case id_glUniform1i:
+        case id_glUniform3f:
+        case id_glUniform4f:        return set_uniform_shadow(s, int32_t(v[0]), hash_bytes(v + 1, (n - 1) * sizeof(uint64_t), id));
+        case id_glDrawArrays:
+        case id_glDrawElements:
+        case id_glMultiDrawElementsIndirect:
+        case id_glMultiDrawElementsIndirectCount:{
+            state().draw_calls += 1;
+            return false;
+        }
+        default:                    return false;
+    }
+}
+
+void count_call(uint16_t id, bool redundant){
+    auto& s = state();
+    s.calls[id] += 1;
+    if(redundant) s.redundant[id] += 1;
+}
+
+bool should_record(){
+    auto& s = state();
+    return s.recording && !s.replaying;
+}
+
+template<class T>
+T decode(reader_t& r, replay_map_t& m, char kind){
+    if constexpr(std::is_pointer<T>::value){
+        return reinterpret_cast<T>(uintptr_t(r.get<uint64_t>()));
+    }else if constexpr(std::is_integral<T>::value){
+        return T(m.map(kind, int64_t(r.get<T>())));
+    }else{
+        return r.get<T>();
+    }
+}
+
+// 通用函数的参数类型与glad指针, 按id排列
+const char* generic_kinds[] = {
+#define X_KINDS(NAME, KINDS) KINDS,
+    GL_GENERIC_FUNCS(X_KINDS)
+    GL_OPTIONAL_FUNCS(X_KINDS)
+#undef X_KINDS
+};
+
+void** generic_slots[] = {
+#define X_SLOT(NAME, KINDS) reinterpret_cast<void**>(&glad_##NAME),
+    GL_GENERIC_FUNCS(X_SLOT)
+    GL_OPTIONAL_FUNCS(X_SLOT)
+#undef X_SLOT
+};
+
+template<uint16_t ID, class Sig>
+struct generic_hook_t;
+
+/**
+ * 只有值参数的函数: 统计, 判断冗余, 录制, 转发
+ */
+template<uint16_t ID, class R, class... Args>
+struct generic_hook_t<ID, R (APIENTRYP)(Args...)>{
+    using fn_t = R (APIENTRYP)(Args...);
+    static constexpr size_t arg_num = sizeof...(Args);
+
+    static R APIENTRY call(Args... args){
+        const uint64_t v[arg_num + 1] = {to_u64(args)...};
+        count_call(ID, update_shadow(ID, v, arg_num));
+        if(should_record()){
+            auto& w = state().writer;
+            w.put(ID);
+            (w.put(args), ...);
+        }
+        return reinterpret_cast<fn_t>(state().real[ID])(args...);
+    }
+    static R APIENTRY null_call(Args...){
+        return R();
+    }
+    static void replay(reader_t& r, replay_map_t& m){
+        replay_impl(r, m, std::index_sequence_for<Args...>());
+    }
+    template<size_t... I>
+    static void replay_impl(reader_t& r, replay_map_t& m, std::index_sequence<I...>){
+        const char* kinds = generic_kinds[ID];
+        // 花括号初始化保证从左到右求值
+        std::tuple<Args...> args{decode<Args>(r, m, kinds[I])...};
+        // 回放环境的驱动不支持该可选函数
+        if(!r.ok || *generic_slots[ID] == nullptr) return;
+        if constexpr(ID == id_glUseProgram)
+            m.program = std::get<0>(args);
+        std::apply(*reinterpret_cast<fn_t*>(generic_slots[ID]), args);
+    }
+};
+
+// 参数类型的个数需与函数参数个数一致
+#define X_CHECK_KINDS(NAME, KINDS) \
+    static_assert(sizeof(KINDS) - 1 == generic_hook_t<id_##NAME, decltype(glad_##NAME)>::arg_num, \
+        "argument kinds of " #NAME " mismatch");
+GL_GENERIC_FUNCS(X_CHECK_KINDS)
+GL_OPTIONAL_FUNCS(X_CHECK_KINDS)
+#undef X_CHECK_KINDS
+
+#define REAL(NAME) reinterpret_cast<decltype(glad_##NAME)>(state().real[id_##NAME])
+// 回放时调用当前的glad指针(可能是空后端)
+#define CURRENT(NAME) glad_##NAME
+
+/**
+ * 生成与删除对象名字, 录制名字以便回放时映射
+ */
+template<uint16_t GEN_ID, uint16_t DEL_ID, char KIND>
+struct name_hook_t{
+    static void** gen_slot;
+    static void** del_slot;
+
+    static void APIENTRY gen(GLsizei n, GLuint* names){
+        count_call(GEN_ID, false);
+        reinterpret_cast<PFNGLGENTEXTURESPROC>(state().real[GEN_ID])(n, names);
+        if(should_record()){
+            auto& w = state().writer;
+            w.put(GEN_ID);
+            w.put_bytes(names, n * sizeof(GLuint));
+        }
+    }
+    static void APIENTRY del(GLsizei n, const GLuint* names){
+        count_call(DEL_ID, false);
+        // 被删除的名字可能被重新使用
+        state().shadow.invalidate();
+        if(should_record()){
+            auto& w = state().writer;
+            w.put(DEL_ID);
+            w.put_bytes(names, n * sizeof(GLuint));
+        }
+        reinterpret_cast<PFNGLDELETETEXTURESPROC>(state().real[DEL_ID])(n, names);
+    }
+    static void APIENTRY null_gen(GLsizei n, GLuint* names){
+        for(GLsizei i=0; i<n; i++)
+            names[i] = state().null_next_name++;
+    }
+    static void APIENTRY null_del(GLsizei, const GLuint*){
+    }
+    static void replay_gen(reader_t& r, replay_map_t& m){
+        uint32_t size;
+        auto recorded = static_cast<const GLuint*>(r.get_bytes(size));
+        const GLsizei n = size / sizeof(GLuint);
+        if(!r.ok || n == 0) return;
+        std::vector<GLuint> names(n);
+        (*reinterpret_cast<PFNGLGENTEXTURESPROC*>(gen_slot))(n, names.data());
+        for(GLsizei i=0; i<n; i++){
+            GLuint name;
+            memcpy(&name, recorded + i, sizeof(name));
+            m.names[int(KIND)][name] = names[i];
+        }
+    }
+    static void replay_del(reader_t& r, replay_map_t& m){
+        uint32_t size;
+        auto recorded = static_cast<const GLuint*>(r.get_bytes(size));
+        const GLsizei n = size / sizeof(GLuint);
+        if(!r.ok || n == 0) return;
+        std::vector<GLuint> names(n);
+        for(GLsizei i=0; i<n; i++){
+            GLuint name;
+            memcpy(&name, recorded + i, sizeof(name));
+            names[i] = GLuint(m.map(KIND, name));
+        }
+        (*reinterpret_cast<PFNGLDELETETEXTURESPROC*>(del_slot))(n, names.data());
+    }
+};
+
+#define X_NAME_SLOTS(GEN, DEL, KIND) \
+    template<> void** name_hook_t<id_##GEN, id_##DEL, KIND>::gen_slot = reinterpret_cast<void**>(&glad_##GEN); \
+    template<> void** name_hook_t<id_##GEN, id_##DEL, KIND>::del_slot = reinterpret_cast<void**>(&glad_##DEL);
+GL_NAME_FUNCS(X_NAME_SLOTS)
+#undef X_NAME_SLOTS
+
+template<uint16_t ID, int N>
+struct uniformv_hook_t{
+    static void** slot;
+
+    static void APIENTRY call(GLint loc, GLsizei count, const GLfloat* value){
+        auto& s = state();
+        const size_t size = sizeof(GLfloat) * N * count;
+        count_call(ID, set_uniform_shadow(s.shadow, loc, hash_bytes(value, size, ID)));
+        if(should_record()){
+            s.writer.put(ID);
+            s.writer.put(loc);
+            s.writer.put_bytes(value, size);
+        }
+        reinterpret_cast<PFNGLUNIFORM3FVPROC>(s.real[ID])(loc, count, value);
+    }
+    static void APIENTRY null_call(GLint, GLsizei, const GLfloat*){
+    }
+    static void replay(reader_t& r, replay_map_t& m){
+        const auto loc = GLint(m.map('u', r.get<GLint>()));
+        uint32_t size;
+        auto value = r.get_bytes(size);
+        if(!r.ok || value == nullptr) return;
+        // 录制数据未必对齐
+        std::vector<GLfloat> data(size / sizeof(GLfloat));
+        memcpy(data.data(), value, data.size() * sizeof(GLfloat));
+        (*reinterpret_cast<PFNGLUNIFORM3FVPROC*>(slot))(loc, GLsizei(data.size() / N), data.data());
+    }
+};
+
+#define X_UNIFORMV_SLOT(NAME, N) \
+    template<> void** uniformv_hook_t<id_##NAME, N>::slot = reinterpret_cast<void**>(&glad_##NAME);
+GL_UNIFORMV_FUNCS(X_UNIFORMV_SLOT)
+#undef X_UNIFORMV_SLOT
+
+template<uint16_t ID, int N>
+struct uniform_matrix_hook_t{
+    static void** slot;
+
+    static void APIENTRY call(GLint loc, GLsizei count, GLboolean transpose, const GLfloat* value){
+        auto& s = state();
+        const size_t size = sizeof(GLfloat) * N * count;
+        count_call(ID, set_uniform_shadow(s.shadow, loc, hash_bytes(value, size, ID + transpose)));
+        if(should_record()){
+            s.writer.put(ID);
+            s.writer.put(loc);
+            s.writer.put(transpose);
+            s.writer.put_bytes(value, uint32_t(size));
+        }
+        reinterpret_cast<PFNGLUNIFORMMATRIX4FVPROC>(s.real[ID])(loc, count, transpose, value);
+    }
+    static void APIENTRY null_call(GLint, GLsizei, GLboolean, const GLfloat*){
+    }
+    static void replay(reader_t& r, replay_map_t& m){
+        const auto loc = GLint(m.map('u', r.get<GLint>()));
+        const auto transpose = r.get<GLboolean>();
+        uint32_t size;
+        auto value = r.get_bytes(size);
+        if(!r.ok || value == nullptr) return;
+        std::vector<GLfloat> data(size / sizeof(GLfloat));
+        memcpy(data.data(), value, data.size() * sizeof(GLfloat));
+        (*reinterpret_cast<PFNGLUNIFORMMATRIX4FVPROC*>(slot))(loc, GLsizei(data.size() / N), transpose, data.data());
+    }
+};
+
+#define X_UNIFORM_MATRIX_SLOT(NAME, N) \
+    template<> void** uniform_matrix_hook_t<id_##NAME, N>::slot = reinterpret_cast<void**>(&glad_##NAME);
+GL_UNIFORM_MATRIX_FUNCS(X_UNIFORM_MATRIX_SLOT)
+#undef X_UNIFORM_MATRIX_SLOT
+
+/**
+ * 查询只统计, 录制文件中不需要
+ */
+template<uint16_t ID, class Sig>
+struct query_hook_t;
+
+template<uint16_t ID, class R, class... Args>
+struct query_hook_t<ID, R (APIENTRYP)(Args...)>{
+    static R APIENTRY call(Args... args){
+        count_call(ID, false);
+        return reinterpret_cast<R (APIENTRYP)(Args...)>(state().real[ID])(args...);
+    }
+};
+
+int texture_channels(GLenum format){
+    switch(format){
+        case GL_RED: case GL_RED_INTEGER: case GL_DEPTH_COMPONENT: return 1;
+        case GL_RG: case GL_RG_INTEGER: case GL_DEPTH_STENCIL: return 2;
+        case GL_RGB: case GL_BGR: case GL_RGB_INTEGER: return 3;
+        default: return 4;
+    }
+}
+
+size_t texture_bytes(GLsizei width, GLsizei height, GLenum format, GLenum type){
+    size_t pixel;
+    switch(type){
+        case GL_UNSIGNED_BYTE: case GL_BYTE: pixel = texture_channels(format); break;
+        case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT: pixel = 2 * texture_channels(format); break;
+        case GL_UNSIGNED_INT: case GL_INT: case GL_FLOAT: pixel = 4 * texture_channels(format); break;
+        // 打包格式一个像素4字节
+        default: pixel = 4; break;
+    }
+    const size_t align = state().shadow.unpack_alignment;
+    const size_t row = (width * pixel + align - 1) / align * align;
+    // 最后一行不需要补齐
+    return height == 0 ? 0 : row * (height - 1) + width * pixel;
+}
+
+/*
+ * 带指针参数或返回对象名字的函数
+ */
+
+void APIENTRY hook_glBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage){
+    auto& s = state();
+    count_call(id_glBufferData, false);
+    if(data != nullptr) s.upload_bytes += size;
+    if(should_record()){
+        s.writer.put(id_glBufferData);
+        s.writer.put(target);
+        s.writer.put(uint64_t(size));
+        s.writer.put(usage);
+        s.writer.put_bytes(data, uint32_t(size));
+    }
+    REAL(glBufferData)(target, size, data, usage);
+}
+void APIENTRY null_glBufferData(GLenum, GLsizeiptr, const void*, GLenum){}
+void replay_glBufferData(reader_t& r, replay_map_t&){
+    const auto target = r.get<GLenum>();
+    const auto size = r.get<uint64_t>();
+    const auto usage = r.get<GLenum>();
+    uint32_t data_size;
+    auto data = r.get_bytes(data_size);
+    if(r.ok) CURRENT(glBufferData)(target, GLsizeiptr(size), data, usage);
+}
+
+void APIENTRY hook_glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data){
+    auto& s = state();
+    count_call(id_glBufferSubData, false);
+    s.upload_bytes += size;
+    if(should_record()){
+        s.writer.put(id_glBufferSubData);
+        s.writer.put(target);
+        s.writer.put(uint64_t(offset));
+        s.writer.put_bytes(data, uint32_t(size));
+    }
+    REAL(glBufferSubData)(target, offset, size, data);
+}
+void APIENTRY null_glBufferSubData(GLenum, GLintptr, GLsizeiptr, const void*){}
+void replay_glBufferSubData(reader_t& r, replay_map_t&){
+    const auto target = r.get<GLenum>();
+    const auto offset = r.get<uint64_t>();
+    uint32_t size;
+    auto data = r.get_bytes(size);
+    if(r.ok && data != nullptr) CURRENT(glBufferSubData)(target, GLintptr(offset), size, data);
+}
+
+GLuint APIENTRY hook_glCreateProgram(){
+    count_call(id_glCreateProgram, false);
+    const auto program = REAL(glCreateProgram)();
+    if(should_record()){
+        state().writer.put(id_glCreateProgram);
+        state().writer.put(program);
+    }
+    return program;
+}
+GLuint APIENTRY null_glCreateProgram(){
+    return state().null_next_name++;
+}
+void replay_glCreateProgram(reader_t& r, replay_map_t& m){
+    const auto recorded = r.get<GLuint>();
+    if(r.ok) m.names[int('p')][recorded] = CURRENT(glCreateProgram)();
+}
+
+GLuint APIENTRY hook_glCreateShader(GLenum type){
+    count_call(id_glCreateShader, false);
+    const auto shader = REAL(glCreateShader)(type);
+    if(should_record()){
+        state().writer.put(id_glCreateShader);
+        state().writer.put(type);
+        state().writer.put(shader);
+    }
+    return shader;
+}
+GLuint APIENTRY null_glCreateShader(GLenum){
+    return state().null_next_name++;
+}
+void replay_glCreateShader(reader_t& r, replay_map_t& m){
+    const auto type = r.get<GLenum>();
+    const auto recorded = r.get<GLuint>();
+    if(r.ok) m.names[int('s')][recorded] = CURRENT(glCreateShader)(type);
+}
+
+void APIENTRY hook_glDrawBuffers(GLsizei n, const GLenum* bufs){
+    count_call(id_glDrawBuffers, false);
+    if(should_record()){
+        state().writer.put(id_glDrawBuffers);
+        state().writer.put_bytes(bufs, n * sizeof(GLenum));
+    }
+    REAL(glDrawBuffers)(n, bufs);
+}
+void APIENTRY null_glDrawBuffers(GLsizei, const GLenum*){}
+void replay_glDrawBuffers(reader_t& r, replay_map_t&){
+    uint32_t size;
+    auto data = r.get_bytes(size);
+    if(!r.ok || data == nullptr) return;
+    std::vector<GLenum> bufs(size / sizeof(GLenum));
+    memcpy(bufs.data(), data, bufs.size() * sizeof(GLenum));
+    CURRENT(glDrawBuffers)(GLsizei(bufs.size()), bufs.data());
+}
+
+GLint APIENTRY hook_glGetUniformLocation(GLuint program, const GLchar* name){
+    count_call(id_glGetUniformLocation, false);
+    const auto loc = REAL(glGetUniformLocation)(program, name);
+    if(should_record()){
+        auto& w = state().writer;
+        w.put(id_glGetUniformLocation);
+        w.put(program);
+        w.put_bytes(name, uint32_t(strlen(name)));
+        w.put(loc);
+    }
+    return loc;
+}
+GLint APIENTRY null_glGetUniformLocation(GLuint program, const GLchar* name){
+    auto& s = state();
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for(const char* c = name; *c; c++)
+        hash = (hash ^ uint8_t(*c)) * 16777619u;
+    auto& bucket = s.null_uniforms[uint64_t(program) << 32 | hash];
+    for(const auto& uniform: bucket)
+        if(uniform.first == name) return uniform.second;
+    const int loc = s.null_uniform_num++;
+    bucket.emplace_back(name, loc);
+    return loc;
+}
+void replay_glGetUniformLocation(reader_t& r, replay_map_t& m){
+    const auto program = GLuint(m.map('p', r.get<GLuint>()));
+    uint32_t size;
+    auto data = r.get_bytes(size);
+    const auto recorded = r.get<GLint>();
+    if(!r.ok || data == nullptr) return;
+    const std::string name(static_cast<const char*>(data), size);
+    m.uniforms[uint64_t(program) << 32 | uint32_t(recorded)] = CURRENT(glGetUniformLocation)(program, name.c_str());
+}
+
+void APIENTRY hook_glShaderSource(GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length){
+    count_call(id_glShaderSource, false);
+    if(should_record()){
+        auto& w = state().writer;
+        w.put(id_glShaderSource);
+        w.put(shader);
+        w.put(count);
+        for(GLsizei i=0; i<count; i++){
+            const auto len = length != nullptr && length[i] >= 0 ? uint32_t(length[i]) : uint32_t(strlen(string[i]));
+            w.put_bytes(string[i], len);
+        }
+    }
+    REAL(glShaderSource)(shader, count, string, length);
+}
+void APIENTRY null_glShaderSource(GLuint, GLsizei, const GLchar* const*, const GLint*){}
+void replay_glShaderSource(reader_t& r, replay_map_t& m){
+    const auto shader = GLuint(m.map('s', r.get<GLuint>()));
+    const auto count = r.get<GLsizei>();
+    std::vector<const GLchar*> strings;
+    std::vector<GLint> lengths;
+    for(GLsizei i=0; i<count && r.ok; i++){
+        uint32_t size;
+        auto data = r.get_bytes(size);
+        strings.push_back(data == nullptr ? "" : static_cast<const GLchar*>(data));
+        lengths.push_back(GLint(size));
+    }
+    if(r.ok) CURRENT(glShaderSource)(shader, count, strings.data(), lengths.data());
+}
+
+void APIENTRY hook_glTexImage2D(GLenum target, GLint level, GLint internal_format, GLsizei width, GLsizei height,
+                                GLint border, GLenum format, GLenum type, const void* pixels){
+    auto& s = state();
+    count_call(id_glTexImage2D, false);
+    const size_t size = pixels == nullptr ? 0 : texture_bytes(width, height, format, type);
+    s.upload_bytes += size;
+    if(should_record()){
+        auto& w = s.writer;
+        w.put(id_glTexImage2D);
+        w.put(target); w.put(level); w.put(internal_format); w.put(width); w.put(height);
+        w.put(border); w.put(format); w.put(type);
+        w.put_bytes(pixels, uint32_t(size));
+    }
+    REAL(glTexImage2D)(target, level, internal_format, width, height, border, format, type, pixels);
+}
+void APIENTRY null_glTexImage2D(GLenum, GLint, GLint, GLsizei, GLsizei, GLint, GLenum, GLenum, const void*){}
+void replay_glTexImage2D(reader_t& r, replay_map_t&){
+    const auto target = r.get<GLenum>();
+    const auto level = r.get<GLint>();
+    const auto internal_format = r.get<GLint>();
+    const auto width = r.get<GLsizei>();
+    const auto height = r.get<GLsizei>();
+    const auto border = r.get<GLint>();
+    const auto format = r.get<GLenum>();
+    const auto type = r.get<GLenum>();
+    uint32_t size;
+    auto pixels = r.get_bytes(size);
+    // 对齐方式由录制的 glPixelStorei 恢复
+    if(r.ok) CURRENT(glTexImage2D)(target, level, internal_format, width, height, border, format, type, pixels);
+}
+
+void APIENTRY hook_glCompressedTexImage2D(GLenum target, GLint level, GLenum internal_format, GLsizei width, GLsizei height,
+                                          GLint border, GLsizei image_size, const void* data){
+    auto& s = state();
+    count_call(id_glCompressedTexImage2D, false);
+    s.upload_bytes += image_size;
+    if(should_record()){
+        auto& w = s.writer;
+        w.put(id_glCompressedTexImage2D);
+        w.put(target); w.put(level); w.put(internal_format); w.put(width); w.put(height); w.put(border);
+        w.put_bytes(data, uint32_t(image_size));
+    }
+    REAL(glCompressedTexImage2D)(target, level, internal_format, width, height, border, image_size, data);
+}
+void APIENTRY null_glCompressedTexImage2D(GLenum, GLint, GLenum, GLsizei, GLsizei, GLint, GLsizei, const void*){}
+void replay_glCompressedTexImage2D(reader_t& r, replay_map_t&){
+    const auto target = r.get<GLenum>();
+    const auto level = r.get<GLint>();
+    const auto internal_format = r.get<GLenum>();
+    const auto width = r.get<GLsizei>();
+    const auto height = r.get<GLsizei>();
+    const auto border = r.get<GLint>();
+    uint32_t size;
+    auto data = r.get_bytes(size);
+    if(r.ok) CURRENT(glCompressedTexImage2D)(target, level, internal_format, width, height, border, GLsizei(size), data);
+}
+
+void APIENTRY hook_glTexImage3D(GLenum target, GLint level, GLint internal_format, GLsizei width, GLsizei height,
+                                GLsizei depth, GLint border, GLenum format, GLenum type, const void* pixels){
+    auto& s = state();
+    count_call(id_glTexImage3D, false);
+    // 各层的行连续存放, 按 height*depth 行计算
+    const size_t size = pixels == nullptr ? 0 : texture_bytes(width, height * depth, format, type);
+    s.upload_bytes += size;
+    if(should_record()){
+        auto& w = s.writer;
+        w.put(id_glTexImage3D);
+        w.put(target); w.put(level); w.put(internal_format); w.put(width); w.put(height); w.put(depth);
+        w.put(border); w.put(format); w.put(type);
+        w.put_bytes(pixels, uint32_t(size));
+    }
+    REAL(glTexImage3D)(target, level, internal_format, width, height, depth, border, format, type, pixels);
+}
+void APIENTRY null_glTexImage3D(GLenum, GLint, GLint, GLsizei, GLsizei, GLsizei, GLint, GLenum, GLenum, const void*){}
+void replay_glTexImage3D(reader_t& r, replay_map_t&){
+    const auto target = r.get<GLenum>();
+    const auto level = r.get<GLint>();
+    const auto internal_format = r.get<GLint>();
+    const auto width = r.get<GLsizei>();
+    const auto height = r.get<GLsizei>();
+    const auto depth = r.get<GLsizei>();
+    const auto border = r.get<GLint>();
+    const auto format = r.get<GLenum>();
+    const auto type = r.get<GLenum>();
+    uint32_t size;
+    auto pixels = r.get_bytes(size);
+    if(r.ok) CURRENT(glTexImage3D)(target, level, internal_format, width, height, depth, border, format, type, pixels);
+}
+
+void APIENTRY hook_glTexSubImage3D(GLenum target, GLint level, GLint x, GLint y, GLint z,
+                                   GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const void* pixels){
+    auto& s = state();
+    count_call(id_glTexSubImage3D, false);
+    const size_t size = pixels == nullptr ? 0 : texture_bytes(width, height * depth, format, type);
+    s.upload_bytes += size;
+    if(should_record()){
+        auto& w = s.writer;
+        w.put(id_glTexSubImage3D);
+        w.put(target); w.put(level); w.put(x); w.put(y); w.put(z);
+        w.put(width); w.put(height); w.put(depth); w.put(format); w.put(type);
+        w.put_bytes(pixels, uint32_t(size));
+    }
+    REAL(glTexSubImage3D)(target, level, x, y, z, width, height, depth, format, type, pixels);
+}
+void APIENTRY null_glTexSubImage3D(GLenum, GLint, GLint, GLint, GLint, GLsizei, GLsizei, GLsizei, GLenum, GLenum, const void*){}
+void replay_glTexSubImage3D(reader_t& r, replay_map_t&){
+    const auto target = r.get<GLenum>();
+    const auto level = r.get<GLint>();
+    const auto x = r.get<GLint>();
+    const auto y = r.get<GLint>();
+    const auto z = r.get<GLint>();
+    const auto width = r.get<GLsizei>();
+    const auto height = r.get<GLsizei>();
+    const auto depth = r.get<GLsizei>();
+    const auto format = r.get<GLenum>();
+    const auto type = r.get<GLenum>();
+    uint32_t size;
+    auto pixels = r.get_bytes(size);
+    if(r.ok) CURRENT(glTexSubImage3D)(target, level, x, y, z, width, height, depth, format, type, pixels);
+}
+
+/*
+ * 空后端的查询, 模拟一个总是成功的驱动
+ */
+
+GLenum APIENTRY null_glCheckFramebufferStatus(GLenum){
+    return GL_FRAMEBUFFER_COMPLETE;
+}
+void APIENTRY null_glGetBufferSubData(GLenum, GLintptr, GLsizeiptr size, void* data){
+    memset(data, 0, size_t(size));
+}
+void APIENTRY null_glGetIntegerv(GLenum pname, GLint* data){
+    const auto& s = state().shadow;
+    switch(pname){
+        case GL_VIEWPORT:
+            for(int i=0; i<4; i++) data[i] = s.viewport_rect[i];
+            break;
+        case GL_DRAW_FRAMEBUFFER_BINDING: *data = GLint(s.draw_fbo.value); break;
+        case GL_READ_FRAMEBUFFER_BINDING: *data = GLint(s.read_fbo.value); break;
+        case GL_CURRENT_PROGRAM: *data = GLint(s.program.value); break;
+        case GL_VERTEX_ARRAY_BINDING: *data = GLint(s.vao.value); break;
+        // 不跟踪写入掩码, 按默认状态报告
+        case GL_COLOR_WRITEMASK:
+            for(int i=0; i<4; i++) data[i] = GL_TRUE;
+            break;
+        case GL_DEPTH_WRITEMASK: *data = GL_TRUE; break;
+        // 所有函数都有空实现, 按支持全部可选函数的版本报告
+        case GL_MAJOR_VERSION: *data = 4; break;
+        case GL_MINOR_VERSION: *data = 6; break;
+        default: *data = 0; break;
+    }
+}
+void APIENTRY null_glGetProgramInfoLog(GLuint, GLsizei buf_size, GLsizei* length, GLchar* info_log){
+    if(length != nullptr) *length = 0;
+    if(buf_size > 0) info_log[0] = '\0';
+}
+void APIENTRY null_glGetProgramiv(GLuint, GLenum pname, GLint* params){
+    *params = pname == GL_LINK_STATUS || pname == GL_VALIDATE_STATUS ? GL_TRUE : 0;
+}
+void APIENTRY null_glGetQueryObjectiv(GLuint, GLenum pname, GLint* params){
+    *params = pname == GL_QUERY_RESULT_AVAILABLE ? GL_TRUE : 0;
+}
+// 遮挡查询的结果总是可见
+void APIENTRY null_glGetQueryObjectuiv(GLuint, GLenum pname, GLuint* params){
+    *params = pname == GL_QUERY_RESULT_AVAILABLE || pname == GL_QUERY_RESULT ? GL_TRUE : 0;
+}
+void APIENTRY null_glGetQueryObjectui64v(GLuint, GLenum, GLuint64* params){
+    *params = 0;
+}
+void APIENTRY null_glGetShaderInfoLog(GLuint, GLsizei buf_size, GLsizei* length, GLchar* info_log){
+    if(length != nullptr) *length = 0;
+    if(buf_size > 0) info_log[0] = '\0';
+}
+void APIENTRY null_glGetShaderiv(GLuint, GLenum pname, GLint* params){
+    *params = pname == GL_COMPILE_STATUS ? GL_TRUE : 0;
+}
+void APIENTRY null_glReadPixels(GLint, GLint, GLsizei width, GLsizei height, GLenum format, GLenum type, void* pixels){
+    if(format == GL_RGBA && type == GL_UNSIGNED_BYTE)
+        memset(pixels, 0, size_t(width) * height * 4);
+}
+
+std::vector<func_entry_t>& entries(){
+    static std::vector<func_entry_t> table = [](){
+        std::vector<func_entry_t> t(func_num);
+#define X_GENERIC(NAME, KINDS) \
+        t[id_##NAME] = func_entry_t{#NAME, reinterpret_cast<void**>(&glad_##NAME), \
+            reinterpret_cast<void*>(&generic_hook_t<id_##NAME, decltype(glad_##NAME)>::call), \
+            reinterpret_cast<void*>(&generic_hook_t<id_##NAME, decltype(glad_##NAME)>::null_call), \
+            &generic_hook_t<id_##NAME, decltype(glad_##NAME)>::replay, nullptr, false};
+        GL_GENERIC_FUNCS(X_GENERIC)
+        GL_OPTIONAL_FUNCS(X_GENERIC)
+#undef X_GENERIC
+#define X_OPTIONAL(NAME, KINDS) t[id_##NAME].optional = true;
+        GL_OPTIONAL_FUNCS(X_OPTIONAL)
+#undef X_OPTIONAL
+#define X_NAME(GEN, DEL, KIND) \
+        t[id_##GEN] = func_entry_t{#GEN, reinterpret_cast<void**>(&glad_##GEN), \
+            reinterpret_cast<void*>(&name_hook_t<id_##GEN, id_##DEL, KIND>::gen), \
+            reinterpret_cast<void*>(&name_hook_t<id_##GEN, id_##DEL, KIND>::null_gen), \
+            &name_hook_t<id_##GEN, id_##DEL, KIND>::replay_gen, nullptr, false}; \
+        t[id_##DEL] = func_entry_t{#DEL, reinterpret_cast<void**>(&glad_##DEL), \
+            reinterpret_cast<void*>(&name_hook_t<id_##GEN, id_##DEL, KIND>::del), \
+            reinterpret_cast<void*>(&name_hook_t<id_##GEN, id_##DEL, KIND>::null_del), \
+            &name_hook_t<id_##GEN, id_##DEL, KIND>::replay_del, nullptr, false};
+        GL_NAME_FUNCS(X_NAME)
+#undef X_NAME
+#define X_UNIFORMV(NAME, N) \
+        t[id_##NAME] = func_entry_t{#NAME, reinterpret_cast<void**>(&glad_##NAME), \
+            reinterpret_cast<void*>(&uniformv_hook_t<id_##NAME, N>::call), \
+            reinterpret_cast<void*>(&uniformv_hook_t<id_##NAME, N>::null_call), \
+            &uniformv_hook_t<id_##NAME, N>::replay, nullptr, false};
+        GL_UNIFORMV_FUNCS(X_UNIFORMV)
+#undef X_UNIFORMV
+#define X_UNIFORM_MATRIX(NAME, N) \
+        t[id_##NAME] = func_entry_t{#NAME, reinterpret_cast<void**>(&glad_##NAME), \
+            reinterpret_cast<void*>(&uniform_matrix_hook_t<id_##NAME, N>::call), \
+            reinterpret_cast<void*>(&uniform_matrix_hook_t<id_##NAME, N>::null_call), \
+            &uniform_matrix_hook_t<id_##NAME, N>::replay, nullptr, false};
+        GL_UNIFORM_MATRIX_FUNCS(X_UNIFORM_MATRIX)
+#undef X_UNIFORM_MATRIX
+#define X_QUERY(NAME) \
+        t[id_##NAME] = func_entry_t{#NAME, reinterpret_cast<void**>(&glad_##NAME), \
+            reinterpret_cast<void*>(&query_hook_t<id_##NAME, decltype(glad_##NAME)>::call), \
+            reinterpret_cast<void*>(&null_##NAME), nullptr, nullptr, false};
+        GL_QUERY_FUNCS(X_QUERY)
+#undef X_QUERY
+#define X_OTHER(NAME) \
+        t[id_##NAME] = func_entry_t{#NAME, reinterpret_cast<void**>(&glad_##NAME), \
+            reinterpret_cast<void*>(&hook_##NAME), reinterpret_cast<void*>(&null_##NAME), &replay_##NAME, nullptr, false};
+        GL_OTHER_FUNCS(X_OTHER)
+#undef X_OTHER
+        return t;
+    }();
+    return table;
+}
+
+}
+
+void gl_backend::install(backend_t backend){
+    auto& s = state();
+    assert_with_info(!s.installed, "gl backend is already installed");
+    auto& table = entries();
+    for(uint16_t id=0; id<func_num; id++){
+        auto& e = table[id];
+        e.saved = *e.slot;
+        if(backend == backend_t::native && e.saved == nullptr && e.optional){
+            s.real[id] = nullptr;
+            continue;
+        }
+        if(backend == backend_t::native){
+            assert_with_info(e.saved != nullptr, "%s is not loaded, call gladLoadGLLoader first", e.name);
+            s.real[id] = e.saved;
+        }else{
+            s.real[id] = e.null;
+        }
+        *e.slot = e.hook;
+    }
+    s.backend = backend;
+    s.installed = true;
+    s.shadow = shadow_t();
+    reset_stats();
+}
+
+void gl_backend::uninstall(){
+    auto& s = state();
+    if(!s.installed) return;
+    end_record();
+    for(auto& e: entries())
+        *e.slot = e.saved;
+    s.installed = false;
+}
+
+bool gl_backend::installed(){
+    return state().installed;
+}
+
+void gl_backend::frame_boundary(){
+    auto& s = state();
+    if(!s.installed) return;
+    s.frames += 1;
+    s.shadow.invalidate();
+    if(s.recording){
+        s.writer.put(frame_marker);
+        s.writer.flush();
+    }
+}
+
+void gl_backend::invalidate_state(){
+    state().shadow.invalidate();
+}
+
+gl_backend::stats_t gl_backend::stats(){
+    const auto& s = state();
+    const auto& table = entries();
+    stats_t res;
+    res.draw_calls = s.draw_calls;
+    res.upload_bytes = s.upload_bytes;
+    res.frames = s.frames;
+    for(uint16_t id=0; id<func_num; id++){
+        if(s.calls[id] == 0) continue;
+        res.calls += s.calls[id];
+        res.redundant += s.redundant[id];
+        res.funcs.push_back(call_stat_t{table[id].name, s.calls[id], s.redundant[id]});
+    }
+    std::sort(res.funcs.begin(), res.funcs.end(), [](const call_stat_t& a, const call_stat_t& b){return a.calls > b.calls;});
+    return res;
+}
+
+void gl_backend::reset_stats(){
+    auto& s = state();
+    memset(s.calls, 0, sizeof(s.calls));
+    memset(s.redundant, 0, sizeof(s.redundant));
+    s.draw_calls = 0;
+    s.upload_bytes = 0;
+    s.frames = 0;
+}
+
+void gl_backend::print_stats(FILE* fp){
+    const auto res = stats();
+    fprintf(fp, "GL calls %llu, redundant %llu (%.1f%%), draw calls %llu, upload %llu bytes, %llu frames\n",
+        (unsigned long long)res.calls, (unsigned long long)res.redundant, res.redundant_ratio() * 100,
+        (unsigned long long)res.draw_calls, (unsigned long long)res.upload_bytes, (unsigned long long)res.frames);
+    for(const auto& f: res.funcs)
+        fprintf(fp, "  %-32s %10llu  redundant %10llu\n", f.name, (unsigned long long)f.calls, (unsigned long long)f.redundant);
+}
+
+bool gl_backend::begin_record(const char* path){
+    auto& s = state();
+    assert_with_info(s.installed, "install gl backend before recording");
+    end_record();
+    s.writer.fp = fopen(path, "wb");
+    if(s.writer.fp == nullptr){
+        log_with_info("fail to open record file %s", path);
+        return false;
+    }
+    s.writer.buf.clear();
+    s.writer.put(record_magic);
+    s.writer.put(record_version);
+    s.recording = true;
+    return true;
+}
+
+void gl_backend::end_record(){
+    auto& s = state();
+    if(!s.recording) return;
+    s.writer.flush();
+    fclose(s.writer.fp);
+    s.writer.fp = nullptr;
+    s.recording = false;
+}
+
+bool gl_backend::recording(){
+    return state().recording;
+}
+
+std::vector<double> gl_backend::replay(const char* path){
+    std::vector<double> frame_ms;
+    FILE* fp = fopen(path, "rb");
+    if(fp == nullptr){
+        log_with_info("fail to open record file %s", path);
+        return frame_ms;
+    }
+    std::vector<uint8_t> data;
+    uint8_t chunk[1 << 16];
+    size_t n;
+    while((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+        data.insert(data.end(), chunk, chunk + n);
+    fclose(fp);
+
+    reader_t r{data.data(), data.data() + data.size()};
+    if(r.get<uint32_t>() != record_magic || r.get<uint32_t>() != record_version){
+        log_with_info("%s is not a gl record file", path);
+        return frame_ms;
+    }
+
+    auto& s = state();
+    auto& table = entries();
+    s.replaying = true;
+    replay_map_t map;
+    auto frame_beg = std::chrono::steady_clock::now();
+    while(r.ok && r.p < r.end){
+        const auto id = r.get<uint16_t>();
+        if(id == frame_marker){
+            s.frames += 1;
+            s.shadow.invalidate();
+            const auto now = std::chrono::steady_clock::now();
+            frame_ms.push_back(std::chrono::duration<double, std::milli>(now - frame_beg).count());
+            frame_beg = now;
+            continue;
+        }
+        if(id >= func_num || table[id].replay == nullptr){
+            log_with_info("corrupted gl record %s, unknown call %u", path, id);
+            break;
+        }
+        table[id].replay(r, map);
+    }
+    s.replaying = false;
+    return frame_ms;
+}
@@ -0,0 +1,90 @@
+/**
+ * @file gl_backend.hpp
+ * @brief 可替换的GL分发层: 统计调用与冗余调用, 空后端, 调用流录制与回放
+ * @note 通过替换glad的函数指针实现, 只拦截引擎(vertices/mesh/window层)发出的调用,
+ * ImGui使用自己的加载器, 其调用不经过这里
+ *
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace Ez3DGL {
+namespace gl_backend {
+
+    enum class backend_t{
+        // 转发给驱动, 同时统计
+        native,
+        // 不执行任何GL调用, 只统计, 返回值与输出参数模拟一个总是成功的驱动, 不需要GL上下文
+        null,
+    };
+
+    /**
+     * @brief 安装分发层
+     * @note native 需在 gladLoadGLLoader 之后调用; null 可在没有GL上下文时代替 gladLoadGLLoader,
+     * 也可在已加载glad时调用, 使引擎的调用不再到达驱动.
+     * 计算着色器与间接绘制等 GL 4.2 以上的函数在驱动不支持时保持为空指针; 空后端报告 GL 4.6 并提供所有函数
+     */
+    void install(backend_t backend);
+    /**
+     * @brief 恢复安装前的glad函数指针
+     */
+    void uninstall();
+    bool installed();
+
+    /**
+     * @brief 帧边界, 由 window_loop 调用. 录制时写入帧标记;
+     * 同时清空状态缓存, 因为ImGui等绕过glad的调用会改变GL状态
+     */
+    void frame_boundary();
+    /**
+     * @brief 清空用于判断冗余调用的状态缓存
+     */
+    void invalidate_state();
+
+    struct call_stat_t{
+        const char* name;
+        uint64_t calls;
+        // 设置的状态与当前状态相同的调用次数(绑定, 开关, uniform等)
+        uint64_t redundant;
+    };
+
+    struct stats_t{
+        uint64_t calls = 0;
+        uint64_t redundant = 0;
+        uint64_t draw_calls = 0;
+        // 通过 glBufferData/glBufferSubData/glTexImage2D 上传的字节数
+        uint64_t upload_bytes = 0;
+        uint64_t frames = 0;
+        // 按调用次数从多到少排列, 不含未调用的函数
+        std::vector<call_stat_t> funcs;
+
+        double redundant_ratio() const{
+            return calls == 0 ? 0. : double(redundant) / calls;
+        }
+    };
+
+    stats_t stats();
+    void reset_stats();
+    void print_stats(FILE* fp=stdout);
+
+    /**
+     * @brief 把此后的调用流(含参数与上传的数据)录制到二进制文件
+     * @note 录制开始前创建的GL对象在回放时按原名字使用, 要在新的上下文中完整回放,
+     * 需在 user_setup 创建资源之前开始录制
+     */
+    bool begin_record(const char* path);
+    void end_record();
+    bool recording();
+
+    /**
+     * @brief 通过当前的glad函数指针回放录制文件, 对象名字与uniform位置重新映射
+     * @return 每帧回放耗时(毫秒), 失败时为空
+     * @note 配合 install(backend_t::null) 可测量不含驱动开销的回放本身
+     */
+    std::vector<double> replay(const char* path);
+
+}
+}
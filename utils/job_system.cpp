@@ -0,0 +1,346 @@
+#include "utils/job_system.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <thread>
+#include "utils/debug.hpp"
+
+using namespace Ez3DGL;
+
+struct job_system::job_t{
+    job_fn_t fn;
+    counter_t* counter;
+};
+
+namespace {
+
+using job_system::job_t;
+
+/**
+ * Chase-Lev 工作窃取队列, 只有所属线程 push/pop(后进先出), 其他线程从另一端 steal
+ */
+class ws_deque_t{
+public:
+    static constexpr int64_t capacity = 1 << 12;
+
+    bool push(job_t* job){
+        const int64_t b = bottom.load(std::memory_order_relaxed);
+        const int64_t t = top.load(std::memory_order_acquire);
+        if(b - t >= capacity) return false;
+        buffer[b & (capacity - 1)].store(job, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+    job_t* pop(){
+        const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if(t > b){
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        job_t* job = buffer[b & (capacity - 1)].load(std::memory_order_relaxed);
+        if(t == b){
+            // 只剩最后一个, 与窃取者竞争
+            if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                job = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+    job_t* steal(){
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = bottom.load(std::memory_order_acquire);
+        if(t >= b) return nullptr;
+        job_t* job = buffer[t & (capacity - 1)].load(std::memory_order_relaxed);
+        if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+        return job;
+    }
+private:
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    std::atomic<job_t*> buffer[capacity];
+};
+
+struct scheduler_state_t{
+    bool initialized = false;
+    std::atomic<bool> running{false};
+    std::vector<std::thread> workers;
+    // 0为主线程, 1..N为工作线程
+    std::vector<std::unique_ptr<ws_deque_t>> deques;
+
+    // 非任务系统线程提交的任务, 以及本地队列已满时的溢出
+    std::mutex inject_mutex;
+    std::deque<job_t*> injected;
+
+    // 尚未被取走的任务数, 用于判断工作线程能否休眠
+    std::atomic<int64_t> queued{0};
+    std::atomic<int32_t> sleeping{0};
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cv;
+
+    std::mutex main_mutex;
+    std::vector<job_system::job_fn_t> main_queue;
+};
+
+scheduler_state_t& state(){
+    static scheduler_state_t s;
+    return s;
+}
+
+thread_local int tls_index = -1;
+
+}
+
+struct job_system::scheduler_t{
+    static void push(job_t* job){
+        auto& s = state();
+        if(tls_index < 0 || !s.deques[tls_index]->push(job)){
+            std::lock_guard<std::mutex> lock(s.inject_mutex);
+            s.injected.push_back(job);
+        }
+        s.queued.fetch_add(1);
+        if(s.sleeping.load() > 0){
+            std::lock_guard<std::mutex> lock(s.sleep_mutex);
+            s.sleep_cv.notify_one();
+        }
+    }
+
+    static job_t* find_job(){
+        auto& s = state();
+        job_t* job = nullptr;
+        if(tls_index >= 0)
+            job = s.deques[tls_index]->pop();
+        if(job == nullptr){
+            std::lock_guard<std::mutex> lock(s.inject_mutex);
+            if(!s.injected.empty()){
+                job = s.injected.front();
+                s.injected.pop_front();
+            }
+        }
+        if(job == nullptr){
+            // 从下一个线程开始依次窃取, 分散竞争
+            const size_t n = s.deques.size();
+            const size_t start = tls_index < 0 ? 0 : size_t(tls_index) + 1;
+            for(size_t i=0; i<n && job==nullptr; i++){
+                const size_t victim = (start + i) % n;
+                if(int(victim) != tls_index)
+                    job = s.deques[victim]->steal();
+            }
+        }
+        if(job != nullptr)
+            s.queued.fetch_sub(1);
+        return job;
+    }
+
+    static void finish(job_t* job){
+        auto counter = job->counter;
+        delete job;
+        if(counter == nullptr) return;
+        // 不是最后一个任务时无锁递减
+        int32_t pending = counter->pending.load(std::memory_order_relaxed);
+        while(pending > 1 && !counter->pending.compare_exchange_weak(pending, pending - 1, std::memory_order_acq_rel))
+            ;
+        if(pending > 1) return;
+        // 可能归零: 在锁内归零并取走后续任务, 计数器析构前会获取一次该锁, 解锁后不再访问计数器
+        std::vector<job_t*> ready;
+        {
+            std::lock_guard<std::mutex> lock(counter->mutex);
+            if(counter->pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                return;
+            ready.swap(counter->continuations);
+        }
+        for(auto next: ready)
+            schedule(next);
+    }
+
+    static void execute(job_t* job){
+        job->fn();
+        finish(job);
+    }
+
+    static void schedule(job_t* job){
+        // 没有工作线程时立即执行
+        if(!state().running.load(std::memory_order_relaxed)){
+            execute(job);
+            return;
+        }
+        push(job);
+    }
+
+    static void submit(job_fn_t fn, counter_t* counter){
+        if(counter != nullptr)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        schedule(new job_t{std::move(fn), counter});
+    }
+
+    static void submit_after(counter_t* dependency, job_fn_t fn, counter_t* counter){
+        if(counter != nullptr)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        auto job = new job_t{std::move(fn), counter};
+        {
+            std::lock_guard<std::mutex> lock(dependency->mutex);
+            if(!dependency->done()){
+                dependency->continuations.push_back(job);
+                return;
+            }
+        }
+        schedule(job);
+    }
+
+    static void worker_main(int index){
+        tls_index = index;
+        auto& s = state();
+        while(s.running.load()){
+            job_t* job = find_job();
+            for(int spin=0; job==nullptr && spin<64; spin++){
+                std::this_thread::yield();
+                job = find_job();
+            }
+            if(job != nullptr){
+                execute(job);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(s.sleep_mutex);
+            s.sleeping.fetch_add(1);
+            s.sleep_cv.wait(lock, [&](){return !s.running.load() || s.queued.load() > 0;});
+            s.sleeping.fetch_sub(1);
+        }
+    }
+};
+
+job_system::counter_t::~counter_t(){
+    assert_with_info(done(), "counter is destroyed before its jobs finish");
+    // 等待把计数器归零的线程释放锁(done() 在其解锁前就已为真)
+    std::lock_guard<std::mutex> lock(mutex);
+}
+
+void job_system::init(int worker_num){
+    auto& s = state();
+    assert_with_info(!s.initialized, "job system is already initialized");
+    if(worker_num < 0){
+        const char* env = getenv("EZ3DGL_WORKERS");
+        if(env != nullptr)
+            worker_num = std::max(0, atoi(env));
+        else
+            worker_num = std::max(1u, std::thread::hardware_concurrency()) - 1;
+    }
+    tls_index = 0;
+    s.deques.clear();
+    for(int i=0; i<=worker_num; i++)
+        s.deques.emplace_back(new ws_deque_t);
+    s.initialized = true;
+    s.running = worker_num > 0;
+    for(int i=1; i<=worker_num; i++)
+        s.workers.emplace_back(&scheduler_t::worker_main, i);
+}
+
+void job_system::shutdown(){
+    auto& s = state();
+    if(!s.initialized) return;
+    // 先执行完已提交的任务
+    while(auto job = scheduler_t::find_job())
+        scheduler_t::execute(job);
+    {
+        std::lock_guard<std::mutex> lock(s.sleep_mutex);
+        s.running = false;
+        s.sleep_cv.notify_all();
+    }
+    for(auto& worker: s.workers)
+        worker.join();
+    // 工作线程退出前可能又提交了任务, 此时已没有工作线程, 在当前线程上执行完
+    for(;;){
+        bool idle = true;
+        while(auto job = scheduler_t::find_job()){
+            scheduler_t::execute(job);
+            idle = false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(s.main_mutex);
+            idle = idle && s.main_queue.empty();
+        }
+        if(idle) break;
+        pump_main();
+    }
+    assert_with_info(s.queued.load() == 0, "jobs are left in the queues after shutdown");
+    s.workers.clear();
+    s.deques.clear();
+    s.initialized = false;
+    tls_index = -1;
+}
+
+bool job_system::initialized(){
+    return state().initialized;
+}
+
+uint32_t job_system::worker_num(){
+    return static_cast<uint32_t>(state().workers.size());
+}
+
+int job_system::thread_index(){
+    return tls_index;
+}
+
+void job_system::run(job_fn_t fn, counter_t* counter){
+    scheduler_t::submit(std::move(fn), counter);
+}
+
+void job_system::run_after(counter_t* dependency, job_fn_t fn, counter_t* counter){
+    scheduler_t::submit_after(dependency, std::move(fn), counter);
+}
+
+void job_system::wait(counter_t* counter){
+    while(!counter->done()){
+        if(tls_index == 0)
+            pump_main();
+        if(auto job = scheduler_t::find_job())
+            scheduler_t::execute(job);
+        else
+            std::this_thread::yield();
+    }
+}
+
+void job_system::parallel_for(size_t beg, size_t end, const std::function<void(size_t, size_t)>& fn, size_t min_chunk){
+    if(end <= beg) return;
+    const size_t n = end - beg;
+    min_chunk = std::max<size_t>(min_chunk, 1);
+    const size_t thread_num = worker_num() + 1;
+    if(thread_num == 1 || n <= min_chunk){
+        fn(beg, end);
+        return;
+    }
+    // 每个线程约4块, 兼顾负载均衡与调度开销
+    const size_t chunk = std::max(min_chunk, (n + thread_num * 4 - 1) / (thread_num * 4));
+    counter_t counter;
+    size_t chunk_beg = beg;
+    for(; chunk_beg + chunk < end; chunk_beg += chunk){
+        const size_t chunk_end = chunk_beg + chunk;
+        run([&fn, chunk_beg, chunk_end](){fn(chunk_beg, chunk_end);}, &counter);
+    }
+    // 最后一块在调用线程上执行
+    fn(chunk_beg, end);
+    wait(&counter);
+}
+
+void job_system::run_on_main(job_fn_t fn){
+    auto& s = state();
+    std::lock_guard<std::mutex> lock(s.main_mutex);
+    s.main_queue.push_back(std::move(fn));
+}
+
+void job_system::pump_main(){
+    auto& s = state();
+    std::vector<job_fn_t> jobs;
+    {
+        std::lock_guard<std::mutex> lock(s.main_mutex);
+        jobs.swap(s.main_queue);
+    }
+    for(auto& job: jobs)
+        job();
+}
@@ -0,0 +1,89 @@
+/**
+ * @file job_system.hpp
+ * @brief 任务系统: 每个线程一个工作窃取队列, 计数器表示依赖, 自动分块的 parallel_for, 主线程(GL)任务队列
+ * @note 未初始化或工作线程数为0时所有任务在调用线程上立即执行, 结果与单线程一致
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace Ez3DGL {
+namespace job_system {
+
+    using job_fn_t = std::function<void()>;
+
+    struct job_t;
+    struct scheduler_t;
+
+    /**
+     * @brief 任务计数器, 提交时加一, 任务完成时减一, 归零后调度依赖它的任务
+     */
+    class counter_t{
+    public:
+        counter_t() = default;
+        counter_t(const counter_t&) = delete;
+        counter_t& operator=(const counter_t&) = delete;
+        ~counter_t();
+
+        bool done() const{
+            return pending.load(std::memory_order_acquire) == 0;
+        }
+    private:
+        std::atomic<int32_t> pending{0};
+        std::mutex mutex;
+        // 等待本计数器归零的任务
+        std::vector<job_t*> continuations;
+
+        friend struct scheduler_t;
+    };
+
+    /**
+     * @brief 启动工作线程, 调用线程视为主线程
+     * @param worker_num 工作线程数(不含主线程), 小于0时读取环境变量 EZ3DGL_WORKERS,
+     * 未设置则为硬件线程数减一; 为0时所有任务在提交线程上执行, 便于确定性测试
+     */
+    void init(int worker_num=-1);
+    void shutdown();
+    bool initialized();
+    // 工作线程数, 不含主线程
+    uint32_t worker_num();
+    // 当前线程编号, 主线程为0, 工作线程从1开始, 其他线程为-1
+    int thread_index();
+
+    /**
+     * @brief 提交任务
+     * @param counter 不为空时任务完成后计数器减一
+     */
+    void run(job_fn_t fn, counter_t* counter=nullptr);
+    /**
+     * @brief dependency 归零后再执行 fn
+     */
+    void run_after(counter_t* dependency, job_fn_t fn, counter_t* counter=nullptr);
+    /**
+     * @brief 等待计数器归零, 等待期间当前线程也执行任务(主线程还会执行主线程队列)
+     */
+    void wait(counter_t* counter);
+
+    /**
+     * @brief 把[beg, end)分块并行执行 fn(chunk_beg, chunk_end), 返回时全部完成
+     * @param min_chunk 每块至少包含的元素数, 单个元素很轻时调大以减少调度开销
+     */
+    void parallel_for(size_t beg, size_t end, const std::function<void(size_t, size_t)>& fn, size_t min_chunk=1);
+
+    /**
+     * @brief 提交只能在主线程执行的任务(如GL调用), 由 window_loop 每帧开始时执行
+     */
+    void run_on_main(job_fn_t fn);
+    /**
+     * @brief 执行主线程队列中的所有任务, 只能在主线程调用
+     */
+    void pump_main();
+
+}
+}
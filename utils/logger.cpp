@@ -0,0 +1,527 @@
+#include "utils/logger.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "utils/debug.hpp"
+
+using namespace Ez3DGL;
+using logger::level_t;
+using logger::detail::tag_t;
+
+namespace {
+
+/**
+ * 记录头, 之后是各参数(1字节类型 + 值, 字符串为长度 + 字节), 整条记录按8字节对齐.
+ * site 为空表示回绕前的填充
+ */
+struct record_t{
+    uint32_t size;
+    uint32_t argc;
+    uint32_t suppressed;
+    uint64_t time_ns;
+    const logger::site_t* site;
+};
+
+/**
+ * 单生产者(所属线程)单消费者(持有 drain_mutex 的线程)的字节环形缓冲
+ */
+struct ring_t{
+    static constexpr uint64_t capacity = 1 << 16;
+
+    alignas(64) std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+    // 生产者在 begin 与 end 之间预留到的位置
+    uint64_t pending = 0;
+    std::atomic<uint64_t> dropped{0};
+    // 所属线程已退出, 输出完后释放
+    std::atomic<bool> retired{false};
+    uint32_t thread = 0;
+    alignas(8) uint8_t data[capacity];
+
+    uint8_t* reserve(size_t size){
+        const uint64_t h = head.load(std::memory_order_relaxed);
+        const uint64_t t = tail.load(std::memory_order_acquire);
+        const uint64_t pos = h & (capacity - 1);
+        const uint64_t contiguous = capacity - pos;
+        // 末尾放不下时跳到开头, 末尾的空间作为填充
+        const uint64_t skip = contiguous < size ? contiguous : 0;
+        if(capacity - (h - t) < size + skip)
+            return nullptr;
+        if(skip >= sizeof(record_t)){
+            record_t* pad = reinterpret_cast<record_t*>(data + pos);
+            pad->size = uint32_t(skip);
+            pad->site = nullptr;
+        }
+        pending = h + skip + size;
+        return data + ((h + skip) & (capacity - 1));
+    }
+};
+
+struct entry_t{
+    uint64_t time_ns;
+    uint32_t thread;
+    const record_t* record;
+};
+
+struct logger_state_t{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::atomic<level_t> level{level_t::trace};
+    std::atomic<uint32_t> rate_limit{100};
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> written{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> suppressed{0};
+
+    std::mutex rings_mutex;
+    std::vector<ring_t*> rings;
+    uint32_t next_thread = 0;
+
+    // 持有者是所有缓冲唯一的消费者
+    std::mutex drain_mutex;
+    FILE* out = stdout;
+    bool color = true;
+    std::vector<ring_t*> drain_rings;
+    std::vector<uint64_t> drain_heads;
+    std::vector<entry_t> batch;
+    std::string line;
+    std::string text;
+
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    std::thread drainer;
+};
+
+logger_state_t* state();
+
+uint64_t now_ns(const logger_state_t* s){
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s->start).count());
+}
+
+struct ring_handle_t{
+    ring_t* ring = nullptr;
+    ~ring_handle_t(){
+        if(ring != nullptr)
+            ring->retired.store(true, std::memory_order_release);
+        ring = nullptr;
+    }
+};
+thread_local ring_handle_t local_ring;
+
+ring_t* current_ring(){
+    if(local_ring.ring == nullptr){
+        logger_state_t* s = state();
+        ring_t* ring = new ring_t();
+        std::lock_guard<std::mutex> lock(s->rings_mutex);
+        ring->thread = s->next_thread++;
+        s->rings.push_back(ring);
+        local_ring.ring = ring;
+    }
+    return local_ring.ring;
+}
+
+const char* level_name(level_t level){
+    switch(level){
+        case level_t::trace: return "TRACE";
+        case level_t::debug: return "DEBUG";
+        case level_t::info:  return "INFO ";
+        case level_t::warn:  return "WARN ";
+        case level_t::error: return "ERROR";
+        case level_t::fatal: return "FATAL";
+        default: return "?????";
+    }
+}
+
+const char* level_color(level_t level){
+    switch(level){
+        case level_t::trace: return ANSI_FG_WHITE;
+        case level_t::debug: return ANSI_FG_CYAN;
+        case level_t::info:  return ANSI_FG_BLUE;
+        case level_t::warn:  return ANSI_FG_YELLOW;
+        default: return ANSI_FG_RED;
+    }
+}
+
+struct arg_t{
+    tag_t tag;
+    uint64_t bits;
+    const char* str;
+    uint32_t len;
+
+    long long as_int() const{
+        if(tag == tag_t::f64){
+            double f;
+            memcpy(&f, &bits, 8);
+            return (long long)f;
+        }
+        return (long long)bits;
+    }
+    double as_double() const{
+        if(tag == tag_t::f64){
+            double f;
+            memcpy(&f, &bits, 8);
+            return f;
+        }
+        return tag == tag_t::i64 ? double(int64_t(bits)) : double(bits);
+    }
+};
+
+class arg_reader_t{
+public:
+    arg_reader_t(const record_t* record)
+        :p(reinterpret_cast<const uint8_t*>(record + 1)), left(record->argc){}
+
+    bool next(arg_t& arg){
+        if(left == 0) return false;
+        left--;
+        arg.tag = tag_t(*p++);
+        if(arg.tag == tag_t::str){
+            memcpy(&arg.len, p, sizeof(uint32_t));
+            arg.str = reinterpret_cast<const char*>(p + sizeof(uint32_t));
+            arg.bits = 0;
+            p += sizeof(uint32_t) + arg.len;
+        }else{
+            memcpy(&arg.bits, p, 8);
+            arg.str = nullptr;
+            arg.len = 0;
+            p += 8;
+        }
+        return true;
+    }
+private:
+    const uint8_t* p;
+    uint32_t left;
+};
+
+template<typename T>
+void append_format(std::string& out, const char* spec, T value){
+    char buffer[256];
+    const int n = snprintf(buffer, sizeof(buffer), spec, value);
+    if(n < 0) return;
+    if(size_t(n) < sizeof(buffer)){
+        out.append(buffer, size_t(n));
+        return;
+    }
+    const size_t old_size = out.size();
+    out.resize(old_size + size_t(n) + 1);
+    snprintf(&out[old_size], size_t(n) + 1, spec, value);
+    out.resize(old_size + size_t(n));
+}
+
+/**
+ * 按 printf 格式串解释捕获的参数: 逐个转换说明改写长度修饰后单独调用 snprintf,
+ * 整数统一按 long long 传递, 浮点按 double, 类型不符时转换而不是读取错误的值
+ */
+void format_record(const record_t* record, std::string& out, std::string& text){
+    arg_reader_t reader(record);
+    const char* f = record->site->fmt;
+    arg_t arg;
+    while(*f){
+        if(*f != '%'){
+            const char* run = f;
+            while(*f && *f != '%') f++;
+            out.append(run, size_t(f - run));
+            continue;
+        }
+        if(f[1] == '%'){
+            out.push_back('%');
+            f += 2;
+            continue;
+        }
+        char spec[48];
+        size_t n = 0;
+        spec[n++] = *f++;
+        while(*f && strchr("-+ #0", *f) && n < 8)
+            spec[n++] = *f++;
+        for(int part=0; part<2; part++){
+            // part 0 为宽度, 1 为精度
+            if(part == 1){
+                if(*f != '.') break;
+                spec[n++] = *f++;
+            }
+            if(*f == '*'){
+                f++;
+                const int v = reader.next(arg) ? int(arg.as_int()) : 0;
+                n += size_t(snprintf(spec + n, 12, "%d", v));
+            }else{
+                while(*f >= '0' && *f <= '9' && n < 24)
+                    spec[n++] = *f++;
+            }
+        }
+        while(*f && strchr("hljztLq", *f))
+            f++;
+        const char conv = *f;
+        if(conv == 0) break;
+        f++;
+        if(!reader.next(arg)){
+            out.append("<missing>");
+            continue;
+        }
+        switch(conv){
+            case 'd': case 'i':
+                memcpy(spec + n, "lld", 4);
+                append_format(out, spec, arg.as_int());
+                break;
+            case 'u': case 'o': case 'x': case 'X':
+                spec[n++] = 'l';
+                spec[n++] = 'l';
+                spec[n++] = conv;
+                spec[n] = 0;
+                append_format(out, spec, (unsigned long long)arg.as_int());
+                break;
+            case 'c':
+                memcpy(spec + n, "c", 2);
+                append_format(out, spec, int(arg.as_int()));
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                spec[n++] = conv;
+                spec[n] = 0;
+                append_format(out, spec, arg.as_double());
+                break;
+            case 's':
+                memcpy(spec + n, "s", 2);
+                if(arg.tag == tag_t::str)
+                    text.assign(arg.str, arg.len);
+                else
+                    text.assign("<not a string>");
+                append_format(out, spec, text.c_str());
+                break;
+            case 'p':
+                memcpy(spec + n, "p", 2);
+                append_format(out, spec, reinterpret_cast<const void*>(uintptr_t(arg.bits)));
+                break;
+            default:
+                // %n 等不支持的转换原样输出
+                out.append(spec, n);
+                out.push_back(conv);
+                break;
+        }
+    }
+    while(!out.empty() && out.back() == '\n')
+        out.pop_back();
+}
+
+void write_record(logger_state_t* s, const entry_t& entry){
+    const record_t* record = entry.record;
+    const logger::site_t* site = record->site;
+    std::string& line = s->line;
+    line.clear();
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "[%10.6f] [T%u] ", double(record->time_ns) * 1e-9, entry.thread);
+    line.append(prefix);
+    if(s->color) line.append(level_color(site->level));
+    line.push_back('[');
+    line.append(level_name(site->level));
+    line.append("] ");
+    format_record(record, line, s->text);
+    if(s->color) line.append(ANSI_NONE);
+    if(record->suppressed != 0)
+        append_format(line, " (%u similar messages suppressed)", record->suppressed);
+    if(site->location){
+        line.append("  <");
+        line.append(site->file);
+        append_format(line, ":%d ", site->line);
+        line.append(site->func);
+        line.push_back('>');
+    }
+    line.push_back('\n');
+    fwrite(line.data(), 1, line.size(), s->out);
+}
+
+/**
+ * 收集所有缓冲中已提交的记录, 按时间排序后输出, 需持有 drain_mutex
+ */
+void drain(logger_state_t* s){
+    {
+        std::lock_guard<std::mutex> lock(s->rings_mutex);
+        s->drain_rings = s->rings;
+    }
+    s->batch.clear();
+    s->drain_heads.resize(s->drain_rings.size());
+    uint64_t dropped = 0;
+    for(size_t i=0; i<s->drain_rings.size(); i++){
+        ring_t* ring = s->drain_rings[i];
+        const uint64_t h = ring->head.load(std::memory_order_acquire);
+        uint64_t t = ring->tail.load(std::memory_order_relaxed);
+        s->drain_heads[i] = h;
+        while(t < h){
+            const uint64_t pos = t & (ring_t::capacity - 1);
+            if(ring_t::capacity - pos < sizeof(record_t)){
+                t += ring_t::capacity - pos;
+                continue;
+            }
+            const record_t* record = reinterpret_cast<const record_t*>(ring->data + pos);
+            if(record->site != nullptr)
+                s->batch.push_back(entry_t{record->time_ns, ring->thread, record});
+            t += record->size;
+        }
+        dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+    }
+    // 同一线程内时间单调, 稳定排序保持其顺序
+    std::stable_sort(s->batch.begin(), s->batch.end(), [](const entry_t& a, const entry_t& b){
+        return a.time_ns < b.time_ns;
+    });
+    for(const auto& entry: s->batch)
+        write_record(s, entry);
+    if(dropped != 0)
+        fprintf(s->out, "[logger] %llu messages dropped, ring buffers full\n", (unsigned long long)dropped);
+    if(!s->batch.empty() || dropped != 0)
+        fflush(s->out);
+    for(size_t i=0; i<s->drain_rings.size(); i++)
+        s->drain_rings[i]->tail.store(s->drain_heads[i], std::memory_order_release);
+
+    // 释放所属线程已退出且已输出完的缓冲
+    std::lock_guard<std::mutex> lock(s->rings_mutex);
+    for(size_t i=0; i<s->rings.size(); ){
+        ring_t* ring = s->rings[i];
+        if(ring->retired.load(std::memory_order_acquire) &&
+           ring->tail.load(std::memory_order_relaxed) == ring->head.load(std::memory_order_acquire)){
+            s->rings[i] = s->rings.back();
+            s->rings.pop_back();
+            delete ring;
+        }else
+            i++;
+    }
+}
+
+void drainer_main(logger_state_t* s){
+    while(s->running.load(std::memory_order_acquire)){
+        {
+            std::unique_lock<std::mutex> lock(s->wake_mutex);
+            s->wake.wait_for(lock, std::chrono::milliseconds(10));
+        }
+        std::lock_guard<std::mutex> lock(s->drain_mutex);
+        drain(s);
+    }
+}
+
+level_t parse_level(const char* name, level_t fallback){
+    static const char* names[] = {"trace", "debug", "info", "warn", "error", "fatal", "off"};
+    for(int i=0; i<7; i++)
+        if(strcmp(name, names[i]) == 0)
+            return level_t(i);
+    return fallback;
+}
+
+// 进程退出时仍可能有线程记录日志, 状态不析构
+logger_state_t* state(){
+    static logger_state_t* s = []{
+        auto* s = new logger_state_t();
+        if(const char* env = std::getenv("EZ3DGL_LOG"))
+            s->level.store(parse_level(env, level_t::trace));
+        s->running.store(true);
+        s->drainer = std::thread(drainer_main, s);
+        std::atexit(logger::shutdown);
+        return s;
+    }();
+    return s;
+}
+
+}
+
+uint8_t* logger::detail::begin(site_t& site, size_t args_size, uint32_t argc){
+    logger_state_t* s = state();
+    if(site.level < s->level.load(std::memory_order_relaxed))
+        return nullptr;
+    const uint64_t now = now_ns(s);
+    const uint32_t limit = s->rate_limit.load(std::memory_order_relaxed);
+    if(limit != 0 && site.level < level_t::fatal){
+        // 窗口从1开始, 0表示调用点还没有记录过
+        const uint64_t second = now / 1000000000ull + 1;
+        uint64_t window = site.window.load(std::memory_order_relaxed);
+        if(window != second && site.window.compare_exchange_strong(window, second, std::memory_order_relaxed))
+            site.count.store(0, std::memory_order_relaxed);
+        if(site.count.fetch_add(1, std::memory_order_relaxed) >= limit){
+            site.suppressed.fetch_add(1, std::memory_order_relaxed);
+            s->suppressed.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+    }
+    const size_t size = (sizeof(record_t) + args_size + 7) & ~size_t(7);
+    ring_t* ring = current_ring();
+    if(size > ring_t::capacity / 2){
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        s->dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    uint8_t* p = ring->reserve(size);
+    if(p == nullptr && site.level >= level_t::error){
+        // 错误不丢弃, 在当前线程输出后重试
+        flush();
+        p = ring->reserve(size);
+    }
+    if(p == nullptr){
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        s->dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    record_t* record = reinterpret_cast<record_t*>(p);
+    record->size = uint32_t(size);
+    record->argc = argc;
+    record->suppressed = site.suppressed.exchange(0, std::memory_order_relaxed);
+    record->time_ns = now;
+    record->site = &site;
+    return p + sizeof(record_t);
+}
+
+void logger::detail::end(const site_t& site){
+    logger_state_t* s = state();
+    ring_t* ring = local_ring.ring;
+    ring->head.store(ring->pending, std::memory_order_release);
+    s->written.fetch_add(1, std::memory_order_relaxed);
+    if(site.level >= level_t::fatal || !s->running.load(std::memory_order_acquire)){
+        flush();
+        return;
+    }
+    const uint64_t used = ring->pending - ring->tail.load(std::memory_order_relaxed);
+    if(site.level >= level_t::warn || used > ring_t::capacity / 2)
+        s->wake.notify_one();
+}
+
+void logger::set_level(level_t level){
+    state()->level.store(level, std::memory_order_relaxed);
+}
+
+level_t logger::level(){
+    return state()->level.load(std::memory_order_relaxed);
+}
+
+void logger::set_rate_limit(uint32_t per_second){
+    state()->rate_limit.store(per_second, std::memory_order_relaxed);
+}
+
+void logger::set_output(FILE* out, bool color){
+    logger_state_t* s = state();
+    std::lock_guard<std::mutex> lock(s->drain_mutex);
+    drain(s);
+    s->out = out;
+    s->color = color;
+}
+
+void logger::flush(){
+    logger_state_t* s = state();
+    std::lock_guard<std::mutex> lock(s->drain_mutex);
+    drain(s);
+}
+
+void logger::shutdown(){
+    logger_state_t* s = state();
+    if(s->running.exchange(false)){
+        s->wake.notify_one();
+        s->drainer.join();
+    }
+    flush();
+}
+
+logger::stats_t logger::stats(){
+    const logger_state_t* s = state();
+    stats_t result;
+    result.written = s->written.load(std::memory_order_relaxed);
+    result.dropped = s->dropped.load(std::memory_order_relaxed);
+    result.suppressed = s->suppressed.load(std::memory_order_relaxed);
+    return result;
+}
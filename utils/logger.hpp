@@ -0,0 +1,214 @@
+/**
+ * @file logger.hpp
+ * @brief 异步日志: 分级与编译期过滤, 每线程无锁环形缓冲, 参数按二进制捕获并由后台线程格式化输出, 按调用点限流
+ * @note 低于 EZ3DGL_LOG_LEVEL 的日志宏展开为空语句(仍检查格式串), 默认调试构建为 debug, 定义 NDEBUG 时为 info
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+// 0 trace, 1 debug, 2 info, 3 warn, 4 error, 5 fatal
+#ifndef EZ3DGL_LOG_LEVEL
+#ifdef NDEBUG
+#define EZ3DGL_LOG_LEVEL 2
+#else
+#define EZ3DGL_LOG_LEVEL 1
+#endif
+#endif
+
+namespace Ez3DGL {
+namespace logger {
+
+    enum class level_t: uint8_t{
+        trace, debug, info, warn, error, fatal, off
+    };
+
+    /**
+     * @brief 调用点, 由日志宏定义为静态变量, 记录中只保存其指针
+     */
+    struct site_t{
+        constexpr site_t(level_t level, bool location, const char* file, int line, const char* func, const char* fmt)
+            :level(level), location(location), file(file), line(line), func(func), fmt(fmt){}
+
+        const level_t level;
+        // 输出时是否附带文件, 行号与函数名
+        const bool location;
+        const char* const file;
+        const int line;
+        const char* const func;
+        const char* const fmt;
+        // 限流状态: 当前计数的秒, 本秒已记录的条数, 被丢弃的条数(随下一条记录输出)
+        std::atomic<uint64_t> window{0};
+        std::atomic<uint32_t> count{0};
+        std::atomic<uint32_t> suppressed{0};
+    };
+
+    struct stats_t{
+        uint64_t written = 0;
+        // 缓冲已满而丢弃的条数(error 及以上不丢弃, 改为在调用线程上同步输出)
+        uint64_t dropped = 0;
+        // 被限流的条数
+        uint64_t suppressed = 0;
+    };
+
+    /**
+     * @brief 运行时级别, 只能在编译期级别之上进一步过滤; 启动时读取环境变量 EZ3DGL_LOG (trace/debug/info/warn/error/off)
+     */
+    void set_level(level_t level);
+    level_t level();
+    /**
+     * @brief 每个调用点每秒最多记录多少条, 0表示不限流, 默认100; fatal 不受限
+     */
+    void set_rate_limit(uint32_t per_second);
+    /**
+     * @brief 输出目标, 默认为 stdout 并带颜色
+     */
+    void set_output(FILE* out, bool color=false);
+    /**
+     * @brief 在调用线程上输出所有线程已记录的日志, 返回时已写入输出目标
+     */
+    void flush();
+    /**
+     * @brief 停止后台线程并输出剩余日志, 进程退出时自动调用; 之后的日志在调用线程上同步输出
+     */
+    void shutdown();
+    stats_t stats();
+
+    /**
+     * @brief 只用于让编译器检查格式串与参数, 不会被调用
+     */
+#if defined(__GNUC__)
+    __attribute__((format(printf, 1, 2)))
+#endif
+    inline void check_format(const char*, ...){}
+
+    namespace detail {
+
+        enum class tag_t: uint8_t{
+            i64, u64, f64, ptr, str
+        };
+        // 字符串参数最多捕获的字节数
+        constexpr uint32_t max_str = 1024;
+
+        /**
+         * @brief 过滤与限流后在当前线程的缓冲中预留记录, 返回参数区, 被过滤或缓冲已满时返回空
+         */
+        uint8_t* begin(site_t& site, size_t args_size, uint32_t argc);
+        // 提交 begin 预留的记录
+        void end(const site_t& site);
+
+        inline uint32_t str_len(const char* s){
+            if(s == nullptr) return 6;
+            const size_t len = strlen(s);
+            return uint32_t(len < max_str ? len : max_str);
+        }
+
+        template<typename T>
+        inline size_t arg_size(T v){
+            if constexpr(std::is_same_v<T, const char*> || std::is_same_v<T, char*>)
+                return 1 + sizeof(uint32_t) + str_len(v);
+            else{
+                static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T> || std::is_pointer_v<T>,
+                    "log arguments must be arithmetic, enum, pointer or C string");
+                return 1 + 8;
+            }
+        }
+
+        template<typename T>
+        inline uint8_t* put(uint8_t* p, T v){
+            if constexpr(std::is_same_v<T, const char*> || std::is_same_v<T, char*>){
+                const uint32_t len = str_len(v);
+                *p++ = uint8_t(tag_t::str);
+                memcpy(p, &len, sizeof(len));
+                memcpy(p + sizeof(len), v == nullptr ? "(null)" : v, len);
+                return p + sizeof(len) + len;
+            }else if constexpr(std::is_enum_v<T>){
+                return put(p, std::underlying_type_t<T>(v));
+            }else if constexpr(std::is_pointer_v<T>){
+                const uint64_t u = uint64_t(reinterpret_cast<uintptr_t>(v));
+                *p++ = uint8_t(tag_t::ptr);
+                memcpy(p, &u, 8);
+                return p + 8;
+            }else if constexpr(std::is_floating_point_v<T>){
+                const double f = double(v);
+                *p++ = uint8_t(tag_t::f64);
+                memcpy(p, &f, 8);
+                return p + 8;
+            }else if constexpr(std::is_signed_v<T>){
+                const int64_t i = int64_t(v);
+                *p++ = uint8_t(tag_t::i64);
+                memcpy(p, &i, 8);
+                return p + 8;
+            }else{
+                const uint64_t u = uint64_t(v);
+                *p++ = uint8_t(tag_t::u64);
+                memcpy(p, &u, 8);
+                return p + 8;
+            }
+        }
+
+    }
+
+    /**
+     * @brief 记录一条日志: 只把调用点指针, 时间与参数的二进制值写入当前线程的缓冲, 格式化在后台线程进行
+     * @note 字符串参数按值复制(最多 detail::max_str 字节), 其他指针只记录地址
+     */
+    template<typename... Args>
+    inline void write(site_t& site, Args... args){
+        const size_t size = (size_t(0) + ... + detail::arg_size(args));
+        uint8_t* p = detail::begin(site, size, uint32_t(sizeof...(Args)));
+        if(p == nullptr) return;
+        ((p = detail::put(p, args)), ...);
+        (void)p;
+        detail::end(site);
+    }
+
+}
+}
+
+#define log_at_(LEVEL, LOCATION, FMT, ...) \
+    do{ \
+        static Ez3DGL::logger::site_t _log_site(Ez3DGL::logger::level_t::LEVEL, LOCATION, \
+            __FILE__, __LINE__, __func__, FMT); \
+        if(false) Ez3DGL::logger::check_format(FMT, ## __VA_ARGS__); \
+        Ez3DGL::logger::write(_log_site, ## __VA_ARGS__); \
+    }while(0)
+
+#define log_filtered_(FMT, ...) \
+    do{ \
+        if(false) Ez3DGL::logger::check_format(FMT, ## __VA_ARGS__); \
+    }while(0)
+
+#if EZ3DGL_LOG_LEVEL <= 0
+#define log_trace(FMT, ...) log_at_(trace, true, FMT, ## __VA_ARGS__)
+#else
+#define log_trace(FMT, ...) log_filtered_(FMT, ## __VA_ARGS__)
+#endif
+#if EZ3DGL_LOG_LEVEL <= 1
+#define log_debug(FMT, ...) log_at_(debug, true, FMT, ## __VA_ARGS__)
+#else
+#define log_debug(FMT, ...) log_filtered_(FMT, ## __VA_ARGS__)
+#endif
+#if EZ3DGL_LOG_LEVEL <= 2
+#define log_info(FMT, ...) log_at_(info, false, FMT, ## __VA_ARGS__)
+#else
+#define log_info(FMT, ...) log_filtered_(FMT, ## __VA_ARGS__)
+#endif
+#if EZ3DGL_LOG_LEVEL <= 3
+#define log_warn(FMT, ...) log_at_(warn, true, FMT, ## __VA_ARGS__)
+#else
+#define log_warn(FMT, ...) log_filtered_(FMT, ## __VA_ARGS__)
+#endif
+#if EZ3DGL_LOG_LEVEL <= 4
+#define log_error(FMT, ...) log_at_(error, true, FMT, ## __VA_ARGS__)
+#else
+#define log_error(FMT, ...) log_filtered_(FMT, ## __VA_ARGS__)
+#endif
+// fatal 不受编译期过滤, 记录后立即输出
+#define log_fatal(FMT, ...) log_at_(fatal, true, FMT, ## __VA_ARGS__)
@@ -143,6 +143,11 @@ namespace Ez3DGL {
 
         class shader{
         public:
+            /**
+             * @brief 法线矩阵 normal_matrix 由 shader_t::update_model 在CPU上按对象计算, 不在顶点着色器中求逆
+             * @note gl_Position 声明为 invariant, 只写深度的变体与着色变体共用该顶点着色器, 深度逐位相同
+             *
+             */
             static std::string vs_fragpos_normal_texcoord(){
                 return std::string(R"(
 #version 330 core
@@ -155,14 +160,18 @@ out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoord;
 
+// 深度预通道与着色阶段的深度须逐位一致(GL_EQUAL 测试)
+invariant gl_Position;
+
 uniform mat4 model;
+uniform mat3 normal_matrix;
 uniform mat4 view;
 uniform mat4 projection;
 
 void main()
 {
     FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;  
+    Normal = normal_matrix * aNormal;
     TexCoord = aTexCoord;
     
     gl_Position = projection * view * vec4(FragPos, 1.0);
@@ -170,37 +179,180 @@ void main()
 }
                 )");
             }
-            static std::string fs_multiple_lights_shader(uint32_t max_light_num){
+            /**
+             * @brief GPU蒙皮, 输出同 vs_fragpos_normal_texcoord; 关节矩阵按列存放在纹理缓冲中,
+             * 每个矩阵4个texel, bone_offset 为本实例第一个矩阵所在的texel
+             *
+             */
+            static std::string vs_skinned(){
                 return std::string(R"(
 #version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoord;
+layout (location = 3) in vec4 aJoints;
+layout (location = 4) in vec4 aWeights;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoord;
+
+invariant gl_Position;
 
+uniform mat4 model;
+uniform mat3 normal_matrix;
+uniform mat4 view;
+uniform mat4 projection;
+uniform samplerBuffer bone_matrices;
+uniform int bone_offset;
+
+mat4 bone(float joint)
+{
+    int base = bone_offset + int(joint + 0.5) * 4;
+    return mat4(texelFetch(bone_matrices, base), texelFetch(bone_matrices, base + 1),
+                texelFetch(bone_matrices, base + 2), texelFetch(bone_matrices, base + 3));
+}
+
+void main()
+{
+    mat4 skin = bone(aJoints.x) * aWeights.x + bone(aJoints.y) * aWeights.y +
+                bone(aJoints.z) * aWeights.z + bone(aJoints.w) * aWeights.w;
+    FragPos = vec3(model * skin * vec4(aPos, 1.0));
+    Normal = normal_matrix * (mat3(skin) * aNormal);
+    TexCoord = aTexCoord;
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+
+}
+                )");
+            }
+            /**
+             * @brief 多光源着色器变体的特性开关
+             * @note 光源数量上限为0时对应类型的光源数组与循环会被整体裁掉
+             * 
+             */
+            struct lights_features{
+                uint32_t dir_light_max;
+                uint32_t point_light_max;
+                uint32_t spot_light_max;
+                // material.diffuse[0]
+                bool diffuse_map;
+                // material.diffuse[1], 仅聚光使用
+                bool diffuse_mix_map;
+                // material.specular[0]
+                bool specular_map;
+                // 是否计算镜面光
+                bool specular;
+                // 点光源与聚光改由 LightCluster 分簇提供, 只遍历片元所在网格内的灯光
+                bool clustered = false;
+                // 延迟渲染的几何阶段, 只输出法线与材质到G-buffer, 不计算光照
+                bool gbuffer = false;
+                // 贴图来自纹理数组(sampler2DArray)的一层或其中一块图集区域, 不使用 diffuse[1]
+                bool texture_array = false;
+            };
+            /**
+             * @brief 完整的多光源着色器(所有特性开启,每种光源最多 max_light_num 个)
+             * 
+             */
+            static std::string fs_multiple_lights_shader(uint32_t max_light_num){
+                return fs_multiple_lights_shader(lights_features{
+                    max_light_num, max_light_num, max_light_num,
+                    true, true, true, true});
+            }
+            /**
+             * @brief 按特性生成特化的多光源着色器, 通过 #define 裁剪不需要的光源与纹理采样
+             * 
+             */
+            static std::string fs_multiple_lights_shader(const lights_features& features){
+                return std::string("#version 330 core\n")+
+                    "#define DIR_LIGHT_MAX "+std::to_string(features.dir_light_max)+"\n"+
+                    "#define POINT_LIGHT_MAX "+std::to_string(features.point_light_max)+"\n"+
+                    "#define SPOT_LIGHT_MAX "+std::to_string(features.spot_light_max)+"\n"+
+                    "#define HAS_DIFFUSE_MAP "+(features.diffuse_map ? "1" : "0")+"\n"+
+                    "#define HAS_DIFFUSE_MIX_MAP "+(features.diffuse_mix_map ? "1" : "0")+"\n"+
+                    "#define HAS_SPECULAR_MAP "+(features.specular_map ? "1" : "0")+"\n"+
+                    "#define ENABLE_SPECULAR "+(features.specular ? "1" : "0")+"\n"+
+                    "#define CLUSTERED_LIGHTS "+(features.clustered ? "1" : "0")+"\n"+
+                    "#define GBUFFER_PASS "+(features.gbuffer ? "1" : "0")+"\n"+
+                    "#define TEXTURE_ARRAY "+(features.texture_array ? "1" : "0")+"\n"+
+                    std::string(R"(
+#if GBUFFER_PASS
+// 八面体编码的法线 + 高光指数(RGB10_A2), 漫反射颜色 + 高光强度(RGBA8), 位置由深度重建
+layout (location = 0) out vec4 g_normal;
+layout (location = 1) out vec4 g_albedo_spec;
+
+vec2 OctEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return e * 0.5 + 0.5;
+}
+#else
 out vec4 frag_col;
+#endif
 
 in vec3 Normal;  
 in vec3 FragPos;  
 in vec2 TexCoord;
 
+#if ENABLE_SPECULAR
 uniform vec3 viewPos;
+#endif
 
 // 材质
 
-#define MAX_LIGHT_NUM )")+
-std::to_string(max_light_num)+
-std::string(R"(
 #define MAX_MATERIAL_NUM 4
 
-uniform int diffuse_num;
-uniform int specular_num;
 struct Material {
+#if TEXTURE_ARRAY
+    // region 为区域在层中的 uv 偏移(xy)与缩放(zw)
+#if HAS_DIFFUSE_MAP
+    sampler2DArray diffuse_array;
+    vec4 diffuse_region;
+    float diffuse_layer;
+#endif
+#if HAS_SPECULAR_MAP
+    sampler2DArray specular_array;
+    vec4 specular_region;
+    float specular_layer;
+#endif
+#else
+#if HAS_DIFFUSE_MAP
     sampler2D diffuse[MAX_MATERIAL_NUM];
+#endif
+#if HAS_SPECULAR_MAP
     sampler2D specular[MAX_MATERIAL_NUM];
+#endif
+#endif
     //TODO Emission
     float shininess;
 }; 
 uniform Material material;
 
+#if TEXTURE_ARRAY
+// 在纹理数组的一层中按区域采样, 区域小于整层(图集或补边)时在区域内重复寻址
+vec4 SampleRegion(sampler2DArray tex, vec4 region, float layer, vec2 uv)
+{
+    vec2 local = (region.z < 1.0 || region.w < 1.0) ? fract(uv) : uv;
+    // 按连续的 uv 求导, 避免 fract 跳变处选到最小的 mip 层
+    return textureGrad(tex, vec3(region.xy + local * region.zw, layer), dFdx(uv) * region.zw, dFdy(uv) * region.zw);
+}
+#endif
+
+// 镜面光着色
+float CalcSpecular(vec3 lightDir, vec3 normal, vec3 viewDir)
+{
+#if ENABLE_SPECULAR
+    vec3 reflectDir = reflect(-lightDir, normal);
+    return pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+#else
+    return 0.0;
+#endif
+}
+
 // 定向光
 
+#if DIR_LIGHT_MAX > 0
 struct DirLight {
     vec3 direction;
 
@@ -208,26 +360,26 @@ struct DirLight {
     vec3 diffuse;
     vec3 specular;
 };  
-uniform DirLight lights_dir[MAX_LIGHT_NUM];
+uniform DirLight lights_dir[DIR_LIGHT_MAX];
 uniform int dir_light_num;
 
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 albedo, vec3 spec_col)
 {
     vec3 lightDir = normalize(-light.direction);
     // 漫反射着色
     float diff = max(dot(normal, lightDir), 0.0);
-    // 镜面光着色
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
     // 合并结果
-    vec3 ambient  = light.ambient  * vec3(texture(material.diffuse[0], TexCoord));
-    vec3 diffuse  = light.diffuse  * diff * vec3(texture(material.diffuse[0], TexCoord));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular[0], TexCoord));
-    return (ambient + diffuse + specular);
+    vec3 result = light.ambient * albedo + light.diffuse * diff * albedo;
+#if ENABLE_SPECULAR
+    result += light.specular * CalcSpecular(lightDir, normal, viewDir) * spec_col;
+#endif
+    return result;
 }
+#endif
 
 // 点光源
 
+#if POINT_LIGHT_MAX > 0
 struct PointLight {
     vec3 position;
 
@@ -239,33 +391,30 @@ struct PointLight {
     vec3 diffuse;
     vec3 specular;
 };  
-uniform PointLight lights_point[MAX_LIGHT_NUM];
+uniform PointLight lights_point[POINT_LIGHT_MAX];
 uniform int point_light_num;
 
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 spec_col)
 {
     vec3 lightDir = normalize(light.position - fragPos);
     // 漫反射着色
     float diff = max(dot(normal, lightDir), 0.0);
-    // 镜面光着色
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
     // 衰减
     float distance    = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + 
                  light.quadratic * (distance * distance));    
     // 合并结果
-    vec3 ambient  = light.ambient  * texture(material.diffuse[0], TexCoord).rgb;
-    vec3 diffuse  = light.diffuse  * diff * texture(material.diffuse[0], TexCoord).rgb;
-    vec3 specular = light.specular * spec * texture(material.specular[0], TexCoord).rgb;
-    ambient  *= attenuation;
-    diffuse  *= attenuation;
-    specular *= attenuation;
-    return (ambient + diffuse + specular);
+    vec3 result = light.ambient * albedo + light.diffuse * diff * albedo;
+#if ENABLE_SPECULAR
+    result += light.specular * CalcSpecular(lightDir, normal, viewDir) * spec_col;
+#endif
+    return result * attenuation;
 }
+#endif
 
 // 聚光
 
+#if SPOT_LIGHT_MAX > 0
 struct SpotLight {
     vec3 position;
     vec3 direction;
@@ -280,17 +429,14 @@ struct SpotLight {
     vec3 diffuse;
     vec3 specular;       
 };
-uniform SpotLight lights_spot[MAX_LIGHT_NUM];
+uniform SpotLight lights_spot[SPOT_LIGHT_MAX];
 uniform int spot_light_num;
 
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 spec_col)
 {
     vec3 lightDir = normalize(light.position - fragPos);
     // diffuse shading
     float diff = max(dot(normal, lightDir), 0.0);
-    // specular shading
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
     // attenuation
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
@@ -299,42 +445,502 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float epsilon = light.cutoff - light.cutoff_outer;
     float intensity = clamp((theta - light.cutoff_outer) / epsilon, 0.0, 1.0);
     // combine results
-    vec3 ambient = light.ambient * vec3(mix(texture(material.diffuse[0], TexCoord), texture(material.diffuse[1], TexCoord), 0.2));
-    vec3 diffuse = light.diffuse * diff * vec3(mix(texture(material.diffuse[0], TexCoord), texture(material.diffuse[1], TexCoord), 0.2));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular[0], TexCoord));
-    ambient *= attenuation * intensity;
-    diffuse *= attenuation * intensity;
-    specular *= attenuation * intensity;
-    return (ambient + diffuse + specular);
+    vec3 result = light.ambient * albedo + light.diffuse * diff * albedo;
+#if ENABLE_SPECULAR
+    result += light.specular * CalcSpecular(lightDir, normal, viewDir) * spec_col;
+#endif
+    return result * attenuation * intensity;
 }
+#endif
+
+// 分簇的点光源与聚光, 点光源以张角180度的聚光表示
+
+#if CLUSTERED_LIGHTS
+// 每个网格的(起始位置, 数量)
+uniform usamplerBuffer cluster_grid;
+uniform usamplerBuffer cluster_items;
+// 每个灯光5个texel: (position, cutoff_outer) (ambient, constant) (diffuse, linear) (specular, quadratic) (direction, cutoff)
+uniform samplerBuffer cluster_lights;
+uniform vec3 cluster_dim;
+// (grid_x/viewport_w, grid_y/viewport_h, depth_scale, depth_bias)
+uniform vec4 cluster_scale;
+uniform mat4 view;
+
+vec3 CalcClusterLight(int idx, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 albedo_spot, vec3 spec_col)
+{
+    vec4 t0 = texelFetch(cluster_lights, idx*5);
+    vec4 t1 = texelFetch(cluster_lights, idx*5 + 1);
+    vec4 t2 = texelFetch(cluster_lights, idx*5 + 2);
+    vec4 t3 = texelFetch(cluster_lights, idx*5 + 3);
+    vec4 t4 = texelFetch(cluster_lights, idx*5 + 4);
+    vec3 lightDir = normalize(t0.xyz - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+    float distance = length(t0.xyz - fragPos);
+    float attenuation = 1.0 / (t1.w + t2.w * distance + t3.w * (distance * distance));
+    float theta = dot(lightDir, normalize(-t4.xyz));
+    float intensity = clamp((theta - t0.w) / (t4.w - t0.w), 0.0, 1.0);
+    vec3 base = t0.w > -1.5 ? albedo_spot : albedo;
+    vec3 result = t1.rgb * base + t2.rgb * diff * base;
+#if ENABLE_SPECULAR
+    result += t3.rgb * CalcSpecular(lightDir, normal, viewDir) * spec_col;
+#endif
+    return result * attenuation * intensity;
+}
+#endif
 
 
 
 void main()
 {
     vec3 norm = normalize(Normal);
+#if ENABLE_SPECULAR
     vec3 viewDir = normalize(viewPos - FragPos);
-
+#else
+    vec3 viewDir = vec3(0.0);
+#endif
+
+    // 材质只采样一次, 所有光源共用
+#if HAS_DIFFUSE_MAP && TEXTURE_ARRAY
+    vec3 albedo = SampleRegion(material.diffuse_array, material.diffuse_region, material.diffuse_layer, TexCoord).rgb;
+#elif HAS_DIFFUSE_MAP
+    vec3 albedo = texture(material.diffuse[0], TexCoord).rgb;
+#else
+    vec3 albedo = vec3(1.0);
+#endif
+#if HAS_DIFFUSE_MIX_MAP
+    vec3 albedo_spot = mix(albedo, texture(material.diffuse[1], TexCoord).rgb, 0.2);
+#else
+    vec3 albedo_spot = albedo;
+#endif
+    // 没有高光贴图时沿用漫反射颜色(与未绑定采样器默认读取0号纹理单元的行为一致)
+#if HAS_SPECULAR_MAP && TEXTURE_ARRAY
+    vec3 spec_col = SampleRegion(material.specular_array, material.specular_region, material.specular_layer, TexCoord).rgb;
+#elif HAS_SPECULAR_MAP
+    vec3 spec_col = texture(material.specular[0], TexCoord).rgb;
+#else
+    vec3 spec_col = albedo;
+#endif
+
+#if GBUFFER_PASS
+#if ENABLE_SPECULAR
+    float shininess = material.shininess;
+#else
+    float shininess = 32.0;
+#endif
+    // 高光指数在 [1, 1024] 内按 log2 存放, 10位精度足够
+    g_normal = vec4(OctEncode(norm), clamp(log2(max(shininess, 1.0)) / 10.0, 0.0, 1.0), 1.0);
+    g_albedo_spec = vec4(albedo, dot(spec_col, vec3(0.299, 0.587, 0.114)));
+#else
+    vec3 result = vec3(0, 0, 0);
     // 第一阶段：定向光照
-    vec3 dir_result = vec3(0, 0, 0);
-    for(int i = 0; i < min(MAX_LIGHT_NUM, dir_light_num); i++)
-        dir_result += CalcDirLight(lights_dir[i], norm, viewDir);
+#if DIR_LIGHT_MAX > 0
+    for(int i = 0; i < min(DIR_LIGHT_MAX, dir_light_num); i++)
+        result += CalcDirLight(lights_dir[i], norm, viewDir, albedo, spec_col);
+#endif
     // 第二阶段：点光源
-    vec3 point_result = vec3(0, 0, 0);
-    for(int i = 0; i < min(MAX_LIGHT_NUM, point_light_num); i++)
-        point_result += CalcPointLight(lights_point[i], norm, FragPos, viewDir);
+#if POINT_LIGHT_MAX > 0
+    for(int i = 0; i < min(POINT_LIGHT_MAX, point_light_num); i++)
+        result += CalcPointLight(lights_point[i], norm, FragPos, viewDir, albedo, spec_col);
+#endif
     // 第三阶段：聚光
-    vec3 spot_result = vec3(0, 0, 0);
-    for(int i = 0; i < min(MAX_LIGHT_NUM, spot_light_num); i++)
-        spot_result += CalcSpotLight(lights_spot[i], norm, FragPos, viewDir);
-    
-    int light_num_sum = dir_light_num + point_light_num + spot_light_num;
-    vec3 result = dir_result + point_result + spot_result;
+#if SPOT_LIGHT_MAX > 0
+    for(int i = 0; i < min(SPOT_LIGHT_MAX, spot_light_num); i++)
+        result += CalcSpotLight(lights_spot[i], norm, FragPos, viewDir, albedo_spot, spec_col);
+#endif
+    // 分簇：只计算片元所在网格内的灯光
+#if CLUSTERED_LIGHTS
+    float view_depth = -(view * vec4(FragPos, 1.0)).z;
+    ivec3 cell = ivec3(gl_FragCoord.xy * cluster_scale.xy, log(max(view_depth, 1e-4)) * cluster_scale.z + cluster_scale.w);
+    cell = clamp(cell, ivec3(0), ivec3(cluster_dim) - 1);
+    int cluster_id = cell.x + int(cluster_dim.x) * (cell.y + int(cluster_dim.y) * cell.z);
+    uvec2 range = texelFetch(cluster_grid, cluster_id).xy;
+    for(uint i = 0u; i < range.y; i++)
+        result += CalcClusterLight(int(texelFetch(cluster_items, int(range.x + i)).x), norm, FragPos, viewDir, albedo, albedo_spot, spec_col);
+#endif
+
     frag_col = vec4(result, 1.0);
+#endif
     
 } 
                 )");
             }
+            /**
+             * @brief 覆盖全屏的三角形, 配合 vertices_t({2}) 使用 draw_array 绘制
+             * 
+             */
+            static std::string vs_fullscreen(){
+                return std::string(R"(
+#version 330 core
+layout (location = 0) in vec2 aPos;
+
+void main()
+{
+    gl_Position = vec4(aPos, 0.0, 1.0);
+}
+                )");
+            }
+            /**
+             * @brief GPU驱动绘制(GpuCuller), 输出同 vs_fragpos_normal_texcoord; 实例号来自剔除阶段写入的可见列表,
+             * 每个实例的 model 与法线矩阵按列存放在纹理缓冲中, 占8个texel
+             *
+             */
+            static std::string vs_gpu_driven(){
+                return std::string(R"(
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoord;
+layout (location = 3) in uint aInstance;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoord;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform samplerBuffer instance_data;
+
+void main()
+{
+    int base = int(aInstance) * 8;
+    mat4 model = mat4(texelFetch(instance_data, base), texelFetch(instance_data, base + 1),
+                      texelFetch(instance_data, base + 2), texelFetch(instance_data, base + 3));
+    mat3 normal_matrix = mat3(texelFetch(instance_data, base + 4).xyz, texelFetch(instance_data, base + 5).xyz,
+                              texelFetch(instance_data, base + 6).xyz);
+    FragPos = vec3(model * vec4(aPos, 1.0));
+    Normal = normal_matrix * aNormal;
+    TexCoord = aTexCoord;
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
+                )");
+            }
+            /**
+             * @brief GpuCuller 的剔除阶段, 每个实例一个线程: 视锥与层次深度测试包围球, 按距离选择LOD,
+             * 通过则追加到对应绘制命令的实例区间
+             *
+             */
+            static std::string cs_gpu_cull(){
+                return std::string(R"(
+#version 430
+layout (local_size_x = 64) in;
+
+struct Mesh {
+    // 局部空间包围球
+    vec4 sphere;
+    // 各级LOD的起始距离
+    vec4 lod_distance;
+    // x 第一条绘制命令, y LOD级数
+    uvec4 lod;
+};
+struct DrawCommand {
+    uint count;
+    uint instance_count;
+    uint first_index;
+    int base_vertex;
+    uint base_instance;
+};
+
+layout (std430, binding = 0) readonly buffer Instances { vec4 instance_data[]; };
+layout (std430, binding = 1) readonly buffer Meshes { Mesh meshes[]; };
+layout (std430, binding = 2) buffer Commands { DrawCommand commands[]; };
+layout (std430, binding = 3) writeonly buffer Visible { uint visible[]; };
+layout (std430, binding = 5) buffer Params { uint draw_count; uint frustum_culled; uint occluded; uint padding; };
+
+uniform int instance_num;
+uniform vec4 frustum[6];
+uniform vec3 camera_pos;
+// 层次深度的级数, 0表示不做遮挡测试
+uniform int hiz_levels;
+uniform vec2 hiz_size;
+uniform mat4 hiz_view_projection;
+uniform sampler2D hiz;
+
+bool Occluded(vec3 center, float radius)
+{
+    vec2 uv_min = vec2(1.0);
+    vec2 uv_max = vec2(0.0);
+    float z_min = 1.0;
+    for(int i = 0; i < 8; i++){
+        vec3 corner = center + radius * vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = hiz_view_projection * vec4(corner, 1.0);
+        // 跨过近平面时得不到屏幕范围, 视为可见
+        if(clip.w <= 1e-4)
+            return false;
+        vec3 ndc = clip.xyz / clip.w;
+        uv_min = min(uv_min, ndc.xy * 0.5 + 0.5);
+        uv_max = max(uv_max, ndc.xy * 0.5 + 0.5);
+        z_min = min(z_min, ndc.z * 0.5 + 0.5);
+    }
+    uv_min = clamp(uv_min, 0.0, 1.0);
+    uv_max = clamp(uv_max, 0.0, 1.0);
+    // 选择使包围矩形最多覆盖 2x2 个texel的级别
+    vec2 extent = (uv_max - uv_min) * hiz_size;
+    int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, hiz_levels - 1);
+    ivec2 size = textureSize(hiz, level);
+    ivec2 p0 = clamp(ivec2(uv_min * vec2(size)), ivec2(0), size - 1);
+    ivec2 p1 = clamp(ivec2(uv_max * vec2(size)), ivec2(0), size - 1);
+    float depth = max(max(texelFetch(hiz, p0, level).r, texelFetch(hiz, ivec2(p1.x, p0.y), level).r),
+                      max(texelFetch(hiz, ivec2(p0.x, p1.y), level).r, texelFetch(hiz, p1, level).r));
+    return z_min > depth;
+}
+
+void main()
+{
+    uint id = gl_GlobalInvocationID.x;
+    if(id >= uint(instance_num))
+        return;
+    uint base = id * 8u;
+    uvec4 info = floatBitsToUint(instance_data[base + 7u]);
+    if(info.y == 0u)
+        return;
+    Mesh mesh = meshes[info.x];
+    mat4 model = mat4(instance_data[base], instance_data[base + 1u], instance_data[base + 2u], instance_data[base + 3u]);
+    vec3 center = vec3(model * vec4(mesh.sphere.xyz, 1.0));
+    float scale = sqrt(max(max(dot(model[0].xyz, model[0].xyz), dot(model[1].xyz, model[1].xyz)), dot(model[2].xyz, model[2].xyz)));
+    float radius = mesh.sphere.w * scale;
+    for(int i = 0; i < 6; i++){
+        if(dot(frustum[i].xyz, center) + frustum[i].w < -radius){
+            atomicAdd(frustum_culled, 1u);
+            return;
+        }
+    }
+    if(hiz_levels > 0 && Occluded(center, radius)){
+        atomicAdd(occluded, 1u);
+        return;
+    }
+    float dist = distance(center, camera_pos);
+    uint lod = 0u;
+    for(uint i = 1u; i < mesh.lod.y; i++)
+        if(dist >= mesh.lod_distance[i])
+            lod = i;
+    uint cmd = mesh.lod.x + lod;
+    uint slot = atomicAdd(commands[cmd].instance_count, 1u);
+    visible[commands[cmd].base_instance + slot] = id;
+}
+                )");
+            }
+            /**
+             * @brief GpuCuller 的压缩阶段, 把实例数不为0的绘制命令连续写出, 数量写入 draw_count
+             *
+             */
+            static std::string cs_draw_compact(){
+                return std::string(R"(
+#version 430
+layout (local_size_x = 64) in;
+
+struct DrawCommand {
+    uint count;
+    uint instance_count;
+    uint first_index;
+    int base_vertex;
+    uint base_instance;
+};
+
+layout (std430, binding = 2) readonly buffer Commands { DrawCommand commands[]; };
+layout (std430, binding = 4) writeonly buffer Compacted { DrawCommand compacted[]; };
+layout (std430, binding = 5) buffer Params { uint draw_count; uint frustum_culled; uint occluded; uint padding; };
+
+uniform int command_num;
+
+void main()
+{
+    uint id = gl_GlobalInvocationID.x;
+    if(id >= uint(command_num) || commands[id].instance_count == 0u)
+        return;
+    compacted[atomicAdd(draw_count, 1u)] = commands[id];
+}
+                )");
+            }
+            /**
+             * @brief 层次深度的一级: 每个texel取上一级(或深度缓冲) 2x2 中的最大(最远)深度,
+             * 上一级尺寸为奇数时最后一行/列多取一个, 保证结果保守
+             *
+             */
+            static std::string cs_hiz_downsample(){
+                return std::string(R"(
+#version 430
+layout (local_size_x = 8, local_size_y = 8) in;
+
+uniform sampler2D src;
+uniform int src_level;
+layout (r32f, binding = 0) writeonly uniform image2D dst;
+
+void main()
+{
+    ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 dst_size = imageSize(dst);
+    if(any(greaterThanEqual(p, dst_size)))
+        return;
+    ivec2 src_size = textureSize(src, src_level);
+    ivec2 first = p * 2;
+    ivec2 last = first + 1;
+    if(p.x == dst_size.x - 1 && (src_size.x & 1) != 0) last.x += 1;
+    if(p.y == dst_size.y - 1 && (src_size.y & 1) != 0) last.y += 1;
+    last = min(last, src_size - 1);
+    float depth = 0.0;
+    for(int y = first.y; y <= last.y; y++)
+        for(int x = first.x; x <= last.x; x++)
+            depth = max(depth, texelFetch(src, ivec2(x, y), src_level).r);
+    imageStore(dst, p, vec4(depth));
+}
+                )");
+            }
+            /**
+             * @brief 包围盒, 单位立方体 [0,1]^3 的顶点按 box_min/box_max 映射到局部空间
+             *
+             */
+            static std::string vs_bounding_box(){
+                return std::string(R"(
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 box_min;
+uniform vec3 box_max;
+
+void main()
+{
+    gl_Position = projection * view * model * vec4(mix(box_min, box_max, aPos), 1.0);
+}
+                )");
+            }
+            /**
+             * @brief 不输出颜色, 用于只写深度或遮挡查询
+             *
+             */
+            static std::string fs_empty(){
+                return std::string(R"(
+#version 330 core
+
+void main()
+{
+}
+                )");
+            }
+            /**
+             * @brief 延迟渲染的光照阶段, 从G-buffer重建位置后全屏计算光照
+             * @param dir_light_max 平行光数量上限
+             * @param clustered 是否通过 LightCluster 遍历点光源与聚光(按屏幕网格分块)
+             */
+            static std::string fs_deferred_lighting(uint32_t dir_light_max, bool clustered){
+                return std::string("#version 330 core\n")+
+                    "#define DIR_LIGHT_MAX "+std::to_string(dir_light_max)+"\n"+
+                    "#define CLUSTERED_LIGHTS "+(clustered ? "1" : "0")+"\n"+
+                    std::string(R"(
+out vec4 frag_col;
+
+uniform sampler2D g_normal;
+uniform sampler2D g_albedo_spec;
+uniform sampler2D g_depth;
+
+uniform mat4 inv_projection;
+uniform mat4 inv_view;
+uniform vec2 screen_size;
+uniform vec3 viewPos;
+
+// 本像素材质的高光指数, 由 G-buffer 读出
+float shininess;
+
+float CalcSpecular(vec3 lightDir, vec3 normal, vec3 viewDir)
+{
+    vec3 reflectDir = reflect(-lightDir, normal);
+    return pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+}
+
+vec3 OctDecode(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+#if DIR_LIGHT_MAX > 0
+struct DirLight {
+    vec3 direction;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};  
+uniform DirLight lights_dir[DIR_LIGHT_MAX];
+uniform int dir_light_num;
+
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 albedo, vec3 spec_col)
+{
+    vec3 lightDir = normalize(-light.direction);
+    float diff = max(dot(normal, lightDir), 0.0);
+    return light.ambient * albedo + light.diffuse * diff * albedo +
+        light.specular * CalcSpecular(lightDir, normal, viewDir) * spec_col;
+}
+#endif
+
+#if CLUSTERED_LIGHTS
+uniform usamplerBuffer cluster_grid;
+uniform usamplerBuffer cluster_items;
+uniform samplerBuffer cluster_lights;
+uniform vec3 cluster_dim;
+uniform vec4 cluster_scale;
+
+vec3 CalcClusterLight(int idx, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 spec_col)
+{
+    vec4 t0 = texelFetch(cluster_lights, idx*5);
+    vec4 t1 = texelFetch(cluster_lights, idx*5 + 1);
+    vec4 t2 = texelFetch(cluster_lights, idx*5 + 2);
+    vec4 t3 = texelFetch(cluster_lights, idx*5 + 3);
+    vec4 t4 = texelFetch(cluster_lights, idx*5 + 4);
+    vec3 lightDir = normalize(t0.xyz - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+    float distance = length(t0.xyz - fragPos);
+    float attenuation = 1.0 / (t1.w + t2.w * distance + t3.w * (distance * distance));
+    float theta = dot(lightDir, normalize(-t4.xyz));
+    float intensity = clamp((theta - t0.w) / (t4.w - t0.w), 0.0, 1.0);
+    vec3 result = t1.rgb * albedo + t2.rgb * diff * albedo +
+        t3.rgb * CalcSpecular(lightDir, normal, viewDir) * spec_col;
+    return result * attenuation * intensity;
+}
+#endif
+
+void main()
+{
+    vec2 uv = gl_FragCoord.xy / screen_size;
+    float depth = texture(g_depth, uv).r;
+    // 背景保留清屏颜色
+    if(depth >= 1.0)
+        discard;
+    vec4 view_pos = inv_projection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    view_pos /= view_pos.w;
+    vec3 FragPos = vec3(inv_view * view_pos);
+
+    vec4 normal_shininess = texture(g_normal, uv);
+    vec3 norm = OctDecode(normal_shininess.xy);
+    shininess = exp2(normal_shininess.z * 10.0);
+    vec4 albedo_spec = texture(g_albedo_spec, uv);
+    vec3 albedo = albedo_spec.rgb;
+    vec3 spec_col = vec3(albedo_spec.a);
+    vec3 viewDir = normalize(viewPos - FragPos);
+
+    vec3 result = vec3(0, 0, 0);
+#if DIR_LIGHT_MAX > 0
+    for(int i = 0; i < min(DIR_LIGHT_MAX, dir_light_num); i++)
+        result += CalcDirLight(lights_dir[i], norm, viewDir, albedo, spec_col);
+#endif
+#if CLUSTERED_LIGHTS
+    ivec3 cell = ivec3(gl_FragCoord.xy * cluster_scale.xy, log(max(-view_pos.z, 1e-4)) * cluster_scale.z + cluster_scale.w);
+    cell = clamp(cell, ivec3(0), ivec3(cluster_dim) - 1);
+    int cluster_id = cell.x + int(cluster_dim.x) * (cell.y + int(cluster_dim.y) * cell.z);
+    uvec2 range = texelFetch(cluster_grid, cluster_id).xy;
+    for(uint i = 0u; i < range.y; i++)
+        result += CalcClusterLight(int(texelFetch(cluster_items, int(range.x + i)).x), norm, FragPos, viewDir, albedo, spec_col);
+#endif
+    frag_col = vec4(result, 1.0);
+}
+                )");
+            }
         };
     }
 }
\ No newline at end of file
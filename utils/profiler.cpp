@@ -0,0 +1,287 @@
+#include "utils/profiler.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <glad/glad.h>
+#include "imgui.h"
+#include "utils/debug.hpp"
+
+using namespace Ez3DGL;
+
+bool profiler::show_overlay = false;
+
+namespace {
+
+struct pending_query_t{
+    unsigned int query;
+    uint64_t frame;
+    size_t record;
+};
+
+struct profiler_state_t{
+    std::mutex mutex;
+    std::atomic<bool> enabled{true};
+    profiler::frame_t current;
+    profiler::frame_t ring[profiler::frame_ring_size];
+    // 已结束的帧数
+    uint64_t frame_cnt = 0;
+
+    std::vector<unsigned int> query_pool;
+    std::vector<pending_query_t> pending;
+    bool gpu_active = false;
+
+    std::atomic<uint32_t> thread_cnt{0};
+};
+
+profiler_state_t& state(){
+    static profiler_state_t s;
+    return s;
+}
+
+thread_local uint32_t thread_index = UINT32_MAX;
+thread_local uint32_t thread_depth = 0;
+
+const auto start_time = std::chrono::steady_clock::now();
+
+uint32_t current_thread(){
+    if(thread_index == UINT32_MAX)
+        thread_index = state().thread_cnt.fetch_add(1);
+    return thread_index;
+}
+
+void resolve_queries(profiler_state_t& s, bool force){
+    for(size_t i=0; i<s.pending.size();){
+        auto& p = s.pending[i];
+        if(!force && s.current.index - p.frame < profiler::gpu_query_latency){
+            i++;
+            continue;
+        }
+        GLint available = 0;
+        glGetQueryObjectiv(p.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available){
+            i++;
+            continue;
+        }
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(p.query, GL_QUERY_RESULT, &elapsed);
+        auto& frame = s.ring[p.frame % profiler::frame_ring_size];
+        // 过旧的帧已被覆盖, 丢弃结果
+        if(frame.index == p.frame && p.record < frame.gpu.size()){
+            frame.gpu[p.record].elapsed_ns = elapsed;
+            frame.gpu[p.record].resolved = true;
+        }
+        s.query_pool.push_back(p.query);
+        p = s.pending.back();
+        s.pending.pop_back();
+    }
+}
+
+}
+
+uint64_t profiler::now_ns(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+void profiler::set_enabled(bool enabled){
+    state().enabled = enabled;
+}
+
+bool profiler::enabled(){
+    return state().enabled;
+}
+
+void profiler::begin_frame(){
+    auto& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.current.beg_ns = now_ns();
+    if(!s.pending.empty())
+        resolve_queries(s, false);
+}
+
+void profiler::end_frame(){
+    auto& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.current.end_ns = now_ns();
+    const auto index = s.current.index;
+    s.ring[index % frame_ring_size] = std::move(s.current);
+    s.current = frame_t();
+    s.current.index = index + 1;
+    s.frame_cnt = index + 1;
+}
+
+const profiler::frame_t* profiler::last_frame(){
+    auto& s = state();
+    if(s.frame_cnt == 0) return nullptr;
+    return &s.ring[(s.frame_cnt - 1) % frame_ring_size];
+}
+
+std::vector<const profiler::frame_t*> profiler::frames(){
+    auto& s = state();
+    std::vector<const frame_t*> res;
+    const uint64_t n = std::min<uint64_t>(s.frame_cnt, frame_ring_size);
+    for(uint64_t i=s.frame_cnt-n; i<s.frame_cnt; i++)
+        res.push_back(&s.ring[i % frame_ring_size]);
+    return res;
+}
+
+profiler::cpu_scope_t::cpu_scope_t(const char* name):name(name){
+    active = state().enabled;
+    if(!active) return;
+    beg_ns = now_ns();
+    thread_depth += 1;
+}
+
+profiler::cpu_scope_t::~cpu_scope_t(){
+    if(!active) return;
+    const auto end_ns = now_ns();
+    thread_depth -= 1;
+    auto& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.current.cpu.push_back(cpu_record_t{name, beg_ns, end_ns, current_thread(), thread_depth});
+}
+
+profiler::gpu_scope_t::gpu_scope_t(const char* name):cpu(name){
+    auto& s = state();
+    active = s.enabled && !s.gpu_active;
+    if(!active) return;
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.gpu_active = true;
+    unsigned int query;
+    if(s.query_pool.empty()){
+        glGenQueries(1, &query);
+    }else{
+        query = s.query_pool.back();
+        s.query_pool.pop_back();
+    }
+    s.pending.push_back(pending_query_t{query, s.current.index, s.current.gpu.size()});
+    s.current.gpu.push_back(gpu_record_t{name, now_ns(), 0, false});
+    glBeginQuery(GL_TIME_ELAPSED, query);
+}
+
+profiler::gpu_scope_t::~gpu_scope_t(){
+    if(!active) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    state().gpu_active = false;
+}
+
+namespace {
+
+struct scope_sum_t{
+    const char* name;
+    uint32_t depth;
+    uint32_t cnt;
+    double ms;
+};
+
+void accumulate(std::vector<scope_sum_t>& sums, const char* name, uint32_t depth, double ms){
+    for(auto& sum: sums)
+        if(sum.depth == depth && strcmp(sum.name, name) == 0){
+            sum.cnt += 1;
+            sum.ms += ms;
+            return;
+        }
+    sums.push_back(scope_sum_t{name, depth, 1, ms});
+}
+
+}
+
+void profiler::draw_imgui(){
+    const auto all = frames();
+    if(all.empty()) return;
+
+    float frame_ms[frame_ring_size];
+    for(size_t i=0; i<all.size(); i++)
+        frame_ms[i] = (all[i]->end_ns - all[i]->beg_ns) / 1e6f;
+    // 选取GPU结果已全部返回的最新一帧
+    const frame_t* frame = all.front();
+    for(auto it=all.rbegin(); it!=all.rend(); ++it)
+        if(std::all_of((*it)->gpu.begin(), (*it)->gpu.end(), [](const gpu_record_t& r){return r.resolved;})){
+            frame = *it;
+            break;
+        }
+
+    ImGui::SetNextWindowBgAlpha(0.75f);
+    ImGui::Begin("Profiler", &show_overlay, ImGuiWindowFlags_AlwaysAutoResize);
+    ImGui::PlotLines("frame ms", frame_ms, static_cast<int>(all.size()), 0, nullptr, 0.f, FLT_MAX, ImVec2(240, 60));
+    ImGui::Text("frame %llu  %.3f ms", (unsigned long long)frame->index, (frame->end_ns - frame->beg_ns) / 1e6);
+
+    std::vector<scope_sum_t> sums;
+    // 记录按结束顺序存储, 按开始时间排序后父作用域在前
+    auto cpu = frame->cpu;
+    std::sort(cpu.begin(), cpu.end(), [](const cpu_record_t& a, const cpu_record_t& b){return a.beg_ns < b.beg_ns;});
+    for(const auto& r: cpu)
+        if(r.thread == 0)
+            accumulate(sums, r.name, r.depth, (r.end_ns - r.beg_ns) / 1e6);
+    ImGui::Separator();
+    ImGui::Text("CPU (main thread)");
+    for(const auto& sum: sums)
+        ImGui::Text("%*s%s x%u  %.3f ms", int(sum.depth*2), "", sum.name, sum.cnt, sum.ms);
+
+    sums.clear();
+    for(const auto& r: frame->gpu)
+        accumulate(sums, r.name, 0, r.elapsed_ns / 1e6);
+    ImGui::Separator();
+    ImGui::Text("GPU");
+    for(const auto& sum: sums)
+        ImGui::Text("%s x%u  %.3f ms", sum.name, sum.cnt, sum.ms);
+
+    ImGui::Separator();
+    bool enable = enabled();
+    if(ImGui::Checkbox("enable", &enable))
+        set_enabled(enable);
+    ImGui::SameLine();
+    if(ImGui::Button("export trace"))
+        export_chrome_trace("ez3dgl_trace.json");
+    ImGui::End();
+}
+
+static void write_json_string(FILE* fp, const char* str){
+    fputc('"', fp);
+    for(; *str; str++){
+        if(*str == '"' || *str == '\\') fputc('\\', fp);
+        fputc(*str, fp);
+    }
+    fputc('"', fp);
+}
+
+bool profiler::export_chrome_trace(const char* path){
+    FILE* fp = fopen(path, "w");
+    if(fp == nullptr){
+        log_with_info("fail to open trace file %s", path);
+        return false;
+    }
+    // GPU事件放在单独的轨道上
+    const uint32_t gpu_tid = 1000;
+    bool first = true;
+    auto sep = [&](){ if(!first) fputs(",\n", fp); first = false; };
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", fp);
+    for(const auto frame: frames()){
+        sep();
+        fprintf(fp, "{\"name\":\"frame %llu\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f}",
+            (unsigned long long)frame->index, frame->beg_ns / 1e3, (frame->end_ns - frame->beg_ns) / 1e3);
+        for(const auto& r: frame->cpu){
+            sep();
+            fputs("{\"name\":", fp);
+            write_json_string(fp, r.name);
+            fprintf(fp, ",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                r.thread, r.beg_ns / 1e3, (r.end_ns - r.beg_ns) / 1e3);
+        }
+        for(const auto& r: frame->gpu){
+            if(!r.resolved) continue;
+            sep();
+            fputs("{\"name\":", fp);
+            write_json_string(fp, r.name);
+            fprintf(fp, ",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                gpu_tid, r.beg_ns / 1e3, r.elapsed_ns / 1e3);
+        }
+    }
+    sep();
+    fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"GPU\"}}\n", gpu_tid);
+    fputs("]}\n", fp);
+    fclose(fp);
+    return true;
+}
@@ -0,0 +1,117 @@
+/**
+ * @file profiler.hpp
+ * @brief 帧性能分析: CPU作用域计时, GL计时查询, ImGui面板与Chrome trace导出
+ * @note 定义 EZ3DGL_PROFILE 后 profile_scope/profile_gpu_scope 才会生效, 否则展开为空语句
+ *
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Ez3DGL {
+namespace profiler {
+
+    // 保留最近多少帧的结果
+    constexpr size_t frame_ring_size = 16;
+    // GL计时查询延迟多少帧再读取, 保证不会等待GPU
+    constexpr uint64_t gpu_query_latency = 3;
+
+    struct cpu_record_t{
+        const char* name;
+        // 相对分析器启动的时间(纳秒)
+        uint64_t beg_ns, end_ns;
+        uint32_t thread;
+        uint32_t depth;
+    };
+
+    struct gpu_record_t{
+        const char* name;
+        // 发起查询时的CPU时间, 用于在trace中对齐
+        uint64_t beg_ns;
+        // GPU耗时, 查询结果返回前为0
+        uint64_t elapsed_ns;
+        bool resolved;
+    };
+
+    struct frame_t{
+        uint64_t index = 0;
+        uint64_t beg_ns = 0, end_ns = 0;
+        std::vector<cpu_record_t> cpu;
+        std::vector<gpu_record_t> gpu;
+    };
+
+    /**
+     * @brief 帧边界, 由 window_loop 调用
+     */
+    void begin_frame();
+    void end_frame();
+
+    /**
+     * @brief 运行时开关, 关闭后作用域不再记录
+     */
+    void set_enabled(bool enabled);
+    bool enabled();
+
+    uint64_t now_ns();
+
+    /**
+     * @brief 最近一个已结束的帧, 其GPU结果可能尚未返回
+     */
+    const frame_t* last_frame();
+    /**
+     * @brief 按时间从旧到新返回环形缓冲中已结束的帧
+     */
+    std::vector<const frame_t*> frames();
+
+    /**
+     * @brief 绘制ImGui性能面板, 需在 ImGui::NewFrame 与 ImGui::Render 之间调用
+     */
+    void draw_imgui();
+    // 是否在 window_loop 中绘制性能面板
+    extern bool show_overlay;
+
+    /**
+     * @brief 导出环形缓冲中的所有帧为 Chrome trace JSON (chrome://tracing, Perfetto)
+     */
+    bool export_chrome_trace(const char* path);
+
+    class cpu_scope_t{
+    public:
+        explicit cpu_scope_t(const char* name);
+        ~cpu_scope_t();
+    private:
+        const char* name;
+        uint64_t beg_ns;
+        bool active;
+    };
+
+    /**
+     * @brief GL_TIME_ELAPSED 查询作用域, 同时记录CPU时间
+     * @note GL计时查询不能嵌套, 嵌套的GPU作用域只记录CPU时间
+     */
+    class gpu_scope_t{
+    public:
+        explicit gpu_scope_t(const char* name);
+        ~gpu_scope_t();
+    private:
+        cpu_scope_t cpu;
+        bool active;
+    };
+
+}
+}
+
+#define profile_concat_(a, b) a##b
+#define profile_concat(a, b) profile_concat_(a, b)
+
+#ifdef EZ3DGL_PROFILE
+#define profile_scope(NAME) \
+    Ez3DGL::profiler::cpu_scope_t profile_concat(_profile_scope_, __LINE__)(NAME)
+#define profile_gpu_scope(NAME) \
+    Ez3DGL::profiler::gpu_scope_t profile_concat(_profile_scope_, __LINE__)(NAME)
+#else
+#define profile_scope(NAME) do{}while(0)
+#define profile_gpu_scope(NAME) do{}while(0)
+#endif
@@ -0,0 +1,78 @@
+#include "utils/rect_packer.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include "utils/debug.hpp"
+
+using namespace Ez3DGL;
+
+rect_packer_t::rect_packer_t(int width, int height): width(width), height(height){
+    assert_with_info(width>0 && height>0, "invalid packer size %d*%d", width, height);
+    reset();
+}
+
+void rect_packer_t::reset(){
+    skyline.clear();
+    skyline.push_back(segment_t{0, 0, width});
+    used_area = 0;
+}
+
+int rect_packer_t::fit(size_t index, int w, int h) const{
+    const int x = skyline[index].x;
+    if(x + w > width) return -1;
+    int y = 0;
+    int remain = w;
+    for(size_t i=index; remain>0; i++){
+        y = std::max(y, skyline[i].y);
+        if(y + h > height) return -1;
+        remain -= skyline[i].w;
+    }
+    return y;
+}
+
+bool rect_packer_t::insert(int w, int h, int& x, int& y){
+    if(w <= 0 || h <= 0 || w > width || h > height) return false;
+    int best_y = INT_MAX, best_x = 0;
+    size_t best = skyline.size();
+    for(size_t i=0; i<skyline.size(); i++){
+        const int fy = fit(i, w, h);
+        if(fy >= 0 && fy < best_y){
+            best_y = fy;
+            best_x = skyline[i].x;
+            best = i;
+        }
+    }
+    if(best == skyline.size()) return false;
+
+    // 新段覆盖 [best_x, best_x+w), 裁掉其后被覆盖的部分
+    skyline.insert(skyline.begin() + best, segment_t{best_x, best_y + h, w});
+    const int right = best_x + w;
+    size_t i = best + 1;
+    while(i < skyline.size() && skyline[i].x < right){
+        const int seg_right = skyline[i].x + skyline[i].w;
+        if(seg_right <= right){
+            skyline.erase(skyline.begin() + i);
+            continue;
+        }
+        skyline[i].w = seg_right - right;
+        skyline[i].x = right;
+        break;
+    }
+    // 合并等高的相邻段
+    for(i=0; i+1<skyline.size();){
+        if(skyline[i].y == skyline[i+1].y){
+            skyline[i].w += skyline[i+1].w;
+            skyline.erase(skyline.begin() + i + 1);
+        }else{
+            i++;
+        }
+    }
+    used_area += (long long)w * h;
+    x = best_x;
+    y = best_y;
+    return true;
+}
+
+float rect_packer_t::occupancy() const{
+    return float(double(used_area) / (double(width) * height));
+}
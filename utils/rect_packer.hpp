@@ -0,0 +1,44 @@
+/**
+ * @file rect_packer.hpp
+ * @brief 矩形装箱(skyline 左下优先), 用于把小纹理打包进图集
+ *
+ */
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace Ez3DGL {
+
+/**
+ * @brief 在 width*height 的区域中依次放入矩形, 已放入的矩形不会移动
+ * @note 维护一条"天际线", 每个矩形放在使其顶边最低的位置, 顶边相同时取最靠左的位置
+ *
+ */
+class rect_packer_t{
+public:
+    rect_packer_t(int width, int height);
+    /**
+     * @brief 放入 w*h 的矩形
+     * @return 放不下时返回 false, x, y 不变
+     */
+    bool insert(int w, int h, int& x, int& y);
+    void reset();
+    // 已放入矩形的面积占比
+    float occupancy() const;
+
+    int width, height;
+private:
+    struct segment_t{
+        int x, y, w;
+    };
+    std::vector<segment_t> skyline;
+    long long used_area;
+
+    /**
+     * @brief 矩形左边与第 index 段对齐时的底边高度, 放不下时返回 -1
+     */
+    int fit(size_t index, int w, int h) const;
+};
+
+}
@@ -0,0 +1,174 @@
+#include "utils/render_stats.hpp"
+#include <algorithm>
+#include <cfloat>
+#include "imgui.h"
+#include "utils/debug.hpp"
+
+using namespace Ez3DGL;
+using render_stats::counter_t;
+using render_stats::counter_num;
+using render_stats::history_size;
+
+render_stats::frame_t render_stats::detail::current;
+bool render_stats::show_overlay = false;
+
+namespace {
+
+struct stats_state_t{
+    render_stats::frame_t history[history_size];
+    // 每帧超出预算的计数项, 按位记录
+    uint32_t over_budget[history_size] = {};
+    // 已结束的帧数
+    uint64_t frames = 0;
+    uint64_t budgets[counter_num] = {};
+    render_stats::alert_fn_t alert;
+};
+
+stats_state_t& state(){
+    static stats_state_t s;
+    return s;
+}
+
+const char* const counter_names[counter_num] = {
+    "draw calls",
+    "instances",
+    "triangles",
+    "vertices",
+    "program binds",
+    "VAO binds",
+    "texture binds",
+    "uniform calls",
+    "buffer upload bytes",
+    "texture upload bytes",
+    "shader compiles",
+};
+
+size_t history_num(const stats_state_t& s){
+    return size_t(std::min<uint64_t>(s.frames, history_size));
+}
+
+}
+
+void render_stats::end_frame(){
+    auto& s = state();
+    frame_t& frame = detail::current;
+    frame.index = s.frames;
+    const size_t slot = size_t(s.frames % history_size);
+    s.history[slot] = frame;
+    s.over_budget[slot] = 0;
+    s.frames += 1;
+    for(size_t i=0; i<counter_num; i++){
+        if(s.budgets[i] == 0 || frame.values[i] <= s.budgets[i])
+            continue;
+        s.over_budget[slot] |= 1u << i;
+        if(s.alert)
+            s.alert(frame, counter_t(i), s.budgets[i]);
+        else
+            log_warn("frame %llu: %s %llu over budget %llu", (unsigned long long)frame.index, counter_names[i],
+                (unsigned long long)frame.values[i], (unsigned long long)s.budgets[i]);
+    }
+    frame = frame_t();
+    frame.index = s.frames;
+}
+
+void render_stats::reset(){
+    auto& s = state();
+    s.frames = 0;
+    detail::current = frame_t();
+}
+
+const render_stats::frame_t& render_stats::current(){
+    return detail::current;
+}
+
+const render_stats::frame_t& render_stats::last_frame(){
+    static const frame_t empty;
+    const auto& s = state();
+    if(s.frames == 0) return empty;
+    return s.history[size_t((s.frames - 1) % history_size)];
+}
+
+render_stats::summary_t render_stats::summary(counter_t counter){
+    const auto& s = state();
+    const size_t num = history_num(s);
+    summary_t result;
+    if(num == 0) return result;
+    const size_t c = size_t(counter);
+    result.min = UINT64_MAX;
+    double sum = 0.;
+    for(size_t i=0; i<num; i++){
+        const uint64_t v = s.history[i].values[c];
+        result.min = std::min(result.min, v);
+        result.max = std::max(result.max, v);
+        sum += double(v);
+        if(s.over_budget[i] & (1u << c))
+            result.over_budget += 1;
+    }
+    result.avg = sum / double(num);
+    return result;
+}
+
+const char* render_stats::counter_name(counter_t counter){
+    assert_with_info(size_t(counter) < counter_num, "invalid counter %d", int(counter));
+    return counter_names[size_t(counter)];
+}
+
+void render_stats::set_budget(counter_t counter, uint64_t budget){
+    state().budgets[size_t(counter)] = budget;
+}
+
+uint64_t render_stats::budget(counter_t counter){
+    return state().budgets[size_t(counter)];
+}
+
+void render_stats::set_alert_callback(alert_fn_t fn){
+    state().alert = std::move(fn);
+}
+
+void render_stats::draw_imgui(){
+    const auto& s = state();
+    const size_t num = history_num(s);
+    if(num == 0) return;
+
+    // 按时间从旧到新排列的每帧draw call数
+    float draw_calls[history_size];
+    const uint64_t first = s.frames - num;
+    for(size_t i=0; i<num; i++)
+        draw_calls[i] = float(s.history[(first + i) % history_size][counter_t::draw_calls]);
+
+    const frame_t& last = last_frame();
+    ImGui::SetNextWindowBgAlpha(0.75f);
+    ImGui::Begin("Render stats", &show_overlay, ImGuiWindowFlags_AlwaysAutoResize);
+    ImGui::PlotLines("draw calls", draw_calls, int(num), 0, nullptr, 0.f, FLT_MAX, ImVec2(240, 60));
+    ImGui::Text("frame %llu, last %zu frames", (unsigned long long)last.index, num);
+    ImGui::Separator();
+    ImGui::Columns(6, "render_stats", false);
+    for(const char* title: {"", "last", "min", "avg", "max", "budget"}){
+        ImGui::Text("%s", title);
+        ImGui::NextColumn();
+    }
+    for(size_t i=0; i<counter_num; i++){
+        const auto sum = summary(counter_t(i));
+        const bool over = s.budgets[i] != 0 && last.values[i] > s.budgets[i];
+        if(over)
+            ImGui::TextColored(ImVec4(1.f, 0.3f, 0.3f, 1.f), "%s", counter_names[i]);
+        else
+            ImGui::Text("%s", counter_names[i]);
+        ImGui::NextColumn();
+        ImGui::Text("%llu", (unsigned long long)last.values[i]);
+        ImGui::NextColumn();
+        ImGui::Text("%llu", (unsigned long long)sum.min);
+        ImGui::NextColumn();
+        ImGui::Text("%.1f", sum.avg);
+        ImGui::NextColumn();
+        ImGui::Text("%llu", (unsigned long long)sum.max);
+        ImGui::NextColumn();
+        if(s.budgets[i] != 0)
+            ImGui::Text("%llu (%u over)", (unsigned long long)s.budgets[i], sum.over_budget);
+        else
+            ImGui::Text("-");
+        ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+    ImGui::End();
+}
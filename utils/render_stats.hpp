@@ -0,0 +1,117 @@
+/**
+ * @file render_stats.hpp
+ * @brief 每帧渲染统计: 在 vertices_t/shader_t/texture_t 等发出GL调用的地方计数, 按帧汇总并保留最近若干帧的最小/平均/最大值,
+ * 可设置每帧预算并在超出时报警
+ * @note 与 gl_backend 的统计不同, 始终开启且不需要安装分发层, 计数为普通整数加法; 只在GL线程上计数
+ *
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <glad/glad.h>
+
+namespace Ez3DGL {
+namespace render_stats {
+
+    enum class counter_t: uint8_t{
+        draw_calls,
+        instances,
+        triangles,
+        vertices,
+        program_binds,
+        vao_binds,
+        texture_binds,
+        uniform_calls,
+        // 顶点/索引/纹理缓冲等缓冲对象上传的字节数
+        buffer_upload_bytes,
+        texture_upload_bytes,
+        // 编译的着色器阶段数
+        shader_compiles,
+        count
+    };
+    constexpr size_t counter_num = size_t(counter_t::count);
+    // 保留最近多少帧用于计算最小/平均/最大值
+    constexpr size_t history_size = 120;
+
+    struct frame_t{
+        uint64_t index = 0;
+        uint64_t values[counter_num] = {};
+
+        uint64_t operator[](counter_t counter) const{
+            return values[size_t(counter)];
+        }
+    };
+
+    struct summary_t{
+        uint64_t min = 0;
+        uint64_t max = 0;
+        double avg = 0.;
+        // 窗口内超出预算的帧数
+        uint32_t over_budget = 0;
+    };
+
+    namespace detail {
+        extern frame_t current;
+    }
+
+    inline void add(counter_t counter, uint64_t value=1){
+        detail::current.values[size_t(counter)] += value;
+    }
+
+    /**
+     * @brief 记录一次绘制, 按图元类型把顶点数换算为三角形数
+     * @param vertices 每个实例的顶点(索引)数
+     */
+    inline void add_draw(GLenum mode, uint64_t vertices, uint64_t instances=1){
+        uint64_t triangles = 0;
+        if(mode == GL_TRIANGLES)
+            triangles = vertices / 3;
+        else if((mode == GL_TRIANGLE_STRIP || mode == GL_TRIANGLE_FAN) && vertices >= 3)
+            triangles = vertices - 2;
+        uint64_t* values = detail::current.values;
+        values[size_t(counter_t::draw_calls)] += 1;
+        values[size_t(counter_t::instances)] += instances;
+        values[size_t(counter_t::vertices)] += vertices * instances;
+        values[size_t(counter_t::triangles)] += triangles * instances;
+    }
+
+    /**
+     * @brief 结束当前帧, 存入历史并检查预算, 由 window_loop 调用
+     */
+    void end_frame();
+    void reset();
+
+    // 正在累计的帧
+    const frame_t& current();
+    /**
+     * @brief 最近一个已结束的帧, 还没有结束的帧时全为0
+     */
+    const frame_t& last_frame();
+    /**
+     * @brief 最近 history_size 个已结束帧的统计
+     */
+    summary_t summary(counter_t counter);
+    const char* counter_name(counter_t counter);
+
+    using alert_fn_t = std::function<void(const frame_t& frame, counter_t counter, uint64_t budget)>;
+    /**
+     * @brief 设置每帧预算, 0表示不限制
+     */
+    void set_budget(counter_t counter, uint64_t budget);
+    uint64_t budget(counter_t counter);
+    /**
+     * @brief 帧结束时某项超出预算则调用, 默认输出警告日志
+     */
+    void set_alert_callback(alert_fn_t fn);
+
+    /**
+     * @brief 绘制ImGui统计面板, 需在 ImGui::NewFrame 与 ImGui::Render 之间调用
+     */
+    void draw_imgui();
+    // 是否在 window_loop 中绘制统计面板
+    extern bool show_overlay;
+
+}
+}
@@ -0,0 +1,826 @@
+#include "utils/texture_codec.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "utils/debug.hpp"
+#include "utils/job_system.hpp"
+
+using namespace Ez3DGL;
+using texture_codec::format_t;
+
+namespace {
+
+/*
+ * 通用: 主轴与端点拟合
+ */
+
+// 16个像素在前 n 个通道上的主轴(协方差矩阵的最大特征向量, 幂迭代)
+void principal_axis(const float (*px)[4], int n, float mean[4], float axis[4]){
+    for(int c=0; c<4; c++) mean[c] = 0;
+    for(int i=0; i<16; i++)
+        for(int c=0; c<n; c++) mean[c] += px[i][c] / 16.f;
+    float cov[4][4] = {};
+    for(int i=0; i<16; i++)
+        for(int a=0; a<n; a++)
+            for(int b=0; b<n; b++)
+                cov[a][b] += (px[i][a] - mean[a]) * (px[i][b] - mean[b]);
+    // 以范围最大的方向为初值
+    float lo[4] = {FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX}, hi[4] = {-FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for(int i=0; i<16; i++)
+        for(int c=0; c<n; c++){
+            lo[c] = std::min(lo[c], px[i][c]);
+            hi[c] = std::max(hi[c], px[i][c]);
+        }
+    for(int c=0; c<4; c++) axis[c] = c < n ? hi[c] - lo[c] : 0;
+    for(int iter=0; iter<8; iter++){
+        float next[4] = {};
+        for(int a=0; a<n; a++)
+            for(int b=0; b<n; b++) next[a] += cov[a][b] * axis[b];
+        float len = 0;
+        for(int c=0; c<n; c++) len = std::max(len, std::fabs(next[c]));
+        if(len < 1e-6f) break;
+        for(int c=0; c<n; c++) axis[c] = next[c] / len;
+    }
+}
+
+// 按索引对应的权重(0..1)最小二乘求解两个端点, 权重退化时返回 false
+bool least_squares_endpoints(const float (*px)[4], int n, const float* weights, float e0[4], float e1[4]){
+    float aa = 0, ab = 0, bb = 0;
+    float ax[4] = {}, bx[4] = {};
+    for(int i=0; i<16; i++){
+        const float b = weights[i], a = 1.f - b;
+        aa += a * a; ab += a * b; bb += b * b;
+        for(int c=0; c<n; c++){
+            ax[c] += a * px[i][c];
+            bx[c] += b * px[i][c];
+        }
+    }
+    const float det = aa * bb - ab * ab;
+    if(std::fabs(det) < 1e-6f) return false;
+    for(int c=0; c<n; c++){
+        e0[c] = std::clamp((bb * ax[c] - ab * bx[c]) / det, 0.f, 255.f);
+        e1[c] = std::clamp((aa * bx[c] - ab * ax[c]) / det, 0.f, 255.f);
+    }
+    return true;
+}
+
+void load_block(const uint8_t* rgba, float px[16][4]){
+    for(int i=0; i<16; i++)
+        for(int c=0; c<4; c++) px[i][c] = rgba[i * 4 + c];
+}
+
+/*
+ * BC1 颜色块
+ */
+
+uint16_t pack565(const float c[3]){
+    const int r = int(std::lround(std::clamp(c[0], 0.f, 255.f) * 31.f / 255.f));
+    const int g = int(std::lround(std::clamp(c[1], 0.f, 255.f) * 63.f / 255.f));
+    const int b = int(std::lround(std::clamp(c[2], 0.f, 255.f) * 31.f / 255.f));
+    return uint16_t(r << 11 | g << 5 | b);
+}
+
+void unpack565(uint16_t c, int out[3]){
+    const int r = c >> 11 & 31, g = c >> 5 & 63, b = c & 31;
+    out[0] = r << 3 | r >> 2;
+    out[1] = g << 2 | g >> 4;
+    out[2] = b << 3 | b >> 2;
+}
+
+// four_color 为假且 c0<=c1 时为三色模式(第4色透明黑), BC3 中总是四色
+void bc1_palette(uint16_t c0, uint16_t c1, bool four_color, int palette[4][4]){
+    unpack565(c0, palette[0]);
+    unpack565(c1, palette[1]);
+    palette[0][3] = palette[1][3] = 255;
+    if(four_color || c0 > c1){
+        for(int c=0; c<3; c++){
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        palette[2][3] = palette[3][3] = 255;
+    }else{
+        for(int c=0; c<3; c++){
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+        palette[2][3] = 255;
+        palette[3][3] = 0;
+    }
+}
+
+// 为每个像素选最近的颜色, 返回总误差
+int bc1_indices(const float px[16][4], const int palette[4][4], uint8_t indices[16]){
+    int total = 0;
+    for(int i=0; i<16; i++){
+        int best = INT32_MAX;
+        for(int k=0; k<4; k++){
+            int err = 0;
+            for(int c=0; c<3; c++){
+                const int d = int(px[i][c]) - palette[k][c];
+                err += d * d;
+            }
+            if(err < best){
+                best = err;
+                indices[i] = uint8_t(k);
+            }
+        }
+        total += best;
+    }
+    return total;
+}
+
+void encode_bc1(const uint8_t* rgba, uint8_t* block){
+    float px[16][4];
+    load_block(rgba, px);
+    float mean[4], axis[4];
+    principal_axis(px, 3, mean, axis);
+    float tmin = FLT_MAX, tmax = -FLT_MAX;
+    for(int i=0; i<16; i++){
+        const float t = (px[i][0] - mean[0]) * axis[0] + (px[i][1] - mean[1]) * axis[1] + (px[i][2] - mean[2]) * axis[2];
+        tmin = std::min(tmin, t);
+        tmax = std::max(tmax, t);
+    }
+    float axis_len2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    if(axis_len2 < 1e-12f) axis_len2 = 1.f;
+    float e0[4], e1[4];
+    for(int c=0; c<3; c++){
+        e0[c] = mean[c] + axis[c] * tmax / axis_len2;
+        e1[c] = mean[c] + axis[c] * tmin / axis_len2;
+    }
+
+    uint16_t best_c0 = 0, best_c1 = 0;
+    uint8_t best_indices[16] = {};
+    int best_err = INT32_MAX;
+    // 端点取自主轴两端, 再按所选索引最小二乘细化两次
+    for(int iter=0; iter<3; iter++){
+        uint16_t c0 = pack565(e0), c1 = pack565(e1);
+        if(c0 < c1) std::swap(c0, c1);
+        int palette[4][4];
+        bc1_palette(c0, c1, true, palette);
+        uint8_t indices[16];
+        const int err = bc1_indices(px, palette, indices);
+        if(err < best_err){
+            best_err = err;
+            best_c0 = c0;
+            best_c1 = c1;
+            memcpy(best_indices, indices, 16);
+        }
+        if(err == 0) break;
+        static const float index_weight[4] = {0.f, 1.f, 1.f / 3.f, 2.f / 3.f};
+        float weights[16];
+        for(int i=0; i<16; i++) weights[i] = index_weight[indices[i]];
+        if(!least_squares_endpoints(px, 3, weights, e0, e1)) break;
+    }
+    if(best_c0 == best_c1)
+        memset(best_indices, 0, 16);
+    block[0] = uint8_t(best_c0); block[1] = uint8_t(best_c0 >> 8);
+    block[2] = uint8_t(best_c1); block[3] = uint8_t(best_c1 >> 8);
+    uint32_t bits = 0;
+    for(int i=0; i<16; i++) bits |= uint32_t(best_indices[i]) << (2 * i);
+    for(int i=0; i<4; i++) block[4 + i] = uint8_t(bits >> (8 * i));
+}
+
+void decode_bc1(const uint8_t* block, uint8_t* rgba, bool four_color){
+    const uint16_t c0 = uint16_t(block[0] | block[1] << 8), c1 = uint16_t(block[2] | block[3] << 8);
+    int palette[4][4];
+    bc1_palette(c0, c1, four_color, palette);
+    const uint32_t bits = uint32_t(block[4]) | uint32_t(block[5]) << 8 | uint32_t(block[6]) << 16 | uint32_t(block[7]) << 24;
+    for(int i=0; i<16; i++){
+        const int k = bits >> (2 * i) & 3;
+        for(int c=0; c<4; c++) rgba[i * 4 + c] = uint8_t(palette[k][c]);
+    }
+}
+
+/*
+ * BC4 单通道块, 用于 BC3 的alpha与 BC5 的两个通道
+ */
+
+void bc4_palette(int a0, int a1, int palette[8]){
+    palette[0] = a0;
+    palette[1] = a1;
+    if(a0 > a1){
+        for(int i=2; i<8; i++) palette[i] = ((8 - i) * a0 + (i - 1) * a1 + 3) / 7;
+    }else{
+        for(int i=2; i<6; i++) palette[i] = ((6 - i) * a0 + (i - 1) * a1 + 2) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+int bc4_indices(const int values[16], const int palette[8], uint8_t indices[16]){
+    int total = 0;
+    for(int i=0; i<16; i++){
+        int best = INT32_MAX;
+        for(int k=0; k<8; k++){
+            const int d = values[i] - palette[k];
+            if(d * d < best){
+                best = d * d;
+                indices[i] = uint8_t(k);
+            }
+        }
+        total += best;
+    }
+    return total;
+}
+
+void encode_bc4(const uint8_t* rgba, int channel, uint8_t* block){
+    int values[16];
+    int lo = 255, hi = 0, inner_lo = 255, inner_hi = 0;
+    for(int i=0; i<16; i++){
+        values[i] = rgba[i * 4 + channel];
+        lo = std::min(lo, values[i]);
+        hi = std::max(hi, values[i]);
+        // 六值模式下 0 与 255 单独表示, 端点只需覆盖其余的值
+        if(values[i] != 0 && values[i] != 255){
+            inner_lo = std::min(inner_lo, values[i]);
+            inner_hi = std::max(inner_hi, values[i]);
+        }
+    }
+    int palette[8];
+    uint8_t indices[16];
+    // 八值模式
+    int a0 = hi, a1 = lo;
+    bc4_palette(a0, a1, palette);
+    int err = bc4_indices(values, palette, indices);
+    if(err > 0){
+        if(inner_lo > inner_hi) inner_lo = inner_hi = lo;
+        int palette6[8];
+        uint8_t indices6[16];
+        bc4_palette(inner_lo, inner_hi, palette6);
+        const int err6 = bc4_indices(values, palette6, indices6);
+        if(err6 < err){
+            a0 = inner_lo;
+            a1 = inner_hi;
+            memcpy(indices, indices6, 16);
+        }
+    }
+    block[0] = uint8_t(a0);
+    block[1] = uint8_t(a1);
+    uint64_t bits = 0;
+    for(int i=0; i<16; i++) bits |= uint64_t(indices[i]) << (3 * i);
+    for(int i=0; i<6; i++) block[2 + i] = uint8_t(bits >> (8 * i));
+}
+
+void decode_bc4(const uint8_t* block, uint8_t* rgba, int channel){
+    int palette[8];
+    bc4_palette(block[0], block[1], palette);
+    uint64_t bits = 0;
+    for(int i=0; i<6; i++) bits |= uint64_t(block[2 + i]) << (8 * i);
+    for(int i=0; i<16; i++)
+        rgba[i * 4 + channel] = uint8_t(palette[bits >> (3 * i) & 7]);
+}
+
+/*
+ * BC7 模式6
+ */
+
+constexpr int bc7_weights4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+int bc7_interpolate(int e0, int e1, int index){
+    return ((64 - bc7_weights4[index]) * e0 + bc7_weights4[index] * e1 + 32) >> 6;
+}
+
+// 端点量化为7位加共享的p位, 选误差小的p位
+void bc7_quantize_endpoint(const float e[4], int q[4], int& pbit){
+    float best = FLT_MAX;
+    for(int p=0; p<2; p++){
+        int cand[4];
+        float err = 0;
+        for(int c=0; c<4; c++){
+            cand[c] = std::clamp(int(std::lround((e[c] - p) / 2.f)), 0, 127);
+            const float d = float(cand[c] * 2 + p) - e[c];
+            err += d * d;
+        }
+        if(err < best){
+            best = err;
+            pbit = p;
+            for(int c=0; c<4; c++) q[c] = cand[c];
+        }
+    }
+}
+
+struct bit_writer_t{
+    uint8_t* out;
+    int pos = 0;
+    void put(uint32_t value, int bits){
+        for(int i=0; i<bits; i++, pos++)
+            if(value >> i & 1) out[pos >> 3] |= uint8_t(1 << (pos & 7));
+    }
+};
+
+struct bit_reader_t{
+    const uint8_t* in;
+    int pos = 0;
+    uint32_t get(int bits){
+        uint32_t value = 0;
+        for(int i=0; i<bits; i++, pos++)
+            value |= uint32_t(in[pos >> 3] >> (pos & 7) & 1) << i;
+        return value;
+    }
+};
+
+void encode_bc7(const uint8_t* rgba, uint8_t* block){
+    float px[16][4];
+    load_block(rgba, px);
+    float mean[4], axis[4];
+    principal_axis(px, 4, mean, axis);
+    float tmin = FLT_MAX, tmax = -FLT_MAX;
+    for(int i=0; i<16; i++){
+        float t = 0;
+        for(int c=0; c<4; c++) t += (px[i][c] - mean[c]) * axis[c];
+        tmin = std::min(tmin, t);
+        tmax = std::max(tmax, t);
+    }
+    float axis_len2 = 0;
+    for(int c=0; c<4; c++) axis_len2 += axis[c] * axis[c];
+    if(axis_len2 < 1e-12f) axis_len2 = 1.f;
+    float e0[4], e1[4];
+    for(int c=0; c<4; c++){
+        e0[c] = std::clamp(mean[c] + axis[c] * tmin / axis_len2, 0.f, 255.f);
+        e1[c] = std::clamp(mean[c] + axis[c] * tmax / axis_len2, 0.f, 255.f);
+    }
+
+    int best_q0[4] = {}, best_q1[4] = {}, best_p0 = 0, best_p1 = 0;
+    uint8_t best_indices[16] = {};
+    int best_err = INT32_MAX;
+    for(int iter=0; iter<3; iter++){
+        int q0[4], q1[4], p0, p1;
+        bc7_quantize_endpoint(e0, q0, p0);
+        bc7_quantize_endpoint(e1, q1, p1);
+        int palette[16][4];
+        for(int k=0; k<16; k++)
+            for(int c=0; c<4; c++)
+                palette[k][c] = bc7_interpolate(q0[c] * 2 + p0, q1[c] * 2 + p1, k);
+        uint8_t indices[16];
+        int err = 0;
+        for(int i=0; i<16; i++){
+            int best = INT32_MAX;
+            for(int k=0; k<16; k++){
+                int d2 = 0;
+                for(int c=0; c<4; c++){
+                    const int d = int(px[i][c]) - palette[k][c];
+                    d2 += d * d;
+                }
+                if(d2 < best){
+                    best = d2;
+                    indices[i] = uint8_t(k);
+                }
+            }
+            err += best;
+        }
+        if(err < best_err){
+            best_err = err;
+            memcpy(best_q0, q0, sizeof(q0));
+            memcpy(best_q1, q1, sizeof(q1));
+            best_p0 = p0;
+            best_p1 = p1;
+            memcpy(best_indices, indices, 16);
+        }
+        if(err == 0) break;
+        float weights[16];
+        for(int i=0; i<16; i++) weights[i] = bc7_weights4[indices[i]] / 64.f;
+        if(!least_squares_endpoints(px, 4, weights, e0, e1)) break;
+    }
+    // 第0个像素的索引最高位隐含为0, 否则交换端点
+    if(best_indices[0] & 8){
+        std::swap(best_q0, best_q1);
+        std::swap(best_p0, best_p1);
+        for(auto& index: best_indices) index = uint8_t(15 - index);
+    }
+    memset(block, 0, 16);
+    bit_writer_t w{block};
+    w.put(1 << 6, 7);
+    for(int c=0; c<4; c++){
+        w.put(best_q0[c], 7);
+        w.put(best_q1[c], 7);
+    }
+    w.put(best_p0, 1);
+    w.put(best_p1, 1);
+    w.put(best_indices[0], 3);
+    for(int i=1; i<16; i++) w.put(best_indices[i], 4);
+}
+
+bool decode_bc7(const uint8_t* block, uint8_t* rgba){
+    // 模式由第一个字节最低的1位确定
+    if((block[0] & 0x7F) != 0x40) return false;
+    bit_reader_t r{block};
+    r.get(7);
+    int e[2][4];
+    for(int c=0; c<4; c++){
+        e[0][c] = int(r.get(7)) << 1;
+        e[1][c] = int(r.get(7)) << 1;
+    }
+    const int p0 = int(r.get(1)), p1 = int(r.get(1));
+    for(int c=0; c<4; c++){
+        e[0][c] |= p0;
+        e[1][c] |= p1;
+    }
+    for(int i=0; i<16; i++){
+        const int index = int(r.get(i == 0 ? 3 : 4));
+        for(int c=0; c<4; c++) rgba[i * 4 + c] = uint8_t(bc7_interpolate(e[0][c], e[1][c], index));
+    }
+    return true;
+}
+
+/*
+ * sRGB
+ */
+
+float srgb_to_linear(float v){
+    return v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+}
+float linear_to_srgb(float v){
+    return v <= 0.0031308f ? v * 12.92f : 1.055f * std::pow(v, 1.f / 2.4f) - 0.055f;
+}
+
+/*
+ * KTX2
+ */
+
+constexpr uint8_t ktx2_identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+struct ktx2_format_t{
+    format_t format;
+    bool srgb;
+    uint32_t vk_format;
+    // Khronos Data Format 的颜色模型
+    uint8_t color_model;
+};
+
+constexpr ktx2_format_t ktx2_formats[] = {
+    {format_t::rgba8, false, 37, 1},
+    {format_t::rgba8, true, 43, 1},
+    {format_t::bc1, false, 131, 128},
+    {format_t::bc1, true, 132, 128},
+    {format_t::bc3, false, 137, 130},
+    {format_t::bc3, true, 138, 130},
+    {format_t::bc5, false, 141, 132},
+    {format_t::bc7, false, 145, 134},
+    {format_t::bc7, true, 146, 134},
+};
+
+struct byte_writer_t{
+    std::vector<uint8_t> data;
+    void u8(uint8_t v){
+        data.push_back(v);
+    }
+    void u32(uint32_t v){
+        for(int i=0; i<4; i++) data.push_back(uint8_t(v >> (8 * i)));
+    }
+    void u64(uint64_t v){
+        for(int i=0; i<8; i++) data.push_back(uint8_t(v >> (8 * i)));
+    }
+    void align(size_t alignment){
+        while(data.size() % alignment) data.push_back(0);
+    }
+    void patch_u64(size_t offset, uint64_t v){
+        for(int i=0; i<8; i++) data[offset + i] = uint8_t(v >> (8 * i));
+    }
+};
+
+uint32_t read_u32(const uint8_t* p){
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+uint64_t read_u64(const uint8_t* p){
+    return uint64_t(read_u32(p)) | uint64_t(read_u32(p + 4)) << 32;
+}
+
+// 数据格式描述(DFD)的基本描述块
+void write_dfd(byte_writer_t& w, const ktx2_format_t& info){
+    struct sample_t{
+        uint16_t bit_offset;
+        uint8_t bit_length;
+        uint8_t channel;
+        uint32_t upper;
+    };
+    std::vector<sample_t> samples;
+    // 通道类型高4位为限定符, 0x10 表示线性(sRGB 格式中的alpha)
+    const uint8_t linear_alpha = info.srgb ? 0x10 : 0x00;
+    switch(info.format){
+        case format_t::rgba8:
+            samples = {{0, 7, 0, 255}, {8, 7, 1, 255}, {16, 7, 2, 255}, {24, 7, uint8_t(15 | linear_alpha), 255}};
+            break;
+        case format_t::bc1: samples = {{0, 63, 0, UINT32_MAX}}; break;
+        case format_t::bc3: samples = {{0, 63, uint8_t(15 | linear_alpha), UINT32_MAX}, {64, 63, 0, UINT32_MAX}}; break;
+        case format_t::bc5: samples = {{0, 63, 0, UINT32_MAX}, {64, 63, 1, UINT32_MAX}}; break;
+        case format_t::bc7: samples = {{0, 127, 0, UINT32_MAX}}; break;
+    }
+    const bool compressed = texture_codec::is_block_compressed(info.format);
+    const uint32_t block_size = 24 + 16 * uint32_t(samples.size());
+    w.u32(4 + block_size);
+    // vendorId=0(Khronos), descriptorType=0(基本块)
+    w.u32(0);
+    w.u32(2 | block_size << 16);
+    w.u8(info.color_model);
+    w.u8(1);
+    w.u8(info.srgb ? 2 : 1);
+    w.u8(0);
+    w.u8(compressed ? 3 : 0);
+    w.u8(compressed ? 3 : 0);
+    w.u8(0);
+    w.u8(0);
+    w.u8(uint8_t(texture_codec::block_bytes(info.format)));
+    for(int i=0; i<7; i++) w.u8(0);
+    for(const auto& sample: samples){
+        w.u32(uint32_t(sample.bit_offset) | uint32_t(sample.bit_length) << 16 | uint32_t(sample.channel) << 24);
+        w.u32(0);
+        w.u32(0);
+        w.u32(sample.upper);
+    }
+}
+
+}
+
+const char* texture_codec::format_name(format_t format){
+    switch(format){
+        case format_t::rgba8: return "rgba8";
+        case format_t::bc1: return "bc1";
+        case format_t::bc3: return "bc3";
+        case format_t::bc5: return "bc5";
+        case format_t::bc7: return "bc7";
+    }
+    return "unknown";
+}
+
+bool texture_codec::parse_format(const char* name, format_t& format){
+    for(auto f: {format_t::rgba8, format_t::bc1, format_t::bc3, format_t::bc5, format_t::bc7})
+        if(strcmp(name, format_name(f)) == 0){
+            format = f;
+            return true;
+        }
+    return false;
+}
+
+bool texture_codec::is_block_compressed(format_t format){
+    return format != format_t::rgba8;
+}
+
+size_t texture_codec::block_bytes(format_t format){
+    switch(format){
+        case format_t::rgba8: return 4;
+        case format_t::bc1: return 8;
+        default: return 16;
+    }
+}
+
+size_t texture_codec::level_bytes(format_t format, int width, int height){
+    if(!is_block_compressed(format))
+        return size_t(width) * height * 4;
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * block_bytes(format);
+}
+
+int texture_codec::format_channels(format_t format){
+    switch(format){
+        case format_t::bc1: return 3;
+        case format_t::bc5: return 2;
+        default: return 4;
+    }
+}
+
+void texture_codec::encode_block(format_t format, const uint8_t* rgba, uint8_t* block){
+    switch(format){
+        case format_t::rgba8: panic_with_info("rgba8 is not block compressed");
+        case format_t::bc1: encode_bc1(rgba, block); break;
+        case format_t::bc3:
+            encode_bc4(rgba, 3, block);
+            encode_bc1(rgba, block + 8);
+            break;
+        case format_t::bc5:
+            encode_bc4(rgba, 0, block);
+            encode_bc4(rgba, 1, block + 8);
+            break;
+        case format_t::bc7: encode_bc7(rgba, block); break;
+    }
+}
+
+bool texture_codec::decode_block(format_t format, const uint8_t* block, uint8_t* rgba){
+    switch(format){
+        case format_t::rgba8: panic_with_info("rgba8 is not block compressed");
+        case format_t::bc1: decode_bc1(block, rgba, false); return true;
+        case format_t::bc3:
+            decode_bc1(block + 8, rgba, true);
+            decode_bc4(block, rgba, 3);
+            return true;
+        case format_t::bc5:
+            for(int i=0; i<16; i++){
+                rgba[i * 4 + 2] = 0;
+                rgba[i * 4 + 3] = 255;
+            }
+            decode_bc4(block, rgba, 0);
+            decode_bc4(block + 8, rgba, 1);
+            return true;
+        case format_t::bc7: return decode_bc7(block, rgba);
+    }
+    return false;
+}
+
+std::vector<uint8_t> texture_codec::encode(format_t format, const uint8_t* rgba, int width, int height){
+    std::vector<uint8_t> out(level_bytes(format, width, height));
+    if(!is_block_compressed(format)){
+        memcpy(out.data(), rgba, out.size());
+        return out;
+    }
+    const int block_w = (width + 3) / 4, block_h = (height + 3) / 4;
+    const size_t bytes = block_bytes(format);
+    job_system::parallel_for(0, size_t(block_h), [&](size_t beg, size_t end){
+        uint8_t pixels[64];
+        for(size_t by=beg; by<end; by++)
+            for(int bx=0; bx<block_w; bx++){
+                for(int y=0; y<4; y++){
+                    const int sy = std::min(int(by) * 4 + y, height - 1);
+                    for(int x=0; x<4; x++){
+                        const int sx = std::min(bx * 4 + x, width - 1);
+                        memcpy(pixels + (y * 4 + x) * 4, rgba + (size_t(sy) * width + sx) * 4, 4);
+                    }
+                }
+                encode_block(format, pixels, out.data() + (by * block_w + bx) * bytes);
+            }
+    });
+    return out;
+}
+
+bool texture_codec::decode(format_t format, const uint8_t* data, int width, int height, uint8_t* rgba){
+    if(!is_block_compressed(format)){
+        memcpy(rgba, data, level_bytes(format, width, height));
+        return true;
+    }
+    const int block_w = (width + 3) / 4, block_h = (height + 3) / 4;
+    const size_t bytes = block_bytes(format);
+    uint8_t pixels[64];
+    for(int by=0; by<block_h; by++)
+        for(int bx=0; bx<block_w; bx++){
+            if(!decode_block(format, data + (size_t(by) * block_w + bx) * bytes, pixels))
+                return false;
+            for(int y=0; y<4 && by * 4 + y < height; y++)
+                for(int x=0; x<4 && bx * 4 + x < width; x++)
+                    memcpy(rgba + (size_t(by * 4 + y) * width + bx * 4 + x) * 4, pixels + (y * 4 + x) * 4, 4);
+        }
+    return true;
+}
+
+std::vector<texture_codec::level_t> texture_codec::build_mips(const uint8_t* rgba, int width, int height, bool srgb){
+    std::vector<level_t> levels;
+    levels.push_back(level_t{width, height, std::vector<uint8_t>(rgba, rgba + size_t(width) * height * 4)});
+    float to_linear[256];
+    for(int i=0; i<256; i++) to_linear[i] = srgb ? srgb_to_linear(i / 255.f) : i / 255.f;
+    while(levels.back().width > 1 || levels.back().height > 1){
+        const auto& src = levels.back();
+        level_t dst{std::max(1, src.width / 2), std::max(1, src.height / 2), {}};
+        dst.data.resize(size_t(dst.width) * dst.height * 4);
+        for(int y=0; y<dst.height; y++)
+            for(int x=0; x<dst.width; x++){
+                float sum[4] = {};
+                // 奇数尺寸时最后一行(列)并入相邻的像素
+                const int x0 = std::min(x * 2, src.width - 1), x1 = std::min(x * 2 + 1, src.width - 1);
+                const int y0 = std::min(y * 2, src.height - 1), y1 = std::min(y * 2 + 1, src.height - 1);
+                for(int sy: {y0, y1})
+                    for(int sx: {x0, x1}){
+                        const uint8_t* p = src.data.data() + (size_t(sy) * src.width + sx) * 4;
+                        for(int c=0; c<3; c++) sum[c] += to_linear[p[c]];
+                        sum[3] += p[3] / 255.f;
+                    }
+                uint8_t* out = dst.data.data() + (size_t(y) * dst.width + x) * 4;
+                for(int c=0; c<4; c++){
+                    float v = sum[c] / 4.f;
+                    if(srgb && c < 3) v = linear_to_srgb(v);
+                    out[c] = uint8_t(std::lround(std::clamp(v, 0.f, 1.f) * 255.f));
+                }
+            }
+        levels.push_back(std::move(dst));
+    }
+    return levels;
+}
+
+texture_codec::container_t texture_codec::compress(const uint8_t* rgba, int width, int height, format_t format, bool srgb, bool mipmaps){
+    container_t container;
+    container.format = format;
+    // BC5 存放的是数据(如法线), 没有 sRGB 变体
+    container.srgb = srgb && format != format_t::bc5;
+    container.width = width;
+    container.height = height;
+    std::vector<level_t> levels;
+    if(mipmaps)
+        levels = build_mips(rgba, width, height, container.srgb);
+    else
+        levels.push_back(level_t{width, height, std::vector<uint8_t>(rgba, rgba + size_t(width) * height * 4)});
+    for(auto& level: levels)
+        container.levels.push_back(level_t{level.width, level.height, encode(format, level.data.data(), level.width, level.height)});
+    return container;
+}
+
+bool texture_codec::write_container(const char* file_name, const container_t& container){
+    const ktx2_format_t* info = nullptr;
+    for(const auto& f: ktx2_formats)
+        if(f.format == container.format && f.srgb == container.srgb)
+            info = &f;
+    assert_with_info(info != nullptr, "unsupported container format %s", format_name(container.format));
+    const uint32_t level_num = uint32_t(container.levels.size());
+    byte_writer_t w;
+    w.data.assign(ktx2_identifier, ktx2_identifier + 12);
+    w.u32(info->vk_format);
+    w.u32(1);
+    w.u32(container.width);
+    w.u32(container.height);
+    // 深度, 数组层数为0表示普通二维纹理
+    w.u32(0);
+    w.u32(0);
+    w.u32(1);
+    w.u32(level_num);
+    w.u32(0);
+    const size_t index_offset = w.data.size();
+    const size_t dfd_offset = index_offset + 32 + 24 * size_t(level_num);
+    // 数据格式描述写在最后再回填偏移
+    w.u32(0); w.u32(0); w.u32(0); w.u32(0); w.u64(0); w.u64(0);
+    const size_t level_index_offset = w.data.size();
+    for(uint32_t i=0; i<level_num; i++){
+        w.u64(0); w.u64(0); w.u64(0);
+    }
+    write_dfd(w, *info);
+    const uint32_t dfd_length = uint32_t(w.data.size() - dfd_offset);
+    for(int i=0; i<4; i++){
+        w.data[index_offset + i] = uint8_t(dfd_offset >> (8 * i));
+        w.data[index_offset + 4 + i] = uint8_t(dfd_length >> (8 * i));
+    }
+    // 各级从最小的开始存放, 按块大小与4的公倍数对齐
+    const size_t alignment = is_block_compressed(container.format) ? block_bytes(container.format) : 4;
+    for(int i=int(level_num) - 1; i>=0; i--){
+        const auto& level = container.levels[i];
+        assert_with_info(level.data.size() == level_bytes(container.format, level.width, level.height),
+            "level %d has %zu bytes", i, level.data.size());
+        w.align(alignment);
+        w.patch_u64(level_index_offset + 24 * i, w.data.size());
+        w.patch_u64(level_index_offset + 24 * i + 8, level.data.size());
+        w.patch_u64(level_index_offset + 24 * i + 16, level.data.size());
+        w.data.insert(w.data.end(), level.data.begin(), level.data.end());
+    }
+    FILE* fp = fopen(file_name, "wb");
+    if(fp == nullptr) return false;
+    const bool ok = fwrite(w.data.data(), 1, w.data.size(), fp) == w.data.size();
+    return fclose(fp) == 0 && ok;
+}
+
+bool texture_codec::read_container(const char* file_name, container_t& container){
+    FILE* fp = fopen(file_name, "rb");
+    if(fp == nullptr) return false;
+    std::vector<uint8_t> data;
+    uint8_t buf[1 << 16];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(fp);
+    if(data.size() < 80 || memcmp(data.data(), ktx2_identifier, 12) != 0){
+        log_error("%s is not a KTX2 file", file_name);
+        return false;
+    }
+    const uint8_t* header = data.data() + 12;
+    const uint32_t vk_format = read_u32(header);
+    const ktx2_format_t* info = nullptr;
+    for(const auto& f: ktx2_formats)
+        if(f.vk_format == vk_format)
+            info = &f;
+    const uint32_t depth = read_u32(header + 16), layers = read_u32(header + 20), faces = read_u32(header + 24);
+    const uint32_t supercompression = read_u32(header + 32);
+    if(info == nullptr || depth > 1 || layers > 1 || faces != 1 || supercompression != 0){
+        log_error("%s: unsupported KTX2 texture (vkFormat %u)", file_name, vk_format);
+        return false;
+    }
+    container.format = info->format;
+    container.srgb = info->srgb;
+    container.width = int(read_u32(header + 8));
+    container.height = int(read_u32(header + 12));
+    // 级数为0表示由加载方生成多级纹理, 文件中只有第0级
+    const uint32_t level_num = std::max(1u, read_u32(header + 28));
+    container.levels.clear();
+    for(uint32_t i=0; i<level_num; i++){
+        const size_t entry = 80 + 24 * size_t(i);
+        if(entry + 24 > data.size()) return false;
+        const uint64_t offset = read_u64(data.data() + entry), length = read_u64(data.data() + entry + 8);
+        level_t level{std::max(1, container.width >> i), std::max(1, container.height >> i), {}};
+        if(offset + length > data.size() || length != level_bytes(container.format, level.width, level.height)){
+            log_error("%s: broken level %u", file_name, i);
+            return false;
+        }
+        level.data.assign(data.begin() + offset, data.begin() + offset + length);
+        container.levels.push_back(std::move(level));
+    }
+    return true;
+}
+
+bool texture_codec::is_container_file(const char* file_name){
+    const size_t len = strlen(file_name);
+    return len >= 5 && strcmp(file_name + len - 5, ".ktx2") == 0;
+}
+
+double texture_codec::psnr(const uint8_t* a, const uint8_t* b, size_t pixel_num, int channels){
+    double sum = 0;
+    for(size_t i=0; i<pixel_num; i++)
+        for(int c=0; c<channels; c++){
+            const double d = double(a[i * 4 + c]) - b[i * 4 + c];
+            sum += d * d;
+        }
+    if(sum == 0) return 999.;
+    const double mse = sum / (double(pixel_num) * channels);
+    return 10. * std::log10(255. * 255. / mse);
+}
@@ -0,0 +1,106 @@
+/**
+ * @file texture_codec.hpp
+ * @brief 纹理压缩: BC1/BC3/BC5/BC7 块编解码, 多级纹理生成, KTX2 容器读写
+ * @note 全部在CPU上完成, 不依赖GL, 编码质量与速度可以直接在CPU上测量;
+ * BC7 只编码与解码模式6(单分区, RGBA 7777.1 端点, 4位索引), 其他模式的块解码失败
+ *
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Ez3DGL {
+namespace texture_codec {
+
+    enum class format_t : uint32_t{
+        // 未压缩, 每像素4字节
+        rgba8,
+        // RGB, 每块8字节, 不含alpha
+        bc1,
+        // RGBA, BC1 颜色 + BC4 alpha, 每块16字节
+        bc3,
+        // RG 两个 BC4 通道, 每块16字节, 用于法线贴图
+        bc5,
+        // RGBA, 每块16字节
+        bc7,
+    };
+
+    const char* format_name(format_t format);
+    /**
+     * @brief 按名字(rgba8/bc1/bc3/bc5/bc7)解析格式, 名字未知时返回 false
+     */
+    bool parse_format(const char* name, format_t& format);
+    bool is_block_compressed(format_t format);
+    /**
+     * @brief 一个4x4块的字节数, rgba8 为一个像素的字节数
+     */
+    size_t block_bytes(format_t format);
+    size_t level_bytes(format_t format, int width, int height);
+    /**
+     * @brief 参与误差统计的通道数(bc1 不含alpha, bc5 只有RG)
+     */
+    int format_channels(format_t format);
+
+    /**
+     * @brief 编码一个块
+     * @param rgba 4x4个像素, 行优先, 共64字节
+     */
+    void encode_block(format_t format, const uint8_t* rgba, uint8_t* block);
+    /**
+     * @brief 解码一个块到 4x4 个 RGBA8 像素, 不支持的块(BC7 非模式6)返回 false
+     */
+    bool decode_block(format_t format, const uint8_t* block, uint8_t* rgba);
+
+    /**
+     * @brief 编码一张 RGBA8 图片, 按块行在任务系统上并行, 边缘不足4像素的块复制边缘像素
+     */
+    std::vector<uint8_t> encode(format_t format, const uint8_t* rgba, int width, int height);
+    /**
+     * @brief 解码到 width*height 个 RGBA8 像素, 有不支持的块时返回 false
+     */
+    bool decode(format_t format, const uint8_t* data, int width, int height, uint8_t* rgba);
+
+    struct level_t{
+        int width, height;
+        std::vector<uint8_t> data;
+    };
+    /**
+     * @brief 生成多级纹理(RGBA8), 第0级为原图, 逐级2x2盒式滤波到1x1
+     * @param srgb 为真时颜色在线性空间中平均
+     */
+    std::vector<level_t> build_mips(const uint8_t* rgba, int width, int height, bool srgb);
+
+    struct container_t{
+        format_t format = format_t::rgba8;
+        bool srgb = false;
+        int width = 0, height = 0;
+        // 从第0级(最大)开始
+        std::vector<level_t> levels;
+    };
+    /**
+     * @brief 生成多级纹理(可选)并逐级编码
+     */
+    container_t compress(const uint8_t* rgba, int width, int height, format_t format, bool srgb, bool mipmaps=true);
+
+    /**
+     * @brief 以 KTX2 布局写入(不使用超压缩, 不含键值数据)
+     */
+    bool write_container(const char* file_name, const container_t& container);
+    /**
+     * @brief 读取 KTX2 文件, 只支持本模块的格式与单层二维纹理
+     */
+    bool read_container(const char* file_name, container_t& container);
+    /**
+     * @brief 文件名是否以 .ktx2 结尾
+     */
+    bool is_container_file(const char* file_name);
+
+    /**
+     * @brief 两张 RGBA8 图片前 channels 个通道的峰值信噪比(dB), 完全相同时返回 999
+     */
+    double psnr(const uint8_t* a, const uint8_t* b, size_t pixel_num, int channels=4);
+
+}
+}
@@ -0,0 +1,293 @@
+#include "utils/world_pack.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <utility>
+#include "utils/debug.hpp"
+
+using namespace Ez3DGL;
+using namespace Ez3DGL::world_pack;
+
+namespace {
+
+constexpr uint32_t pack_magic = 0x50575A45; // "EZWP"
+constexpr uint32_t pack_version = 1;
+constexpr size_t header_bytes = 16;
+constexpr size_t directory_entry_bytes = 56;
+
+struct byte_writer_t{
+    std::vector<uint8_t> data;
+    void u32(uint32_t v){
+        for(int i=0; i<4; i++) data.push_back(uint8_t(v >> (8 * i)));
+    }
+    void u64(uint64_t v){
+        for(int i=0; i<8; i++) data.push_back(uint8_t(v >> (8 * i)));
+    }
+    void f32(float v){
+        uint32_t bits;
+        memcpy(&bits, &v, 4);
+        u32(bits);
+    }
+    void vec3(const glm::vec3& v){
+        f32(v.x); f32(v.y); f32(v.z);
+    }
+    void bytes(const void* p, size_t n){
+        data.insert(data.end(), static_cast<const uint8_t*>(p), static_cast<const uint8_t*>(p) + n);
+    }
+};
+
+// 越界时 ok 置为 false, 之后的读取都返回0
+struct byte_reader_t{
+    const uint8_t* data;
+    size_t size, pos = 0;
+    bool ok = true;
+    byte_reader_t(const uint8_t* data, size_t size):data(data), size(size){}
+    bool take(void* out, size_t n){
+        if(!ok || pos + n > size){
+            ok = false;
+            memset(out, 0, n);
+            return false;
+        }
+        memcpy(out, data + pos, n);
+        pos += n;
+        return true;
+    }
+    uint32_t u32(){
+        uint8_t b[4];
+        take(b, 4);
+        return uint32_t(b[0]) | uint32_t(b[1]) << 8 | uint32_t(b[2]) << 16 | uint32_t(b[3]) << 24;
+    }
+    uint64_t u64(){
+        const uint64_t lo = u32();
+        return lo | uint64_t(u32()) << 32;
+    }
+    float f32(){
+        const uint32_t bits = u32();
+        float v;
+        memcpy(&v, &bits, 4);
+        return v;
+    }
+    glm::vec3 vec3(){
+        const float x = f32();
+        const float y = f32();
+        const float z = f32();
+        return glm::vec3(x, y, z);
+    }
+};
+
+uint64_t texture_memory(const texture_codec::container_t& texture){
+    uint64_t bytes = 0;
+    for(const auto& level: texture.levels)
+        bytes += level.data.size();
+    return bytes;
+}
+
+}
+
+writer_t::writer_t(float cell_size):cell_size(cell_size){
+    assert_with_info(cell_size > 0, "invalid cell size %f", cell_size);
+}
+
+uint32_t writer_t::add_texture(texture_codec::container_t texture){
+    assert_with_info(!texture.levels.empty(), "texture has no level");
+    textures.push_back(std::move(texture));
+    return uint32_t(textures.size() - 1);
+}
+
+void writer_t::add_mesh(mesh_t mesh){
+    assert_with_info(mesh.vertices.size() % vertex_floats == 0 && !mesh.vertices.empty(), "invalid vertex data");
+    assert_with_info(mesh.texture < int32_t(textures.size()), "texture %d is not added", mesh.texture);
+    mesh.bounds_min = glm::vec3(FLT_MAX);
+    mesh.bounds_max = glm::vec3(-FLT_MAX);
+    for(size_t i=0; i<mesh.vertices.size(); i+=vertex_floats){
+        const glm::vec3 p(mesh.vertices[i], mesh.vertices[i + 1], mesh.vertices[i + 2]);
+        mesh.bounds_min = glm::min(mesh.bounds_min, p);
+        mesh.bounds_max = glm::max(mesh.bounds_max, p);
+    }
+    meshes.push_back(std::move(mesh));
+}
+
+size_t writer_t::cell_num() const{
+    std::map<std::pair<int32_t, int32_t>, int> cells;
+    for(const auto& mesh: meshes){
+        const glm::vec3 center = (mesh.bounds_min + mesh.bounds_max) * 0.5f;
+        cells[{int32_t(std::floor(center.x / cell_size)), int32_t(std::floor(center.z / cell_size))}] = 0;
+    }
+    return cells.size();
+}
+
+bool writer_t::write(const char* file_name) const{
+    // 按 (x, z) 排序的单元, 每个单元记录其中的网格
+    std::map<std::pair<int32_t, int32_t>, std::vector<size_t>> cells;
+    for(size_t i=0; i<meshes.size(); i++){
+        const glm::vec3 center = (meshes[i].bounds_min + meshes[i].bounds_max) * 0.5f;
+        cells[{int32_t(std::floor(center.x / cell_size)), int32_t(std::floor(center.z / cell_size))}].push_back(i);
+    }
+    std::vector<cell_info_t> infos;
+    std::vector<std::vector<uint8_t>> blobs;
+    for(const auto& cell: cells){
+        cell_info_t info;
+        info.x = cell.first.first;
+        info.z = cell.first.second;
+        info.bounds_min = glm::vec3(FLT_MAX);
+        info.bounds_max = glm::vec3(-FLT_MAX);
+        // 单元内使用的纹理重新编号
+        std::map<int32_t, int32_t> remap;
+        std::vector<int32_t> used;
+        for(auto index: cell.second){
+            const auto& mesh = meshes[index];
+            info.bounds_min = glm::min(info.bounds_min, mesh.bounds_min);
+            info.bounds_max = glm::max(info.bounds_max, mesh.bounds_max);
+            if(mesh.texture >= 0 && remap.emplace(mesh.texture, int32_t(used.size())).second)
+                used.push_back(mesh.texture);
+        }
+        byte_writer_t w;
+        w.u32(uint32_t(used.size()));
+        w.u32(uint32_t(cell.second.size()));
+        for(auto texture_index: used){
+            const auto& texture = textures[texture_index];
+            w.u32(uint32_t(texture.format));
+            w.u32(texture.srgb ? 1 : 0);
+            w.u32(uint32_t(texture.width));
+            w.u32(uint32_t(texture.height));
+            w.u32(uint32_t(texture.levels.size()));
+            for(const auto& level: texture.levels){
+                w.u64(level.data.size());
+                w.bytes(level.data.data(), level.data.size());
+            }
+            info.memory_bytes += texture_memory(texture);
+        }
+        for(auto index: cell.second){
+            const auto& mesh = meshes[index];
+            w.u32(uint32_t(mesh.texture >= 0 ? remap[mesh.texture] : -1));
+            w.u32(uint32_t(mesh.vertex_num()));
+            w.u32(uint32_t(mesh.indices.size()));
+            w.vec3(mesh.bounds_min);
+            w.vec3(mesh.bounds_max);
+            for(float v: mesh.vertices)
+                w.f32(v);
+            for(uint32_t i: mesh.indices)
+                w.u32(i);
+            info.memory_bytes += mesh.vertices.size() * sizeof(float) + mesh.indices.size() * sizeof(uint32_t);
+        }
+        info.size = w.data.size();
+        infos.push_back(info);
+        blobs.push_back(std::move(w.data));
+    }
+
+    byte_writer_t w;
+    w.u32(pack_magic);
+    w.u32(pack_version);
+    w.f32(cell_size);
+    w.u32(uint32_t(infos.size()));
+    uint64_t offset = header_bytes + directory_entry_bytes * infos.size();
+    for(auto& info: infos){
+        info.offset = offset;
+        offset += info.size;
+        w.u32(uint32_t(info.x));
+        w.u32(uint32_t(info.z));
+        w.vec3(info.bounds_min);
+        w.vec3(info.bounds_max);
+        w.u64(info.offset);
+        w.u64(info.size);
+        w.u64(info.memory_bytes);
+    }
+    FILE* fp = fopen(file_name, "wb");
+    if(fp == nullptr) return false;
+    bool ok = fwrite(w.data.data(), 1, w.data.size(), fp) == w.data.size();
+    for(const auto& blob: blobs)
+        ok = ok && fwrite(blob.data(), 1, blob.size(), fp) == blob.size();
+    return fclose(fp) == 0 && ok;
+}
+
+bool reader_t::open(const char* file_name){
+    FILE* fp = fopen(file_name, "rb");
+    if(fp == nullptr){
+        log_error("fail to open world pack %s", file_name);
+        return false;
+    }
+    uint8_t header[header_bytes];
+    bool ok = fread(header, 1, header_bytes, fp) == header_bytes;
+    byte_reader_t h(header, header_bytes);
+    const uint32_t magic = h.u32(), version = h.u32();
+    size = h.f32();
+    const uint32_t cell_num = h.u32();
+    if(!ok || magic != pack_magic || version != pack_version){
+        log_error("%s is not a world pack (version %u)", file_name, version);
+        fclose(fp);
+        return false;
+    }
+    std::vector<uint8_t> directory(directory_entry_bytes * size_t(cell_num));
+    ok = fread(directory.data(), 1, directory.size(), fp) == directory.size();
+    fclose(fp);
+    if(!ok){
+        log_error("%s: broken directory", file_name);
+        return false;
+    }
+    byte_reader_t r(directory.data(), directory.size());
+    infos.resize(cell_num);
+    for(auto& info: infos){
+        info.x = int32_t(r.u32());
+        info.z = int32_t(r.u32());
+        info.bounds_min = r.vec3();
+        info.bounds_max = r.vec3();
+        info.offset = r.u64();
+        info.size = r.u64();
+        info.memory_bytes = r.u64();
+    }
+    this->file_name = file_name;
+    return true;
+}
+
+bool reader_t::read_cell(size_t index, cell_t& cell) const{
+    assert_with_info(index < infos.size(), "cell %zu out of range", index);
+    const auto& info = infos[index];
+    FILE* fp = fopen(file_name.c_str(), "rb");
+    if(fp == nullptr) return false;
+    std::vector<uint8_t> data(info.size);
+    const bool ok = fseek(fp, long(info.offset), SEEK_SET) == 0 && fread(data.data(), 1, data.size(), fp) == data.size();
+    fclose(fp);
+    if(!ok) return false;
+
+    byte_reader_t r(data.data(), data.size());
+    const uint32_t texture_num = r.u32(), mesh_num = r.u32();
+    cell.textures.clear();
+    cell.meshes.clear();
+    for(uint32_t i=0; i<texture_num && r.ok; i++){
+        texture_codec::container_t texture;
+        texture.format = texture_codec::format_t(r.u32());
+        texture.srgb = r.u32() != 0;
+        texture.width = int(r.u32());
+        texture.height = int(r.u32());
+        const uint32_t level_num = r.u32();
+        for(uint32_t l=0; l<level_num && r.ok; l++){
+            texture_codec::level_t level{std::max(1, texture.width >> l), std::max(1, texture.height >> l), {}};
+            const uint64_t bytes = r.u64();
+            if(bytes != texture_codec::level_bytes(texture.format, level.width, level.height))
+                return false;
+            level.data.resize(bytes);
+            r.take(level.data.data(), bytes);
+            texture.levels.push_back(std::move(level));
+        }
+        cell.textures.push_back(std::move(texture));
+    }
+    for(uint32_t i=0; i<mesh_num && r.ok; i++){
+        mesh_t mesh;
+        mesh.texture = int32_t(r.u32());
+        const uint32_t vertex_num = r.u32(), index_num = r.u32();
+        mesh.bounds_min = r.vec3();
+        mesh.bounds_max = r.vec3();
+        if(mesh.texture >= int32_t(texture_num) || (size_t(vertex_num) * vertex_floats + index_num) * 4 > data.size())
+            return false;
+        mesh.vertices.resize(size_t(vertex_num) * vertex_floats);
+        mesh.indices.resize(index_num);
+        // 文件为小端, 假定运行平台也是小端, 直接复制
+        r.take(mesh.vertices.data(), mesh.vertices.size() * sizeof(float));
+        r.take(mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+        cell.meshes.push_back(std::move(mesh));
+    }
+    return r.ok;
+}
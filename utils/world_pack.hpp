@@ -0,0 +1,99 @@
+/**
+ * @file world_pack.hpp
+ * @brief 世界分块文件: 场景按水平网格划分为单元, 每个单元的网格与纹理连续存放, 可单独读取
+ * @note 只做文件读写, 不依赖GL; 读取可以在工作线程进行
+ *
+ * 文件布局(小端):
+ *     头部     magic "EZWP", 版本, 单元边长, 单元数
+ *     目录     每个单元的网格坐标, 包围盒, 数据偏移与长度, 上传后占用的显存字节数
+ *     单元数据 纹理(texture_codec 格式的各级数据), 网格(位置/法线/uv 交错的顶点与索引)
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "utils/texture_codec.hpp"
+
+namespace Ez3DGL {
+namespace world_pack {
+
+    // 每个顶点的 float 数: 位置3, 法线3, uv2
+    constexpr size_t vertex_floats = 8;
+
+    struct mesh_t{
+        // 世界空间的交错顶点
+        std::vector<float> vertices;
+        std::vector<uint32_t> indices;
+        // 漫反射纹理在所属单元 textures 中的序号, -1 表示没有
+        int32_t texture = -1;
+        glm::vec3 bounds_min = glm::vec3(0.f), bounds_max = glm::vec3(0.f);
+
+        size_t vertex_num() const{
+            return vertices.size() / vertex_floats;
+        }
+    };
+
+    struct cell_t{
+        std::vector<texture_codec::container_t> textures;
+        std::vector<mesh_t> meshes;
+    };
+
+    struct cell_info_t{
+        // 水平网格坐标, 单元覆盖 [x, x+1)*cell_size, [z, z+1)*cell_size
+        int32_t x = 0, z = 0;
+        // 单元内所有网格的包围盒, 可能超出网格范围
+        glm::vec3 bounds_min = glm::vec3(0.f), bounds_max = glm::vec3(0.f);
+        uint64_t offset = 0, size = 0;
+        // 上传后顶点, 索引与纹理占用的字节数
+        uint64_t memory_bytes = 0;
+    };
+
+    /**
+     * @brief 收集网格与纹理, 按网格包围盒中心所在的单元分组后写入文件
+     */
+    class writer_t{
+    public:
+        explicit writer_t(float cell_size);
+        /**
+         * @brief 加入纹理并返回序号, 网格通过序号引用; 被多个单元引用的纹理在每个单元中各存一份
+         */
+        uint32_t add_texture(texture_codec::container_t texture);
+        /**
+         * @brief 加入世界空间的网格, mesh.texture 为 add_texture 返回的序号, 包围盒在此计算
+         */
+        void add_mesh(mesh_t mesh);
+        size_t cell_num() const;
+        bool write(const char* file_name) const;
+    private:
+        float cell_size;
+        std::vector<texture_codec::container_t> textures;
+        std::vector<mesh_t> meshes;
+    };
+
+    /**
+     * @brief 读取目录, 按需读取单个单元
+     */
+    class reader_t{
+    public:
+        bool open(const char* file_name);
+        float cell_size() const{
+            return size;
+        }
+        const std::vector<cell_info_t>& cells() const{
+            return infos;
+        }
+        /**
+         * @brief 读取一个单元, 每次调用单独打开文件, 多个线程可以同时读取不同单元
+         */
+        bool read_cell(size_t index, cell_t& cell) const;
+    private:
+        std::string file_name;
+        float size = 0.f;
+        std::vector<cell_info_t> infos;
+    };
+
+}
+}
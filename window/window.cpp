@@ -4,9 +4,17 @@
 #include <filesystem>
 #include <string>
 #include <chrono>
+#include <cmath>
 #include "utils/debug.hpp"
+#include "utils/profiler.hpp"
+#include "utils/gl_backend.hpp"
+#include "utils/job_system.hpp"
+#include "utils/frame_arena.hpp"
+#include "utils/render_stats.hpp"
 
 #include "window.hpp"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
 
 using namespace Ez3DGL;
 
@@ -18,10 +26,31 @@ glfw_win_t::glfw_win_t(int width_, int height_, const char* title_):width(width_
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 }
 
+glfw_win_t::glfw_win_t(int width_, int height_, const char* title_, const headless_opt_t& headless_opt_):
+    width(width_), height(height_), title(title_), headless(true), headless_opt(headless_opt_){
+#if GLFW_VERSION_MAJOR * 100 + GLFW_VERSION_MINOR >= 304
+    glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    if(!glfwInit()){
+        log_warn("Null platform is unavailable, fallback to invisible window");
+        glfwInitHint(GLFW_PLATFORM, GLFW_ANY_PLATFORM);
+        glfwInit();
+    }
+#else
+    glfwInit();
+#endif
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_CREATION_API, headless_opt.use_egl ? GLFW_EGL_CONTEXT_API : GLFW_OSMESA_CONTEXT_API);
+}
+
 int glfw_win_t::show(int (*setup)(), int (*loop)(), int (*exit)()){
+    if(headless)
+        return show_headless(setup, loop, exit);
     window = glfwCreateWindow(width, height, title, NULL, NULL);
     if(window==NULL){
-        printf("Failed to create Window\n");
+        log_error("Failed to create Window");
         glfwTerminate();
         return -1;
     }
@@ -55,9 +84,101 @@ int glfw_win_t::show(int (*setup)(), int (*loop)(), int (*exit)()){
 }
 
 
+int glfw_win_t::show_headless(int (*setup)(), int (*loop)(), int (*exit)()){
+    window = glfwCreateWindow(width, height, title, NULL, NULL);
+    if(window==NULL){
+        log_error("Failed to create offscreen context");
+        glfwTerminate();
+        return -1;
+    }
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(0);
+
+    int ret = setup();
+    if(ret!=0) return ret;
+
+    // 渲染到固定大小的帧缓冲, 与窗口系统无关
+    create_headless_fbo();
+    glViewport(0, 0, width, height);
+
+    frame_cpu_ms.clear();
+    frame_cpu_ms.reserve(headless_opt.frame_num);
+    const double beg_time = glfwGetTime();
+    for(int i=0; i<headless_opt.frame_num && !glfwWindowShouldClose(window); i++){
+        float current_frame = glfwGetTime();
+        frame_time_delta = current_frame - frame_time_last;
+        frame_time_last = current_frame;
+
+        glfwPollEvents();
+
+        const double frame_beg = glfwGetTime();
+        ret = loop();
+        if(ret!=0) return ret;
+        frame_cpu_ms.push_back((glfwGetTime() - frame_beg) * 1e3);
+    }
+    glFinish();
+    const double total_ms = (glfwGetTime() - beg_time) * 1e3;
+    log_info("Headless %dx%d, %zu frames in %.2f ms (%.3f ms/frame)",
+        width, height, frame_cpu_ms.size(), total_ms, frame_cpu_ms.empty() ? 0. : total_ms / frame_cpu_ms.size());
+
+    if(headless_opt.png_path != nullptr && !save_png(headless_opt.png_path))
+        ret = -1;
+
+    int exit_ret = exit();
+    if(exit_ret!=0) return exit_ret;
+
+    glDeleteFramebuffers(1, &headless_fbo);
+    const unsigned int renderbuffers[] = {headless_color_rbo, headless_depth_rbo};
+    glDeleteRenderbuffers(2, renderbuffers);
+    headless_fbo = headless_color_rbo = headless_depth_rbo = 0;
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return ret;
+}
+
+void glfw_win_t::create_headless_fbo(){
+    glGenRenderbuffers(1, &headless_color_rbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, headless_color_rbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &headless_depth_rbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, headless_depth_rbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &headless_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, headless_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, headless_color_rbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, headless_depth_rbo);
+    assert_with_info(glCheckFramebufferStatus(GL_FRAMEBUFFER)==GL_FRAMEBUFFER_COMPLETE, "offscreen framebuffer is incomplete");
+}
+
+bool glfw_win_t::save_png(const char* path) const{
+    std::vector<unsigned char> pixels(size_t(width) * height * 4);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, headless_fbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    // OpenGL 的原点在左下角
+    stbi_flip_vertically_on_write(1);
+    if(!stbi_write_png(path, width, height, 4, pixels.data(), width * 4)){
+        log_error("Failed to write %s", path);
+        return false;
+    }
+    log_info("Frame saved to %s", path);
+    return true;
+}
+
+
 static glfw_win_t* win;
 static camera_t* camera;
 
+// 固定步长模拟, 步长为0时关闭
+static double fixed_step = 0;
+static int fixed_max_steps = 5;
+static double fixed_accumulator = 0;
+// 离屏运行时每帧推进的固定时间
+static double virtual_frame_seconds = 0;
+
 static bool ign_keyboard = false, ign_mouse = false;
 
 static void framebuffer_size_callback(GLFWwindow* win, int w, int h){
@@ -107,12 +228,16 @@ int window_setup(){
     ImGui_ImplOpenGL3_Init("#version 330");
 
     if(!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)){
-        printf("Failed to init GLAD\n");
+        log_error("Failed to init GLAD");
         return -1;
     }
 
     glEnable(GL_DEPTH_TEST);
 
+    // 用户可在调用 window_launch 之前自行 init 以指定工作线程数
+    if(!job_system::initialized())
+        job_system::init();
+
     extern void user_setup();
     user_setup();
 
@@ -120,10 +245,21 @@ int window_setup(){
 }
 
 int window_loop(){
+    profiler::begin_frame();
+    gl_backend::frame_boundary();
+    // ImGui 绕过引擎切换程序和绑定纹理
+    shader_t::invalidate_bind_cache();
+    {
+        profile_scope("job_system::pump_main");
+        job_system::pump_main();
+    }
     extern void user_imgui();
-    user_imgui();
+    {
+        profile_scope("user_imgui");
+        user_imgui();
+    }
 
-    auto io = ImGui::GetIO();
+    const auto& io = ImGui::GetIO();
     if(io.WantCaptureMouse)
         ign_mouse = true;
     else
@@ -138,20 +274,67 @@ int window_loop(){
     glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // also clear the depth buffer now!
 
-    static std::chrono::system_clock::time_point timer_pre = std::chrono::system_clock::now();
-    auto timer_now = std::chrono::system_clock::now();
-    auto timer_delta = std::chrono::duration_cast<std::chrono::milliseconds>(timer_now - timer_pre);
+    static std::chrono::steady_clock::time_point timer_pre = std::chrono::steady_clock::now();
+    auto timer_now = std::chrono::steady_clock::now();
+    double delta_seconds = std::chrono::duration<double>(timer_now - timer_pre).count();
     timer_pre = timer_now;
-    extern void user_loop(long int frame_delta_ms);
-    user_loop(timer_delta.count());
+    if(virtual_frame_seconds > 0)
+        delta_seconds = virtual_frame_seconds;
+
+    if(fixed_step > 0){
+        extern void user_fixed_update(double step_seconds);
+        extern void user_render(float alpha);
+        fixed_accumulator += delta_seconds;
+        int steps = 0;
+        {
+            profile_scope("user_fixed_update");
+            while(fixed_accumulator >= fixed_step && steps < fixed_max_steps){
+                model_t::advance_tick();
+                user_fixed_update(fixed_step);
+                fixed_accumulator -= fixed_step;
+                steps += 1;
+            }
+        }
+        if(fixed_accumulator >= fixed_step)
+            fixed_accumulator = std::fmod(fixed_accumulator, fixed_step);
+        const float alpha = float(fixed_accumulator / fixed_step);
+        model_t::set_render_alpha(alpha);
+        {
+            profile_gpu_scope("user_render");
+            user_render(alpha);
+        }
+        model_t::set_render_alpha(1.f);
+    }else{
+        // 保留不足1毫秒的部分, 累计的时间不会因截断而变少
+        static double delta_ms_carry = 0;
+        delta_ms_carry += delta_seconds * 1e3;
+        const long delta_ms = long(delta_ms_carry);
+        delta_ms_carry -= delta_ms;
+        extern void user_loop(long int frame_delta_ms);
+        {
+            profile_gpu_scope("user_loop");
+            user_loop(delta_ms);
+        }
+    }
 
 //    printf("camera pos: %f %f %f\n", camera->position.x, camera->position.y, camera->position.z);
 //    printf("camera fov: %f\n", camera->fov);
 
 
+    if(profiler::show_overlay)
+        profiler::draw_imgui();
+    if(render_stats::show_overlay)
+        render_stats::draw_imgui();
+
     // Rendering
-    ImGui::Render();
-    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    {
+        profile_gpu_scope("imgui");
+        ImGui::Render();
+        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    }
+    profiler::end_frame();
+    render_stats::end_frame();
+    frame_arena::end_frame();
     return 0;
 }
 
@@ -160,6 +343,7 @@ int window_exit(){
 
     extern void user_exit();
     user_exit();
+    job_system::shutdown();
 
     // Cleanup
     ImGui_ImplOpenGL3_Shutdown();
@@ -173,6 +357,24 @@ int window_launch(const char* title, int win_width, int win_height){
     return win->show(window_setup, window_loop, window_exit);
 }
 
+int window_launch_headless(const char* title, int win_width, int win_height, const headless_opt_t& opt){
+    virtual_frame_seconds = opt.frame_seconds;
+    win = new glfw_win_t(win_width, win_height, title, opt);
+    return win->show(window_setup, window_loop, window_exit);
+}
+
+const glfw_win_t* window_instance(){
+    return win;
+}
+
+void window_set_fixed_timestep(double step_seconds, int max_steps){
+    assert_with_info(step_seconds >= 0, "fixed timestep must not be negative");
+    assert_with_info(max_steps > 0, "max steps must be positive");
+    fixed_step = step_seconds;
+    fixed_max_steps = max_steps;
+    fixed_accumulator = 0;
+}
+
 static void implement_tip(){
     // log_with_info("Maybe implement the function yourself");
 }
@@ -194,6 +396,14 @@ __attribute__((weak)) void user_loop(long int frame_delta_ms){
     implement_tip();
 }
 
+__attribute__((weak)) void user_fixed_update(double step_seconds){
+    implement_tip();
+}
+
+__attribute__((weak)) void user_render(float alpha){
+    implement_tip();
+}
+
 __attribute__((weak)) void user_exit(){
     implement_tip();
 }
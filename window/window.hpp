@@ -2,12 +2,30 @@
 
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
+#include <vector>
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 
 namespace Ez3DGL {
+/**
+ * @brief 无窗口离屏渲染选项
+ * @note 优先使用GLFW的null平台(需GLFW 3.4)配合OSMesa/EGL创建上下文, 可在没有GPU和显示服务的机器上
+ * 通过Mesa llvmpipe软件渲染; 不支持时退化为不可见窗口
+ *
+ */
+struct headless_opt_t{
+    // 渲染的帧数
+    int frame_num = 1;
+    // 结束后将最后一帧保存为PNG, 为空则不保存
+    const char* png_path = nullptr;
+    // 使用EGL(surfaceless)而不是OSMesa创建上下文
+    bool use_egl = false;
+    // 大于0时每帧按固定的时间推进(秒)而不是实际耗时, 使模拟结果与运行速度无关, 便于截图对比
+    double frame_seconds = 0;
+};
+
 /**
  * @brief 窗口对象,自动管理GLFWwindow,ImGui,OpenGL,
  暴露给用户setup(启动时调用),loop(渲染时调用),exit(退出时调用)接口, 以及键盘输入,鼠标等接口
@@ -25,13 +43,38 @@ class glfw_win_t{
 
         GLFWwindow* window;
 
+        bool headless = false;
+        headless_opt_t headless_opt;
+        // 离屏渲染的目标帧缓冲
+        unsigned int headless_fbo = 0;
+        unsigned int headless_color_rbo = 0, headless_depth_rbo = 0;
+        // 离屏渲染时每帧 loop 的耗时(毫秒)
+        std::vector<double> frame_cpu_ms;
+
         glfw_win_t(int width, int height, const char* title);
+        glfw_win_t(int width, int height, const char* title, const headless_opt_t& headless_opt);
 
         int show(int (*setup)(), int (*loop)(), int (*exit)());
+    private:
+        int show_headless(int (*setup)(), int (*loop)(), int (*exit)());
+        void create_headless_fbo();
+        bool save_png(const char* path) const;
 };
 }
 
 int window_launch(const char* title, int win_width, int win_height);
+/**
+ * @brief 离屏运行固定帧数(不限帧率), 使用相同的 user_setup/user_loop 等接口, 用于基准测试与截图回归测试
+ */
+int window_launch_headless(const char* title, int win_width, int win_height, const Ez3DGL::headless_opt_t& opt);
+const Ez3DGL::glfw_win_t* window_instance();
+/**
+ * @brief 开启固定步长模拟, 之后 window_loop 以 step_seconds 为步长调用 user_fixed_update(step_seconds),
+ * 每帧调用一次 user_render(alpha) 代替 user_loop, alpha 为剩余时间占一步的比例, 用于在最近两步之间插值
+ * @param max_steps 每帧最多模拟的步数, 渲染跟不上时丢弃积压的时间, 避免越积越多
+ * @param step_seconds 为0时关闭, 恢复每帧调用 user_loop
+ */
+void window_set_fixed_timestep(double step_seconds, int max_steps=5);
 void window_key_callback(int key, int scancode, int action, int mods);
 void window_mouse_callback(double xpos, double ypos);
 void window_scroll_callback(double xoffset, double yoffset);